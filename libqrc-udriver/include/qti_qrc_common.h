@@ -13,6 +13,7 @@
 #include <stdlib.h>
 #include <string.h>
 #include <sys/ioctl.h>
+#include <sys/uio.h>
 #include <unistd.h>
 
 struct qrc_device_ops
@@ -21,6 +22,7 @@ struct qrc_device_ops
   void (*close)(int);
   ssize_t (*read)(int, char *, size_t);
   ssize_t (*write)(int, const char *, size_t);
+  ssize_t (*writev)(int, const struct iovec *, int);
   int (*fionread)(int, int * arg);
   int (*tcflsh)(int);
 };
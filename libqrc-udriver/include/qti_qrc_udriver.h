@@ -8,11 +8,13 @@
 #define __QTI_QRC_UDRIVER_H
 
 #include <stdio.h>
+#include <sys/uio.h>
 
 int qrc_udriver_open(void);
 void qrc_udriver_close(int fd);
 ssize_t qrc_udriver_read(int fd, char * buffer, size_t size);
 ssize_t qrc_udriver_write(int fd, const char * data, size_t length);
+ssize_t qrc_udriver_writev(int fd, const struct iovec * iov, int iovcnt);
 int qrc_udriver_fionread(int fd, int * arg);
 int qrc_udriver_tcflsh(int fd);
 
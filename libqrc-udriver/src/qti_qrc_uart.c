@@ -2,11 +2,15 @@
  * SPDX-License-Identifier: BSD-3-Clause-Clear
  */
 
+#include <errno.h>
+#include <poll.h>
 #include <termios.h>
 
 #include "qti_qrc_common.h"
 
 #define DEFAULT_BAUDRATE 115200
+#define MAX_WRITEV_IOV 16
+#define WRITEV_TIMEOUT_MS 1000 /* the tty took no byte for this long */
 
 static int userial_to_tcio_baud(int cfg_baud)
 {
@@ -93,6 +97,63 @@ static ssize_t qrc_serial_write(int fd, const char * data, size_t size)
   return write(fd, data, size);
 }
 
+/* write all segments, the tty is non-blocking so wait in poll() when it is full,
+ * but no longer than WRITEV_TIMEOUT_MS for each wait */
+static ssize_t qrc_serial_writev(int fd, const struct iovec * iov, int iovcnt)
+{
+  struct iovec vec[MAX_WRITEV_IOV];
+  struct iovec * cur = vec;
+  size_t total = 0;
+  ssize_t ret;
+
+  if (fd < 0) {
+    fprintf(stderr, "Failed to writev, No initialization\n");
+    return -1;
+  }
+  if (iov == NULL || iovcnt < 0 || iovcnt > MAX_WRITEV_IOV) {
+    fprintf(stderr, "Failed to writev, iov is invalid\n");
+    return -1;
+  }
+
+  memcpy(vec, iov, iovcnt * sizeof(struct iovec));
+  while (iovcnt > 0) {
+    ret = writev(fd, cur, iovcnt);
+    if (ret < 0) {
+      if (errno == EINTR) {
+        continue;
+      }
+      if (errno == EAGAIN || errno == EWOULDBLOCK) {
+        struct pollfd pfd = { .fd = fd, .events = POLLOUT };
+        ret = poll(&pfd, 1, WRITEV_TIMEOUT_MS);
+        if (ret == 0) {
+          fprintf(stderr, "Failed to writev, tty is not writable\n");
+          errno = ETIMEDOUT;
+          return -1;
+        }
+        if (ret < 0 && errno != EINTR) {
+          return -1;
+        }
+        continue;
+      }
+      return -1;
+    }
+
+    /* skip what has been written, partial segment is adjusted in place */
+    total += ret;
+    while (iovcnt > 0 && (size_t)ret >= cur->iov_len) {
+      ret -= cur->iov_len;
+      cur++;
+      iovcnt--;
+    }
+    if (iovcnt > 0) {
+      cur->iov_base = (char *)cur->iov_base + ret;
+      cur->iov_len -= ret;
+    }
+  }
+
+  return total;
+}
+
 static ssize_t qrc_serial_read(int fd, char * data, size_t size)
 {
   if (fd < 0) {
@@ -152,6 +213,7 @@ struct qrc_device_ops qrc_uart_ops = {
   .open = qrc_serial_open,
   .close = qrc_serial_close,
   .write = qrc_serial_write,
+  .writev = qrc_serial_writev,
   .read = qrc_serial_read,
   .fionread = qrc_serial_fionread,
   .tcflsh = qrc_serial_tcflsh,
@@ -99,6 +99,11 @@ ssize_t qrc_udriver_write(int fd, const char * data, size_t length)
   return protocol_list[ops_num].device_ops->write(fd, data, length);
 }
 
+ssize_t qrc_udriver_writev(int fd, const struct iovec * iov, int iovcnt)
+{
+  return protocol_list[ops_num].device_ops->writev(fd, iov, iovcnt);
+}
+
 int qrc_udriver_fionread(int fd, int * arg)
 {
   return protocol_list[ops_num].device_ops->fionread(fd, arg);
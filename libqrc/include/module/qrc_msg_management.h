@@ -9,24 +9,55 @@
 #include <pthread.h>
 #include <stdbool.h>
 #include <stdint.h>
+#include <sys/uio.h>
 #include <unistd.h>
 
 #ifdef __cplusplus
 extern "C" {
 #endif
 
+/* max data segments of one qrc_writev(), one TinyFrame segment is the qrc header */
+#define QRC_MAX_IOV 7
+
+/* max reliable frames of a pipe waiting for acks, see qrc_set_send_window() */
+#ifdef QRC_MCB
+#define QRC_MAX_SEND_WINDOW 8
+#else
+#define QRC_MAX_SEND_WINDOW 32
+#endif
+
+/* max frames of a pipe the peer may send before their callbacks are done,
+ * see qrc_set_rx_credits() */
+#define QRC_MAX_CREDITS 1024
+
+/* max time the ack of a received write with ack may wait to ride on a frame
+ * back, see qrc_set_ack_delay() */
+#define QRC_MAX_ACK_DELAY_US 10000
+
+/* size of a pipe name, terminating '\0' included */
+#define QRC_PIPE_NAME_LEN 32
+
 typedef struct qrc_pipe_s
 {
-  char pipe_name[10];
+  char pipe_name[QRC_PIPE_NAME_LEN];
   pthread_cond_t pipe_cond;
   pthread_mutex_t pipe_mutex;
   volatile bool is_pipe_timeout_busy; /* true: bus timeout in use */
-  uint8_t pipe_id;
-  uint8_t peer_pipe_id;
+  uint16_t pipe_id;
+  uint16_t peer_pipe_id;
   bool pipe_ready;
   void (*cb)(struct qrc_pipe_s * pipe, void * data, size_t len, bool response);
 } qrc_pipe_s;
 
+/* data points into a pooled receive buffer, valid until the callback returns
+ * unless the callback keeps it with qrc_buffer_retain(), then until
+ * qrc_buffer_release(), which must come before deinit_qrc_management().
+ * response is true for a qrc_sync_write() request, answer it with
+ * qrc_response() in the callback.
+ * The callbacks of a pipe and its write completions run one at a time in the
+ * order they arrived, callbacks of different pipes run in parallel. A slow
+ * callback delays the later messages of its own pipe only, unless the pipe
+ * runs it on the read thread with qrc_set_inline_dispatch() */
 typedef void (*qrc_msg_cb)(struct qrc_pipe_s * pipe, void * data, size_t len, bool response);
 
 enum qrc_write_status_e
@@ -34,25 +65,270 @@ enum qrc_write_status_e
   SUCCESS = 0,
   TIMEOUT,
   ACK_ERR,
-  FAILED
+  FAILED,
+  BUSY /* tx ring is full, nothing was sent, try again later */
+};
+
+/* handle of a qrc_write_async(), never 0 */
+typedef uint32_t qrc_write_handle;
+
+/* completion of a qrc_write_async(): SUCCESS when the peer acknowledged the
+ * data, TIMEOUT when it never did, FAILED when qrc is deinitialized first.
+ * Runs on a thread of the callback pool */
+typedef void (*qrc_write_done_cb)(struct qrc_pipe_s * pipe,
+    qrc_write_handle handle,
+    enum qrc_write_status_e status,
+    void * arg);
+
+/* severity of a message of the library, see qrc_set_log_level() */
+enum qrc_log_level_e
+{
+  QRC_LOG_DEBUG = 0,
+  QRC_LOG_INFO,
+  QRC_LOG_WARNING,
+  QRC_LOG_ERROR,
+  QRC_LOG_NONE /* level only, nothing is logged */
+};
+
+/* takes the messages of the library instead of stdout, see qrc_set_log_sink().
+ * msg has no trailing newline. Called by one thread at a time: the log
+ * thread once qrc is initialized, the logging thread before */
+typedef void (*qrc_log_sink)(enum qrc_log_level_e level, const char * msg, void * arg);
+
+/* how the receive thread waits for data on the link */
+enum qrc_rx_mode_e
+{
+  QRC_RX_BLOCKING = 0, /* sleep in poll() until the link is readable */
+  QRC_RX_BUSY_POLL,    /* keep reading for spin_us after data before sleeping */
 };
 
+/* threads of the library, see qrc_set_thread_config() */
+enum qrc_thread_role_e
+{
+  QRC_THREAD_READ = 0, /* reads the link, runs inline callbacks */
+  QRC_THREAD_WRITE,    /* writes the tx ring to the link */
+  QRC_THREAD_CONTROL,  /* control pool, connects the pipes */
+  QRC_THREAD_MESSAGE,  /* message pool, runs the pipe callbacks */
+  QRC_THREAD_ROLES,
+};
+
+/* scheduling of the threads of a role, all zero is the default: inherited
+ * policy, any CPU, default stack */
+struct qrc_thread_config_s
+{
+  int policy;           /* SCHED_OTHER, SCHED_FIFO or SCHED_RR of <sched.h> */
+  int priority;         /* 1 ~ 99 for SCHED_FIFO and SCHED_RR, 0 otherwise */
+  uint64_t cpus;        /* bit n: may run on CPU n, 0 for any CPU */
+  size_t stack_size;    /* bytes, 0 for the default */
+  size_t prefault_size; /* bytes of stack touched at start so they are mapped */
+};
+
+/* retransmission of the writes with ack of a pipe, see qrc_set_retry_policy() */
+struct qrc_retry_policy_s
+{
+  uint8_t max_tries;     /* transmissions of a frame before it is given up, >= 1 */
+  uint32_t init_rto_ms;  /* retransmission timeout before a round trip is measured */
+  uint32_t min_rto_ms;   /* bounds of the retransmission timeout, backoff included */
+  uint32_t max_rto_ms;
+};
+
+/* bus leases of qrc_require_pipe(), see qrc_get_bus_stats() */
+struct qrc_bus_stats_s
+{
+  uint32_t acquires;      /* qrc_require_pipe() that got the bus */
+  uint32_t round_trips;   /* of them, ones that asked the peer for a lease */
+  uint32_t expired;       /* leases that ran out while held */
+  uint32_t wait_max_us;   /* longest qrc_require_pipe() */
+  uint64_t wait_total_us;
+  uint32_t hold_max_us;   /* longest time from qrc_require_pipe() to qrc_release_pipe() */
+  uint64_t hold_total_us;
+};
+
+/* round trip estimate of a pipe, see qrc_get_rtt_info() */
+struct qrc_rtt_info_s
+{
+  uint32_t srtt_us;     /* smoothed round trip time, 0 before the first sample */
+  uint32_t rttvar_us;   /* round trip time variation */
+  uint32_t rto_us;      /* retransmission timeout in use, backoff included */
+  uint32_t samples;     /* round trips measured */
+  uint32_t retransmits; /* frames sent again */
+  uint32_t given_up;    /* frames never acknowledged */
+  uint32_t acks;             /* frames of only an ack sent for the peer's writes */
+  uint32_t acks_piggybacked; /* acks sent on frames of ours instead */
+};
+
+/* credit based flow control of a pipe, see qrc_get_credit_info() */
+struct qrc_credit_info_s
+{
+  bool enabled;          /* the peer grants credits, writes are not held back before */
+  uint32_t credits;      /* frames this side may send now */
+  uint32_t peer_credits; /* frames the peer may send now */
+  uint32_t capacity;     /* frames of the peer this side takes at once */
+  uint32_t stalls;       /* writes refused with BUSY or delayed for lack of credits */
+  uint32_t probes;       /* credit requests sent to the peer */
+  uint32_t grants;       /* credits given to the peer */
+};
+
+/* shared memory segment qrc-top reads by default, see qrc_set_stats_shm() */
+#define QRC_STATS_SHM_DEFAULT "/qrc_stats"
+
+/* counters of the link since init, see qrc_get_link_stats() */
+struct qrc_link_stats_s
+{
+  uint64_t tx_frames;     /* frames written to the link */
+  uint64_t tx_bytes;
+  uint64_t tx_busy;       /* frames refused because the tx ring was full */
+  uint64_t rx_frames;     /* frames parsed */
+  uint64_t rx_bytes;      /* bytes read from the link */
+  uint64_t rx_dropped;    /* frames without a header, pipe, callback or rx buffer */
+  uint64_t crc_errors;    /* head and body checksum mismatches */
+  uint64_t parser_errors; /* partial frames timed out, oversized and unhandled frames */
+  uint32_t tx_queue;      /* frames waiting in the tx ring */
+  uint32_t rx_queue;      /* messages waiting for a callback thread */
+  uint32_t rx_queue_high; /* most messages that waited at once */
+  bool tty_valid;         /* the link is a uart reporting the counts below */
+  uint32_t tty_overruns;  /* bytes lost by the uart and the driver buffer */
+  uint32_t tty_frame_errors;
+  uint32_t tty_parity_errors;
+  uint32_t tty_breaks;
+};
+
+/* counters of a pipe since init, see qrc_get_pipe_stats() */
+struct qrc_pipe_stats_s
+{
+  uint64_t tx_frames;    /* frames sent, retransmissions included */
+  uint64_t tx_bytes;     /* user data of them */
+  uint64_t rx_frames;
+  uint64_t rx_bytes;
+  uint64_t rx_dropped;   /* frames without callback or rx buffer, duplicates */
+  uint64_t retransmits;
+  uint64_t timeouts;     /* frames given up, requests and control requests unanswered */
+  uint64_t acks;         /* writes with ack whose round trip was measured */
+  uint64_t ack_total_us; /* sum of those round trips */
+  uint32_t ack_max_us;
+  uint64_t cb_overruns; /* callbacks that ran past the budget of qrc_set_callback_budget() */
+};
+
+/* shared memory segment of qrc_set_stats_shm(), this header is followed by
+ * pipe_max entries of struct qrc_stats_entry_s. Counters only grow, readers
+ * take rates from two snapshots */
+#define QRC_STATS_SHM_MAGIC (0x51524353) /* "QRCS" */
+#define QRC_STATS_SHM_VERSION (3)
+
+struct qrc_stats_shm_s
+{
+  uint32_t magic;
+  uint32_t version;
+  uint32_t pid;        /* process owning the link */
+  uint32_t pipe_max;   /* entries following the header */
+  uint32_t pipe_count; /* entries in use, by pipe id */
+  uint64_t update_us;  /* CLOCK_MONOTONIC time the gauges of link were refreshed */
+  struct qrc_link_stats_s link;
+};
+
+struct qrc_stats_entry_s
+{
+  char name[QRC_PIPE_NAME_LEN];
+  struct qrc_pipe_stats_s stats;
+};
+
+/* where the time of a message goes, each stage has a latency histogram per
+ * pipe, see qrc_get_latency() */
+enum qrc_latency_stage_e
+{
+  QRC_LAT_PARSE = 0, /* read() returned the first bytes of a frame to the frame decoded */
+  QRC_LAT_DISPATCH,  /* decoded to queued for the callback, reordering included */
+  QRC_LAT_QUEUE,     /* queued to the callback started by a worker */
+  QRC_LAT_CALLBACK,  /* callback started to returned */
+  QRC_LAT_ACK,       /* write with ack sent to acknowledged */
+  QRC_LAT_STAGES,
+};
+
+/* default of qrc_set_callback_budget() */
+#define QRC_CALLBACK_BUDGET_DEFAULT_US (10000)
+
+/* callback budget set by qrc_set_inline_dispatch(), after QRC_INLINE_STRIKES
+ * inline callbacks over it the pipe goes back to the worker threads */
+#define QRC_INLINE_BUDGET_DEFAULT_US (200)
+#define QRC_INLINE_STRIKES (3)
+
+/* summary of a latency histogram. Buckets are 1/8 of a power of two wide,
+ * so percentiles are within 12.5% of the true value */
+struct qrc_latency_s
+{
+  uint64_t count;
+  uint64_t total_us;
+  uint32_t min_us;
+  uint32_t max_us;
+  uint32_t p50_us;
+  uint32_t p90_us;
+  uint32_t p99_us;
+  uint32_t p999_us;
+};
+
+bool qrc_set_log_sink(qrc_log_sink sink, void * arg);
+bool qrc_set_log_level(enum qrc_log_level_e level);
 bool init_qrc_management(void);
+bool qrc_set_rx_mode(enum qrc_rx_mode_e mode, uint32_t spin_us);
+bool qrc_set_thread_config(enum qrc_thread_role_e role, const struct qrc_thread_config_s * config);
+bool qrc_load_thread_config(const char * path);
+bool qrc_set_memory_lock(bool enable);
 bool qrc_require_pipe(qrc_pipe_s * p);
 bool qrc_release_pipe(qrc_pipe_s * p);
+bool qrc_set_bus_lease(uint32_t lease_ms, uint32_t linger_ms);
+bool qrc_get_bus_stats(struct qrc_bus_stats_s * stats);
 qrc_pipe_s * qrc_get_pipe(const char * pipe_name);
+bool qrc_get_pipes(const char * const pipe_names[], qrc_pipe_s * pipes[], int count);
+bool qrc_set_pipe_map_file(const char * path);
 bool qrc_register_message_cb(qrc_pipe_s * pipe, const qrc_msg_cb fun_cb);
 enum qrc_write_status_e
 qrc_write(const qrc_pipe_s * pipe, const uint8_t * data, const size_t len, const bool data_ack);
+enum qrc_write_status_e qrc_writev(const qrc_pipe_s * pipe,
+    const struct iovec * iov,
+    const int iovcnt,
+    const bool data_ack);
+enum qrc_write_status_e qrc_write_async(qrc_pipe_s * pipe,
+    const void * data,
+    const size_t len,
+    qrc_write_done_cb done_cb,
+    void * arg,
+    qrc_write_handle * handle);
+enum qrc_write_status_e qrc_writev_async(qrc_pipe_s * pipe,
+    const struct iovec * iov,
+    const int iovcnt,
+    qrc_write_done_cb done_cb,
+    void * arg,
+    qrc_write_handle * handle);
+int qrc_write_event_fd(qrc_pipe_s * pipe);
+bool qrc_write_poll(qrc_pipe_s * pipe, qrc_write_handle * handle, enum qrc_write_status_e * status);
+bool qrc_set_send_window(qrc_pipe_s * pipe, uint16_t window);
+enum qrc_write_status_e qrc_flush(const qrc_pipe_s * pipe);
+bool qrc_set_retry_policy(qrc_pipe_s * pipe, const struct qrc_retry_policy_s * policy);
+bool qrc_get_rtt_info(const qrc_pipe_s * pipe, struct qrc_rtt_info_s * info);
+bool qrc_set_ack_delay(qrc_pipe_s * pipe, uint32_t delay_us);
+bool qrc_set_rx_credits(qrc_pipe_s * pipe, uint16_t credits);
+bool qrc_get_credit_info(const qrc_pipe_s * pipe, struct qrc_credit_info_s * info);
+bool qrc_set_stats_shm(const char * name);
+bool qrc_get_link_stats(struct qrc_link_stats_s * stats);
+bool qrc_get_pipe_stats(const qrc_pipe_s * pipe, struct qrc_pipe_stats_s * stats);
+bool qrc_get_latency(const qrc_pipe_s * pipe,
+    enum qrc_latency_stage_e stage,
+    struct qrc_latency_s * latency);
+bool qrc_reset_latency(const qrc_pipe_s * pipe);
+bool qrc_set_callback_budget(qrc_pipe_s * pipe, uint32_t budget_us);
+bool qrc_set_inline_dispatch(qrc_pipe_s * pipe, bool enable);
 enum qrc_write_status_e qrc_sync_write(const qrc_pipe_s * pipe,
     const void * data,
     const size_t len,
-    const void * respond_data,
-    const size_t res_len);
+    void * respond_data,
+    size_t * res_len,
+    const uint32_t timeout_ms);
 enum qrc_write_status_e qrc_write_fast(const qrc_pipe_s * pipe,
     const void * data,
     const size_t len);
 enum qrc_write_status_e qrc_response(const qrc_pipe_s * pipe, const void * data, const size_t len);
+bool qrc_buffer_retain(const void * data);
+bool qrc_buffer_release(const void * data);
 bool deinit_qrc_management(void);
 
 #ifdef __cplusplus
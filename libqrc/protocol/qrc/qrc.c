@@ -6,6 +6,10 @@
  ****************************************************************************/
 #include "qrc.h"
 
+#ifndef QRC_MCB
+#include <linux/serial.h> /* TIOCGICOUNT counts of the uart */
+#endif
+
 #include "qti_qrc_udriver.h"
 
 /****************************************************************************
@@ -14,31 +18,79 @@
 
 #define QRC_MSG_TIME_OUT_MS (500) /* ms */
 #define QRC_MSG_TIME_OUT_S (4)    /* s */
-#define MAX_PIPE_ID (64)
+#define QRC_TF_TICK_MS (10)       /* TF_Tick() period while a frame is partly received */
+#define QRC_ACK_RETRY_US (1000)   /* a QRC_ACK the tx ring refused goes out again after it */
+#define QRC_ACK_WORDS ((MAX_PIPE_ID + 31) / 32)
 
 #define MCB_RESET_MAGIC_CMD 0x7102
-#define DEFAULT_TF_MSG_TYPE 0x22
 #define QRC_HW_SYNC_MSG "OK"
 #define QRC_CONTROL_THREAD_NUM (1) /* must be single thread for mutex */
+#define QRC_TX_BATCH (16)          /* max frames per writev of write thread */
+
+#if QRC_MAX_IOV + 1 > TF_MAX_IOV
+#error "TF_MAX_IOV must leave a segment for the qrc_frame and extended header"
+#endif
+
+#define QRC_PIPE_HASH_SIZE (2 * MAX_PIPE_ID) /* never more than half full */
+
+/* a pipe and the control timeout it waits on */
+struct qrc_pipe_node_s
+{
+  struct qrc_pipe_s pipe;
+  volatile bool timeout_signaled; /* answer came for armed pipe timeout */
+  volatile bool timeout_expired;
+  struct qrc_timer_s timer;
+};
 
 struct qrc_s
 {
+  /* pipes are only added, under pipe_list_mutex. A new pipe is published by
+   * pipe_cnt and its pipe_names slot, so lookups take no lock */
   pthread_mutex_t pipe_list_mutex;
-  pthread_mutex_t qrc_write_mutex;
-  struct qrc_pipe_s pipe_list[MAX_PIPE_ID];
+  struct qrc_pipe_node_s * pipe_chunks[QRC_PIPE_CHUNKS];
+  uint16_t pipe_names[QRC_PIPE_HASH_SIZE]; /* open addressing by name, pipe id or 0 */
+  volatile uint16_t pipe_cnt;
   int fd;
   TinyFrame * tf;
+  struct qrc_rxbuf_s * rx_buf; /* slab the parser is collecting into */
   qrc_thread_pool msg_threadpool;
   qrc_thread_pool control_threadpool;
-  uint8_t pipe_cnt;
   volatile bool peer_pipe_list_ready;
 
   /* used for bus timeout */
   pthread_cond_t bus_lock_cond;
   pthread_mutex_t bus_lock_mutex;
   volatile bool is_bus_timeout_busy; /* true: bus lock in use */
+  volatile bool bus_timeout_signaled;
+  volatile bool bus_timeout_expired;
+  struct qrc_timer_s bus_lock_timer;
+
+  /* TF_Tick() is run by the read thread for the ticks counted by tf_timer */
+  struct qrc_timer_s tf_timer;
+  volatile bool tf_partial; /* the parser is inside a frame */
+  uint32_t tf_ticks;
+
+  /* QRC_ACK of the read thread never waits for the tx ring, the peer pipes
+   * whose ack found it full are sent by ack_timer */
+  uint32_t ack_deferred[QRC_ACK_WORDS];
+  struct qrc_timer_s ack_timer;
+
+  /* read thread, for the parse latency of the frames */
+  uint64_t rx_read_us;  /* the last read() returned data */
+  uint64_t rx_frame_us; /* the first bytes of the frame being parsed came */
+
+  /* user frames wait while the bus is locked by qrc_bus_lock() */
+  pthread_cond_t bus_gate_cond;
+  pthread_mutex_t bus_gate_mutex;
+  volatile int bus_gate;
+
+  pthread_t write_thread; /* drains the tx ring to the link */
 
   pthread_t read_thread;
+  int wakeup_fd[2]; /* [0] is polled by read thread, [1] is written to wake it up */
+  volatile bool read_thread_stop;
+  volatile enum qrc_rx_mode_e rx_mode;
+  volatile uint32_t rx_spin_us; /* busy poll budget after the last data */
 };
 
 /****************************************************************************
@@ -49,11 +101,15 @@ static struct qrc_s g_qrc;
 
 #ifdef QRC_MCB
 #define QRC_THREAD_NUM (2)
+#define QRC_CONTROL_WORK_SLOTS (16) /* control messages waiting for its thread */
 #define QRC_MCB_FD ("/dev/ttyS2")
 #define QRC_FIONREAD FIONREAD
+#define QRC_MAX_READ_SIZE 256
 
 #else
-#define QRC_THREAD_NUM (2)
+#define QRC_THREAD_NUM (2)           /* at least, one per CPU up to QRC_THREAD_MAX */
+#define QRC_THREAD_MAX (8)
+#define QRC_CONTROL_WORK_SLOTS (256) /* pipes created at once by the peer */
 #define QRC_IOC_MAGIC 'q'
 #define QRC_FIONREAD _IO(QRC_IOC_MAGIC, 5)
 #define QRC_RESET_MCB _IO(QRC_IOC_MAGIC, 2)
@@ -66,15 +122,29 @@ static struct qrc_s g_qrc;
  * Private Functions
  ****************************************************************************/
 void TF_WriteImpl(TinyFrame * tf, const uint8_t * buff, uint32_t len);
+void TF_WriteVImpl(TinyFrame * tf, const struct iovec * iov, int iovcnt);
+static ssize_t qrc_device_writev(const struct iovec * iov, int iovcnt);
 static TF_Result read_response_listener(TinyFrame * tf, TF_Msg * msg);
 static void * read_thread(void * args);
+static void * write_thread(void * args);
+static ssize_t qrc_device_read(uint8_t * buf, size_t size);
 static void qrc_control_pipe_callback(qrc_pipe_s * pipe, void * data, size_t len, bool response);
-static void stop_pipe_timeout(const uint8_t pipe_id);
-static void qrc_msg_cb_work(struct qrc_msg_cb_args_s args);
+static void qrc_control_batch(const uint8_t * data, size_t len);
+static void stop_pipe_timeout(const uint16_t pipe_id);
+static void qrc_msg_cb_work(const struct qrc_msg_cb_args_s * args);
+static void qrc_write_done_work(const struct qrc_msg_cb_args_s * args);
 static int qrc_hardware_sync(int qrc_fd);
+static int qrc_thread_num(void);
 
 static void qrc_lock_stop_timeout(void);
+static int qrc_lock_arm_timeout(void);
+static void qrc_lock_disarm_timeout(void);
 static int qrc_lock_start_timeout(bool * timeout);
+static void qrc_lock_timeout_expired(void * arg);
+static void qrc_pipe_timeout_expired(void * arg);
+static void qrc_tf_tick(void * arg);
+static void qrc_ack_retry_expired(void * arg);
+static void qrc_tf_accept(const uint8_t * buf, uint32_t len);
 
 /****************************************************************************
  * @intro: send TF frame
@@ -84,15 +154,77 @@ static int qrc_lock_start_timeout(bool * timeout);
  ****************************************************************************/
 void TF_WriteImpl(TinyFrame * tf, const uint8_t * buff, uint32_t len)
 {
-  uint32_t write_cnt = 0;
+  struct iovec iov;
+  iov.iov_base = (void *)buff;
+  iov.iov_len = len;
+
+  QRC_TRACE1(tf_write, len);
+  if (qrc_device_writev(&iov, 1) != (ssize_t)len) {
+    QRC_LOGE("Write failed!");
+  }
+}
+
+/****************************************************************************
+ * @intro: send TF frame given as segments (head, body segments, checksum)
+ * @param tf: tf
+ * @param iov: frame segments
+ * @param iovcnt: number of segments
+ ****************************************************************************/
+void TF_WriteVImpl(TinyFrame * tf, const struct iovec * iov, int iovcnt)
+{
+  (void)tf;
+  ssize_t len = 0;
+  for (int i = 0; i < iovcnt; i++) {
+    len += iov[i].iov_len;
+  }
+
+  QRC_TRACE1(tf_write, len);
+  if (qrc_device_writev(iov, iovcnt) != len) {
+    QRC_LOGE("Write failed!");
+  }
+}
+
+/****************************************************************************
+ * @intro: write all segments to the link in one go
+ * @param iov: segments
+ * @param iovcnt: number of segments
+ * @return: bytes written, -1 on error
+ ****************************************************************************/
+static ssize_t qrc_device_writev(const struct iovec * iov, int iovcnt)
+{
 #ifndef QRC_MCB
-  write_cnt = qrc_udriver_write(g_qrc.fd, buff, len);
+  return qrc_udriver_writev(g_qrc.fd, iov, iovcnt);
 #else  // QRC_MCB
-  write_cnt = write(g_qrc.fd, buff, len);
-#endif
-  if (write_cnt != len) {
-    printf("ERROR: Write failed!\n");
+  struct iovec vec[QRC_TX_BATCH];
+  struct iovec * cur = vec;
+  ssize_t total = 0;
+  ssize_t ret;
+
+  if (iovcnt > QRC_TX_BATCH) {
+    return -1;
+  }
+  memcpy(vec, iov, iovcnt * sizeof(struct iovec));
+  while (iovcnt > 0) {
+    ret = writev(g_qrc.fd, cur, iovcnt);
+    if (ret < 0) {
+      if (EINTR == errno) {
+        continue;
+      }
+      return -1;
+    }
+    total += ret;
+    while (iovcnt > 0 && (size_t)ret >= cur->iov_len) {
+      ret -= cur->iov_len;
+      cur++;
+      iovcnt--;
+    }
+    if (iovcnt > 0) {
+      cur->iov_base = (uint8_t *)cur->iov_base + ret;
+      cur->iov_len -= ret;
+    }
   }
+  return total;
+#endif
 }
 
 /****************************************************************************
@@ -104,33 +236,80 @@ void TF_WriteImpl(TinyFrame * tf, const uint8_t * buff, uint32_t len)
  * @return: result of TF_Send()
  ****************************************************************************/
 bool qrc_control_write(const struct qrc_pipe_s * pipe,
-    const uint8_t pipe_id,
+    const uint16_t pipe_id,
     const enum qrc_msg_cmd cmd)
 {
   bool timeout;
-  bool send_result;
+  enum qrc_write_status_e send_result;
   qrc_frame qrcf;
+  memset(&qrcf, 0, sizeof(qrcf));
   qrcf.receiver_id = 0;
   qrcf.ack = NO_ACK;
 
   qrc_msg msg;
   msg.cmd = cmd;
-  msg.pipe_id = pipe_id;
+  msg.pipe_id = (uint8_t)pipe_id;
 
   if (NULL == pipe) {
-    printf("ERROR: qrc_control_write pipe is invalid\n");
+    QRC_LOGE("qrc_control_write pipe is invalid");
     return false;
   }
 
   if (QRC_REQUEST == cmd || QRC_RESPONSE == cmd) /* apply new pipe */
   {
-    memset(msg.pipe_name, '\0', 10);
+    if (pipe_id > QRC_MSG_ID_MAX || strlen(pipe->pipe_name) > QRC_MSG_NAME_LEN) {
+      qrc_pipe_s * const pipes[1] = {(qrc_pipe_s *)pipe};
+      return qrc_control_write_batch(
+          pipes, 1, (QRC_REQUEST == cmd) ? QRC_REQUEST_BATCH : QRC_RESPONSE_BATCH);
+    }
+    memset(msg.pipe_name, '\0', QRC_MSG_NAME_LEN);
     memcpy(msg.pipe_name, pipe->pipe_name, strlen(pipe->pipe_name) * sizeof(char));
+  } else {
+    if (QRC_WRITE_LOCK == cmd) {
+      qrc_lease_encode(&msg);
+    } else if (QRC_CONNECT_REQUEST == cmd) {
+      qrc_pipe_map_encode(&msg, qrc_pipe_map_hash(true));
+    } else if (QRC_CONNECT_RESPONSE == cmd) {
+      qrc_pipe_map_encode(&msg, qrc_pipe_map_accepted());
+    } else {
+      memset(msg.pipe_name, '\0', QRC_MSG_NAME_LEN);
+    }
+    msg.pipe_name[QRC_MSG_ID_HI] = (char)(pipe_id >> 8);
+  }
+
+  /* arm the timeout first, the answer may come before the send returns. A
+   * request waits on its own pipe, so several can be pending */
+  switch (cmd) {
+    case QRC_REQUEST:
+      if (QRC_OK != arm_pipe_timeout(pipe->pipe_id)) {
+        QRC_LOGE("qrc_control_write pipe(%s) timeout is using", pipe->pipe_name);
+        return false;
+      }
+      break;
+    case QRC_CONNECT_REQUEST:
+      if (QRC_OK != arm_pipe_timeout(QRC_CONTROL_PIPE_ID)) {
+        QRC_LOGE("qrc_control_write  timeout is using");
+        return false;
+      }
+      break;
+    case QRC_WRITE_LOCK:
+      if (QRC_OK != qrc_lock_arm_timeout()) {
+        return false;
+      }
+      break;
+    default:;
   }
 
   send_result = qrc_frame_send(&qrcf, (uint8_t *)(&msg), sizeof(qrc_msg), true);
-  if (!send_result) {
-    printf("ERROR: qrc_control_write send msg failed\n");
+  if (SUCCESS != send_result) {
+    QRC_LOGE("qrc_control_write send msg failed");
+    if (QRC_REQUEST == cmd) {
+      disarm_pipe_timeout(pipe->pipe_id);
+    } else if (QRC_CONNECT_REQUEST == cmd) {
+      disarm_pipe_timeout(QRC_CONTROL_PIPE_ID);
+    } else if (QRC_WRITE_LOCK == cmd) {
+      qrc_lock_disarm_timeout();
+    }
     return false;
   }
 
@@ -138,16 +317,16 @@ bool qrc_control_write(const struct qrc_pipe_s * pipe,
   switch (cmd) {
     case QRC_REQUEST:
     case QRC_CONNECT_REQUEST: {
-      /* start control pipe timeout */
-      if (QRC_OK != start_pipe_timeout(QRC_CONTROL_PIPE_ID, &timeout)) {
-        printf("ERROR: qrc_control_write  timeout failed\n");
+      /* start pipe timeout */
+      if (QRC_OK != start_pipe_timeout(
+                        (QRC_REQUEST == cmd) ? pipe->pipe_id : QRC_CONTROL_PIPE_ID, &timeout)) {
+        QRC_LOGE("qrc_control_write  timeout failed");
         return false;
       }
       return !timeout;
     }
-    case QRC_WRITE_LOCK:
-    case QRC_WRITE_UNLOCK: {
-      /* start bus lock timeout */
+    case QRC_WRITE_LOCK: {
+      /* start bus lock timeout, the unlock is not answered */
       if (QRC_OK != qrc_lock_start_timeout(&timeout)) {
         return false;
       }
@@ -155,6 +334,7 @@ bool qrc_control_write(const struct qrc_pipe_s * pipe,
     }
     case QRC_ACK:
     case QRC_RESPONSE:
+    case QRC_WRITE_UNLOCK:
     case QRC_WRITE_LOCK_ACK:
     case QRC_WRITE_UNLOCK_ACK:
     case QRC_CONNECT_RESPONSE:
@@ -164,6 +344,77 @@ bool qrc_control_write(const struct qrc_pipe_s * pipe,
   return true;
 }
 
+/****************************************************************************
+ * @intro: connect several pipes with one control frame per QRC_BATCH_MAX
+ *pipes. A request waits for the answers of all its pipes together
+ * @param pipes: pipes of this side
+ * @param count: number of pipes
+ * @param cmd: QRC_REQUEST_BATCH or QRC_RESPONSE_BATCH
+ * @return: true if sent, for a request also answered for every pipe
+ ****************************************************************************/
+bool qrc_control_write_batch(qrc_pipe_s * const pipes[], int count, const enum qrc_msg_cmd cmd)
+{
+  uint8_t frame[2 + QRC_BATCH_MAX * QRC_BATCH_ENTRY_MAX];
+  uint16_t ids[QRC_BATCH_MAX];
+  bool request = (QRC_REQUEST_BATCH == cmd);
+  bool res = true;
+  bool timeout;
+  qrc_frame qrcf;
+  int i = 0;
+
+  memset(&qrcf, 0, sizeof(qrcf));
+  qrcf.receiver_id = QRC_CONTROL_PIPE_ID;
+  qrcf.ack = NO_ACK;
+
+  while (i < count) {
+    size_t len = 2;
+    int armed = 0;
+
+    /* as many entries as fit in a frame */
+    for (; i < count && armed < QRC_BATCH_MAX; i++) {
+      qrc_pipe_s * p = pipes[i];
+      size_t name_len = strnlen(p->pipe_name, QRC_PIPE_NAME_LEN - 1);
+      if (len + 3 + name_len > QRC_MAX_PAYLOAD) {
+        break;
+      }
+      if (request && QRC_OK != arm_pipe_timeout(p->pipe_id)) {
+        QRC_LOGE("qrc_control_write_batch pipe(%s) timeout is using", p->pipe_name);
+        res = false;
+        continue;
+      }
+      frame[len++] = (uint8_t)(p->pipe_id >> 8);
+      frame[len++] = (uint8_t)p->pipe_id;
+      frame[len++] = (uint8_t)name_len;
+      memcpy(frame + len, p->pipe_name, name_len);
+      len += name_len;
+      ids[armed++] = p->pipe_id;
+    }
+    if (0 == armed) {
+      continue;
+    }
+    frame[0] = (uint8_t)cmd;
+    frame[1] = (uint8_t)armed;
+
+    if (SUCCESS != qrc_frame_send(&qrcf, frame, len, true)) {
+      QRC_LOGE("qrc_control_write_batch send msg failed");
+      for (int j = 0; request && j < armed; j++) {
+        disarm_pipe_timeout(ids[j]);
+      }
+      res = false;
+      continue;
+    }
+
+    /* the answer covers them all, so the waits end together */
+    for (int j = 0; request && j < armed; j++) {
+      if (QRC_OK != start_pipe_timeout(ids[j], &timeout) || timeout) {
+        res = false;
+      }
+    }
+  }
+
+  return res;
+}
+
 /****************************************************************************
  * @intro: this function will be called when tf receive msg
  * @param tf: receiver
@@ -173,33 +424,263 @@ bool qrc_control_write(const struct qrc_pipe_s * pipe,
 static TF_Result read_response_listener(TinyFrame * tf, TF_Msg * msg)
 {
   qrc_frame qrcf;
-  struct qrc_msg_cb_args_s args;
-
+  struct qrc_ext_s ext;
+  struct qrc_rxbuf_s * buf;
+  struct qrc_rxbuf_s * next_buf;
+  struct qrc_pipe_stats_s * stats;
+  uint32_t hdr_len = sizeof(qrc_frame);
+  int32_t ext_len;
+  uint64_t now = qrc_timer_now_us();
+  uint64_t parse_us = now - g_qrc.rx_frame_us;
+
+  /* the next frame starts in this read at the earliest */
+  g_qrc.rx_frame_us = g_qrc.rx_read_us;
+  QRC_STAT_ADD(qrc_stats_link()->rx_frames, 1);
+  if (msg->len < sizeof(qrc_frame)) {
+    QRC_LOGE("qrc frame without header dropped!");
+    QRC_STAT_ADD(qrc_stats_link()->rx_dropped, 1);
+    return TF_STAY;
+  }
   memcpy(&qrcf, msg->data, sizeof(qrc_frame));
 
-  qrc_pipe_s * p = qrc_pipe_find_by_pipeid(qrcf.receiver_id);
+  ext.flags = 0;
+  if (QRC_EXT_TF_MSG_TYPE == msg->type) {
+    ext_len = qrc_ext_decode(&ext, msg->data + hdr_len, msg->len - hdr_len);
+    if (ext_len < 0) {
+      QRC_LOGE("qrc frame with bad extended header dropped!");
+      QRC_STAT_ADD(qrc_stats_link()->rx_dropped, 1);
+      return TF_STAY;
+    }
+    hdr_len += (uint32_t)ext_len;
+  }
+
+  uint16_t receiver_id = qrcf.receiver_id;
+  if (ext.flags & QRC_EXT_PIPE) {
+    receiver_id = ext.pipe;
+  }
+  qrc_pipe_s * p = qrc_pipe_find_by_pipeid(receiver_id);
   if (NULL == p) {
-    printf("ERROR: here is no pipe with peer pipe id %u, receive failed!\n", qrcf.receiver_id);
+    QRC_LOGE("here is no pipe with peer pipe id %u, receive failed!", receiver_id);
+    QRC_STAT_ADD(qrc_stats_link()->rx_dropped, 1);
+    return TF_STAY;
+  }
+  stats = qrc_stats_pipe(p->pipe_id);
+  qrc_latency_record(p->pipe_id, QRC_LAT_PARSE, parse_us);
+  QRC_TRACE4(rx_frame, p->pipe_id, ext.flags, msg->len - hdr_len, g_qrc.rx_buf);
+
+  /* protocol parts of the header are handled here on the read thread */
+  if (ext.flags & QRC_EXT_ACK) {
+    qrc_rel_on_ack(p, ext.ack, ext.sack);
+  }
+  if (ext.flags & QRC_EXT_RST) {
+    qrc_rel_on_rst(p);
+  }
+  if (ext.flags & QRC_EXT_SYN) {
+    qrc_rel_on_syn(p, ext.seq);
+  }
+  if (ext.flags & QRC_EXT_RSP) {
+    QRC_STAT_ADD(stats->rx_frames, 1);
+    QRC_STAT_ADD(stats->rx_bytes, msg->len - hdr_len);
+    /* copied straight into the buffer of the waiting qrc_sync_write() */
+    qrc_rpc_on_response(p, ext.rpc, (uint8_t *)msg->data + hdr_len, msg->len - hdr_len);
+    return TF_STAY;
+  }
+  /* frames of only acks or sequence control carry no data */
+  if (0 != (ext.flags & ~QRC_EXT_PIPE) && !(ext.flags & (QRC_EXT_SEQ | QRC_EXT_REQ))) {
+    return TF_STAY;
+  }
+
+  if (QRC_CONTROL_PIPE_ID == p->pipe_id &&
+      qrc_credit_on_control((uint8_t *)msg->data + hdr_len, msg->len - hdr_len)) {
+    return TF_STAY;
+  }
+
+  /* the frame took a credit of the peer, given back by qrc_credit_done() */
+  qrc_credit_on_rx(p);
+  QRC_STAT_ADD(stats->rx_frames, 1);
+  QRC_STAT_ADD(stats->rx_bytes, msg->len - hdr_len);
+
+  /* reliable frames are acknowledged even without a callback */
+  if (NULL == p->cb && !(ext.flags & QRC_EXT_SEQ)) {
+    qrc_stats_dropped(p);
+    qrc_credit_done(p);
+    return TF_STAY;
+  }
+
+  /* hand the filled slab on, parse the next frame into a new one */
+  next_buf = qrc_rxbuf_alloc();
+  if (NULL == next_buf) {
+    QRC_LOGE("qrc rx buffers are all in use, pipe(%s) frame dropped!", p->pipe_name);
+    qrc_stats_dropped(p);
+    qrc_credit_done(p);
+    return TF_STAY;
+  }
+  TF_SwapRxBuffer(tf, qrc_rxbuf_data(next_buf));
+  buf = g_qrc.rx_buf;
+  g_qrc.rx_buf = next_buf;
+  qrc_rxbuf_stamp(buf, now);
+
+  if (ext.flags & QRC_EXT_SEQ) {
+    qrc_rel_on_data(p, ext.seq, buf, (uint8_t *)msg->data + hdr_len, msg->len - hdr_len);
   } else {
-    if (NULL != p->cb) {
-      args.fun_cb = p->cb;
-      args.pipe = p;
-      args.len = msg->len - sizeof(qrc_frame);
-      args.data = (uint8_t *)malloc(args.len);
-      memcpy(args.data, msg->data + sizeof(qrc_frame), args.len);
-      args.response = false;
-      args.need_ack = qrcf.ack;
-      if (p->pipe_id == QRC_CONTROL_PIPE_ID) {
-        qrc_threadpool_add_work(g_qrc.control_threadpool, qrc_msg_cb_work, args);
-      } else {
-        qrc_threadpool_add_work(g_qrc.msg_threadpool, qrc_msg_cb_work, args);
-      }
-    }
+    qrc_msg_dispatch(
+        p, buf, (uint8_t *)msg->data + hdr_len, msg->len - hdr_len, qrcf.ack, ext.rpc);
   }
 
   return TF_STAY;
 }
 
+/****************************************************************************
+ * @intro: read thread, send the QRC_ACK of a frame without waiting for the
+ *tx ring. An ack that finds it full is deferred to ack_timer. A pipe of
+ *the peer waits for one ack at a time, so a bit per pipe holds it
+ * @param peer_pipe_id: pipe of the peer waiting for the ack
+ ****************************************************************************/
+static void qrc_ack_send(uint16_t peer_pipe_id)
+{
+  qrc_frame qrcf;
+  qrc_msg msg;
+
+  memset(&qrcf, 0, sizeof(qrcf));
+  qrcf.receiver_id = QRC_CONTROL_PIPE_ID;
+  qrcf.ack = NO_ACK;
+  memset(&msg, 0, sizeof(msg));
+  msg.cmd = QRC_ACK;
+  msg.pipe_id = (uint8_t)peer_pipe_id;
+  msg.pipe_name[QRC_MSG_ID_HI] = (char)(peer_pipe_id >> 8);
+  if (SUCCESS != qrc_frame_try_send(&qrcf, (const uint8_t *)&msg, sizeof(msg))) {
+    __atomic_or_fetch(
+        &g_qrc.ack_deferred[peer_pipe_id / 32], 1U << (peer_pipe_id % 32), __ATOMIC_RELEASE);
+    qrc_timer_arm(&g_qrc.ack_timer, QRC_ACK_RETRY_US);
+  }
+}
+
+/* timer callback, send the QRC_ACK the tx ring refused */
+static void qrc_ack_retry_expired(void * arg)
+{
+  uint32_t bits;
+  (void)arg;
+
+  for (int i = 0; i < QRC_ACK_WORDS; i++) {
+    bits = __atomic_exchange_n(&g_qrc.ack_deferred[i], 0, __ATOMIC_ACQUIRE);
+    while (0 != bits) {
+      int bit = __builtin_ctz(bits);
+      bits &= bits - 1;
+      qrc_ack_send((uint16_t)(i * 32 + bit)); /* defers it again if the ring is still full */
+    }
+  }
+}
+
+/****************************************************************************
+ * @intro: queue a received message for the callback of its pipe
+ * @param p: receiver pipe
+ * @param buf: slab holding data, the reference is passed on
+ * @param data: user data
+ * @param len: length of data
+ * @param need_ack: ACK if the peer waits for a QRC_ACK
+ * @param rpc_id: id of a qrc_sync_write() request to answer, 0 if none
+ ****************************************************************************/
+void qrc_msg_dispatch(qrc_pipe_s * p,
+    struct qrc_rxbuf_s * buf,
+    uint8_t * data,
+    size_t len,
+    uint8_t need_ack,
+    uint16_t rpc_id)
+{
+  struct qrc_msg_cb_args_s args;
+  uint64_t now;
+  int res;
+
+  if (NULL == p->cb) {
+    qrc_rxbuf_release(buf);
+    qrc_stats_dropped(p);
+    qrc_credit_done(p);
+    return;
+  }
+  now = qrc_timer_now_us();
+  qrc_latency_record(p->pipe_id, QRC_LAT_DISPATCH, now - qrc_rxbuf_stamp_us(buf));
+
+  args.fun_cb = p->cb;
+  args.pipe = p;
+  args.buf = buf;
+  args.len = len;
+  args.data = data;
+  args.response = (0 != rpc_id);
+  args.rpc_id = rpc_id;
+  args.done_cb = NULL;
+  args.queued_us = now;
+  if (p->pipe_id == QRC_CONTROL_PIPE_ID) {
+    res = qrc_threadpool_add_work(g_qrc.control_threadpool, qrc_msg_cb_work, &args);
+  } else if (qrc_strand_try_inline(qrc_msg_cb_work, &args)) {
+    res = 0;
+  } else {
+    res = qrc_strand_add_work(qrc_msg_cb_work, &args);
+  }
+  if (0 != res) {
+    qrc_rxbuf_release(buf);
+    qrc_stats_dropped(p);
+    qrc_credit_done(p);
+  } else if (ACK == need_ack) {
+    /* acked once queued or run inline, not when a worker gets to it */
+    qrc_ack_send(p->peer_pipe_id);
+  }
+}
+
+/****************************************************************************
+ * @intro: control thread, connect the pipes of a QRC_REQUEST_BATCH and
+ *answer with our ids, or take the ids of a QRC_RESPONSE_BATCH
+ * @param data: cmd, count and the entries
+ * @param len: length of data
+ ****************************************************************************/
+static void qrc_control_batch(const uint8_t * data, size_t len)
+{
+  qrc_pipe_s * pipes[QRC_BATCH_MAX];
+  uint8_t cmd = data[0];
+  int count = data[1];
+  size_t pos = 2;
+  int n = 0;
+
+  if (count > QRC_BATCH_MAX) {
+    QRC_LOGW("qrc_control_batch of %d pipes is invalid", count);
+    return;
+  }
+
+  for (int i = 0; i < count; i++) {
+    char pipe_name[QRC_PIPE_NAME_LEN] = "\0";
+    uint16_t pipe_id;
+    size_t name_len;
+    qrc_pipe_s * p;
+
+    if (pos + 3 > len || pos + 3 + data[pos + 2] > len || data[pos + 2] >= QRC_PIPE_NAME_LEN) {
+      QRC_LOGW("qrc_control_batch msg of %u bytes is invalid", (unsigned)len);
+      break;
+    }
+    pipe_id = (uint16_t)((data[pos] << 8) | data[pos + 1]);
+    name_len = data[pos + 2];
+    memcpy(pipe_name, data + pos + 3, name_len);
+    pos += 3 + name_len;
+
+    p = (QRC_REQUEST_BATCH == cmd) ? qrc_pipe_insert(pipe_name) : qrc_pipe_find_by_name(pipe_name);
+    if (NULL == p) {
+      QRC_LOGE("corresponding pipe(%s) of batch is not available!", pipe_name);
+      continue;
+    }
+    p->peer_pipe_id = pipe_id;
+    p->pipe_ready = true;
+    if (QRC_REQUEST_BATCH == cmd) {
+      qrc_rel_on_peer_connect(p);
+      pipes[n++] = p;
+    } else {
+      stop_pipe_timeout(p->pipe_id);
+    }
+  }
+
+  if (QRC_REQUEST_BATCH == cmd && n > 0) {
+    qrc_control_write_batch(pipes, n, QRC_RESPONSE_BATCH);
+  }
+  qrc_pipe_map_save();
+}
+
 /****************************************************************************
  * @intro: callback function of pipelist[0], whose pipe id is 0
  * @param pipe: pipelist[0]
@@ -209,45 +690,62 @@ static TF_Result read_response_listener(TinyFrame * tf, TF_Msg * msg)
  ****************************************************************************/
 static void qrc_control_pipe_callback(qrc_pipe_s * pipe, void * data, size_t len, bool response)
 {
+  if (len >= 2 &&
+      (QRC_REQUEST_BATCH == ((uint8_t *)data)[0] || QRC_RESPONSE_BATCH == ((uint8_t *)data)[0])) {
+    qrc_control_batch(data, len);
+    return;
+  }
+  if (len < sizeof(qrc_msg)) {
+    QRC_LOGW("qrc_control_pipe_callback msg of %u bytes is too short", (unsigned)len);
+    return;
+  }
+
   qrc_msg qmsg;
   memcpy(&qmsg, data, sizeof(qrc_msg));
   uint8_t cmd = qmsg.cmd;
-  uint8_t pipe_id = qmsg.pipe_id; /*pipe id of receiver*/
-  char pipe_name[10] = "\0";
-  memcpy(pipe_name, qmsg.pipe_name, 10);
+  uint16_t pipe_id = qmsg.pipe_id; /*pipe id of receiver*/
+  char pipe_name[QRC_MSG_NAME_LEN + 1] = "\0";
+  memcpy(pipe_name, qmsg.pipe_name, QRC_MSG_NAME_LEN);
+  if (QRC_REQUEST != cmd && QRC_RESPONSE != cmd) {
+    pipe_id |= (uint16_t)((uint8_t)qmsg.pipe_name[QRC_MSG_ID_HI] << 8);
+  }
 
   switch (cmd) {
     case QRC_REQUEST: {
       qrc_pipe_s * p = qrc_pipe_insert(pipe_name);
       if (p == NULL) {
-        printf("ERROR: corresponding pipe(%s) create failed!\n", pipe_name);
+        QRC_LOGE("corresponding pipe(%s) create failed!", pipe_name);
       } else {
         p->peer_pipe_id = pipe_id;
         p->pipe_ready = true;
+        qrc_rel_on_peer_connect(p); /* the peer may have restarted */
         qrc_control_write(p, p->pipe_id, QRC_RESPONSE);
+        qrc_pipe_map_save();
       }
       break;
     }
     case QRC_RESPONSE: {
       qrc_pipe_s * p = qrc_pipe_find_by_name(pipe_name);
       if (p == NULL) {
-        printf("ERROR: pipe name(%s) doesn't exit, can not handle QRC_RESPONSE!\n", pipe_name);
+        QRC_LOGE("pipe name(%s) doesn't exit, can not handle QRC_RESPONSE!", pipe_name);
       } else {
         p->peer_pipe_id = pipe_id;
         p->pipe_ready = true;
-        stop_pipe_timeout(QRC_CONTROL_PIPE_ID);
+        stop_pipe_timeout(p->pipe_id);
+        qrc_pipe_map_save();
       }
       break;
     }
     case QRC_WRITE_LOCK: {
       qrc_pipe_s * p = qrc_pipe_find_by_pipeid(pipe_id);
+      qrc_lease_on_lock(&qmsg);
       qrc_control_write(p, p->pipe_id, QRC_WRITE_LOCK_ACK);
-      qrc_bus_lock();
       break;
     }
     case QRC_WRITE_UNLOCK: {
+      /* still answered for old peers that wait for it */
       qrc_pipe_s * p = qrc_pipe_find_by_pipeid(pipe_id);
-      qrc_bus_unlock();
+      qrc_lease_on_unlock();
       qrc_control_write(p, p->pipe_id, QRC_WRITE_UNLOCK_ACK);
       break;
     }
@@ -261,21 +759,28 @@ static void qrc_control_pipe_callback(qrc_pipe_s * pipe, void * data, size_t len
       break;
     }
     case QRC_WRITE_UNLOCK_ACK: {
-      qrc_lock_stop_timeout();
+      /* nobody waits for it, it must not pass for the ack of a new lock */
       break;
     }
     case QRC_CONNECT_REQUEST: {
       qrc_pipe_s * p = qrc_pipe_find_by_pipeid(pipe_id);
+      qrc_rel_on_peer_restart(); /* sent by the peer when it starts */
+      qrc_pipe_map_accept(&qmsg);
       qrc_control_write(p, QRC_CONTROL_PIPE_ID, QRC_CONNECT_RESPONSE);
       break;
     }
     case QRC_CONNECT_RESPONSE: {
+      /* the peer has the pipes of our map with the same ids */
+      uint32_t hash = qrc_pipe_map_decode(&qmsg);
+      if (0 != hash && hash == qrc_pipe_map_hash(true)) {
+        qrc_pipe_map_validated();
+      }
       g_qrc.peer_pipe_list_ready = true;
       stop_pipe_timeout(QRC_CONTROL_PIPE_ID);
       break;
     }
     default:
-      printf("WARNING: qrc_control_pipe_callback cmd=%d is invalid\n", cmd);
+      QRC_LOGW("qrc_control_pipe_callback cmd=%d is invalid", cmd);
       break;
   }
 }
@@ -287,18 +792,18 @@ static void qrc_control_pipe_callback(qrc_pipe_s * pipe, void * data, size_t len
 qrc_pipe_s qrc_pipe_init(void)
 {
   qrc_pipe_s pipe;
-  memset(pipe.pipe_name, '\0', 10);
+  memset(pipe.pipe_name, '\0', sizeof(pipe.pipe_name));
 
   if (0 != pthread_cond_init(&pipe.pipe_cond, NULL)) {
-    printf("\nERROR: pipe cond initalize failed!\n");
+    QRC_LOGE("pipe cond initalize failed!");
     return pipe;
   }
   if (0 != pthread_mutex_init(&pipe.pipe_mutex, NULL)) {
-    printf("\nERROR: pipe mutex initalize failed!\n");
+    QRC_LOGE("pipe mutex initalize failed!");
     return pipe;
   }
-  pipe.pipe_id = 255;
-  pipe.peer_pipe_id = 255;
+  pipe.pipe_id = QRC_PIPE_ID_NONE;
+  pipe.peer_pipe_id = QRC_PIPE_ID_NONE;
   pipe.is_pipe_timeout_busy = false;
   pipe.cb = NULL;
   pipe.pipe_ready = false;
@@ -307,30 +812,102 @@ qrc_pipe_s qrc_pipe_init(void)
 }
 
 /****************************************************************************
- * @intro: initilize the pipe list
+ * @intro: FNV-1a hash
+ * @param h: QRC_FNV_OFFSET, or the hash of the data before
+ * @return: hash
  ****************************************************************************/
-bool qrc_pipe_list_init(void)
+uint32_t qrc_fnv1a(uint32_t h, const void * data, size_t len)
 {
-  bool res;
+  const uint8_t * d = (const uint8_t *)data;
+
+  for (size_t i = 0; i < len; i++) {
+    h = (h ^ d[i]) * QRC_FNV_PRIME;
+  }
+  return h;
+}
+
+/* node of a published pipe id */
+static struct qrc_pipe_node_s * qrc_pipe_node(uint16_t pipe_id)
+{
+  if (pipe_id >= __atomic_load_n(&g_qrc.pipe_cnt, __ATOMIC_ACQUIRE)) {
+    return NULL;
+  }
+  return &g_qrc.pipe_chunks[pipe_id >> QRC_PIPE_CHUNK_BITS][pipe_id & (QRC_PIPE_CHUNK - 1)];
+}
+
+/* pipe_list_mutex held, set up the node of the next pipe id, not published yet */
+static struct qrc_pipe_node_s * qrc_pipe_node_new(const char * pipe_name)
+{
+  uint16_t pipe_id = g_qrc.pipe_cnt;
+  struct qrc_pipe_node_s ** chunk = &g_qrc.pipe_chunks[pipe_id >> QRC_PIPE_CHUNK_BITS];
+  struct qrc_pipe_node_s * node;
+
+  if (pipe_id >= MAX_PIPE_ID) {
+    QRC_LOGE("qrc has %d pipes already!", MAX_PIPE_ID);
+    return NULL;
+  }
+  /* chunks are kept after qrc_destroy(), pipes of the last init stay valid */
+  if (NULL == *chunk) {
+    *chunk = (struct qrc_pipe_node_s *)calloc(QRC_PIPE_CHUNK, sizeof(struct qrc_pipe_node_s));
+    if (NULL == *chunk) {
+      QRC_LOGE("pipe(%s) malloc failed!", pipe_name);
+      return NULL;
+    }
+  }
+
+  node = &(*chunk)[pipe_id & (QRC_PIPE_CHUNK - 1)];
+  node->pipe = qrc_pipe_init();
+  node->pipe.pipe_id = pipe_id;
+  strcpy(node->pipe.pipe_name, pipe_name);
+  node->timeout_signaled = false;
+  node->timeout_expired = false;
+  qrc_timer_setup(&node->timer, qrc_pipe_timeout_expired, node);
+  qrc_stats_pipe_added(&node->pipe);
+
+  return node;
+}
+
+/****************************************************************************
+ * @intro: start the pipe list with the control pipe, before the read thread
+ *runs, so the peer's first QRC_CONNECT_REQUEST finds it
+ ****************************************************************************/
+static bool qrc_control_pipe_init(void)
+{
+  struct qrc_pipe_node_s * node;
 
   pthread_mutex_lock(&g_qrc.pipe_list_mutex);
 
-  /* init qrc control pipe */
-  g_qrc.pipe_list[QRC_CONTROL_PIPE_ID] = qrc_pipe_init();
-  g_qrc.pipe_list[QRC_CONTROL_PIPE_ID].pipe_id = QRC_CONTROL_PIPE_ID;
-  g_qrc.pipe_list[QRC_CONTROL_PIPE_ID].peer_pipe_id = QRC_CONTROL_PIPE_ID;
-  char * pipe_name = "QRC_CTL";
+  g_qrc.pipe_cnt = 0;
+  memset(g_qrc.pipe_names, 0, sizeof(g_qrc.pipe_names));
 
-  memcpy(
-      g_qrc.pipe_list[QRC_CONTROL_PIPE_ID].pipe_name, pipe_name, strlen(pipe_name) * sizeof(char));
-  g_qrc.pipe_list[QRC_CONTROL_PIPE_ID].cb = qrc_control_pipe_callback;
-  g_qrc.pipe_cnt = 1;
+  /* init qrc control pipe */
+  node = qrc_pipe_node_new("QRC_CTL");
+  if (NULL == node) {
+    pthread_mutex_unlock(&g_qrc.pipe_list_mutex);
+    return false;
+  }
+  node->pipe.peer_pipe_id = QRC_CONTROL_PIPE_ID;
+  node->pipe.cb = qrc_control_pipe_callback;
+  __atomic_store_n(&g_qrc.pipe_cnt, 1, __ATOMIC_RELEASE);
 
   pthread_mutex_unlock(&g_qrc.pipe_list_mutex);
 
+  return true;
+}
+
+/****************************************************************************
+ * @intro: initilize the pipe list
+ ****************************************************************************/
+bool qrc_pipe_list_init(void)
+{
+  bool res;
+
+  /* pipes of the last run, connected by the handshake if the peer agrees */
+  qrc_pipe_map_load();
+
   /* send connect request to peer for shake hands */
   res = qrc_control_write(
-      &g_qrc.pipe_list[QRC_CONTROL_PIPE_ID], QRC_CONTROL_PIPE_ID, QRC_CONNECT_REQUEST);
+      qrc_pipe_find_by_pipeid(QRC_CONTROL_PIPE_ID), QRC_CONTROL_PIPE_ID, QRC_CONNECT_REQUEST);
 
   return res;
 }
@@ -341,51 +918,61 @@ bool qrc_pipe_list_init(void)
  ****************************************************************************/
 qrc_pipe_s * qrc_pipe_insert(const char * pipe_name)
 {
-  pthread_mutex_lock(&g_qrc.pipe_list_mutex);
-  qrc_pipe_s * lt = g_qrc.pipe_list;
-  if (g_qrc.pipe_cnt >= 63) {
-    pthread_mutex_unlock(&g_qrc.pipe_list_mutex);
+  size_t name_len = strlen(pipe_name);
+  struct qrc_pipe_node_s * node;
+  uint32_t i;
+
+  if (0 == name_len || name_len >= QRC_PIPE_NAME_LEN) {
     return NULL;
   }
+
+  pthread_mutex_lock(&g_qrc.pipe_list_mutex);
   qrc_pipe_s * find_res = qrc_pipe_find_by_name(pipe_name);
   if (NULL == find_res) {
-    uint8_t new_pipe_index = g_qrc.pipe_cnt;
-    g_qrc.pipe_cnt = (g_qrc.pipe_cnt + 1) % 64;
-    lt[new_pipe_index] = qrc_pipe_init();
-    lt[new_pipe_index].pipe_id = new_pipe_index;
-    // debug
-    lt[new_pipe_index].peer_pipe_id = new_pipe_index;
-    memcpy(lt[new_pipe_index].pipe_name, pipe_name, strlen(pipe_name) * sizeof(char));
-    find_res = &lt[new_pipe_index];
+    node = qrc_pipe_node_new(pipe_name);
+    if (NULL != node) {
+      i = qrc_fnv1a(QRC_FNV_OFFSET, pipe_name, name_len) & (QRC_PIPE_HASH_SIZE - 1);
+      while (0 != g_qrc.pipe_names[i]) {
+        i = (i + 1) & (QRC_PIPE_HASH_SIZE - 1);
+      }
+      /* readers find the id only after the node is complete */
+      __atomic_store_n(&g_qrc.pipe_cnt, g_qrc.pipe_cnt + 1, __ATOMIC_RELEASE);
+      __atomic_store_n(&g_qrc.pipe_names[i], node->pipe.pipe_id, __ATOMIC_RELEASE);
+      find_res = &node->pipe;
+    }
   }
   pthread_mutex_unlock(&g_qrc.pipe_list_mutex);
   return find_res;
 }
 
 /****************************************************************************
- * @intro: find a pipe named pipe_name
+ * @intro: find a pipe named pipe_name, takes no lock
  * @return: pointer of pipe or NULL
  ****************************************************************************/
 qrc_pipe_s * qrc_pipe_find_by_name(const char * pipe_name)
 {
-  for (uint8_t i = 1; i < g_qrc.pipe_cnt; i++) {
-    if (0 == strcmp(g_qrc.pipe_list[i].pipe_name, pipe_name)) {
-      return &g_qrc.pipe_list[i];
+  uint32_t i = qrc_fnv1a(QRC_FNV_OFFSET, pipe_name, strlen(pipe_name)) & (QRC_PIPE_HASH_SIZE - 1);
+  uint16_t pipe_id;
+
+  while (0 != (pipe_id = __atomic_load_n(&g_qrc.pipe_names[i], __ATOMIC_ACQUIRE))) {
+    struct qrc_pipe_node_s * node = qrc_pipe_node(pipe_id);
+    if (NULL != node && 0 == strcmp(node->pipe.pipe_name, pipe_name)) {
+      return &node->pipe;
     }
+    i = (i + 1) & (QRC_PIPE_HASH_SIZE - 1);
   }
   return NULL;
 }
 
 /****************************************************************************
- * @intro: find a pipe by its pipe_id
+ * @intro: find a pipe by its pipe_id, takes no lock
  * @return: pointer of pipe or NULL
  ****************************************************************************/
-qrc_pipe_s * qrc_pipe_find_by_pipeid(const uint8_t pipe_id)
+qrc_pipe_s * qrc_pipe_find_by_pipeid(const uint16_t pipe_id)
 {
-  if (g_qrc.pipe_cnt <= pipe_id) {
-    return NULL;
-  }
-  return &g_qrc.pipe_list[pipe_id];
+  struct qrc_pipe_node_s * node = qrc_pipe_node(pipe_id);
+
+  return (NULL == node) ? NULL : &node->pipe;
 }
 
 /****************************************************************************
@@ -398,204 +985,579 @@ qrc_pipe_s * qrc_pipe_modify_by_name(const char * pipe_name, const qrc_pipe_s *
 }
 
 /****************************************************************************
- * @intro: send TF frame
- * @param qrcf: qrcf_frame(sync_mode + ack + receiver_id)
- * @param data: qrc_msg(qrc_msg_cmd + pipe id + pipe name) or user data
- * @param len: length of data
- * @param qrc_write_lock: whether hold lock to ensure the integrity of the
- *frame, default is true
- * @return: result of TF_Send()
+ * @intro: run a work on the control pool, for threads that must not block
+ *on a control write themselves
+ * @param args: copied
+ * @return: 0, -1 if the control pool queue is full
  ****************************************************************************/
-bool qrc_frame_send(const qrc_frame * qrcf,
-    const uint8_t * data,
-    const size_t len,
-    const bool qrc_write_lock)
+int qrc_control_add_work(qrc_work work_fun, const struct qrc_msg_cb_args_s * args)
 {
-  int status;
+  return qrc_threadpool_add_work(g_qrc.control_threadpool, work_fun, args);
+}
 
-  if (true == qrc_write_lock) {
-    status = pthread_mutex_lock(&g_qrc.qrc_write_mutex);
-    if (status != 0) {
-      printf("ERROR: qrc_frame_send: pthread_mutex_lock failed=%d\n", status);
-      return false;
-    }
+/****************************************************************************
+ * @intro: queue the completion callback of a qrc_write_async() on the
+ *callback thread pool, so it may block or write again. It goes into the
+ *strand slot the write reserved, so it is never refused
+ * @param p: writer pipe
+ * @param done_cb: completion callback
+ * @param arg: argument of done_cb
+ * @param handle: handle of the write
+ * @param status: SUCCESS, TIMEOUT or FAILED
+ ****************************************************************************/
+void qrc_write_done_dispatch(qrc_pipe_s * p,
+    qrc_write_done_cb done_cb,
+    void * arg,
+    uint32_t handle,
+    enum qrc_write_status_e status)
+{
+  struct qrc_msg_cb_args_s args;
+
+  memset(&args, 0, sizeof(args));
+  args.pipe = p;
+  args.done_cb = done_cb;
+  args.done_arg = arg;
+  args.handle = handle;
+  args.status = (uint8_t)status;
+  if (0 != qrc_strand_add_reserved(qrc_write_done_work, &args)) {
+    /* the strands are destroyed only after the threads that complete writes
+     * stopped, qrc_rel_destroy() fails the writes left then */
+    QRC_LOGE("pipe(%s) write completion %u has no strand!", p->pipe_name, (unsigned)handle);
   }
+}
+
+/* frame to be composed into a tx ring slot */
+struct qrc_frame_compose_s
+{
+  const qrc_frame * qrcf;
+  const struct qrc_ext_s * ext;
+  const struct iovec * iov;
+  int iovcnt;
+};
+
+/****************************************************************************
+ * @intro: compose qrc_frame byte, extended header and user data into a TF
+ *frame, runs on the sending thread
+ * @return: length of the frame, 0 on failure
+ ****************************************************************************/
+static uint32_t qrc_frame_compose(uint8_t * frame, uint32_t size, void * arg)
+{
+  struct qrc_frame_compose_s * c = (struct qrc_frame_compose_s *)arg;
+  uint8_t hdr[sizeof(qrc_frame) + QRC_EXT_MAX_LEN];
+  struct iovec vec[TF_MAX_IOV];
+  uint32_t len;
   TF_Msg msg;
+
   TF_ClearMsg(&msg);
   msg.type = DEFAULT_TF_MSG_TYPE;
-  uint8_t * msg_qrc = (uint8_t *)malloc(sizeof(qrc_frame) + len);
-  if (NULL == msg_qrc) {
-    printf("qrc frame : malloc error\n");
-    return false;
-  }
-  memcpy(msg_qrc, qrcf, sizeof(qrc_frame));
-  memcpy(msg_qrc + sizeof(qrc_frame), data, len);
-  msg.data = msg_qrc;
-  msg.len = sizeof(qrc_frame) + len;
-
-  bool send_res = TF_Send(g_qrc.tf, &msg);
-  free(msg_qrc);
-  if (true == qrc_write_lock) {
-    status = pthread_mutex_unlock(&g_qrc.qrc_write_mutex);
-    if (status != 0) {
-      printf("ERROR: qrc_frame_send: pthread_mutex_unlock failed=%d\n", status);
-      return false;
-    }
+  memcpy(hdr, c->qrcf, sizeof(qrc_frame));
+  vec[0].iov_base = hdr;
+  vec[0].iov_len = sizeof(qrc_frame);
+  if (NULL != c->ext && 0 != c->ext->flags) {
+    msg.type = QRC_EXT_TF_MSG_TYPE;
+    vec[0].iov_len += qrc_ext_encode(hdr + sizeof(qrc_frame), c->ext);
   }
+  memcpy(&vec[1], c->iov, c->iovcnt * sizeof(struct iovec));
 
-  return send_res;
+  len = TF_ComposeVector(g_qrc.tf, frame, size, &msg, vec, c->iovcnt + 1);
+  QRC_TRACE1(tf_write, len);
+  return len;
 }
 
-bool is_pipe_timeout_busy(const uint8_t pipe_id)
+/****************************************************************************
+ * @intro: address a frame to a peer pipe, an id that does not fit in
+ *qrc_frame goes in the extended header
+ * @param qrcf: frame
+ * @param ext: extended header of the frame, must be sent with it
+ * @param peer_pipe_id: receiver
+ ****************************************************************************/
+void qrc_frame_address(qrc_frame * qrcf, struct qrc_ext_s * ext, uint16_t peer_pipe_id)
 {
-  qrc_pipe_s * p = qrc_pipe_find_by_pipeid(pipe_id);
-  if (p == NULL) {
-    printf("ERROR: input pipe id is invalid\n");
-    return QRC_ERROR;
+  if (peer_pipe_id < QRC_PIPE_ID_EXT) {
+    qrcf->receiver_id = (uint8_t)peer_pipe_id;
+    return;
   }
-  return p->is_pipe_timeout_busy;
+  qrcf->receiver_id = QRC_PIPE_ID_EXT;
+  ext->flags |= QRC_EXT_PIPE;
+  ext->pipe = peer_pipe_id;
 }
 
 /****************************************************************************
- * @intro: start the timeout of pipe whose pipe id is pipe_id
+ * @intro: send TF frame
+ * @param qrcf: qrcf_frame(sync_mode + ack + receiver_id)
+ * @param data: qrc_msg(qrc_msg_cmd + pipe id + pipe name) or user data
+ * @param len: length of data
+ * @param qrc_write_lock: whether wait while the bus is locked by a pipe,
+ *default is true
+ * @return: result of qrc_frame_sendv()
+ ****************************************************************************/
+enum qrc_write_status_e qrc_frame_send(const qrc_frame * qrcf,
+    const uint8_t * data,
+    const size_t len,
+    const bool qrc_write_lock)
+{
+  struct iovec iov;
+  iov.iov_base = (void *)data;
+  iov.iov_len = len;
+
+  return qrc_frame_sendv(qrcf, NULL, &iov, 1, qrc_write_lock);
+}
+
+/****************************************************************************
+ * @intro: send a control frame only if the tx ring has a free slot, for
+ *callers that may hold the tx lock of a pipe and must not wait for the
+ *write thread
+ * @param qrcf: qrcf_frame(sync_mode + ack + receiver_id)
+ * @param data: user data
+ * @param len: length of user data
+ * @return: SUCCESS, BUSY if the tx ring is full, FAILED
+ ****************************************************************************/
+enum qrc_write_status_e qrc_frame_try_send(const qrc_frame * qrcf,
+    const uint8_t * data,
+    const size_t len)
+{
+  struct qrc_frame_compose_s c;
+  struct iovec iov;
+  enum qrc_write_status_e res;
+
+  iov.iov_base = (void *)data;
+  iov.iov_len = len;
+  c.qrcf = qrcf;
+  c.ext = NULL;
+  c.iov = &iov;
+  c.iovcnt = 1;
+  res = qrc_txring_push(qrc_frame_compose, &c, false);
+  if (BUSY == res) {
+    QRC_STAT_ADD(qrc_stats_link()->tx_busy, 1);
+  }
+
+  return res;
+}
+
+/****************************************************************************
+ * @intro: compose a TF frame on the calling thread and queue it for the
+ *write thread. Control frames wait for a free slot and pass a locked bus,
+ *user frames are refused with BUSY when the tx ring is full
+ * @param qrcf: qrcf_frame(sync_mode + ack + receiver_id)
+ * @param ext: extended header, NULL or no flags for a plain frame
+ * @param iov: user data segments
+ * @param iovcnt: number of segments, at most QRC_MAX_IOV
+ * @param qrc_write_lock: whether wait while the bus is locked by a pipe,
+ *default is true
+ * @return: SUCCESS, BUSY or FAILED
+ ****************************************************************************/
+enum qrc_write_status_e qrc_frame_sendv(const qrc_frame * qrcf,
+    const struct qrc_ext_s * ext,
+    const struct iovec * iov,
+    const int iovcnt,
+    const bool qrc_write_lock)
+{
+  struct qrc_frame_compose_s c;
+  enum qrc_write_status_e res;
+  bool control = (QRC_CONTROL_PIPE_ID == qrcf->receiver_id);
+
+  if (iovcnt < 0 || iovcnt > QRC_MAX_IOV) {
+    QRC_LOGE("qrc_frame_sendv: %d segments is too many!", iovcnt);
+    return FAILED;
+  }
+
+  if (true == qrc_write_lock && !control) {
+    qrc_bus_gate_wait();
+  }
+
+  c.qrcf = qrcf;
+  c.ext = ext;
+  c.iov = iov;
+  c.iovcnt = iovcnt;
+  res = qrc_txring_push(qrc_frame_compose, &c, control);
+  if (BUSY == res) {
+    QRC_STAT_ADD(qrc_stats_link()->tx_busy, 1);
+  }
+
+  return res;
+}
+
+/****************************************************************************
+ * @intro: address a frame of a pipe to its peer pipe and send it. A frame
+ *that takes a receive slot of the peer (user data or a request) needs one
+ *of the peer's credits
+ * @param pipe: sender
+ * @param resend: the frame was sent before, the peer got it or lost it
+ *without counting it, so it goes on the credit of the first send
+ * @return: SUCCESS, BUSY if the peer has no room or the tx ring is full,
+ *FAILED
+ ****************************************************************************/
+enum qrc_write_status_e qrc_pipe_sendv(const qrc_pipe_s * pipe,
+    qrc_frame * qrcf,
+    struct qrc_ext_s * ext,
+    const struct iovec * iov,
+    const int iovcnt,
+    const bool qrc_write_lock,
+    const bool resend)
+{
+  struct qrc_pipe_stats_s * stats;
+  enum qrc_write_status_e res;
+  bool data = (0 == (ext->flags & ~QRC_EXT_PIPE) || (ext->flags & (QRC_EXT_SEQ | QRC_EXT_REQ)));
+  bool credit = data && !resend;
+
+  if (credit && SUCCESS != qrc_credit_take(pipe)) {
+    return BUSY;
+  }
+  qrc_frame_address(qrcf, ext, pipe->peer_pipe_id);
+  res = qrc_frame_sendv(qrcf, ext, iov, iovcnt, qrc_write_lock);
+  if (credit && SUCCESS != res) {
+    qrc_credit_untake(pipe);
+  }
+
+  /* frames of only acks or sequence control are not counted */
+  if (SUCCESS == res && (data || (ext->flags & QRC_EXT_RSP))) {
+    stats = qrc_stats_pipe(pipe->pipe_id);
+    QRC_STAT_ADD(stats->tx_frames, 1);
+    for (int i = 0; i < iovcnt; i++) {
+      QRC_STAT_ADD(stats->tx_bytes, iov[i].iov_len);
+    }
+  }
+
+  return res;
+}
+
+bool is_pipe_timeout_busy(const uint16_t pipe_id)
+{
+  qrc_pipe_s * p = qrc_pipe_find_by_pipeid(pipe_id);
+  if (p == NULL) {
+    QRC_LOGE("input pipe id is invalid");
+    return QRC_ERROR;
+  }
+  return p->is_pipe_timeout_busy;
+}
+
+/****************************************************************************
+ * @intro: claim the timeout of pipe whose pipe id is pipe_id, must be done
+ *before the frame is sent, so an answer that comes back before
+ *start_pipe_timeout() waits is not lost
  * @param pipe_id: pipe id
+ * @return: QRC_OK, QRC_ERROR if the timeout is in use
  ****************************************************************************/
-int start_pipe_timeout(const uint8_t pipe_id, bool * timeout)
+int arm_pipe_timeout(const uint16_t pipe_id)
+{
+  struct qrc_pipe_node_s * node = qrc_pipe_node(pipe_id);
+  int res = QRC_OK;
+
+  if (node == NULL) {
+    QRC_LOGE("arm_pipe_timeout input pipe id is invalid");
+    return QRC_ERROR;
+  }
+
+  pthread_mutex_lock(&node->pipe.pipe_mutex);
+  if (true == node->pipe.is_pipe_timeout_busy) {
+    res = QRC_ERROR;
+  } else {
+    node->pipe.is_pipe_timeout_busy = true;
+    node->timeout_signaled = false;
+  }
+  pthread_mutex_unlock(&node->pipe.pipe_mutex);
+
+  return res;
+}
+
+/****************************************************************************
+ * @intro: give back the timeout claimed by arm_pipe_timeout() without
+ *waiting, used when the frame could not be sent
+ * @param pipe_id: pipe id
+ ****************************************************************************/
+void disarm_pipe_timeout(const uint16_t pipe_id)
 {
   qrc_pipe_s * p = qrc_pipe_find_by_pipeid(pipe_id);
-  struct timeval now;
+  if (p == NULL) {
+    return;
+  }
+
+  pthread_mutex_lock(&p->pipe_mutex);
+  p->is_pipe_timeout_busy = false;
+  pthread_mutex_unlock(&p->pipe_mutex);
+}
+
+/****************************************************************************
+ * @intro: wait for the answer of the timeout armed by arm_pipe_timeout()
+ * @param pipe_id: pipe id
+ ****************************************************************************/
+int start_pipe_timeout(const uint16_t pipe_id, bool * timeout)
+{
+  struct qrc_pipe_node_s * node = qrc_pipe_node(pipe_id);
+  qrc_pipe_s * p = (NULL == node) ? NULL : &node->pipe;
 
   *timeout = false;
 
   if (p == NULL) {
-    printf("ERROR: start_pipe_timeout input pipe id is invalid\n");
+    QRC_LOGE("start_pipe_timeout input pipe id is invalid");
     return QRC_ERROR;
   }
 
-  if (true == p->is_pipe_timeout_busy) {
-    printf("Warning: start_pipe_timeout  timeout is using\n");
+  if (false == p->is_pipe_timeout_busy) {
+    QRC_LOGW("start_pipe_timeout timeout is not armed");
     return QRC_ERROR;
   }
 
-  gettimeofday(&now, NULL);
-
-  struct timespec outtime;
-  outtime.tv_sec = now.tv_sec + QRC_MSG_TIME_OUT_S;
-  outtime.tv_nsec = now.tv_usec; /*500ms*/
-
+  QRC_TRACE1(pipe_wait, pipe_id);
   pthread_mutex_lock(&p->pipe_mutex);
-  p->is_pipe_timeout_busy = true;
-  if (0 != pthread_cond_timedwait(&p->pipe_cond, &p->pipe_mutex, &outtime)) {
-    printf("\nERROR: pipe(%s) TIMEOUT!\n", p->pipe_name);
+  node->timeout_expired = false;
+  qrc_timer_arm(&node->timer, QRC_MSG_TIME_OUT_S * 1000000ULL);
+  while (!node->timeout_signaled && !node->timeout_expired) {
+    pthread_cond_wait(&p->pipe_cond, &p->pipe_mutex);
+  }
+  if (!node->timeout_signaled) {
+    QRC_LOGE("pipe(%s) TIMEOUT!", p->pipe_name);
+    QRC_STAT_ADD(qrc_stats_pipe(pipe_id)->timeouts, 1);
     *timeout = true;
   }
+  pthread_mutex_unlock(&p->pipe_mutex);
+  QRC_TRACE2(pipe_wait_done, pipe_id, *timeout);
 
+  /* the timer callback takes pipe_mutex, cancel it unlocked */
+  qrc_timer_cancel(&node->timer);
+
+  pthread_mutex_lock(&p->pipe_mutex);
   p->is_pipe_timeout_busy = false;
   pthread_mutex_unlock(&p->pipe_mutex);
 
   return QRC_OK;
 }
 
+/****************************************************************************
+ * @intro: timer callback, the answer for the pipe timeout did not come
+ * @param arg: node of the pipe
+ ****************************************************************************/
+static void qrc_pipe_timeout_expired(void * arg)
+{
+  struct qrc_pipe_node_s * node = (struct qrc_pipe_node_s *)arg;
+
+  pthread_mutex_lock(&node->pipe.pipe_mutex);
+  node->timeout_expired = true;
+  pthread_cond_signal(&node->pipe.pipe_cond);
+  pthread_mutex_unlock(&node->pipe.pipe_mutex);
+}
+
 /****************************************************************************
  * @intro: wake up the timeout of pipe whose pipe id is pipe_id
  * @param pipe_id: pipe id
  ****************************************************************************/
-static void stop_pipe_timeout(const uint8_t pipe_id)
+static void stop_pipe_timeout(const uint16_t pipe_id)
 {
-  qrc_pipe_s * p = qrc_pipe_find_by_pipeid(pipe_id);
+  struct qrc_pipe_node_s * node = qrc_pipe_node(pipe_id);
+  qrc_pipe_s * p = (NULL == node) ? NULL : &node->pipe;
   int status;
 
   if (p == NULL) {
-    printf("ERROR: stop_pipe_timeout input pipe id is invalid\n");
+    QRC_LOGE("stop_pipe_timeout input pipe id is invalid");
     return;
   }
 
-  if (false == p->is_pipe_timeout_busy) {
-    printf("WARNING: stop_pipe_timeout timeout in idle\n");
-  }
-
   status = pthread_mutex_lock(&p->pipe_mutex);
   if (status != 0) {
-    printf("stop_pipe_timeout:ERROR pthread_mutex_lock failed=%d\n", status);
+    QRC_LOGE("stop_pipe_timeout: pthread_mutex_lock failed=%d", status);
     return;
   }
 
+  if (false == p->is_pipe_timeout_busy) {
+    QRC_LOGW("stop_pipe_timeout timeout in idle");
+  }
+  node->timeout_signaled = true;
+
   if (0 != pthread_cond_signal(&p->pipe_cond)) {
-    printf("\nERROR: Can not wake up ack pipe(%s) thread!\n", p->pipe_name);
+    QRC_LOGE("Can not wake up ack pipe(%s) thread!", p->pipe_name);
     pthread_mutex_unlock(&p->pipe_mutex);
     return;
   }
 
   status = pthread_mutex_unlock(&p->pipe_mutex);
   if (status != 0) {
-    printf("stop_pipe_timeout:ERROR pthread_mutex_unlock failed=%d\n", status);
+    QRC_LOGE("stop_pipe_timeout: pthread_mutex_unlock failed=%d", status);
     return;
   }
 }
 
 /****************************************************************************
- * @intro: lock the qrc_write_mutex
+ * @intro: close the bus gate, qrc_write() of other pipes waits until
+ *qrc_bus_unlock(), qrc_write_fast() and control frames still pass
  ****************************************************************************/
 void qrc_bus_lock(void)
 {
   int status;
-  status = pthread_mutex_lock(&g_qrc.qrc_write_mutex);
+  status = pthread_mutex_lock(&g_qrc.bus_gate_mutex);
   if (status != 0) {
-    printf("qrc_bus_lock:ERROR pthread_mutex_lock failed=%d\n", status);
+    QRC_LOGE("qrc_bus_lock: pthread_mutex_lock failed=%d", status);
+    return;
   }
+  g_qrc.bus_gate++;
+  pthread_mutex_unlock(&g_qrc.bus_gate_mutex);
 }
 
 /****************************************************************************
- * @intro: unlock the qrc_write_mutex
+ * @intro: open the bus gate closed by qrc_bus_lock()
  ****************************************************************************/
 void qrc_bus_unlock(void)
 {
   int status;
-  status = pthread_mutex_unlock(&g_qrc.qrc_write_mutex);
+  status = pthread_mutex_lock(&g_qrc.bus_gate_mutex);
   if (status != 0) {
-    printf("qrc_bus_unlock:ERROR pthread_mutex_unlock failed=%d\n", status);
+    QRC_LOGE("qrc_bus_unlock: pthread_mutex_lock failed=%d", status);
+    return;
+  }
+  if (g_qrc.bus_gate > 0) {
+    g_qrc.bus_gate--;
+  }
+  if (0 == g_qrc.bus_gate) {
+    pthread_cond_broadcast(&g_qrc.bus_gate_cond);
   }
+  pthread_mutex_unlock(&g_qrc.bus_gate_mutex);
 }
 
 /****************************************************************************
- * @intro: timeout for qrc bus lock
+ * @intro: wait while the bus gate is closed by qrc_bus_lock()
  ****************************************************************************/
-static int qrc_lock_start_timeout(bool * timeout)
+void qrc_bus_gate_wait(void)
 {
-  struct timeval now;
+  if (g_qrc.bus_gate <= 0) {
+    return;
+  }
 
+  pthread_mutex_lock(&g_qrc.bus_gate_mutex);
+  while (g_qrc.bus_gate > 0) {
+    pthread_cond_wait(&g_qrc.bus_gate_cond, &g_qrc.bus_gate_mutex);
+  }
+  pthread_mutex_unlock(&g_qrc.bus_gate_mutex);
+}
+
+/****************************************************************************
+ * @intro: whether qrc_write() of a pipe would wait for the bus gate now
+ ****************************************************************************/
+bool qrc_bus_gate_closed(void)
+{
+  return g_qrc.bus_gate > 0;
+}
+
+/****************************************************************************
+ * @intro: claim the bus lock timeout before the lock frame is sent
+ * @return: QRC_OK, QRC_ERROR if the timeout is in use
+ ****************************************************************************/
+static int qrc_lock_arm_timeout(void)
+{
+  int res = QRC_OK;
+
+  pthread_mutex_lock(&g_qrc.bus_lock_mutex);
   if (true == g_qrc.is_bus_timeout_busy) {
-    printf("Warning: qrc_lock_start_timeout  timeout is using\n");
-    return QRC_ERROR;
+    QRC_LOGW("qrc_lock_arm_timeout  timeout is using");
+    res = QRC_ERROR;
+  } else {
+    g_qrc.is_bus_timeout_busy = true;
+    g_qrc.bus_timeout_signaled = false;
   }
+  pthread_mutex_unlock(&g_qrc.bus_lock_mutex);
 
-  gettimeofday(&now, NULL);
+  return res;
+}
 
-  struct timespec outtime;
-  outtime.tv_sec = now.tv_sec + QRC_MSG_TIME_OUT_S;
-  outtime.tv_nsec = now.tv_usec;
+static void qrc_lock_disarm_timeout(void)
+{
+  pthread_mutex_lock(&g_qrc.bus_lock_mutex);
+  g_qrc.is_bus_timeout_busy = false;
+  pthread_mutex_unlock(&g_qrc.bus_lock_mutex);
+}
+
+static int qrc_lock_start_timeout(bool * timeout)
+{
+  if (false == g_qrc.is_bus_timeout_busy) {
+    QRC_LOGW("qrc_lock_start_timeout  timeout is not armed");
+    return QRC_ERROR;
+  }
 
   *timeout = false;
+  QRC_TRACE0(lock_wait);
   pthread_mutex_lock(&g_qrc.bus_lock_mutex);
-  g_qrc.is_bus_timeout_busy = true;
-  if (0 != pthread_cond_timedwait(&g_qrc.bus_lock_cond, &g_qrc.bus_lock_mutex, &outtime)) {
-    printf("\nERROR: bus lock TIMEOUT!\n");
+  g_qrc.bus_timeout_expired = false;
+  qrc_timer_arm(&g_qrc.bus_lock_timer, QRC_MSG_TIME_OUT_S * 1000000ULL);
+  while (!g_qrc.bus_timeout_signaled && !g_qrc.bus_timeout_expired) {
+    pthread_cond_wait(&g_qrc.bus_lock_cond, &g_qrc.bus_lock_mutex);
+  }
+  if (!g_qrc.bus_timeout_signaled) {
+    QRC_LOGE("bus lock TIMEOUT!");
     *timeout = true; /* timeout happened */
   }
+  pthread_mutex_unlock(&g_qrc.bus_lock_mutex);
+  QRC_TRACE1(lock_wait_done, *timeout);
 
-  g_qrc.is_bus_timeout_busy = false;
+  qrc_timer_cancel(&g_qrc.bus_lock_timer);
 
+  pthread_mutex_lock(&g_qrc.bus_lock_mutex);
+  g_qrc.is_bus_timeout_busy = false;
   pthread_mutex_unlock(&g_qrc.bus_lock_mutex);
 
   return QRC_OK;
 }
 
+/* timer callback, the bus lock answer did not come */
+static void qrc_lock_timeout_expired(void * arg)
+{
+  (void)arg;
+
+  pthread_mutex_lock(&g_qrc.bus_lock_mutex);
+  g_qrc.bus_timeout_expired = true;
+  pthread_cond_signal(&g_qrc.bus_lock_cond);
+  pthread_mutex_unlock(&g_qrc.bus_lock_mutex);
+}
+
+/****************************************************************************
+ * @intro: timer callback, count a TinyFrame tick for the read thread and
+ *keep ticking while a frame is partly received
+ ****************************************************************************/
+static void qrc_tf_tick(void * arg)
+{
+  (void)arg;
+
+  __atomic_add_fetch(&g_qrc.tf_ticks, 1, __ATOMIC_RELAXED);
+  if (g_qrc.tf_partial) {
+    qrc_timer_arm(&g_qrc.tf_timer, QRC_TF_TICK_MS * 1000ULL);
+  }
+}
+
+/****************************************************************************
+ * @intro: read thread, feed received bytes to the parser after running the
+ *TF_Tick() counted since the last call, so a frame cut off on the link is
+ *dropped by the parser timeout instead of swallowing the next frame
+ ****************************************************************************/
+static void qrc_tf_accept(const uint8_t * buf, uint32_t len)
+{
+  uint32_t ticks = __atomic_exchange_n(&g_qrc.tf_ticks, 0, __ATOMIC_RELAXED);
+  bool partial;
+
+  if (ticks > TF_PARSER_TIMEOUT_TICKS) {
+    ticks = TF_PARSER_TIMEOUT_TICKS;
+  }
+  while (ticks-- > 0) {
+    TF_Tick(g_qrc.tf);
+  }
+  if (TFState_SOF == g_qrc.tf->state) {
+    g_qrc.rx_frame_us = g_qrc.rx_read_us;
+  }
+
+  TF_Accept(g_qrc.tf, buf, len);
+
+  partial = (TFState_SOF != g_qrc.tf->state);
+  if (partial && !g_qrc.tf_partial) {
+    g_qrc.tf_partial = true;
+    qrc_timer_arm(&g_qrc.tf_timer, QRC_TF_TICK_MS * 1000ULL);
+  } else if (!partial) {
+    g_qrc.tf_partial = false; /* the tick timer stops after its next run */
+  }
+}
+
 static void qrc_lock_stop_timeout(void)
 {
   pthread_mutex_lock(&g_qrc.bus_lock_mutex);
+  g_qrc.bus_timeout_signaled = true;
 
   if (0 != pthread_cond_signal(&g_qrc.bus_lock_cond)) {
-    printf("\nERROR: Can not wake up bus lock thread!\n");
+    QRC_LOGE("Can not wake up bus lock thread!");
     pthread_mutex_unlock(&g_qrc.bus_lock_mutex);
     return;
   }
@@ -603,61 +1565,269 @@ static void qrc_lock_stop_timeout(void)
 }
 
 /****************************************************************************
- * @intro: thread of reading response
+ * @intro: read what is currently available on the link without blocking
+ * @param buf: destination buffer
+ * @param size: size of buf
+ * @return: bytes read, 0 if nothing is available, -1 on error
  ****************************************************************************/
-static void * read_thread(void * args)
+static ssize_t qrc_device_read(uint8_t * buf, size_t size)
 {
 #ifndef QRC_MCB
-  while (1) {
-    uint8_t buf[QRC_MAX_READ_SIZE];
-    ssize_t read_len = qrc_udriver_read(g_qrc.fd, (char *)buf, sizeof(buf));
-    if (read_len > 0) {
-      TF_Accept(g_qrc.tf, (uint8_t *)buf, (uint32_t)read_len);
-    } else {
-      usleep(100);
+  return qrc_udriver_read(g_qrc.fd, (char *)buf, size);
+#else  // QRC_MCB
+  int readable_len = 0;
+  if (ioctl(g_qrc.fd, QRC_FIONREAD, &readable_len) < 0) {
+    QRC_LOGE("qrc get readable size fail!");
+    return -1;
+  }
+  if (readable_len <= 0) {
+    return 0;
+  }
+  if ((size_t)readable_len > size) {
+    readable_len = (int)size;
+  }
+  return read(g_qrc.fd, buf, readable_len);
+#endif
+}
+
+/****************************************************************************
+ * @intro: select how read thread waits for data
+ * @param mode: QRC_RX_BLOCKING or QRC_RX_BUSY_POLL
+ * @param spin_us: busy poll budget after the last received data
+ ****************************************************************************/
+void qrc_read_mode_config(enum qrc_rx_mode_e mode, uint32_t spin_us)
+{
+  g_qrc.rx_spin_us = spin_us;
+  g_qrc.rx_mode = mode;
+
+  /* let a sleeping read thread pick up the new mode */
+  qrc_read_thread_wakeup();
+}
+
+/* inline callbacks run here, they must not wait for the peer */
+bool qrc_in_read_thread(void)
+{
+  return pthread_equal(pthread_self(), g_qrc.read_thread);
+}
+
+/****************************************************************************
+ * @intro: make a read thread sleeping in poll() go round its loop
+ ****************************************************************************/
+void qrc_read_thread_wakeup(void)
+{
+  if (g_qrc.wakeup_fd[1] > 0) {
+    uint8_t c = 0;
+    if (write(g_qrc.wakeup_fd[1], &c, 1) != 1) {
+      QRC_LOGW("qrc read thread wake up failed");
     }
-    pthread_testcancel();
   }
-#else  // QRC_MCB
-  int readable_len;
-  while (1) {
-    readable_len = 0;
-    if (ioctl(g_qrc.fd, QRC_FIONREAD, &readable_len) < 0) {
-      printf("\nERROR: qrc get readable size fail!\n");
-      return NULL;
+}
+
+/****************************************************************************
+ * @intro: thread of reading response, sleeps in poll() on the link and the
+ *wakeup pipe, in QRC_RX_BUSY_POLL mode it keeps reading for rx_spin_us after
+ *the last data before going back to poll()
+ ****************************************************************************/
+static void * read_thread(void * args)
+{
+  uint8_t buf[QRC_MAX_READ_SIZE];
+  struct pollfd fds[2];
+  uint64_t last_rx_us = 0;
+  bool burst = false; /* frames were read since the last ack flush */
+  ssize_t read_len;
+  int ret;
+
+  (void)args;
+
+  fds[0].fd = g_qrc.fd;
+  fds[0].events = POLLIN;
+  fds[1].fd = g_qrc.wakeup_fd[0];
+  fds[1].events = POLLIN;
+
+  while (!g_qrc.read_thread_stop) {
+    read_len = qrc_device_read(buf, sizeof(buf));
+    if (read_len > 0) {
+      QRC_TRACE1(link_read, read_len);
+      g_qrc.rx_read_us = qrc_timer_now_us();
+      last_rx_us = g_qrc.rx_read_us;
+      QRC_STAT_ADD(qrc_stats_link()->rx_bytes, read_len);
+      qrc_tf_accept(buf, (uint32_t)read_len);
+      burst = true;
+      continue;
     }
-    if (readable_len > 0) {
-      uint8_t * buf = malloc(readable_len * sizeof(uint8_t));
-      int read_len = read(g_qrc.fd, buf, readable_len);
-      if (read_len > 0) {
-        TF_Accept(g_qrc.tf, (uint8_t *)buf, (uint32_t)read_len);
+
+    /* the burst is over, acknowledge it with one frame per pipe. Delayed
+     * acks are sent when their timer fires */
+    if (burst || qrc_rel_ack_timer_fired()) {
+      burst = false;
+      qrc_rel_flush_acks();
+    }
+
+    if (QRC_RX_BUSY_POLL == g_qrc.rx_mode &&
+        qrc_timer_now_us() - last_rx_us < g_qrc.rx_spin_us) {
+      continue;
+    }
+
+    fds[0].revents = 0;
+    fds[1].revents = 0;
+    ret = poll(fds, 2, -1);
+    if (ret < 0) {
+      if (EINTR == errno) {
+        continue;
       }
-      free(buf);
+      QRC_LOGE("qrc read thread poll failed, errno=%d", errno);
+      break;
+    }
+
+    if (fds[1].revents & POLLIN) {
+      /* drain wake ups, loop condition checks for stop */
+      uint8_t drain[8];
+      if (read(g_qrc.wakeup_fd[0], drain, sizeof(drain)) < 0) {
+        QRC_LOGW("qrc read thread drain wakeup failed");
+      }
+      last_rx_us = qrc_timer_now_us();
+    }
+
+    /* a hung up link stays readable with nothing to read, take what it
+     * still holds and stop instead of spinning on it */
+    if (fds[0].revents & (POLLERR | POLLHUP | POLLNVAL)) {
+      while (!(fds[0].revents & POLLNVAL) && (read_len = qrc_device_read(buf, sizeof(buf))) > 0) {
+        qrc_tf_accept(buf, (uint32_t)read_len);
+      }
+      qrc_rel_flush_acks();
+      QRC_LOGE("qrc read thread device error, revents=0x%x", fds[0].revents);
+      break;
+    }
+
+    if ((fds[0].revents & POLLIN) && QRC_RX_BUSY_POLL == g_qrc.rx_mode) {
+      last_rx_us = qrc_timer_now_us();
+    }
+  }
+
+  return NULL;
+}
+
+/****************************************************************************
+ * @intro: thread of writing frames, sends the frames queued in the tx ring
+ *in batches with one writev, until qrc_txring_stop()
+ ****************************************************************************/
+static void * write_thread(void * args)
+{
+  struct iovec iov[QRC_TX_BATCH];
+  ssize_t len;
+  int frames;
+
+  (void)args;
+
+  while (qrc_txring_wait()) {
+    frames = qrc_txring_peek(iov, QRC_TX_BATCH);
+    len = 0;
+    for (int i = 0; i < frames; i++) {
+      len += iov[i].iov_len;
+    }
+    QRC_TRACE2(link_write, frames, len);
+    if (qrc_device_writev(iov, frames) != len) {
+      QRC_LOGE("qrc write thread write failed!");
     } else {
-      usleep(100);
+      QRC_STAT_ADD(qrc_stats_link()->tx_frames, frames);
+      QRC_STAT_ADD(qrc_stats_link()->tx_bytes, len);
     }
-    pthread_testcancel();
+    qrc_txring_consume(frames);
   }
-#endif
+
+  return NULL;
 }
 
 /****************************************************************************
  * @intro: execute the function args.fun_cb
  * @param args: thread holder
  ****************************************************************************/
-static void qrc_msg_cb_work(struct qrc_msg_cb_args_s args)
+static void qrc_msg_cb_work(const struct qrc_msg_cb_args_s * args)
+{
+  uint64_t start = qrc_timer_now_us();
+  uint64_t us;
+
+  qrc_latency_record(args->pipe->pipe_id, QRC_LAT_QUEUE, start - args->queued_us);
+  if (0 != args->rpc_id) {
+    qrc_rpc_enter(args->pipe, args->rpc_id);
+  }
+  QRC_TRACE3(cb_start, args->pipe->pipe_id, args->buf, args->len);
+  args->fun_cb(args->pipe, args->data, args->len, args->response);
+  us = qrc_timer_now_us() - start;
+  QRC_TRACE3(cb_end, args->pipe->pipe_id, args->buf, us);
+  if (0 != args->rpc_id) {
+    qrc_rpc_leave();
+  }
+  qrc_latency_callback(args->pipe, us);
+  qrc_rxbuf_release(args->buf);
+  qrc_credit_done(args->pipe);
+}
+
+/****************************************************************************
+ * @intro: execute the completion callback of a qrc_write_async()
+ * @param args: thread holder
+ ****************************************************************************/
+static void qrc_write_done_work(const struct qrc_msg_cb_args_s * args)
+{
+  args->done_cb(args->pipe, args->handle, (enum qrc_write_status_e)args->status, args->done_arg);
+}
+
+/****************************************************************************
+ * @intro: fill the link counters kept elsewhere: queue depths, parser
+ *errors and the error counts of the uart driver
+ * @param stats: link counters, the other fields are left alone
+ ****************************************************************************/
+void qrc_link_gauges(struct qrc_link_stats_s * stats)
 {
-  if (ACK == args.need_ack) {
-    qrc_control_write(args.pipe, args.pipe->peer_pipe_id, QRC_ACK);
+#if !defined(QRC_MCB) && defined(TIOCGICOUNT)
+  struct serial_icounter_struct icount;
+#endif
+  const TF_Stats * tf;
+
+  stats->tx_queue = qrc_txring_depth();
+  stats->rx_queue =
+      qrc_strand_queue_len() + (uint32_t)qrc_threadpool_queue_len(g_qrc.control_threadpool);
+  stats->rx_queue_high =
+      qrc_strand_queue_high() + (uint32_t)qrc_threadpool_queue_high(g_qrc.control_threadpool);
+  if (NULL != g_qrc.tf) {
+    tf = &g_qrc.tf->stats;
+    stats->crc_errors = __atomic_load_n(&tf->head_errors, __ATOMIC_RELAXED) +
+                        __atomic_load_n(&tf->body_errors, __ATOMIC_RELAXED);
+    stats->parser_errors = __atomic_load_n(&tf->timeouts, __ATOMIC_RELAXED) +
+                           __atomic_load_n(&tf->oversized, __ATOMIC_RELAXED) +
+                           __atomic_load_n(&tf->unhandled, __ATOMIC_RELAXED);
   }
 
-  args.fun_cb(args.pipe, args.data, args.len, args.response);
-  free(args.data);
+  stats->tty_valid = false;
+#if !defined(QRC_MCB) && defined(TIOCGICOUNT)
+  if (0 == ioctl(g_qrc.fd, TIOCGICOUNT, &icount)) {
+    stats->tty_valid = true;
+    stats->tty_overruns = (uint32_t)(icount.overrun + icount.buf_overrun);
+    stats->tty_frame_errors = (uint32_t)icount.frame;
+    stats->tty_parity_errors = (uint32_t)icount.parity;
+    stats->tty_breaks = (uint32_t)icount.brk;
+  }
+#endif
 }
 
-uint8_t get_pipe_number(void)
+uint16_t get_pipe_number(void)
 {
-  return g_qrc.pipe_cnt;
+  return __atomic_load_n(&g_qrc.pipe_cnt, __ATOMIC_ACQUIRE);
+}
+
+/* threads of the message pool, strands let them scale with the CPUs */
+static int qrc_thread_num(void)
+{
+#ifdef QRC_MCB
+  return QRC_THREAD_NUM;
+#else
+  long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+
+  if (cpus < QRC_THREAD_NUM) {
+    return QRC_THREAD_NUM;
+  }
+  return (cpus > QRC_THREAD_MAX) ? QRC_THREAD_MAX : (int)cpus;
+#endif
 }
 
 /* Hardware sync */
@@ -678,10 +1848,10 @@ static int qrc_hardware_sync(int qrc_fd)
 
   write_cnt = qrc_udriver_write(qrc_fd, &mcb_boot_app, 1);
   if (write_cnt != 1) {
-    printf("ERROR: qrc bus write failed!\n");
+    QRC_LOGE("qrc bus write failed!");
   }
 
-  printf("INFO: qrc start bus sync\n");
+  QRC_LOGI("qrc start bus sync");
 
   while (try > 0) {
     try--;
@@ -695,31 +1865,31 @@ static int qrc_hardware_sync(int qrc_fd)
         if (buf[count] == 'O' && buf[count + 1] == 'K') {
           write_cnt = qrc_udriver_write(qrc_fd, ack, sizeof(ack));
           if (write_cnt != sizeof(ack)) {
-            printf("ERROR: qrc bus write SYNC MSG failed!\n");
+            QRC_LOGE("qrc bus write SYNC MSG failed!");
             qrc_udriver_close(qrc_fd);
             return -1;
           }
-          printf("DEBUG: qrc bus SYNC done\n");
+          QRC_LOGD("qrc bus SYNC done");
           return 0;
         }
         count = count + 1;
       }
     }
-    printf("INFO: qrc bus write SYNC try = %d \n", try);
+    QRC_LOGI("qrc bus write SYNC try = %d", try);
   }
 
 #else  // QRC_MCB
   while (try > 0) {
     write_cnt = write(qrc_fd, ack, sizeof(ack));
     if (write_cnt != sizeof(ack)) {
-      printf("ERROR: qrc bus write SYNC MSG failed!\n");
+      QRC_LOGE("qrc bus write SYNC MSG failed!");
       close(qrc_fd);
       return -1;
     }
 
     /* check if received ACK msg */
     if (ioctl(qrc_fd, QRC_FIONREAD, &readable_len) < 0) {
-      printf("\nERROR: qrc get readable size fail!\n");
+      QRC_LOGE("qrc get readable size fail!");
       close(qrc_fd);
       return -1;
     }
@@ -731,7 +1901,7 @@ static int qrc_hardware_sync(int qrc_fd)
         int count = 0;
         while (count <= (read_len - 2)) {
           if (buf[count] == 'O' && buf[count + 1] == 'K') {
-            printf("INFO: qrc bus sync done\n");
+            QRC_LOGI("qrc bus sync done");
             return 0;
           }
           count = count + 1;
@@ -739,13 +1909,13 @@ static int qrc_hardware_sync(int qrc_fd)
       }
       free(buf);
     }
-    printf("INFO: qrc bus write SYNC try = %d \n", try);
+    QRC_LOGI("qrc bus write SYNC try = %d", try);
     try--;
     sleep(1);
   }
 
 #endif
-  printf("\nERROR: qrc BUS try to sync failed \n");
+  QRC_LOGE("qrc BUS try to sync failed");
   return -1;
 }
 
@@ -759,53 +1929,200 @@ static int qrc_hardware_sync(int qrc_fd)
  ****************************************************************************/
 bool qrc_init(void)
 {
+  uint8_t c = 0;
+
+  /* messages of the threads below go through the log thread */
+  qrc_log_start();
+
+  /* pages of the pools and threads below are locked as they are mapped */
+  qrc_rt_lock_memory();
+
 #ifndef QRC_MCB
   g_qrc.fd = qrc_udriver_open();
 #else
   g_qrc.fd = open(QRC_MCB_FD, O_RDWR);
 #endif
   if (-1 == g_qrc.fd) {
-    printf("ERROR: device open failed!\n");
-    close(g_qrc.fd);
-    return false;
+    QRC_LOGE("device open failed!");
+    goto fail_open;
   }
 
   if (0 != qrc_hardware_sync(g_qrc.fd)) {
-    printf("ERROR: qrc HW sync failed!\n");
-    close(g_qrc.fd);
-    return false;
+    QRC_LOGE("qrc HW sync failed!");
+    goto fail_sync;
   }
 
   if (0 != pthread_mutex_init(&g_qrc.pipe_list_mutex, NULL)) {
-    printf("\nERROR: pipe mutex initalize failed!\n");
-    close(g_qrc.fd);
-    return false;
+    QRC_LOGE("pipe mutex initalize failed!");
+    goto fail_sync;
   }
-  if (0 != pthread_mutex_init(&g_qrc.qrc_write_mutex, NULL)) {
-    printf("\nERROR: pipe mutex initalize failed!\n");
-    close(g_qrc.fd);
-    return false;
+  if (0 != pthread_mutex_init(&g_qrc.bus_gate_mutex, NULL) ||
+      0 != pthread_cond_init(&g_qrc.bus_gate_cond, NULL)) {
+    QRC_LOGE("bus gate mutex initalize failed!");
+    goto fail_sync;
   }
+  g_qrc.bus_gate = 0;
 
   /* init qrc lock timeout cond & mutex */
   if (0 != pthread_cond_init(&g_qrc.bus_lock_cond, NULL)) {
-    printf("\nERROR: bus_lock_cond cond initalize failed!\n");
-    return false;
+    QRC_LOGE("bus_lock_cond cond initalize failed!");
+    goto fail_sync;
   }
   if (0 != pthread_mutex_init(&g_qrc.bus_lock_mutex, NULL)) {
-    printf("\nERROR: bus_lock_mutex initalize failed!\n");
-    return false;
+    QRC_LOGE("bus_lock_mutex initalize failed!");
+    goto fail_sync;
+  }
+
+  /* one monotonic timer thread drives the protocol timeouts */
+  if (!qrc_timer_init()) {
+    QRC_LOGE("qrc timer initalize failed!");
+    goto fail_sync;
+  }
+  qrc_timer_setup(&g_qrc.bus_lock_timer, qrc_lock_timeout_expired, NULL);
+  qrc_timer_setup(&g_qrc.tf_timer, qrc_tf_tick, NULL);
+  memset(g_qrc.ack_deferred, 0, sizeof(g_qrc.ack_deferred));
+  qrc_timer_setup(&g_qrc.ack_timer, qrc_ack_retry_expired, NULL);
+
+  /* counters of the link and the pipes, before the first pipe is added */
+  if (!qrc_stats_init()) {
+    QRC_LOGE("qrc stats initalize failed!");
+    goto fail_timer;
+  }
+
+  /* bus leases of qrc_require_pipe() */
+  if (!qrc_lease_init()) {
+    QRC_LOGE("qrc bus lease initalize failed!");
+    goto fail_stats;
+  }
+
+  /* flow control, the peer counts our frames anew */
+  if (!qrc_credit_init()) {
+    QRC_LOGE("qrc credits initalize failed!");
+    goto fail_lease;
+  }
+
+  /* latency histograms of the last run are forgotten */
+  if (!qrc_latency_init()) {
+    QRC_LOGE("qrc latency initialize failed!");
+    goto fail_credit;
   }
 
   g_qrc.peer_pipe_list_ready = false;
-  g_qrc.msg_threadpool = qrc_thread_pool_init(QRC_THREAD_NUM);
-  g_qrc.control_threadpool = qrc_thread_pool_init(QRC_CONTROL_THREAD_NUM);
+  /* callbacks of a pipe run in order on its strand, pipes run in parallel */
+  g_qrc.msg_threadpool =
+      qrc_thread_pool_init(qrc_thread_num(), QRC_STRAND_MAX, QRC_THREAD_MESSAGE);
+  g_qrc.control_threadpool = qrc_thread_pool_init(
+      QRC_CONTROL_THREAD_NUM, QRC_CONTROL_WORK_SLOTS, QRC_THREAD_CONTROL);
+  if (NULL == g_qrc.control_threadpool || !qrc_strand_init(g_qrc.msg_threadpool)) {
+    QRC_LOGE("qrc strands initialize failed!");
+    goto fail_pools;
+  }
   g_qrc.tf = TF_Init(TF_MASTER);
   TF_AddGenericListener(g_qrc.tf, read_response_listener);
 
-  pthread_create(&g_qrc.read_thread, NULL, read_thread, NULL);
+  /* the parser collects payloads straight into pooled receive slabs */
+  if (!qrc_rxbuf_pool_init()) {
+    QRC_LOGE("qrc rx buffer pool initalize failed!");
+    goto fail_pools;
+  }
+  g_qrc.rx_buf = qrc_rxbuf_alloc();
+  if (NULL == g_qrc.rx_buf) {
+    QRC_LOGE("qrc rx buffer alloc failed!");
+    goto fail_rxbuf_pool;
+  }
+  TF_SwapRxBuffer(g_qrc.tf, qrc_rxbuf_data(g_qrc.rx_buf));
+
+  if (!qrc_control_pipe_init()) {
+    goto fail_rx_buf;
+  }
 
-  return qrc_pipe_list_init();
+  /* frames are composed by the senders and written by the write thread */
+  if (!qrc_txring_init()) {
+    QRC_LOGE("qrc tx ring initalize failed!");
+    goto fail_rx_buf;
+  }
+  if (0 != qrc_rt_thread_create(QRC_THREAD_WRITE, &g_qrc.write_thread, write_thread, NULL)) {
+    QRC_LOGE("qrc write thread create failed!");
+    goto fail_txring;
+  }
+
+  /* sequence numbers, acks and retransmission of reliable pipes */
+  if (!qrc_rel_init()) {
+    QRC_LOGE("qrc reliable delivery initalize failed!");
+    goto fail_write_thread;
+  }
+
+  /* requests of qrc_sync_write() waiting for responses */
+  if (!qrc_rpc_init()) {
+    QRC_LOGE("qrc rpc initalize failed!");
+    goto fail_rel;
+  }
+
+  /* last: the first frame of the peer may be answered or be reliable */
+  if (0 != pipe(g_qrc.wakeup_fd)) {
+    QRC_LOGE("read thread wakeup pipe create failed!");
+    goto fail_rpc;
+  }
+  g_qrc.read_thread_stop = false;
+  if (0 != qrc_rt_thread_create(QRC_THREAD_READ, &g_qrc.read_thread, read_thread, NULL)) {
+    QRC_LOGE("qrc read thread create failed!");
+    goto fail_wakeup;
+  }
+
+  if (qrc_pipe_list_init()) {
+    return true;
+  }
+
+  /* undo the steps above in reverse order, as qrc_destroy() does */
+  g_qrc.read_thread_stop = true;
+  if (write(g_qrc.wakeup_fd[1], &c, 1) != 1) {
+    QRC_LOGW("qrc read thread wake up failed");
+  }
+  pthread_join(g_qrc.read_thread, NULL);
+  g_qrc.tf_partial = false;
+  qrc_timer_cancel(&g_qrc.tf_timer);
+  qrc_timer_cancel(&g_qrc.ack_timer);
+fail_wakeup:
+  close(g_qrc.wakeup_fd[0]);
+  close(g_qrc.wakeup_fd[1]);
+  g_qrc.wakeup_fd[0] = -1;
+  g_qrc.wakeup_fd[1] = -1;
+fail_rpc:
+  qrc_rpc_destroy();
+fail_rel:
+  qrc_rel_stop();
+  qrc_rel_destroy();
+fail_write_thread:
+  qrc_txring_stop();
+  pthread_join(g_qrc.write_thread, NULL);
+fail_txring:
+  qrc_txring_destroy();
+fail_rx_buf:
+  TF_SwapRxBuffer(g_qrc.tf, NULL);
+  qrc_rxbuf_release(g_qrc.rx_buf);
+  g_qrc.rx_buf = NULL;
+fail_rxbuf_pool:
+  qrc_rxbuf_pool_destroy();
+fail_pools:
+  qrc_threadpool_destroy(g_qrc.msg_threadpool);
+  qrc_threadpool_destroy(g_qrc.control_threadpool);
+  g_qrc.msg_threadpool = NULL;
+  g_qrc.control_threadpool = NULL;
+  qrc_strand_destroy();
+fail_credit:
+  qrc_credit_destroy();
+fail_lease:
+  qrc_lease_destroy();
+fail_stats:
+  qrc_stats_destroy();
+fail_timer:
+  qrc_timer_destroy();
+fail_sync:
+  close(g_qrc.fd);
+fail_open:
+  qrc_rt_unlock_memory();
+  qrc_log_stop();
+  return false;
 }
 
 void qrc_pipe_threads_join(void)
@@ -816,16 +2133,54 @@ void qrc_pipe_threads_join(void)
 
 bool qrc_destroy(void)
 {
-  printf("INFO: qrc destroy\n");
+  QRC_LOGI("qrc destroy");
+
+  /* wake read thread up from poll() and let it exit, it queues works to the
+   * pools and runs inline callbacks until then */
+  uint8_t c = 0;
+  g_qrc.read_thread_stop = true;
+  if (write(g_qrc.wakeup_fd[1], &c, 1) != 1) {
+    QRC_LOGW("qrc read thread wake up failed");
+  }
+  pthread_join(g_qrc.read_thread, NULL);
+  g_qrc.tf_partial = false;
+  qrc_timer_cancel(&g_qrc.tf_timer);
+  qrc_timer_cancel(&g_qrc.ack_timer);
+  close(g_qrc.wakeup_fd[0]);
+  close(g_qrc.wakeup_fd[1]);
+  g_qrc.wakeup_fd[0] = -1;
+  g_qrc.wakeup_fd[1] = -1;
+
+  /* the retransmit thread fails async writes to the pool too */
+  qrc_rel_stop();
   qrc_threadpool_destroy(g_qrc.msg_threadpool);
   qrc_threadpool_destroy(g_qrc.control_threadpool);
-  pthread_cancel(g_qrc.read_thread);
-  pthread_join(g_qrc.read_thread, NULL);
+  qrc_strand_destroy();
+
+  /* fail the waiting senders and drop the frames held for reordering */
+  qrc_rel_destroy();
+  qrc_rpc_destroy();
+  qrc_lease_destroy();
+  qrc_credit_destroy();
+  qrc_stats_destroy();
+  qrc_timer_destroy();
+
+  /* send what is queued, then let write thread exit */
+  qrc_txring_stop();
+  pthread_join(g_qrc.write_thread, NULL);
+  qrc_txring_destroy();
+
+  TF_SwapRxBuffer(g_qrc.tf, NULL);
+  qrc_rxbuf_release(g_qrc.rx_buf);
+  g_qrc.rx_buf = NULL;
+  qrc_rxbuf_pool_destroy();
 
 #ifndef QRC_MCB
   /* reset MCB */
   qrc_mcb_reset();
 #endif
 
+  qrc_rt_unlock_memory();
+  qrc_log_stop();
   return close(g_qrc.fd) == 0;
 }
@@ -10,6 +10,7 @@
 #include <assert.h>
 #include <errno.h>
 #include <fcntl.h>
+#include <poll.h>
 #include <signal.h>
 #include <stddef.h>
 #include <stdlib.h>
@@ -17,15 +18,40 @@
 #include <sys/ioctl.h>
 #include <sys/time.h>
 #include <sys/types.h>
+#include <sys/uio.h>
+#include <time.h>
 #include <unistd.h>
 
 #include "TinyFrame.h"
+#include "qrc_log.h"
 #include "qrc_msg_management.h"
+#include "qrc_trace.h"
 
 /* qrc control pipe id */
 #define QRC_CONTROL_PIPE_ID 0
+
+/* pipes are allocated in chunks that never move, so a pipe pointer stays
+ * valid and the receive path looks pipes up without a lock */
+#ifdef QRC_MCB
+#define QRC_PIPE_CHUNK_BITS (4)
+#define QRC_PIPE_CHUNKS (4)
+#else
+#define QRC_PIPE_CHUNK_BITS (6)
+#define QRC_PIPE_CHUNKS (64)
+#endif
+#define QRC_PIPE_CHUNK (1 << QRC_PIPE_CHUNK_BITS)
+#define MAX_PIPE_ID (QRC_PIPE_CHUNKS * QRC_PIPE_CHUNK)
+
+#define QRC_PIPE_ID_NONE (0xFFFF) /* peer_pipe_id of a pipe the peer does not know */
+
+/* receiver_id of a frame to a pipe id that does not fit in qrc_frame, the id
+ * follows in the extended header */
+#define QRC_PIPE_ID_EXT (63)
 #define QRC_OK 0
 #define QRC_ERROR (-1)
+
+#define QRC_FNV_OFFSET (2166136261U)
+#define QRC_FNV_PRIME (16777619U)
 enum qrc_msg_cmd
 {
   QRC_REQUEST = 1,
@@ -37,6 +63,10 @@ enum qrc_msg_cmd
   QRC_ACK,
   QRC_CONNECT_REQUEST,
   QRC_CONNECT_RESPONSE,
+  QRC_REQUEST_BATCH,  /* QRC_REQUEST of several pipes in one frame */
+  QRC_RESPONSE_BATCH, /* QRC_RESPONSE to it */
+  QRC_CREDIT,         /* frames of a pipe the peer may send, see qrc_credit.c */
+  QRC_CREDIT_PROBE,   /* a stalled sender asks for QRC_CREDIT */
 };
 
 enum ack_request
@@ -45,6 +75,9 @@ enum ack_request
   ACK
 };
 
+/* QRC_REQUEST and QRC_RESPONSE carry pipes with names of up to 10 chars and
+ * ids up to 254, the others go in batches. The other cmds carry the high byte
+ * of pipe_id in the last byte of the unused name */
 typedef struct qrc_msg
 {
   uint8_t cmd;
@@ -52,6 +85,15 @@ typedef struct qrc_msg
   char pipe_name[10];
 } qrc_msg;
 
+#define QRC_MSG_NAME_LEN (10)
+#define QRC_MSG_ID_MAX (254) /* 255 was the id of no pipe */
+#define QRC_MSG_ID_HI (9) /* index in pipe_name */
+
+/* QRC_REQUEST_BATCH and QRC_RESPONSE_BATCH are cmd, count and count of
+ * entries: pipe id (2 bytes big endian), name length and name */
+#define QRC_BATCH_MAX (32)                              /* entries of one batch frame */
+#define QRC_BATCH_ENTRY_MAX (3 + QRC_PIPE_NAME_LEN - 1) /* bytes of one entry */
+
 typedef struct qrc_frame
 {
   uint8_t sync_mode : 1;
@@ -59,49 +101,330 @@ typedef struct qrc_frame
   uint8_t receiver_id : 6;
 } qrc_frame;
 
+/* TF types: a plain frame is qrc_frame + data, an extended frame is
+ * qrc_frame + qrc_ext header + data */
+#define DEFAULT_TF_MSG_TYPE 0x22
+#define QRC_EXT_TF_MSG_TYPE 0x23
+
+enum qrc_ext_flag
+{
+  QRC_EXT_SEQ = 0x01, /* reliable data frame, seq is its sequence number */
+  QRC_EXT_ACK = 0x02, /* acknowledges the peer's reliable frames */
+  QRC_EXT_RST = 0x04, /* receiver lost the sequence of the sender, which has to SYN */
+  QRC_EXT_SYN = 0x08, /* sender starts its sequence numbers at seq */
+  QRC_EXT_REQ = 0x10, /* qrc_sync_write() request, rpc is its id */
+  QRC_EXT_RSP = 0x20, /* qrc_response() to the request rpc */
+  QRC_EXT_PIPE = 0x40, /* receiver_id is QRC_PIPE_ID_EXT, pipe is the receiver */
+};
+
+/* extended header, see qrc_ext.c for the wire format */
+struct qrc_ext_s
+{
+  uint8_t flags;
+  uint16_t seq;  /* SEQ, SYN */
+  uint16_t ack;  /* ACK: next sequence number the receiver expects */
+  uint32_t sack; /* ACK: bit i set means ack + 1 + i was received */
+  uint16_t rpc;  /* REQ, RSP: request id, never 0 */
+  uint16_t pipe; /* PIPE: receiver pipe id */
+};
+
+#define QRC_EXT_MAX_LEN (1 + 2 + 2 + 4 + 2 + 2)
+
+/* largest user data of one frame */
+#define QRC_MAX_PAYLOAD (TF_MAX_PAYLOAD_RX - sizeof(qrc_frame) - QRC_EXT_MAX_LEN)
+
 typedef struct qrc_thread_pool_s * qrc_thread_pool;
 
+/* largest composed frame in the tx ring */
+#define QRC_TX_FRAME_MAX (TF_MAX_PAYLOAD_RX + TF_FRAME_OVERHEAD)
+
+/* composes one frame into a tx ring slot, returns its length or 0 */
+typedef uint32_t (*qrc_tx_compose)(uint8_t * frame, uint32_t size, void * arg);
+
+/* refcounted receive slab, see qrc_rxbuf.c */
+struct qrc_rxbuf_s;
+
 struct qrc_msg_cb_args_s
 {
   qrc_msg_cb fun_cb;
   struct qrc_pipe_s * pipe;
+  struct qrc_rxbuf_s * buf; /* slab holding data, released after fun_cb */
   uint8_t * data;
   size_t len;
   bool response;
-  uint8_t need_ack;
+  uint16_t rpc_id;    /* id of a qrc_sync_write() request, 0 otherwise */
+  uint64_t queued_us; /* time it was queued for a worker */
+
+  /* completion of a qrc_write_async() instead of a message */
+  qrc_write_done_cb done_cb;
+  void * done_arg;
+  uint32_t handle;
+  uint8_t status;
 };
 
-typedef void (*qrc_work)(struct qrc_msg_cb_args_s args);
-struct qrc_thread_pool_s * qrc_thread_pool_init(int num);
+typedef void (*qrc_work)(const struct qrc_msg_cb_args_s * args);
+struct qrc_thread_pool_s *
+qrc_thread_pool_init(int num, uint32_t slots, enum qrc_thread_role_e role);
 int qrc_threadpool_add_work(struct qrc_thread_pool_s * thpool,
     qrc_work work_fun,
-    struct qrc_msg_cb_args_s args);
+    const struct qrc_msg_cb_args_s * args);
 void qrc_threadpool_wait(struct qrc_thread_pool_s * thpool);
+int qrc_threadpool_queue_len(struct qrc_thread_pool_s * thpool);
+int qrc_threadpool_queue_high(struct qrc_thread_pool_s * thpool);
 void qrc_threadpool_destroy(struct qrc_thread_pool_s * thpool);
 void qrc_threads_join(struct qrc_thread_pool_s * thpool);
 void qrc_pipe_threads_join(void);
 
+/* per pipe serial executors on the message pool, see qrc_strand.c. Every
+ * pipe may have one and the pool holds one work per strand, it has
+ * QRC_STRAND_MAX slots. Strands are created on the first message */
+#define QRC_STRAND_MAX (MAX_PIPE_ID)
+bool qrc_strand_init(struct qrc_thread_pool_s * pool);
+void qrc_strand_destroy(void);
+int qrc_strand_add_work(qrc_work work_fun, const struct qrc_msg_cb_args_s * args);
+bool qrc_strand_reserve(const qrc_pipe_s * pipe);
+int qrc_strand_add_reserved(qrc_work work_fun, const struct qrc_msg_cb_args_s * args);
+bool qrc_strand_set_inline(const qrc_pipe_s * pipe, bool enable);
+bool qrc_strand_try_inline(qrc_work work_fun, const struct qrc_msg_cb_args_s * args);
+uint32_t qrc_strand_queue_len(void);
+uint32_t qrc_strand_queue_high(void);
+
+/* bounded MPMC ring of works, see qrc_workring.c */
+struct qrc_workring_s;
+struct qrc_workring_s * qrc_workring_create(uint32_t slots);
+void qrc_workring_destroy(struct qrc_workring_s * ring);
+bool qrc_workring_push(struct qrc_workring_s * ring,
+    qrc_work work_fun,
+    const struct qrc_msg_cb_args_s * args);
+bool qrc_workring_pop(struct qrc_workring_s * ring,
+    qrc_work * work_fun,
+    struct qrc_msg_cb_args_s * args);
+uint32_t qrc_workring_len(const struct qrc_workring_s * ring);
+uint32_t qrc_workring_high(const struct qrc_workring_s * ring);
+
+/* receive slabs, see qrc_rxbuf.c. Every slab kept by qrc_buffer_retain() must
+ * be released before qrc_destroy(), the pool keeps its memory otherwise */
+bool qrc_rxbuf_pool_init(void);
+void qrc_rxbuf_pool_destroy(void);
+struct qrc_rxbuf_s * qrc_rxbuf_alloc(void);
+uint8_t * qrc_rxbuf_data(struct qrc_rxbuf_s * buf);
+struct qrc_rxbuf_s * qrc_rxbuf_find(const void * data);
+void qrc_rxbuf_retain(struct qrc_rxbuf_s * buf);
+void qrc_rxbuf_release(struct qrc_rxbuf_s * buf);
+void qrc_rxbuf_stamp(struct qrc_rxbuf_s * buf, uint64_t us);
+uint64_t qrc_rxbuf_stamp_us(const struct qrc_rxbuf_s * buf);
+
+uint32_t qrc_ext_encode(uint8_t * buf, const struct qrc_ext_s * ext);
+int32_t qrc_ext_decode(struct qrc_ext_s * ext, const uint8_t * buf, uint32_t len);
+
+bool qrc_rel_init(void);
+void qrc_rel_stop(void);
+void qrc_rel_destroy(void);
+bool qrc_rel_set_window(const qrc_pipe_s * pipe, uint16_t window);
+enum qrc_write_status_e qrc_rel_send(const qrc_pipe_s * pipe,
+    const struct iovec * iov,
+    const int iovcnt);
+enum qrc_write_status_e qrc_rel_send_async(const qrc_pipe_s * pipe,
+    const struct iovec * iov,
+    const int iovcnt,
+    qrc_write_done_cb done_cb,
+    void * arg,
+    uint32_t * handle);
+int qrc_rel_event_fd(const qrc_pipe_s * pipe);
+bool qrc_rel_poll(const qrc_pipe_s * pipe, uint32_t * handle, enum qrc_write_status_e * status);
+enum qrc_write_status_e qrc_rel_flush(const qrc_pipe_s * pipe);
+bool qrc_rel_set_policy(const qrc_pipe_s * pipe, const struct qrc_retry_policy_s * policy);
+bool qrc_rel_get_rtt(const qrc_pipe_s * pipe, struct qrc_rtt_info_s * info);
+void qrc_rel_on_data(qrc_pipe_s * p,
+    uint16_t seq,
+    struct qrc_rxbuf_s * buf,
+    uint8_t * data,
+    size_t len);
+void qrc_rel_on_ack(qrc_pipe_s * p, uint16_t ack, uint32_t sack);
+void qrc_rel_on_syn(qrc_pipe_s * p, uint16_t seq);
+void qrc_rel_on_rst(qrc_pipe_s * p);
+void qrc_rel_on_peer_connect(const qrc_pipe_s * pipe);
+void qrc_rel_on_peer_restart(void);
+bool qrc_rel_ack_timer_fired(void);
+void qrc_rel_flush_acks(void);
+enum qrc_write_status_e qrc_rel_frame_sendv(const qrc_pipe_s * pipe,
+    qrc_frame * qrcf,
+    struct qrc_ext_s * ext,
+    const struct iovec * iov,
+    const int iovcnt,
+    bool wait);
+bool qrc_rel_set_ack_delay(const qrc_pipe_s * pipe, uint32_t delay_us);
+void qrc_rel_on_credit(const qrc_pipe_s * pipe);
+
+bool qrc_rpc_init(void);
+void qrc_rpc_destroy(void);
+enum qrc_write_status_e qrc_rpc_call(const qrc_pipe_s * pipe,
+    const void * data,
+    const size_t len,
+    void * rsp,
+    size_t * rsp_len,
+    uint32_t timeout_ms);
+enum qrc_write_status_e qrc_rpc_respond(const qrc_pipe_s * pipe,
+    const void * data,
+    const size_t len);
+void qrc_rpc_on_response(const qrc_pipe_s * p, uint16_t id, const uint8_t * data, size_t len);
+void qrc_rpc_enter(const qrc_pipe_s * p, uint16_t id);
+void qrc_rpc_leave(void);
+
+bool qrc_lease_init(void);
+void qrc_lease_destroy(void);
+bool qrc_lease_config(uint32_t lease_ms, uint32_t linger_ms);
+void qrc_lease_encode(qrc_msg * msg);
+bool qrc_lease_acquire(qrc_pipe_s * p);
+bool qrc_lease_release(qrc_pipe_s * p);
+void qrc_lease_on_lock(const qrc_msg * msg);
+void qrc_lease_on_unlock(void);
+void qrc_lease_get_stats(struct qrc_bus_stats_s * stats);
+
+bool qrc_credit_init(void);
+void qrc_credit_destroy(void);
+enum qrc_write_status_e qrc_credit_take(const qrc_pipe_s * p);
+void qrc_credit_untake(const qrc_pipe_s * p);
+void qrc_credit_on_rx(const qrc_pipe_s * p);
+void qrc_credit_on_copy(const qrc_pipe_s * p);
+void qrc_credit_done(qrc_pipe_s * p);
+bool qrc_credit_on_control(const uint8_t * data, size_t len);
+bool qrc_credit_set_capacity(qrc_pipe_s * pipe, uint16_t credits);
+void qrc_credit_get_info(const qrc_pipe_s * pipe, struct qrc_credit_info_s * info);
+
+/* counters are bumped without locks, readers see each one whole */
+#define QRC_STAT_ADD(counter, n) __atomic_add_fetch(&(counter), (n), __ATOMIC_RELAXED)
+
+bool qrc_stats_set_shm(const char * name);
+bool qrc_stats_init(void);
+void qrc_stats_destroy(void);
+struct qrc_link_stats_s * qrc_stats_link(void);
+struct qrc_pipe_stats_s * qrc_stats_pipe(uint16_t pipe_id);
+void qrc_stats_pipe_added(const qrc_pipe_s * p);
+void qrc_stats_dropped(const qrc_pipe_s * p);
+void qrc_stats_ack(uint16_t pipe_id, uint64_t rtt_us);
+void qrc_stats_get_link(struct qrc_link_stats_s * stats);
+void qrc_stats_get_pipe(const qrc_pipe_s * pipe, struct qrc_pipe_stats_s * stats);
+
+/* scheduling, CPUs and stacks of the library threads, see qrc_rt.c */
+bool qrc_rt_set_config(enum qrc_thread_role_e role, const struct qrc_thread_config_s * config);
+bool qrc_rt_load_file(const char * path);
+bool qrc_rt_set_mlock(bool enable);
+void qrc_rt_lock_memory(void);
+void qrc_rt_unlock_memory(void);
+int qrc_rt_thread_create(enum qrc_thread_role_e role,
+    pthread_t * thread,
+    void * (*fun)(void *),
+    void * arg);
+
+bool qrc_latency_init(void);
+void qrc_latency_record(uint16_t pipe_id, enum qrc_latency_stage_e stage, uint64_t us);
+void qrc_latency_callback(const qrc_pipe_s * p, uint64_t us);
+bool qrc_latency_set_budget(qrc_pipe_s * pipe, uint32_t budget_us);
+uint32_t qrc_latency_get_budget(const qrc_pipe_s * pipe);
+void qrc_latency_get(const qrc_pipe_s * pipe,
+    enum qrc_latency_stage_e stage,
+    struct qrc_latency_s * latency);
+void qrc_latency_reset(const qrc_pipe_s * pipe);
+
+bool qrc_pipe_map_set_file(const char * path);
+void qrc_pipe_map_load(void);
+void qrc_pipe_map_save(void);
+uint32_t qrc_pipe_map_hash(bool requester);
+void qrc_pipe_map_encode(qrc_msg * msg, uint32_t hash);
+uint32_t qrc_pipe_map_decode(const qrc_msg * msg);
+void qrc_pipe_map_validated(void);
+void qrc_pipe_map_accept(const qrc_msg * msg);
+uint32_t qrc_pipe_map_accepted(void);
+
+/* timer of qrc_timer.c, owned by the caller */
+typedef void (*qrc_timer_cb)(void * arg);
+struct qrc_timer_s
+{
+  struct qrc_timer_s * next;
+  struct qrc_timer_s ** pprev; /* link pointing at this timer, NULL if not armed */
+  uint64_t expires;            /* tick */
+  uint8_t level;
+  uint8_t slot;
+  qrc_timer_cb cb;
+  void * arg;
+};
+
+uint64_t qrc_timer_now_us(void);
+bool qrc_timer_init(void);
+void qrc_timer_destroy(void);
+void qrc_timer_setup(struct qrc_timer_s * t, qrc_timer_cb cb, void * arg);
+void qrc_timer_arm(struct qrc_timer_s * t, uint64_t timeout_us);
+bool qrc_timer_cancel(struct qrc_timer_s * t);
+
+bool qrc_txring_init(void);
+void qrc_txring_destroy(void);
+enum qrc_write_status_e qrc_txring_push(qrc_tx_compose compose, void * arg, bool wait);
+bool qrc_txring_wait(void);
+int qrc_txring_peek(struct iovec * iov, int max);
+void qrc_txring_consume(int frames);
+void qrc_txring_stop(void);
+uint32_t qrc_txring_depth(void);
+
 bool qrc_control_write(const struct qrc_pipe_s * pipe,
-    const uint8_t pipe_id,
+    const uint16_t pipe_id,
     const enum qrc_msg_cmd cmd);
+bool qrc_control_write_batch(qrc_pipe_s * const pipes[], int count, const enum qrc_msg_cmd cmd);
 bool qrc_init(void);
-uint8_t get_pipe_number(void);
+void qrc_read_mode_config(enum qrc_rx_mode_e mode, uint32_t spin_us);
+void qrc_read_thread_wakeup(void);
+bool qrc_in_read_thread(void);
+void qrc_link_gauges(struct qrc_link_stats_s * stats);
+uint16_t get_pipe_number(void);
+uint32_t qrc_fnv1a(uint32_t h, const void * data, size_t len);
 qrc_pipe_s qrc_pipe_node_init(void);
 bool qrc_pipe_list_init(void);
 qrc_pipe_s * qrc_pipe_insert(const char * pipe_name);
 qrc_pipe_s * qrc_pipe_find_by_name(const char * pipe_name);
-qrc_pipe_s * qrc_pipe_find_by_pipeid(const uint8_t pipe_id);
+qrc_pipe_s * qrc_pipe_find_by_pipeid(const uint16_t pipe_id);
 qrc_pipe_s * qrc_pipe_modify_by_name(const char * pipe_name, const qrc_pipe_s * new_data);
-bool qrc_frame_send(const qrc_frame * qrcf,
+void qrc_frame_address(qrc_frame * qrcf, struct qrc_ext_s * ext, uint16_t peer_pipe_id);
+enum qrc_write_status_e qrc_pipe_sendv(const qrc_pipe_s * pipe,
+    qrc_frame * qrcf,
+    struct qrc_ext_s * ext,
+    const struct iovec * iov,
+    const int iovcnt,
+    const bool qrc_write_lock,
+    const bool resend);
+enum qrc_write_status_e qrc_frame_send(const qrc_frame * qrcf,
     const uint8_t * data,
     const size_t len,
     const bool qrc_write_lock);
+enum qrc_write_status_e qrc_frame_try_send(const qrc_frame * qrcf,
+    const uint8_t * data,
+    const size_t len);
+enum qrc_write_status_e qrc_frame_sendv(const qrc_frame * qrcf,
+    const struct qrc_ext_s * ext,
+    const struct iovec * iov,
+    const int iovcnt,
+    const bool qrc_write_lock);
+void qrc_msg_dispatch(qrc_pipe_s * p,
+    struct qrc_rxbuf_s * buf,
+    uint8_t * data,
+    size_t len,
+    uint8_t need_ack,
+    uint16_t rpc_id);
+int qrc_control_add_work(qrc_work work_fun, const struct qrc_msg_cb_args_s * args);
+void qrc_write_done_dispatch(qrc_pipe_s * p,
+    qrc_write_done_cb done_cb,
+    void * arg,
+    uint32_t handle,
+    enum qrc_write_status_e status);
 
-bool is_pipe_timeout_busy(const uint8_t pipe_id);
-int start_pipe_timeout(const uint8_t pipe_id, bool * timeout);
+bool is_pipe_timeout_busy(const uint16_t pipe_id);
+int arm_pipe_timeout(const uint16_t pipe_id);
+void disarm_pipe_timeout(const uint16_t pipe_id);
+int start_pipe_timeout(const uint16_t pipe_id, bool * timeout);
 
 void qrc_bus_unlock(void);
 void qrc_bus_lock(void);
+void qrc_bus_gate_wait(void);
+bool qrc_bus_gate_closed(void);
 
 bool qrc_destroy(void);
 
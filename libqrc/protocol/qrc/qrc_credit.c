@@ -0,0 +1,448 @@
+/****************************************************************************
+ *
+ * Copyright (c) 2024 Qualcomm Innovation Center, Inc. All rights reserved.
+ * SPDX-License-Identifier: BSD-3-Clause-Clear
+ *
+ ****************************************************************************/
+#include <stdio.h>
+
+#include "qrc.h"
+
+/****************************************************************************
+ * Pre-processor Definitions
+ ****************************************************************************/
+
+/* frames of a pipe the receiver takes before their callbacks are done */
+#ifdef QRC_MCB
+#define QRC_CREDIT_DEFAULT (4)
+#else
+#define QRC_CREDIT_DEFAULT (128)
+#endif
+
+#define QRC_CREDIT_PROBE_US (20000) /* a stalled sender asks again after it */
+#define QRC_CREDIT_RETRY_US (1000)  /* a grant the tx ring refused goes out again after it */
+
+/* the sender may send up to limit (a count of its frames), limit is given
+ * by QRC_CREDIT in the unused name of qrc_msg. A QRC_CREDIT_PROBE carries
+ * the count of frames the sender has sent */
+#define QRC_CREDIT_RESYNC (4) /* index of the flag: answer to a probe */
+
+/****************************************************************************
+ * Private Types
+ ****************************************************************************/
+
+/* frames that take a receive slot are counted on both sides: the sender
+ * counts what it sends, the receiver what it gets and what it is done with.
+ * Lost frames make the counts differ, a probe brings them together again */
+struct qrc_credit_pipe_s
+{
+  /* sender */
+  uint32_t sent;     /* frames sent */
+  uint32_t limit;    /* sent may not pass it */
+  bool enabled;      /* the peer grants credits, no limit before */
+  bool probed;       /* the first probe is sent */
+  uint64_t probe_us; /* time of the last probe */
+  uint32_t stalls;
+  uint32_t probes;
+
+  /* receiver */
+  uint32_t received;     /* frames got, read thread only */
+  uint32_t done;         /* of them, handled or dropped */
+  uint32_t granted_done; /* done when the last grant was sent */
+  uint32_t grant_limit;  /* limit of the last grant */
+  bool peer_probed;      /* the peer knows credits, a peer that does not is not sent any */
+  bool grant_pending;    /* a grant found the tx ring full, the timer sends it */
+  bool resync_pending;   /* that grant answers a probe */
+  uint16_t capacity;
+  uint32_t grants;
+};
+
+struct qrc_credit_s
+{
+  struct qrc_credit_pipe_s * pipes[MAX_PIPE_ID]; /* created on first use */
+  pthread_mutex_t mutex;
+  struct qrc_timer_s retry; /* of the pending grants */
+};
+
+/****************************************************************************
+ * Private Data
+ ****************************************************************************/
+
+static struct qrc_credit_s g_credit = {.mutex = PTHREAD_MUTEX_INITIALIZER};
+
+/****************************************************************************
+ * Private Functions
+ ****************************************************************************/
+
+/****************************************************************************
+ * @intro: get the credits of a pipe, create them on first use
+ * @return: credits, NULL for the control pipe or if malloc failed
+ ****************************************************************************/
+static struct qrc_credit_pipe_s * qrc_credit_get(uint16_t pipe_id)
+{
+  struct qrc_credit_pipe_s * c;
+
+  if (QRC_CONTROL_PIPE_ID == pipe_id || pipe_id >= MAX_PIPE_ID) {
+    return NULL;
+  }
+  c = __atomic_load_n(&g_credit.pipes[pipe_id], __ATOMIC_ACQUIRE);
+  if (NULL != c) {
+    return c;
+  }
+
+  pthread_mutex_lock(&g_credit.mutex);
+  c = g_credit.pipes[pipe_id];
+  if (NULL == c) {
+    c = (struct qrc_credit_pipe_s *)calloc(1, sizeof(struct qrc_credit_pipe_s));
+    if (NULL == c) {
+      QRC_LOGE("pipe %u credits malloc failed!", (unsigned)pipe_id);
+    } else {
+      c->capacity = QRC_CREDIT_DEFAULT;
+      __atomic_store_n(&g_credit.pipes[pipe_id], c, __ATOMIC_RELEASE);
+    }
+  }
+  pthread_mutex_unlock(&g_credit.mutex);
+
+  return c;
+}
+
+static void qrc_credit_encode_value(qrc_msg * msg, uint32_t value)
+{
+  msg->pipe_name[0] = (char)(value >> 24);
+  msg->pipe_name[1] = (char)(value >> 16);
+  msg->pipe_name[2] = (char)(value >> 8);
+  msg->pipe_name[3] = (char)value;
+}
+
+static uint32_t qrc_credit_decode_value(const qrc_msg * msg)
+{
+  const uint8_t * n = (const uint8_t *)msg->pipe_name;
+
+  return ((uint32_t)n[0] << 24) | ((uint32_t)n[1] << 16) | ((uint32_t)n[2] << 8) | n[3];
+}
+
+/* tell the peer how far it may send, resync: answer to its probe. It runs
+ * on the read thread and the callback workers, so it never waits for the tx
+ * ring: a grant that finds it full is kept, the retry timer sends it with
+ * the credits of that time */
+static void qrc_credit_grant(const qrc_pipe_s * p, struct qrc_credit_pipe_s * c, bool resync)
+{
+  qrc_frame qrcf;
+  qrc_msg msg;
+  uint32_t limit;
+
+  if (QRC_PIPE_ID_NONE == p->peer_pipe_id) {
+    return;
+  }
+  __atomic_store_n(&c->grant_pending, false, __ATOMIC_RELAXED);
+  if (__atomic_exchange_n(&c->resync_pending, false, __ATOMIC_RELAXED)) {
+    resync = true;
+  }
+  limit = __atomic_load_n(&c->done, __ATOMIC_ACQUIRE) +
+          __atomic_load_n(&c->capacity, __ATOMIC_RELAXED);
+
+  memset(&qrcf, 0, sizeof(qrcf));
+  qrcf.ack = NO_ACK;
+  memset(&msg, 0, sizeof(msg));
+  msg.cmd = QRC_CREDIT;
+  msg.pipe_id = (uint8_t)p->peer_pipe_id;
+  msg.pipe_name[QRC_MSG_ID_HI] = (char)(p->peer_pipe_id >> 8);
+  qrc_credit_encode_value(&msg, limit);
+  msg.pipe_name[QRC_CREDIT_RESYNC] = resync ? 1 : 0;
+  if (SUCCESS != qrc_frame_try_send(&qrcf, (const uint8_t *)&msg, sizeof(msg))) {
+    if (resync) {
+      __atomic_store_n(&c->resync_pending, true, __ATOMIC_RELAXED);
+    }
+    __atomic_store_n(&c->grant_pending, true, __ATOMIC_RELEASE);
+    qrc_timer_arm(&g_credit.retry, QRC_CREDIT_RETRY_US);
+    return;
+  }
+  __atomic_store_n(&c->grant_limit, limit, __ATOMIC_RELAXED);
+  __atomic_add_fetch(&c->grants, 1, __ATOMIC_RELAXED);
+}
+
+/* timer callback, send the grants the tx ring refused */
+static void qrc_credit_retry_expired(void * arg)
+{
+  struct qrc_credit_pipe_s * c;
+  qrc_pipe_s * p;
+  (void)arg;
+
+  for (uint16_t i = 0; i < MAX_PIPE_ID; i++) {
+    c = __atomic_load_n(&g_credit.pipes[i], __ATOMIC_ACQUIRE);
+    if (NULL == c || !__atomic_load_n(&c->grant_pending, __ATOMIC_ACQUIRE)) {
+      continue;
+    }
+    p = qrc_pipe_find_by_pipeid(i);
+    if (NULL == p) {
+      __atomic_store_n(&c->grant_pending, false, __ATOMIC_RELAXED);
+    } else {
+      qrc_credit_grant(p, c, false); /* arms the timer again if the ring is still full */
+    }
+  }
+}
+
+/* ask the peer for credits and let it count the frames it lost. It runs on
+ * the send path, maybe under the tx lock of the pipe, so it never waits for
+ * the tx ring: a probe that finds it full goes out on a later send */
+static void qrc_credit_probe(const qrc_pipe_s * p, struct qrc_credit_pipe_s * c, uint64_t now)
+{
+  qrc_frame qrcf;
+  qrc_msg msg;
+
+  __atomic_store_n(&c->probe_us, now, __ATOMIC_RELAXED);
+
+  memset(&qrcf, 0, sizeof(qrcf));
+  qrcf.ack = NO_ACK;
+  memset(&msg, 0, sizeof(msg));
+  msg.cmd = QRC_CREDIT_PROBE;
+  msg.pipe_id = (uint8_t)p->peer_pipe_id;
+  msg.pipe_name[QRC_MSG_ID_HI] = (char)(p->peer_pipe_id >> 8);
+  qrc_credit_encode_value(&msg, __atomic_load_n(&c->sent, __ATOMIC_RELAXED));
+  if (SUCCESS == qrc_frame_try_send(&qrcf, (const uint8_t *)&msg, sizeof(msg))) {
+    c->probed = true;
+    __atomic_add_fetch(&c->probes, 1, __ATOMIC_RELAXED);
+  }
+}
+
+/****************************************************************************
+ * Public Functions
+ ****************************************************************************/
+
+/****************************************************************************
+ * @intro: forget the credits of the last run, the peer starts counting anew
+ ****************************************************************************/
+bool qrc_credit_init(void)
+{
+  pthread_mutex_lock(&g_credit.mutex);
+  for (int i = 0; i < MAX_PIPE_ID; i++) {
+    free(g_credit.pipes[i]);
+    g_credit.pipes[i] = NULL;
+  }
+  pthread_mutex_unlock(&g_credit.mutex);
+  qrc_timer_setup(&g_credit.retry, qrc_credit_retry_expired, NULL);
+
+  return true;
+}
+
+/****************************************************************************
+ * @intro: drop the pending grants, call before the timers stop
+ ****************************************************************************/
+void qrc_credit_destroy(void)
+{
+  qrc_timer_cancel(&g_credit.retry);
+}
+
+/****************************************************************************
+ * @intro: take a credit for a frame that takes a receive slot of the peer.
+ *The first frame of a pipe asks the peer for credits, frames go without
+ *limit until it grants some, so peers without credits are not held back
+ * @param p: sender
+ * @return: SUCCESS, BUSY if the peer has no room, then a credit probe goes
+ *out now and then
+ ****************************************************************************/
+enum qrc_write_status_e qrc_credit_take(const qrc_pipe_s * p)
+{
+  struct qrc_credit_pipe_s * c = qrc_credit_get(p->pipe_id);
+  uint32_t sent;
+  uint64_t now;
+
+  if (NULL == c) {
+    return SUCCESS;
+  }
+  if (!c->probed) {
+    qrc_credit_probe(p, c, qrc_timer_now_us());
+  }
+
+  sent = __atomic_load_n(&c->sent, __ATOMIC_RELAXED);
+  do {
+    if (__atomic_load_n(&c->enabled, __ATOMIC_ACQUIRE) &&
+        (int32_t)(__atomic_load_n(&c->limit, __ATOMIC_RELAXED) - sent) <= 0) {
+      __atomic_add_fetch(&c->stalls, 1, __ATOMIC_RELAXED);
+      now = qrc_timer_now_us();
+      if (now - __atomic_load_n(&c->probe_us, __ATOMIC_RELAXED) >= QRC_CREDIT_PROBE_US) {
+        qrc_credit_probe(p, c, now);
+      }
+      return BUSY;
+    }
+  } while (!__atomic_compare_exchange_n(
+      &c->sent, &sent, sent + 1, true, __ATOMIC_RELAXED, __ATOMIC_RELAXED));
+
+  return SUCCESS;
+}
+
+/****************************************************************************
+ * @intro: give back the credit of a frame that was not sent
+ ****************************************************************************/
+void qrc_credit_untake(const qrc_pipe_s * p)
+{
+  struct qrc_credit_pipe_s * c = qrc_credit_get(p->pipe_id);
+
+  if (NULL != c) {
+    __atomic_sub_fetch(&c->sent, 1, __ATOMIC_RELAXED);
+  }
+}
+
+/****************************************************************************
+ * @intro: read thread, a frame of the peer took a receive slot of the pipe.
+ *qrc_credit_done() must follow once it is handled or dropped
+ ****************************************************************************/
+void qrc_credit_on_rx(const qrc_pipe_s * p)
+{
+  struct qrc_credit_pipe_s * c = qrc_credit_get(p->pipe_id);
+
+  if (NULL != c) {
+    __atomic_add_fetch(&c->received, 1, __ATOMIC_RELAXED);
+  }
+}
+
+/****************************************************************************
+ * @intro: read thread, a received frame is a copy of one counted before, or
+ *one the peer resends. Resends take no credit, so neither may the copy
+ ****************************************************************************/
+void qrc_credit_on_copy(const qrc_pipe_s * p)
+{
+  struct qrc_credit_pipe_s * c = qrc_credit_get(p->pipe_id);
+
+  if (NULL != c) {
+    __atomic_sub_fetch(&c->received, 1, __ATOMIC_RELAXED);
+  }
+}
+
+/****************************************************************************
+ * @intro: a frame of the pipe is handled or dropped, its slot is free. The
+ *credits go back to the peer once half of them are free
+ ****************************************************************************/
+void qrc_credit_done(qrc_pipe_s * p)
+{
+  struct qrc_credit_pipe_s * c = qrc_credit_get(p->pipe_id);
+  uint32_t done;
+  uint32_t granted_done;
+  uint16_t half;
+
+  if (NULL == c) {
+    return;
+  }
+  done = __atomic_add_fetch(&c->done, 1, __ATOMIC_ACQ_REL);
+  if (!__atomic_load_n(&c->peer_probed, __ATOMIC_ACQUIRE)) {
+    return;
+  }
+  granted_done = __atomic_load_n(&c->granted_done, __ATOMIC_RELAXED);
+  half = __atomic_load_n(&c->capacity, __ATOMIC_RELAXED) / 2;
+  if (done - granted_done >= ((0 == half) ? 1U : half) &&
+      __atomic_compare_exchange_n(
+          &c->granted_done, &granted_done, done, false, __ATOMIC_RELAXED, __ATOMIC_RELAXED)) {
+    qrc_credit_grant(p, c, false);
+  }
+}
+
+/****************************************************************************
+ * @intro: read thread, handle a QRC_CREDIT or QRC_CREDIT_PROBE of the
+ *control pipe here, so the counts of the frames before it are exact
+ * @param data: message of the control pipe
+ * @param len: length of data
+ * @return: false if it is another message
+ ****************************************************************************/
+bool qrc_credit_on_control(const uint8_t * data, size_t len)
+{
+  struct qrc_credit_pipe_s * c;
+  qrc_pipe_s * p;
+  uint16_t pipe_id;
+  uint32_t value;
+  qrc_msg msg;
+
+  if (len < sizeof(qrc_msg) || (QRC_CREDIT != data[0] && QRC_CREDIT_PROBE != data[0])) {
+    return false;
+  }
+  memcpy(&msg, data, sizeof(msg));
+  pipe_id = (uint16_t)(msg.pipe_id | ((uint8_t)msg.pipe_name[QRC_MSG_ID_HI] << 8));
+  value = qrc_credit_decode_value(&msg);
+  p = qrc_pipe_find_by_pipeid(pipe_id);
+  c = (NULL == p) ? NULL : qrc_credit_get(pipe_id);
+  if (NULL == c) {
+    return true;
+  }
+
+  if (QRC_CREDIT == msg.cmd) {
+    uint32_t limit = __atomic_load_n(&c->limit, __ATOMIC_RELAXED);
+    /* grants of the workers may pass each other, only an answer to a probe
+     * takes credits back */
+    if (!c->enabled || 0 != msg.pipe_name[QRC_CREDIT_RESYNC] || (int32_t)(value - limit) > 0) {
+      __atomic_store_n(&c->limit, value, __ATOMIC_RELAXED);
+      __atomic_store_n(&c->enabled, true, __ATOMIC_RELEASE);
+    }
+    qrc_rel_on_credit(p); /* reliable frames the credits refused */
+  } else {
+    /* the frames the peer sent before the probe and we did not get are
+     * lost, they count as done */
+    uint32_t lost = value - __atomic_exchange_n(&c->received, value, __ATOMIC_RELAXED);
+    uint32_t done = __atomic_add_fetch(&c->done, lost, __ATOMIC_ACQ_REL);
+    __atomic_store_n(&c->granted_done, done, __ATOMIC_RELAXED);
+    __atomic_store_n(&c->peer_probed, true, __ATOMIC_RELEASE);
+    qrc_credit_grant(p, c, true);
+  }
+
+  return true;
+}
+
+/****************************************************************************
+ * @intro: set how many frames of the pipe the peer may send before their
+ *callbacks are done
+ * @param pipe: receiver
+ * @param credits: 1 ~ QRC_MAX_CREDITS
+ * @return: result of setting
+ ****************************************************************************/
+bool qrc_credit_set_capacity(qrc_pipe_s * pipe, uint16_t credits)
+{
+  struct qrc_credit_pipe_s * c;
+
+  if (0 == credits || credits > QRC_MAX_CREDITS) {
+    QRC_LOGE("credits %u are out of 1 ~ %d!", (unsigned)credits, QRC_MAX_CREDITS);
+    return false;
+  }
+  c = qrc_credit_get(pipe->pipe_id);
+  if (NULL == c) {
+    return false;
+  }
+  __atomic_store_n(&c->capacity, credits, __ATOMIC_RELAXED);
+  if (__atomic_load_n(&c->peer_probed, __ATOMIC_ACQUIRE)) {
+    uint32_t done = __atomic_load_n(&c->done, __ATOMIC_RELAXED);
+    __atomic_store_n(&c->granted_done, done, __ATOMIC_RELAXED);
+    qrc_credit_grant(pipe, c, true);
+  }
+
+  return true;
+}
+
+/****************************************************************************
+ * @intro: get the credits of a pipe in both directions and its stalls
+ * @param pipe: pipe
+ * @param info: filled with the credits
+ ****************************************************************************/
+void qrc_credit_get_info(const qrc_pipe_s * pipe, struct qrc_credit_info_s * info)
+{
+  struct qrc_credit_pipe_s * c = qrc_credit_get(pipe->pipe_id);
+  uint32_t sent;
+  uint32_t received;
+
+  memset(info, 0, sizeof(*info));
+  if (NULL == c) {
+    return;
+  }
+  info->enabled = __atomic_load_n(&c->enabled, __ATOMIC_ACQUIRE);
+  if (info->enabled) {
+    int32_t left;
+    sent = __atomic_load_n(&c->sent, __ATOMIC_RELAXED);
+    left = (int32_t)(__atomic_load_n(&c->limit, __ATOMIC_RELAXED) - sent);
+    info->credits = (left > 0) ? (uint32_t)left : 0;
+  }
+  received = __atomic_load_n(&c->received, __ATOMIC_RELAXED);
+  if (0 != __atomic_load_n(&c->grants, __ATOMIC_RELAXED)) {
+    int32_t left = (int32_t)(__atomic_load_n(&c->grant_limit, __ATOMIC_RELAXED) - received);
+    info->peer_credits = (left > 0) ? (uint32_t)left : 0;
+  }
+  info->capacity = __atomic_load_n(&c->capacity, __ATOMIC_RELAXED);
+  info->stalls = __atomic_load_n(&c->stalls, __ATOMIC_RELAXED);
+  info->probes = __atomic_load_n(&c->probes, __ATOMIC_RELAXED);
+  info->grants = __atomic_load_n(&c->grants, __ATOMIC_RELAXED);
+}
@@ -0,0 +1,112 @@
+/****************************************************************************
+ *
+ * Copyright (c) 2024 Qualcomm Innovation Center, Inc. All rights reserved.
+ * SPDX-License-Identifier: BSD-3-Clause-Clear
+ *
+ ****************************************************************************/
+#include <stdio.h>
+
+#include "qrc.h"
+
+/****************************************************************************
+ * Pre-processor Definitions
+ ****************************************************************************/
+
+#define QRC_EXT_SEQ_FLAGS (QRC_EXT_SEQ | QRC_EXT_SYN)
+#define QRC_EXT_RPC_FLAGS (QRC_EXT_REQ | QRC_EXT_RSP)
+#define QRC_EXT_ALL_FLAGS \
+  (QRC_EXT_SEQ_FLAGS | QRC_EXT_ACK | QRC_EXT_RST | QRC_EXT_RPC_FLAGS | QRC_EXT_PIPE)
+
+/****************************************************************************
+ * Public Functions
+ ****************************************************************************/
+
+/****************************************************************************
+ * @intro: write the extended header, fields are big endian and only present
+ *when their flag is set
+ * @param buf: at least QRC_EXT_MAX_LEN bytes
+ * @param ext: header
+ * @return: encoded length
+ ****************************************************************************/
+uint32_t qrc_ext_encode(uint8_t * buf, const struct qrc_ext_s * ext)
+{
+  uint32_t n = 0;
+
+  buf[n++] = ext->flags;
+  if (ext->flags & QRC_EXT_SEQ_FLAGS) {
+    buf[n++] = (uint8_t)(ext->seq >> 8);
+    buf[n++] = (uint8_t)ext->seq;
+  }
+  if (ext->flags & QRC_EXT_ACK) {
+    buf[n++] = (uint8_t)(ext->ack >> 8);
+    buf[n++] = (uint8_t)ext->ack;
+    buf[n++] = (uint8_t)(ext->sack >> 24);
+    buf[n++] = (uint8_t)(ext->sack >> 16);
+    buf[n++] = (uint8_t)(ext->sack >> 8);
+    buf[n++] = (uint8_t)ext->sack;
+  }
+  if (ext->flags & QRC_EXT_RPC_FLAGS) {
+    buf[n++] = (uint8_t)(ext->rpc >> 8);
+    buf[n++] = (uint8_t)ext->rpc;
+  }
+  if (ext->flags & QRC_EXT_PIPE) {
+    buf[n++] = (uint8_t)(ext->pipe >> 8);
+    buf[n++] = (uint8_t)ext->pipe;
+  }
+
+  return n;
+}
+
+/****************************************************************************
+ * @intro: read the extended header at the start of a frame payload
+ * @param ext: decoded header, fields whose flag is not set are 0
+ * @param buf: payload after the qrc_frame byte
+ * @param len: length of buf
+ * @return: header length, -1 if the header is truncated or has unknown flags
+ ****************************************************************************/
+int32_t qrc_ext_decode(struct qrc_ext_s * ext, const uint8_t * buf, uint32_t len)
+{
+  uint32_t n = 0;
+
+  memset(ext, 0, sizeof(*ext));
+  if (len < 1) {
+    return -1;
+  }
+  ext->flags = buf[n++];
+  if (ext->flags & ~QRC_EXT_ALL_FLAGS) {
+    return -1;
+  }
+
+  if (ext->flags & QRC_EXT_SEQ_FLAGS) {
+    if (len < n + 2) {
+      return -1;
+    }
+    ext->seq = (uint16_t)((buf[n] << 8) | buf[n + 1]);
+    n += 2;
+  }
+  if (ext->flags & QRC_EXT_ACK) {
+    if (len < n + 6) {
+      return -1;
+    }
+    ext->ack = (uint16_t)((buf[n] << 8) | buf[n + 1]);
+    ext->sack = ((uint32_t)buf[n + 2] << 24) | ((uint32_t)buf[n + 3] << 16) |
+                ((uint32_t)buf[n + 4] << 8) | (uint32_t)buf[n + 5];
+    n += 6;
+  }
+  if (ext->flags & QRC_EXT_RPC_FLAGS) {
+    if (len < n + 2) {
+      return -1;
+    }
+    ext->rpc = (uint16_t)((buf[n] << 8) | buf[n + 1]);
+    n += 2;
+  }
+  if (ext->flags & QRC_EXT_PIPE) {
+    if (len < n + 2) {
+      return -1;
+    }
+    ext->pipe = (uint16_t)((buf[n] << 8) | buf[n + 1]);
+    n += 2;
+  }
+
+  return (int32_t)n;
+}
@@ -0,0 +1,313 @@
+/****************************************************************************
+ *
+ * Copyright (c) 2024 Qualcomm Innovation Center, Inc. All rights reserved.
+ * SPDX-License-Identifier: BSD-3-Clause-Clear
+ *
+ ****************************************************************************/
+#include <stdio.h>
+
+#include "qrc.h"
+
+/****************************************************************************
+ * Pre-processor Definitions
+ ****************************************************************************/
+
+/* log-linear buckets: values below QRC_LAT_SUB are exact, above it every
+ * power of two is split into QRC_LAT_SUB buckets */
+#ifdef QRC_MCB
+#define QRC_LAT_SUB_BITS (2)
+#else
+#define QRC_LAT_SUB_BITS (3)
+#endif
+#define QRC_LAT_SUB (1U << QRC_LAT_SUB_BITS)
+#define QRC_LAT_BUCKETS ((32 - QRC_LAT_SUB_BITS + 1) * QRC_LAT_SUB)
+
+#define QRC_LAT_WARN_INTERVAL_US (1000000ULL) /* over budget warnings of a pipe */
+
+/****************************************************************************
+ * Private Types
+ ****************************************************************************/
+
+struct qrc_lat_hist_s
+{
+  uint64_t count;
+  uint64_t total_us;
+  uint32_t min_us; /* UINT32_MAX while empty */
+  uint32_t max_us;
+  uint32_t buckets[QRC_LAT_BUCKETS];
+};
+
+/* written by the read thread (parse, dispatch, ack) and the workers
+ * (queue, callback) with relaxed atomics, read by anyone */
+struct qrc_lat_pipe_s
+{
+  struct qrc_lat_hist_s stages[QRC_LAT_STAGES];
+  uint32_t budget_us; /* callbacks running longer are counted, 0: no budget */
+  uint64_t warn_us;   /* time of the last over budget warning */
+};
+
+struct qrc_lat_s
+{
+  struct qrc_lat_pipe_s * pipes[MAX_PIPE_ID]; /* created on first use */
+  pthread_mutex_t mutex;
+};
+
+/****************************************************************************
+ * Private Data
+ ****************************************************************************/
+
+static struct qrc_lat_s g_latency = {.mutex = PTHREAD_MUTEX_INITIALIZER};
+
+/****************************************************************************
+ * Private Functions
+ ****************************************************************************/
+
+static void qrc_lat_hist_clear(struct qrc_lat_hist_s * h)
+{
+  memset(h, 0, sizeof(*h));
+  h->min_us = UINT32_MAX;
+}
+
+/****************************************************************************
+ * @intro: get the histograms of a pipe, create them on first use
+ * @return: histograms, NULL if malloc failed
+ ****************************************************************************/
+static struct qrc_lat_pipe_s * qrc_lat_get(uint16_t pipe_id)
+{
+  struct qrc_lat_pipe_s * l;
+
+  if (pipe_id >= MAX_PIPE_ID) {
+    return NULL;
+  }
+  l = __atomic_load_n(&g_latency.pipes[pipe_id], __ATOMIC_ACQUIRE);
+  if (NULL != l) {
+    return l;
+  }
+
+  pthread_mutex_lock(&g_latency.mutex);
+  l = g_latency.pipes[pipe_id];
+  if (NULL == l) {
+    l = (struct qrc_lat_pipe_s *)malloc(sizeof(struct qrc_lat_pipe_s));
+    if (NULL == l) {
+      QRC_LOGE("pipe %u latency malloc failed!", (unsigned)pipe_id);
+    } else {
+      for (int i = 0; i < QRC_LAT_STAGES; i++) {
+        qrc_lat_hist_clear(&l->stages[i]);
+      }
+      /* control callbacks wait for the peer, they have no budget */
+      l->budget_us = (QRC_CONTROL_PIPE_ID == pipe_id) ? 0 : QRC_CALLBACK_BUDGET_DEFAULT_US;
+      l->warn_us = 0;
+      __atomic_store_n(&g_latency.pipes[pipe_id], l, __ATOMIC_RELEASE);
+    }
+  }
+  pthread_mutex_unlock(&g_latency.mutex);
+
+  return l;
+}
+
+static uint32_t qrc_lat_bucket(uint32_t us)
+{
+  uint32_t e;
+
+  if (us < QRC_LAT_SUB) {
+    return us;
+  }
+  e = 31 - (uint32_t)__builtin_clz(us);
+  return (e - QRC_LAT_SUB_BITS + 1) * QRC_LAT_SUB +
+         ((us >> (e - QRC_LAT_SUB_BITS)) & (QRC_LAT_SUB - 1));
+}
+
+/* highest value that falls into a bucket */
+static uint32_t qrc_lat_bucket_top(uint32_t index)
+{
+  uint32_t group = index / QRC_LAT_SUB;
+  uint32_t low;
+
+  if (0 == group) {
+    return index;
+  }
+  low = (QRC_LAT_SUB + index % QRC_LAT_SUB) << (group - 1);
+  return low + ((1U << (group - 1)) - 1);
+}
+
+static void qrc_lat_hist_add(struct qrc_lat_hist_s * h, uint32_t us)
+{
+  uint32_t cur;
+
+  __atomic_add_fetch(&h->buckets[qrc_lat_bucket(us)], 1, __ATOMIC_RELAXED);
+  __atomic_add_fetch(&h->total_us, us, __ATOMIC_RELAXED);
+  __atomic_add_fetch(&h->count, 1, __ATOMIC_RELAXED);
+
+  cur = __atomic_load_n(&h->min_us, __ATOMIC_RELAXED);
+  while (us < cur && !__atomic_compare_exchange_n(
+                         &h->min_us, &cur, us, true, __ATOMIC_RELAXED, __ATOMIC_RELAXED)) {
+  }
+  cur = __atomic_load_n(&h->max_us, __ATOMIC_RELAXED);
+  while (us > cur && !__atomic_compare_exchange_n(
+                         &h->max_us, &cur, us, true, __ATOMIC_RELAXED, __ATOMIC_RELAXED)) {
+  }
+}
+
+/****************************************************************************
+ * Public Functions
+ ****************************************************************************/
+
+/****************************************************************************
+ * @intro: forget the histograms and budgets of the last run
+ ****************************************************************************/
+bool qrc_latency_init(void)
+{
+  pthread_mutex_lock(&g_latency.mutex);
+  for (int i = 0; i < MAX_PIPE_ID; i++) {
+    free(g_latency.pipes[i]);
+    g_latency.pipes[i] = NULL;
+  }
+  pthread_mutex_unlock(&g_latency.mutex);
+
+  return true;
+}
+
+/****************************************************************************
+ * @intro: add a sample to a histogram of a pipe
+ * @param pipe_id: pipe
+ * @param stage: enum qrc_latency_stage_e
+ * @param us: time the message spent in the stage
+ ****************************************************************************/
+void qrc_latency_record(uint16_t pipe_id, enum qrc_latency_stage_e stage, uint64_t us)
+{
+  struct qrc_lat_pipe_s * l = qrc_lat_get(pipe_id);
+
+  if (NULL != l) {
+    qrc_lat_hist_add(&l->stages[stage], (us > UINT32_MAX) ? UINT32_MAX : (uint32_t)us);
+  }
+}
+
+/****************************************************************************
+ * @intro: a callback of the pipe returned after us. One that ran
+ *past the budget is counted, and warned about once a second per pipe
+ ****************************************************************************/
+void qrc_latency_callback(const qrc_pipe_s * p, uint64_t us)
+{
+  struct qrc_lat_pipe_s * l = qrc_lat_get(p->pipe_id);
+  uint32_t budget;
+  uint64_t now;
+  uint64_t warn;
+
+  if (NULL == l) {
+    return;
+  }
+  qrc_lat_hist_add(&l->stages[QRC_LAT_CALLBACK], (us > UINT32_MAX) ? UINT32_MAX : (uint32_t)us);
+
+  budget = __atomic_load_n(&l->budget_us, __ATOMIC_RELAXED);
+  if (0 == budget || us <= budget) {
+    return;
+  }
+  QRC_STAT_ADD(qrc_stats_pipe(p->pipe_id)->cb_overruns, 1);
+
+  now = qrc_timer_now_us();
+  warn = __atomic_load_n(&l->warn_us, __ATOMIC_RELAXED);
+  if ((0 == warn || now - warn >= QRC_LAT_WARN_INTERVAL_US) &&
+      __atomic_compare_exchange_n(
+          &l->warn_us, &warn, now, false, __ATOMIC_RELAXED, __ATOMIC_RELAXED)) {
+    QRC_LOGW("pipe(%s) callback took %llu us, its budget is %u us",
+        p->pipe_name,
+        (unsigned long long)us,
+        (unsigned)budget);
+  }
+}
+
+/****************************************************************************
+ * @intro: set the time a callback of the pipe may take
+ * @param budget_us: 0 for no budget
+ * @return: false if malloc failed
+ ****************************************************************************/
+bool qrc_latency_set_budget(qrc_pipe_s * pipe, uint32_t budget_us)
+{
+  struct qrc_lat_pipe_s * l = qrc_lat_get(pipe->pipe_id);
+
+  if (NULL == l) {
+    return false;
+  }
+  __atomic_store_n(&l->budget_us, budget_us, __ATOMIC_RELAXED);
+  return true;
+}
+
+/* time a callback of the pipe may take, 0 for no budget */
+uint32_t qrc_latency_get_budget(const qrc_pipe_s * pipe)
+{
+  struct qrc_lat_pipe_s * l = qrc_lat_get(pipe->pipe_id);
+
+  return (NULL == l) ? 0 : __atomic_load_n(&l->budget_us, __ATOMIC_RELAXED);
+}
+
+/****************************************************************************
+ * @intro: summarize a histogram of a pipe, all zero if it has no samples
+ ****************************************************************************/
+void qrc_latency_get(const qrc_pipe_s * pipe,
+    enum qrc_latency_stage_e stage,
+    struct qrc_latency_s * latency)
+{
+  static const uint32_t per_mille[] = {500, 900, 990, 999};
+  uint32_t * const out[] = {&latency->p50_us, &latency->p90_us, &latency->p99_us,
+      &latency->p999_us};
+  uint32_t buckets[QRC_LAT_BUCKETS];
+  struct qrc_lat_pipe_s * l;
+  struct qrc_lat_hist_s * h;
+  uint64_t total = 0;
+  uint64_t seen = 0;
+  uint32_t i = 0;
+
+  memset(latency, 0, sizeof(*latency));
+  l = (pipe->pipe_id < MAX_PIPE_ID)
+          ? __atomic_load_n(&g_latency.pipes[pipe->pipe_id], __ATOMIC_ACQUIRE)
+          : NULL;
+  if (NULL == l) {
+    return;
+  }
+  h = &l->stages[stage];
+  for (uint32_t b = 0; b < QRC_LAT_BUCKETS; b++) {
+    buckets[b] = __atomic_load_n(&h->buckets[b], __ATOMIC_RELAXED);
+    total += buckets[b];
+  }
+  if (0 == total) {
+    return;
+  }
+  latency->count = __atomic_load_n(&h->count, __ATOMIC_RELAXED);
+  latency->total_us = __atomic_load_n(&h->total_us, __ATOMIC_RELAXED);
+  latency->min_us = __atomic_load_n(&h->min_us, __ATOMIC_RELAXED);
+  latency->max_us = __atomic_load_n(&h->max_us, __ATOMIC_RELAXED);
+
+  /* the bucket holding the rank of each percentile, by its highest value */
+  for (uint32_t q = 0; q < sizeof(per_mille) / sizeof(per_mille[0]); q++) {
+    uint64_t rank = (total * per_mille[q] + 999) / 1000;
+    while (seen + buckets[i] < rank) {
+      seen += buckets[i++];
+    }
+    *out[q] = qrc_lat_bucket_top(i);
+    if (*out[q] > latency->max_us) {
+      *out[q] = latency->max_us;
+    }
+    if (*out[q] < latency->min_us) {
+      *out[q] = latency->min_us;
+    }
+  }
+}
+
+/****************************************************************************
+ * @intro: empty the histograms of a pipe, samples taken meanwhile may be
+ *partly lost
+ ****************************************************************************/
+void qrc_latency_reset(const qrc_pipe_s * pipe)
+{
+  struct qrc_lat_pipe_s * l = (pipe->pipe_id < MAX_PIPE_ID)
+                                  ? __atomic_load_n(&g_latency.pipes[pipe->pipe_id],
+                                        __ATOMIC_ACQUIRE)
+                                  : NULL;
+
+  if (NULL == l) {
+    return;
+  }
+  for (int i = 0; i < QRC_LAT_STAGES; i++) {
+    qrc_lat_hist_clear(&l->stages[i]);
+  }
+}
@@ -0,0 +1,393 @@
+/****************************************************************************
+ *
+ * Copyright (c) 2024 Qualcomm Innovation Center, Inc. All rights reserved.
+ * SPDX-License-Identifier: BSD-3-Clause-Clear
+ *
+ ****************************************************************************/
+#include <stdio.h>
+
+#include "qrc.h"
+
+/****************************************************************************
+ * Pre-processor Definitions
+ ****************************************************************************/
+
+#define QRC_LEASE_MS (1000)     /* default lease granted by one QRC_WRITE_LOCK */
+#define QRC_LEASE_LINGER_MS (5) /* default time a released lease is kept for reuse */
+#define QRC_LEASE_MAX_MS (60000)
+#define QRC_LEASE_GUARD_US (2000) /* a lease ending sooner is not reused */
+#define QRC_LEASE_RETRY_US (1000) /* linger end retried when the control pool is full */
+
+/* QRC_WRITE_LOCK carries the lease in the unused name of qrc_msg, old
+ * senders leave it uninitialized, so it is marked */
+#define QRC_LEASE_MAGIC0 'L'
+#define QRC_LEASE_MAGIC1 'S'
+
+/****************************************************************************
+ * Private Types
+ ****************************************************************************/
+
+/* the bus of this side is held by a local pipe (holder) and granted to the
+ * peer (grant) independently, like the old lock pair */
+struct qrc_lease_s
+{
+  pthread_mutex_t mutex;
+  pthread_cond_t cond; /* pipes wait for the holder to release */
+  uint32_t lease_ms;
+  uint32_t linger_ms;
+  volatile bool stop;
+
+  /* lease the peer granted us */
+  qrc_pipe_s * pipe;    /* pipe that asked for it, sends the unlock */
+  uint16_t owner;       /* pipe holding it, QRC_PIPE_ID_NONE if idle */
+  bool acquiring;       /* a QRC_WRITE_LOCK round trip is running */
+  bool unlocking;       /* its QRC_WRITE_UNLOCK is being sent */
+  uint64_t expires_us;  /* by our clock, from the send of the lock; 0 if none */
+  uint64_t held_us;     /* time it was acquired */
+  struct qrc_timer_s linger;
+
+  /* lease we granted the peer */
+  bool granted;
+  uint64_t grant_expires_us;
+  struct qrc_timer_s grant;
+
+  struct qrc_bus_stats_s stats;
+};
+
+/****************************************************************************
+ * Private Data
+ ****************************************************************************/
+
+static struct qrc_lease_s g_lease;
+
+/****************************************************************************
+ * Private Functions
+ ****************************************************************************/
+
+/****************************************************************************
+ * @intro: mutex held, end the lease the peer granted us, it opens its bus
+ *gate on our QRC_WRITE_UNLOCK. The caller sends it with
+ *qrc_lease_unlock_send() without the mutex, a control write may wait for
+ *the tx ring. Pipes asking for the bus wait until then, so their
+ *QRC_WRITE_LOCK never overtakes it
+ * @return: pipe to send it on, NULL if none
+ ****************************************************************************/
+static qrc_pipe_s * qrc_lease_drop(void)
+{
+  g_lease.expires_us = 0;
+  if (NULL != g_lease.pipe) {
+    g_lease.unlocking = true;
+  }
+  return g_lease.pipe;
+}
+
+/* mutex not held, send the QRC_WRITE_UNLOCK of qrc_lease_drop() */
+static void qrc_lease_unlock_send(qrc_pipe_s * p)
+{
+  if (NULL == p) {
+    return;
+  }
+  qrc_control_write(p, p->pipe_id, QRC_WRITE_UNLOCK);
+
+  pthread_mutex_lock(&g_lease.mutex);
+  g_lease.unlocking = false;
+  pthread_cond_broadcast(&g_lease.cond);
+  pthread_mutex_unlock(&g_lease.mutex);
+}
+
+/* control thread, send the unlock of a lease that lingered out */
+static void qrc_lease_unlock_work(const struct qrc_msg_cb_args_s * args)
+{
+  qrc_lease_unlock_send(args->pipe);
+}
+
+/****************************************************************************
+ * @intro: timer callback, a released lease was not taken again in time. The
+ *timer thread drives every protocol timeout, so the unlock is sent by the
+ *control pool
+ ****************************************************************************/
+static void qrc_lease_linger_expired(void * arg)
+{
+  struct qrc_msg_cb_args_s args;
+  (void)arg;
+
+  memset(&args, 0, sizeof(args));
+  pthread_mutex_lock(&g_lease.mutex);
+  if (QRC_PIPE_ID_NONE == g_lease.owner && !g_lease.acquiring && 0 != g_lease.expires_us) {
+    args.pipe = g_lease.pipe;
+    if (NULL == args.pipe || 0 == qrc_control_add_work(qrc_lease_unlock_work, &args)) {
+      qrc_lease_drop();
+    } else {
+      qrc_timer_arm(&g_lease.linger, QRC_LEASE_RETRY_US);
+    }
+  }
+  pthread_mutex_unlock(&g_lease.mutex);
+}
+
+/* timer callback, the peer did not renew or release its lease */
+static void qrc_lease_grant_expired(void * arg)
+{
+  (void)arg;
+
+  pthread_mutex_lock(&g_lease.mutex);
+  if (g_lease.granted && qrc_timer_now_us() >= g_lease.grant_expires_us) {
+    QRC_LOGW("bus lease of the peer expired, bus is unlocked");
+    g_lease.granted = false;
+    qrc_bus_unlock();
+  }
+  pthread_mutex_unlock(&g_lease.mutex);
+}
+
+static void qrc_lease_account(uint32_t * max, uint64_t * total, uint64_t us)
+{
+  uint32_t v = (us > UINT32_MAX) ? UINT32_MAX : (uint32_t)us;
+
+  *total += v;
+  if (v > *max) {
+    *max = v;
+  }
+}
+
+/****************************************************************************
+ * Public Functions
+ ****************************************************************************/
+
+bool qrc_lease_init(void)
+{
+  memset(&g_lease, 0, sizeof(g_lease));
+  if (0 != pthread_mutex_init(&g_lease.mutex, NULL) ||
+      0 != pthread_cond_init(&g_lease.cond, NULL)) {
+    QRC_LOGE("qrc lease mutex initalize failed!");
+    return false;
+  }
+  g_lease.lease_ms = QRC_LEASE_MS;
+  g_lease.linger_ms = QRC_LEASE_LINGER_MS;
+  g_lease.owner = QRC_PIPE_ID_NONE;
+  qrc_timer_setup(&g_lease.linger, qrc_lease_linger_expired, NULL);
+  qrc_timer_setup(&g_lease.grant, qrc_lease_grant_expired, NULL);
+
+  return true;
+}
+
+/****************************************************************************
+ * @intro: fail the pipes waiting for the bus, call before the timers stop
+ ****************************************************************************/
+void qrc_lease_destroy(void)
+{
+  pthread_mutex_lock(&g_lease.mutex);
+  g_lease.stop = true;
+  pthread_cond_broadcast(&g_lease.cond);
+  pthread_mutex_unlock(&g_lease.mutex);
+
+  qrc_timer_cancel(&g_lease.linger);
+  qrc_timer_cancel(&g_lease.grant);
+}
+
+/****************************************************************************
+ * @intro: set the lease of the next qrc_require_pipe() round trips
+ * @param lease_ms: longest time a pipe may hold the bus, the peer unlocks
+ *it after that
+ * @param linger_ms: time a released lease is kept, so the next
+ *qrc_require_pipe() needs no round trip. The peer's writes wait meanwhile,
+ *0 gives the bus back at once
+ * @return: result of setting
+ ****************************************************************************/
+bool qrc_lease_config(uint32_t lease_ms, uint32_t linger_ms)
+{
+  if (0 == lease_ms || lease_ms > QRC_LEASE_MAX_MS || linger_ms >= lease_ms) {
+    QRC_LOGE("bus lease %u ms, linger %u ms is invalid!", (unsigned)lease_ms, (unsigned)linger_ms);
+    return false;
+  }
+
+  pthread_mutex_lock(&g_lease.mutex);
+  g_lease.lease_ms = lease_ms;
+  g_lease.linger_ms = linger_ms;
+  pthread_mutex_unlock(&g_lease.mutex);
+
+  return true;
+}
+
+/****************************************************************************
+ * @intro: put the lease of this side into a QRC_WRITE_LOCK message
+ ****************************************************************************/
+void qrc_lease_encode(qrc_msg * msg)
+{
+  uint32_t ms = g_lease.lease_ms;
+
+  memset(msg->pipe_name, 0, sizeof(msg->pipe_name));
+  msg->pipe_name[0] = QRC_LEASE_MAGIC0;
+  msg->pipe_name[1] = QRC_LEASE_MAGIC1;
+  msg->pipe_name[2] = (char)(ms >> 24);
+  msg->pipe_name[3] = (char)(ms >> 16);
+  msg->pipe_name[4] = (char)(ms >> 8);
+  msg->pipe_name[5] = (char)ms;
+}
+
+/****************************************************************************
+ * @intro: take the bus for a pipe. Waits while another pipe of this side
+ *holds it, reuses a lease still held from the last release without a
+ *round trip, otherwise asks the peer with QRC_WRITE_LOCK
+ * @param p: pipe
+ * @return: result of taking
+ ****************************************************************************/
+bool qrc_lease_acquire(qrc_pipe_s * p)
+{
+  uint64_t start = qrc_timer_now_us();
+  uint64_t now;
+  uint64_t sent;
+  bool ok;
+
+  pthread_mutex_lock(&g_lease.mutex);
+  while (!g_lease.stop &&
+         (QRC_PIPE_ID_NONE != g_lease.owner || g_lease.acquiring || g_lease.unlocking)) {
+    pthread_cond_wait(&g_lease.cond, &g_lease.mutex);
+  }
+  if (g_lease.stop) {
+    pthread_mutex_unlock(&g_lease.mutex);
+    return false;
+  }
+
+  now = qrc_timer_now_us();
+  if (0 == g_lease.expires_us || g_lease.expires_us < now + QRC_LEASE_GUARD_US) {
+    g_lease.acquiring = true;
+    g_lease.expires_us = 0;
+    pthread_mutex_unlock(&g_lease.mutex);
+
+    sent = qrc_timer_now_us();
+    ok = qrc_control_write(p, p->pipe_id, QRC_WRITE_LOCK);
+
+    pthread_mutex_lock(&g_lease.mutex);
+    g_lease.acquiring = false;
+    if (!ok) {
+      pthread_cond_broadcast(&g_lease.cond);
+      pthread_mutex_unlock(&g_lease.mutex);
+      QRC_LOGE("%s require pipe failed!", p->pipe_name);
+      return false;
+    }
+    g_lease.expires_us = sent + g_lease.lease_ms * 1000ULL;
+    g_lease.pipe = p;
+    g_lease.stats.round_trips++;
+  }
+
+  g_lease.owner = p->pipe_id;
+  g_lease.held_us = qrc_timer_now_us();
+  g_lease.stats.acquires++;
+  qrc_lease_account(&g_lease.stats.wait_max_us,
+      &g_lease.stats.wait_total_us,
+      g_lease.held_us - start);
+  pthread_mutex_unlock(&g_lease.mutex);
+
+  /* other pipes of this side wait until the release */
+  qrc_bus_lock();
+
+  return true;
+}
+
+/****************************************************************************
+ * @intro: give the bus back. The lease is kept for linger_ms if it lasts
+ *long enough, otherwise the peer is told with QRC_WRITE_UNLOCK without
+ *waiting for its answer
+ * @param p: pipe holding the bus
+ * @return: false if p does not hold the bus or held it past the lease
+ ****************************************************************************/
+bool qrc_lease_release(qrc_pipe_s * p)
+{
+  qrc_pipe_s * unlock = NULL;
+  uint64_t now;
+  uint64_t left;
+  bool expired;
+
+  pthread_mutex_lock(&g_lease.mutex);
+  if (g_lease.owner != p->pipe_id) {
+    pthread_mutex_unlock(&g_lease.mutex);
+    QRC_LOGE("%s releases pipe failed! owner of lock is not you!", p->pipe_name);
+    return false;
+  }
+
+  now = qrc_timer_now_us();
+  g_lease.owner = QRC_PIPE_ID_NONE;
+  qrc_lease_account(
+      &g_lease.stats.hold_max_us, &g_lease.stats.hold_total_us, now - g_lease.held_us);
+  expired = (now >= g_lease.expires_us);
+  if (expired) {
+    g_lease.stats.expired++;
+    g_lease.expires_us = 0; /* the peer unlocked already */
+  } else {
+    left = g_lease.expires_us - now;
+    if (0 != g_lease.linger_ms && left > QRC_LEASE_GUARD_US) {
+      uint64_t linger = g_lease.linger_ms * 1000ULL;
+      left -= QRC_LEASE_GUARD_US;
+      qrc_timer_arm(&g_lease.linger, (linger < left) ? linger : left);
+    } else {
+      unlock = qrc_lease_drop();
+    }
+  }
+  pthread_cond_broadcast(&g_lease.cond);
+  pthread_mutex_unlock(&g_lease.mutex);
+
+  qrc_bus_unlock();
+  qrc_lease_unlock_send(unlock);
+
+  if (expired) {
+    QRC_LOGE("%s held the bus past its lease, the peer did not wait!", p->pipe_name);
+  }
+  return !expired;
+}
+
+/****************************************************************************
+ * @intro: control thread, the peer takes or renews its lease: lock the bus
+ *gate until QRC_WRITE_UNLOCK or the end of the lease. A lease of ours kept
+ *for reuse is given up, the peer wants the bus
+ * @param msg: QRC_WRITE_LOCK
+ ****************************************************************************/
+void qrc_lease_on_lock(const qrc_msg * msg)
+{
+  uint32_t ms = QRC_LEASE_MAX_MS; /* old peers hold the bus until they unlock */
+  qrc_pipe_s * unlock = NULL;
+
+  const uint8_t * n = (const uint8_t *)msg->pipe_name;
+
+  if (QRC_LEASE_MAGIC0 == msg->pipe_name[0] && QRC_LEASE_MAGIC1 == msg->pipe_name[1]) {
+    ms = ((uint32_t)n[2] << 24) | ((uint32_t)n[3] << 16) | ((uint32_t)n[4] << 8) | n[5];
+    if (0 == ms || ms > QRC_LEASE_MAX_MS) {
+      ms = QRC_LEASE_MAX_MS;
+    }
+  }
+
+  pthread_mutex_lock(&g_lease.mutex);
+  if (QRC_PIPE_ID_NONE == g_lease.owner && !g_lease.acquiring && 0 != g_lease.expires_us) {
+    unlock = qrc_lease_drop();
+  }
+  if (!g_lease.granted) {
+    g_lease.granted = true;
+    qrc_bus_lock();
+  }
+  g_lease.grant_expires_us = qrc_timer_now_us() + ms * 1000ULL;
+  qrc_timer_arm(&g_lease.grant, ms * 1000ULL);
+  pthread_mutex_unlock(&g_lease.mutex);
+
+  qrc_lease_unlock_send(unlock);
+}
+
+/****************************************************************************
+ * @intro: control thread, the peer gave its lease back
+ ****************************************************************************/
+void qrc_lease_on_unlock(void)
+{
+  pthread_mutex_lock(&g_lease.mutex);
+  if (g_lease.granted) {
+    g_lease.granted = false;
+    qrc_bus_unlock();
+  }
+  pthread_mutex_unlock(&g_lease.mutex);
+}
+
+/****************************************************************************
+ * @intro: get the counters of qrc_require_pipe()
+ ****************************************************************************/
+void qrc_lease_get_stats(struct qrc_bus_stats_s * stats)
+{
+  pthread_mutex_lock(&g_lease.mutex);
+  *stats = g_lease.stats;
+  pthread_mutex_unlock(&g_lease.mutex);
+}
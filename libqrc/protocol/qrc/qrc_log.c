@@ -0,0 +1,363 @@
+/****************************************************************************
+ *
+ * Copyright (c) 2024 Qualcomm Innovation Center, Inc. All rights reserved.
+ * SPDX-License-Identifier: BSD-3-Clause-Clear
+ *
+ ****************************************************************************/
+#include <pthread.h>
+#include <stdarg.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "qrc_log.h"
+
+/****************************************************************************
+ * Pre-processor Definitions
+ ****************************************************************************/
+
+#define QRC_LOG_MSG_LEN (192)
+#define QRC_LOG_BURST (10) /* messages per second of a call site */
+#define QRC_LOG_WINDOW_US (1000000ULL)
+#define QRC_LOG_RING_SIZE (64) /* messages of a thread waiting for the log thread, power of 2 */
+#define QRC_LOG_RING_MASK (QRC_LOG_RING_SIZE - 1)
+#define QRC_LOG_IDLE_MS (100) /* longest sleep of the log thread when a wake up is missed */
+
+/****************************************************************************
+ * Private Types
+ ****************************************************************************/
+
+struct qrc_log_rec_s
+{
+  enum qrc_log_level_e level;
+  char msg[QRC_LOG_MSG_LEN];
+};
+
+/* messages of one thread, it is the only writer of head and the log thread
+ * the only writer of tail. Rings are never freed, a thread that exits leaves
+ * its ring to the next new one */
+struct qrc_log_ring_s
+{
+  struct qrc_log_ring_s * next; /* all rings */
+  bool in_use;                  /* owned by a live thread */
+  uint32_t head;
+  uint32_t tail;
+  uint32_t dropped; /* messages the full ring refused */
+  struct qrc_log_rec_s recs[QRC_LOG_RING_SIZE];
+};
+
+struct qrc_log_s
+{
+  qrc_log_sink sink;
+  void * arg;
+  pthread_mutex_t sink_mutex; /* one message at a time to the sink */
+  enum qrc_log_level_e level;
+
+  struct qrc_log_ring_s * rings;
+  pthread_once_t key_once;
+  pthread_key_t key; /* ring of the thread, released when it exits */
+
+  pthread_t thread;
+  bool running; /* messages go through the rings */
+  bool stop;
+  bool pending; /* a ring has messages, the log thread was woken */
+  pthread_mutex_t mutex;
+  pthread_cond_t cond;
+};
+
+/****************************************************************************
+ * Private Function Prototypes
+ ****************************************************************************/
+
+static void qrc_log_stdout(enum qrc_log_level_e level, const char * msg, void * arg);
+
+/****************************************************************************
+ * Private Data
+ ****************************************************************************/
+
+static struct qrc_log_s g_log = {
+    .sink = qrc_log_stdout,
+    .sink_mutex = PTHREAD_MUTEX_INITIALIZER,
+    .level = QRC_LOG_INFO,
+    .key_once = PTHREAD_ONCE_INIT,
+    .mutex = PTHREAD_MUTEX_INITIALIZER,
+    .cond = PTHREAD_COND_INITIALIZER,
+};
+
+#ifndef QRC_MCB
+static __thread struct qrc_log_ring_s * t_ring;
+#endif
+
+/****************************************************************************
+ * Private Functions
+ ****************************************************************************/
+
+/* default sink, the messages look like the printf() of old */
+static void qrc_log_stdout(enum qrc_log_level_e level, const char * msg, void * arg)
+{
+  static const char * const prefix[] = {"DEBUG: ", "INFO: ", "WARNING: ", "ERROR: "};
+
+  (void)arg;
+  printf("%s%s\n", (level <= QRC_LOG_ERROR) ? prefix[level] : "", msg);
+}
+
+static void qrc_log_emit(enum qrc_log_level_e level, const char * msg)
+{
+  pthread_mutex_lock(&g_log.sink_mutex);
+  g_log.sink(level, msg, g_log.arg);
+  pthread_mutex_unlock(&g_log.sink_mutex);
+}
+
+static uint64_t qrc_log_now_us(void)
+{
+  struct timespec ts;
+
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (uint64_t)ts.tv_sec * 1000000ULL + (uint64_t)ts.tv_nsec / 1000ULL;
+}
+
+/****************************************************************************
+ * @intro: take a message of a call site against its budget of the second
+ * @param suppressed: messages of the site dropped since the last one passed
+ * @return: true if it may be logged
+ ****************************************************************************/
+static bool qrc_log_pass(struct qrc_log_site_s * site, uint32_t * suppressed)
+{
+  uint64_t now = qrc_log_now_us();
+  uint64_t start = __atomic_load_n(&site->window_us, __ATOMIC_RELAXED);
+
+  if (now - start >= QRC_LOG_WINDOW_US &&
+      __atomic_compare_exchange_n(
+          &site->window_us, &start, now, false, __ATOMIC_RELAXED, __ATOMIC_RELAXED)) {
+    __atomic_store_n(&site->count, 0, __ATOMIC_RELAXED);
+  }
+  if (__atomic_add_fetch(&site->count, 1, __ATOMIC_RELAXED) > QRC_LOG_BURST) {
+    __atomic_add_fetch(&site->suppressed, 1, __ATOMIC_RELAXED);
+    return false;
+  }
+  *suppressed = __atomic_exchange_n(&site->suppressed, 0, __ATOMIC_RELAXED);
+  return true;
+}
+
+static void qrc_log_format(char * msg, uint32_t suppressed, const char * format, va_list ap)
+{
+  int len = vsnprintf(msg, QRC_LOG_MSG_LEN, format, ap);
+
+  if (0 != suppressed && len >= 0 && len < QRC_LOG_MSG_LEN) {
+    snprintf(msg + len, QRC_LOG_MSG_LEN - len, " (%u like it suppressed)", (unsigned)suppressed);
+  }
+}
+
+#ifndef QRC_MCB
+/* key destructor, the thread exits */
+static void qrc_log_ring_release(void * ring)
+{
+  __atomic_store_n(&((struct qrc_log_ring_s *)ring)->in_use, false, __ATOMIC_RELEASE);
+}
+
+static void qrc_log_key_create(void)
+{
+  if (0 != pthread_key_create(&g_log.key, qrc_log_ring_release)) {
+    qrc_log_emit(QRC_LOG_ERROR, "qrc log thread key create failed");
+  }
+}
+
+/****************************************************************************
+ * @intro: ring of the calling thread, one left by an exited thread or a
+ *new one
+ * @return: ring, NULL if malloc failed
+ ****************************************************************************/
+static struct qrc_log_ring_s * qrc_log_ring(void)
+{
+  struct qrc_log_ring_s * ring;
+
+  if (NULL != t_ring) {
+    return t_ring;
+  }
+  pthread_once(&g_log.key_once, qrc_log_key_create);
+
+  for (ring = __atomic_load_n(&g_log.rings, __ATOMIC_ACQUIRE); NULL != ring; ring = ring->next) {
+    bool in_use = false;
+    if (__atomic_compare_exchange_n(
+            &ring->in_use, &in_use, true, false, __ATOMIC_ACQUIRE, __ATOMIC_RELAXED)) {
+      break;
+    }
+  }
+  if (NULL == ring) {
+    ring = (struct qrc_log_ring_s *)calloc(1, sizeof(struct qrc_log_ring_s));
+    if (NULL == ring) {
+      return NULL;
+    }
+    ring->in_use = true;
+    ring->next = __atomic_load_n(&g_log.rings, __ATOMIC_RELAXED);
+    while (!__atomic_compare_exchange_n(
+        &g_log.rings, &ring->next, ring, true, __ATOMIC_RELEASE, __ATOMIC_RELAXED)) {
+    }
+  }
+
+  pthread_setspecific(g_log.key, ring);
+  t_ring = ring;
+  return ring;
+}
+
+/****************************************************************************
+ * @intro: log thread, hand the messages of all rings to the sink
+ ****************************************************************************/
+static void qrc_log_drain(void)
+{
+  struct qrc_log_ring_s * ring = __atomic_load_n(&g_log.rings, __ATOMIC_ACQUIRE);
+  char msg[QRC_LOG_MSG_LEN];
+
+  for (; NULL != ring; ring = ring->next) {
+    uint32_t tail = ring->tail;
+    uint32_t dropped;
+
+    while (tail != __atomic_load_n(&ring->head, __ATOMIC_ACQUIRE)) {
+      struct qrc_log_rec_s * rec = &ring->recs[tail & QRC_LOG_RING_MASK];
+      qrc_log_emit(rec->level, rec->msg);
+      __atomic_store_n(&ring->tail, ++tail, __ATOMIC_RELEASE);
+    }
+    dropped = __atomic_exchange_n(&ring->dropped, 0, __ATOMIC_RELAXED);
+    if (0 != dropped) {
+      snprintf(msg, sizeof(msg), "qrc log dropped %u messages of a thread", (unsigned)dropped);
+      qrc_log_emit(QRC_LOG_WARNING, msg);
+    }
+  }
+}
+
+/* thread of the sink, woken by the first message after it slept */
+static void * qrc_log_thread(void * args)
+{
+  struct timespec ts;
+
+  (void)args;
+
+  while (!__atomic_load_n(&g_log.stop, __ATOMIC_ACQUIRE)) {
+    __atomic_store_n(&g_log.pending, false, __ATOMIC_RELAXED);
+    qrc_log_drain();
+
+    pthread_mutex_lock(&g_log.mutex);
+    if (!__atomic_load_n(&g_log.pending, __ATOMIC_ACQUIRE) && !g_log.stop) {
+      /* writers signal without the mutex, a missed wake up costs QRC_LOG_IDLE_MS */
+      clock_gettime(CLOCK_REALTIME, &ts);
+      ts.tv_nsec += QRC_LOG_IDLE_MS * 1000000L;
+      ts.tv_sec += ts.tv_nsec / 1000000000L;
+      ts.tv_nsec %= 1000000000L;
+      pthread_cond_timedwait(&g_log.cond, &g_log.mutex, &ts);
+    }
+    pthread_mutex_unlock(&g_log.mutex);
+  }
+  qrc_log_drain();
+
+  return NULL;
+}
+#endif
+
+/****************************************************************************
+ * Public Functions
+ ****************************************************************************/
+
+/****************************************************************************
+ * @intro: log a message, use QRC_LOGE() and the like. Once the log thread
+ *runs the message only goes into the ring of this thread, before it (and on
+ *MCB) it goes to the sink right away
+ * @param site: call site, for its budget
+ * @param level: enum qrc_log_level_e
+ * @param format: printf format, no trailing newline
+ ****************************************************************************/
+void qrc_log_write(struct qrc_log_site_s * site,
+    enum qrc_log_level_e level,
+    const char * format,
+    ...)
+{
+  char msg[QRC_LOG_MSG_LEN];
+  uint32_t suppressed;
+  va_list ap;
+
+  if (level < __atomic_load_n(&g_log.level, __ATOMIC_RELAXED) || !qrc_log_pass(site, &suppressed)) {
+    return;
+  }
+
+  va_start(ap, format);
+#ifndef QRC_MCB
+  struct qrc_log_ring_s * ring =
+      __atomic_load_n(&g_log.running, __ATOMIC_ACQUIRE) ? qrc_log_ring() : NULL;
+  if (NULL != ring) {
+    uint32_t head = ring->head;
+    if (head - __atomic_load_n(&ring->tail, __ATOMIC_ACQUIRE) >= QRC_LOG_RING_SIZE) {
+      __atomic_add_fetch(&ring->dropped, 1, __ATOMIC_RELAXED);
+    } else {
+      struct qrc_log_rec_s * rec = &ring->recs[head & QRC_LOG_RING_MASK];
+      rec->level = level;
+      qrc_log_format(rec->msg, suppressed, format, ap);
+      __atomic_store_n(&ring->head, head + 1, __ATOMIC_RELEASE);
+      if (!__atomic_exchange_n(&g_log.pending, true, __ATOMIC_ACQ_REL)) {
+        pthread_cond_signal(&g_log.cond);
+      }
+    }
+    va_end(ap);
+    return;
+  }
+#endif
+  qrc_log_format(msg, suppressed, format, ap);
+  va_end(ap);
+  qrc_log_emit(level, msg);
+}
+
+/****************************************************************************
+ * @intro: start the log thread, messages are queued from now on
+ * @return: false if the thread could not be created, messages still go to
+ *the sink then, from the logging threads
+ ****************************************************************************/
+bool qrc_log_start(void)
+{
+#ifndef QRC_MCB
+  if (__atomic_load_n(&g_log.running, __ATOMIC_ACQUIRE)) {
+    return true;
+  }
+  g_log.stop = false;
+  if (0 != pthread_create(&g_log.thread, NULL, qrc_log_thread, NULL)) {
+    qrc_log_emit(QRC_LOG_ERROR, "qrc log thread create failed");
+    return false;
+  }
+  __atomic_store_n(&g_log.running, true, __ATOMIC_RELEASE);
+#endif
+  return true;
+}
+
+/****************************************************************************
+ * @intro: hand the queued messages to the sink and stop the log thread
+ ****************************************************************************/
+void qrc_log_stop(void)
+{
+#ifndef QRC_MCB
+  if (!__atomic_load_n(&g_log.running, __ATOMIC_ACQUIRE)) {
+    return;
+  }
+  __atomic_store_n(&g_log.running, false, __ATOMIC_RELEASE);
+
+  pthread_mutex_lock(&g_log.mutex);
+  __atomic_store_n(&g_log.stop, true, __ATOMIC_RELEASE);
+  pthread_cond_signal(&g_log.cond);
+  pthread_mutex_unlock(&g_log.mutex);
+  pthread_join(g_log.thread, NULL);
+
+  /* messages of threads that saw the log thread running a moment ago */
+  qrc_log_drain();
+#endif
+}
+
+/* NULL sink: stdout */
+void qrc_log_set_sink(qrc_log_sink sink, void * arg)
+{
+  pthread_mutex_lock(&g_log.sink_mutex);
+  g_log.sink = (NULL == sink) ? qrc_log_stdout : sink;
+  g_log.arg = arg;
+  pthread_mutex_unlock(&g_log.sink_mutex);
+}
+
+void qrc_log_set_level(enum qrc_log_level_e level)
+{
+  __atomic_store_n(&g_log.level, level, __ATOMIC_RELAXED);
+}
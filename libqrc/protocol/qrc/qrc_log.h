@@ -0,0 +1,48 @@
+/****************************************************************************
+ *
+ * Copyright (c) 2024 Qualcomm Innovation Center, Inc. All rights reserved.
+ * SPDX-License-Identifier: BSD-3-Clause-Clear
+ *
+ ****************************************************************************/
+#ifndef __QRC_LOG_H
+#define __QRC_LOG_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "qrc_msg_management.h"
+
+/* messages of the library. The calling thread only formats the message into
+ * its own ring, the log thread hands it to the sink, so a thread holding a
+ * lock never blocks on stdout. Each call site passes QRC_LOG_BURST messages
+ * per second, the ones over it are counted and reported with the next one */
+
+/* state of one call site, zero initialized */
+struct qrc_log_site_s
+{
+  uint64_t window_us; /* start of the current second */
+  uint32_t count;     /* messages in it */
+  uint32_t suppressed;
+};
+
+#define QRC_LOG(level, format, ...)                                                                \
+  do {                                                                                             \
+    static struct qrc_log_site_s qrc_log_site_;                                                    \
+    qrc_log_write(&qrc_log_site_, (level), format, ##__VA_ARGS__);                                 \
+  } while (0)
+
+#define QRC_LOGD(format, ...) QRC_LOG(QRC_LOG_DEBUG, format, ##__VA_ARGS__)
+#define QRC_LOGI(format, ...) QRC_LOG(QRC_LOG_INFO, format, ##__VA_ARGS__)
+#define QRC_LOGW(format, ...) QRC_LOG(QRC_LOG_WARNING, format, ##__VA_ARGS__)
+#define QRC_LOGE(format, ...) QRC_LOG(QRC_LOG_ERROR, format, ##__VA_ARGS__)
+
+void qrc_log_write(struct qrc_log_site_s * site,
+    enum qrc_log_level_e level,
+    const char * format,
+    ...) __attribute__((format(printf, 3, 4)));
+bool qrc_log_start(void);
+void qrc_log_stop(void);
+void qrc_log_set_sink(qrc_log_sink sink, void * arg);
+void qrc_log_set_level(enum qrc_log_level_e level);
+
+#endif
@@ -0,0 +1,252 @@
+/****************************************************************************
+ *
+ * Copyright (c) 2024 Qualcomm Innovation Center, Inc. All rights reserved.
+ * SPDX-License-Identifier: BSD-3-Clause-Clear
+ *
+ ****************************************************************************/
+#include <stdio.h>
+
+#include "qrc.h"
+
+/****************************************************************************
+ * Pre-processor Definitions
+ ****************************************************************************/
+
+#define QRC_MAP_HEADER "qrc-pipe-map 1"
+#define QRC_MAP_PATH_MAX (256)
+
+/* QRC_CONNECT_REQUEST/RESPONSE carry the map hash in the unused name of
+ * qrc_msg */
+#define QRC_MAP_MAGIC 'M'
+
+/****************************************************************************
+ * Private Types
+ ****************************************************************************/
+
+/* pipe ids of the last run, reused when the peer still has the same map */
+struct qrc_pipe_map_s
+{
+  char path[QRC_MAP_PATH_MAX]; /* empty: no map */
+  bool mapped[MAX_PIPE_ID];    /* pipe was loaded from the map, not validated yet */
+  uint32_t accepted;           /* hash of the peer's map we accepted, for the response */
+};
+
+/****************************************************************************
+ * Private Data
+ ****************************************************************************/
+
+static struct qrc_pipe_map_s g_map;
+
+/****************************************************************************
+ * Private Functions
+ ****************************************************************************/
+
+/* pipe whose peer knows it */
+static bool qrc_pipe_map_known(const qrc_pipe_s * p)
+{
+  return p->pipe_ready || g_map.mapped[p->pipe_id];
+}
+
+static uint32_t qrc_pipe_map_entry(uint16_t requester_id,
+    uint16_t responder_id,
+    const qrc_pipe_s * p)
+{
+  uint8_t ids[4] = {(uint8_t)(requester_id >> 8),
+      (uint8_t)requester_id,
+      (uint8_t)(responder_id >> 8),
+      (uint8_t)responder_id};
+
+  return qrc_fnv1a(qrc_fnv1a(QRC_FNV_OFFSET, ids, sizeof(ids)), p->pipe_name, strlen(p->pipe_name));
+}
+
+/****************************************************************************
+ * Public Functions
+ ****************************************************************************/
+
+/****************************************************************************
+ * @intro: keep the pipe map in a file, set before init
+ * @param path: file, NULL to keep no map
+ * @return: result of setting
+ ****************************************************************************/
+bool qrc_pipe_map_set_file(const char * path)
+{
+  memset(&g_map, 0, sizeof(g_map));
+  if (NULL == path) {
+    return true;
+  }
+  if (strlen(path) >= QRC_MAP_PATH_MAX) {
+    QRC_LOGE("pipe map path %s is too long!", path);
+    return false;
+  }
+  strcpy(g_map.path, path);
+
+  return true;
+}
+
+/****************************************************************************
+ * @intro: create the pipes of the map file with their ids of the last run,
+ *before the connect handshake. A map that does not fit is ignored
+ ****************************************************************************/
+void qrc_pipe_map_load(void)
+{
+  char line[64];
+  char name[QRC_PIPE_NAME_LEN];
+  unsigned id;
+  unsigned peer_id;
+  FILE * f;
+
+  if ('\0' == g_map.path[0]) {
+    return;
+  }
+  f = fopen(g_map.path, "r");
+  if (NULL == f) {
+    return;
+  }
+  if (NULL == fgets(line, sizeof(line), f) ||
+      0 != strncmp(line, QRC_MAP_HEADER, strlen(QRC_MAP_HEADER))) {
+    QRC_LOGW("pipe map %s is not valid, ignored", g_map.path);
+    fclose(f);
+    return;
+  }
+
+  while (NULL != fgets(line, sizeof(line), f)) {
+    qrc_pipe_s * p;
+    if (3 != sscanf(line, "%u %u %31s", &id, &peer_id, name)) {
+      continue;
+    }
+    /* ids are given in order, so they come out the same */
+    p = qrc_pipe_insert(name);
+    if (NULL == p || p->pipe_id != id) {
+      QRC_LOGW("pipe map %s does not fit at %s, ignored from there", g_map.path, name);
+      break;
+    }
+    if (peer_id < QRC_PIPE_ID_NONE) {
+      p->peer_pipe_id = (uint16_t)peer_id;
+      g_map.mapped[p->pipe_id] = true;
+    }
+  }
+  fclose(f);
+}
+
+/****************************************************************************
+ * @intro: write the pipes and their peer ids to the map file, called when
+ *a pipe is connected
+ ****************************************************************************/
+void qrc_pipe_map_save(void)
+{
+  char tmp[QRC_MAP_PATH_MAX + 4];
+  uint16_t cnt = get_pipe_number();
+  FILE * f;
+
+  if ('\0' == g_map.path[0]) {
+    return;
+  }
+  snprintf(tmp, sizeof(tmp), "%s.tmp", g_map.path);
+  f = fopen(tmp, "w");
+  if (NULL == f) {
+    QRC_LOGW("pipe map %s write failed", tmp);
+    return;
+  }
+  fprintf(f, "%s\n", QRC_MAP_HEADER);
+  for (uint16_t i = 1; i < cnt; i++) {
+    qrc_pipe_s * p = qrc_pipe_find_by_pipeid(i);
+    fprintf(f,
+        "%u %u %s\n",
+        (unsigned)i,
+        (unsigned)(qrc_pipe_map_known(p) ? p->peer_pipe_id : QRC_PIPE_ID_NONE),
+        p->pipe_name);
+  }
+  if (0 != fclose(f) || 0 != rename(tmp, g_map.path)) {
+    QRC_LOGW("pipe map %s write failed", g_map.path);
+  }
+}
+
+/****************************************************************************
+ * @intro: hash of the pipes both sides know. The entries are summed, so
+ *both sides get the same hash whatever order their ids are in
+ * @param requester: this side sends QRC_CONNECT_REQUEST
+ * @return: hash, 0 if no pipe is known
+ ****************************************************************************/
+uint32_t qrc_pipe_map_hash(bool requester)
+{
+  uint16_t cnt = get_pipe_number();
+  uint32_t h = 0;
+  uint32_t n = 0;
+
+  for (uint16_t i = 1; i < cnt; i++) {
+    qrc_pipe_s * p = qrc_pipe_find_by_pipeid(i);
+    if (!qrc_pipe_map_known(p)) {
+      continue;
+    }
+    h += requester ? qrc_pipe_map_entry(p->pipe_id, p->peer_pipe_id, p) :
+                     qrc_pipe_map_entry(p->peer_pipe_id, p->pipe_id, p);
+    n++;
+  }
+
+  if (0 == n) {
+    return 0;
+  }
+  h = (h ^ n) * QRC_FNV_PRIME;
+  return (0 == h) ? 1 : h;
+}
+
+void qrc_pipe_map_encode(qrc_msg * msg, uint32_t hash)
+{
+  memset(msg->pipe_name, 0, sizeof(msg->pipe_name));
+  if (0 == hash) {
+    return;
+  }
+  msg->pipe_name[0] = QRC_MAP_MAGIC;
+  msg->pipe_name[1] = (char)(hash >> 24);
+  msg->pipe_name[2] = (char)(hash >> 16);
+  msg->pipe_name[3] = (char)(hash >> 8);
+  msg->pipe_name[4] = (char)hash;
+}
+
+uint32_t qrc_pipe_map_decode(const qrc_msg * msg)
+{
+  const uint8_t * n = (const uint8_t *)msg->pipe_name;
+
+  if (QRC_MAP_MAGIC != msg->pipe_name[0]) {
+    return 0;
+  }
+  return ((uint32_t)n[1] << 24) | ((uint32_t)n[2] << 16) | ((uint32_t)n[3] << 8) | n[4];
+}
+
+/****************************************************************************
+ * @intro: the map is the same on both sides, the pipes loaded from it are
+ *connected without QRC_REQUEST
+ ****************************************************************************/
+void qrc_pipe_map_validated(void)
+{
+  uint16_t cnt = get_pipe_number();
+
+  for (uint16_t i = 1; i < cnt; i++) {
+    if (g_map.mapped[i]) {
+      qrc_pipe_find_by_pipeid(i)->pipe_ready = true;
+      g_map.mapped[i] = false;
+    }
+  }
+}
+
+/****************************************************************************
+ * @intro: control thread, check the map hash of a QRC_CONNECT_REQUEST
+ *against the pipes of this side. The answer of qrc_pipe_map_accepted()
+ *goes into the QRC_CONNECT_RESPONSE
+ * @param msg: QRC_CONNECT_REQUEST
+ ****************************************************************************/
+void qrc_pipe_map_accept(const qrc_msg * msg)
+{
+  uint32_t hash = qrc_pipe_map_decode(msg);
+
+  g_map.accepted = 0;
+  if (0 != hash && hash == qrc_pipe_map_hash(false)) {
+    qrc_pipe_map_validated();
+    g_map.accepted = hash;
+  }
+}
+
+uint32_t qrc_pipe_map_accepted(void)
+{
+  return g_map.accepted;
+}
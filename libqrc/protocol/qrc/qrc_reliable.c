@@ -0,0 +1,1615 @@
+/****************************************************************************
+ *
+ * Copyright (c) 2024 Qualcomm Innovation Center, Inc. All rights reserved.
+ * SPDX-License-Identifier: BSD-3-Clause-Clear
+ *
+ ****************************************************************************/
+#include <stdio.h>
+
+#include "qrc.h"
+
+/****************************************************************************
+ * Pre-processor Definitions
+ ****************************************************************************/
+
+#define QRC_REL_WINDOW_MAX QRC_MAX_SEND_WINDOW /* power of 2, at most sack bits */
+#define QRC_REL_MASK (QRC_REL_WINDOW_MAX - 1)
+/* default retry policy: a frame is given up after 8 tries, at most 8 * 500 ms
+ * like the old fixed ack timeout, on a fast link in about 1 s */
+#define QRC_REL_MAX_TRIES (8)
+#define QRC_REL_INIT_RTO_MS (500)
+#define QRC_REL_MIN_RTO_MS (10)
+#define QRC_REL_MAX_RTO_MS (500)
+
+#define QRC_REL_CLOCK_US (100)  /* granularity of the timer wheel */
+#define QRC_REL_RESCAN_US (1000) /* retry of a frame the full tx ring refused */
+#define QRC_REL_RST_US (1000)    /* an unsynced receiver sends at most one RST per this */
+
+/* in order frames an ack may cover before it is sent without waiting for
+ * the end of the receive burst or the ack delay */
+#define QRC_REL_ACK_EVERY (QRC_REL_WINDOW_MAX / 4)
+#define QRC_REL_ACK_PENDING (1ULL << 48) /* ack_word holds an ack */
+
+#if QRC_REL_WINDOW_MAX > 32 || (QRC_REL_WINDOW_MAX & QRC_REL_MASK)
+#error "QRC_MAX_SEND_WINDOW must be a power of 2 and at most 32"
+#endif
+
+/* distance between two 16 bits sequence numbers */
+#define QRC_REL_SET_WORDS ((MAX_PIPE_ID + 63) / 64) /* a bit per pipe */
+
+#define QRC_SEQ_DIFF(a, b) ((int16_t)(uint16_t)((a) - (b)))
+
+/****************************************************************************
+ * Private Types
+ ****************************************************************************/
+
+enum qrc_rel_slot_state_e
+{
+  QRC_REL_FREE = 0,
+  QRC_REL_INFLIGHT, /* sent, waiting for an ack */
+  QRC_REL_SACKED,   /* received by the peer, but not in order yet */
+  QRC_REL_LOST,     /* given up after QRC_REL_MAX_TRIES */
+};
+
+struct qrc_rel_txslot_s
+{
+  uint8_t state;
+  uint8_t tries;   /* times the frame went to the tx ring */
+  bool refused;    /* the tx ring or the peer's credits refused the last send */
+  uint32_t stamp;  /* transmission order of the last send */
+  uint32_t len;
+  uint64_t sent_us; /* time of the last send */
+  uint64_t due_us;  /* next (re)transmission */
+  uint8_t * data;  /* copy of the user data for retransmission */
+
+  /* qrc_write_async(): handle 0 is a blocking write without completion */
+  uint32_t handle;
+  qrc_write_done_cb done_cb; /* NULL: completion goes to the poll queue */
+  void * done_arg;
+};
+
+/* completion waiting for qrc_rel_poll() */
+struct qrc_rel_done_s
+{
+  uint32_t handle;
+  uint8_t status;
+};
+
+/* sender side of a pipe, guarded by mutex */
+struct qrc_rel_tx_s
+{
+  pthread_mutex_t mutex;
+  pthread_cond_t cond; /* senders wait for window space and acks */
+  uint8_t * mem;       /* QRC_REL_WINDOW_MAX * QRC_MAX_PAYLOAD, allocated on first send */
+  uint32_t waiters;    /* senders in qrc_rel_tx_wait(), destroy waits for them */
+  uint16_t window;
+  uint16_t isn;      /* sequence number the last SYN announced */
+  uint16_t base;     /* oldest sequence number not acknowledged */
+  uint16_t next_seq; /* sequence number of the next frame */
+  bool synced;       /* the peer acknowledged our SYN */
+  bool resync;       /* SYN owed even without frames in flight, see qrc_rel_tx_resync() */
+  uint64_t ctl_due_us; /* next SYN */
+  uint32_t lost;       /* frames given up since the last qrc_rel_flush() */
+  uint32_t xmit_stamp; /* counts data frame and SYN transmissions */
+  uint32_t syn_stamp;  /* stamp of the last SYN */
+  uint32_t delivered;  /* latest stamp the peer acknowledged */
+  struct qrc_rel_txslot_s slots[QRC_REL_WINDOW_MAX];
+
+  /* retransmission timeout of RFC 6298, sampled from frames sent once */
+  struct qrc_retry_policy_s policy;
+  uint32_t srtt_us; /* 0: no sample yet */
+  uint32_t rttvar_us;
+  uint32_t rto_us;  /* without backoff */
+  uint8_t backoff;  /* doublings of rto_us since the last sample */
+  uint32_t samples;
+  uint32_t retransmits;
+  uint32_t given_up;
+
+  /* completions of async writes without callback, room for them is
+   * reserved when the write is queued */
+  struct qrc_rel_done_s done[QRC_REL_WINDOW_MAX];
+  uint16_t done_head;
+  uint16_t done_len;
+  int event_fd[2]; /* [0] is readable while done_len > 0 */
+};
+
+/* frame waiting for the ones before it */
+struct qrc_rel_held_s
+{
+  struct qrc_rxbuf_s * buf; /* NULL if not received */
+  uint8_t * data;
+  size_t len;
+};
+
+/* receiver side of a pipe, only used by the read thread */
+struct qrc_rel_rx_s
+{
+  bool synced;      /* a SYN has been received */
+  uint16_t syn_seq; /* seq of that SYN, a retransmitted SYN is ignored */
+  uint64_t rst_us;  /* last RST, sent while not synced */
+  uint16_t next;    /* next sequence number to deliver */
+  uint16_t unacked; /* frames since the ack went out */
+  bool ack_queued;  /* on g_rel.ack_list */
+  uint64_t ack_due_us; /* delayed ack, 0: at the end of the receive burst */
+  struct qrc_rel_pipe_s * ack_next;
+  struct qrc_rel_held_s held[QRC_REL_WINDOW_MAX];
+};
+
+struct qrc_rel_pipe_s
+{
+  qrc_pipe_s * pipe;
+  struct qrc_rel_tx_s tx;
+  struct qrc_rel_rx_s rx;
+
+  /* ack for the peer, set by the read thread and taken by whichever goes
+   * first: a frame of ours to the peer or qrc_rel_flush_acks() */
+  uint64_t ack_word; /* QRC_REL_ACK_PENDING | sack << 16 | ack, 0 if none */
+  uint32_t ack_delay_us;
+  struct qrc_timer_s ack_timer; /* wakes the read thread for a delayed ack */
+  uint32_t acks;             /* frames of only an ack */
+  uint32_t acks_piggybacked; /* acks that went out on other frames */
+  uint64_t scan_due_us;      /* next scan, retransmit thread only */
+};
+
+struct qrc_rel_s
+{
+  struct qrc_rel_pipe_s * pipes[MAX_PIPE_ID]; /* created on first use */
+  pthread_mutex_t mutex;
+  pthread_cond_t cond;     /* wakes the retransmit thread */
+  struct qrc_timer_s tick; /* kicks the retransmit thread when the next frame is due */
+  uint64_t tick_due_us;    /* time tick is armed for, 0 if it is not */
+  pthread_t thread;
+  bool kicked;
+  uint64_t dirty[QRC_REL_SET_WORDS]; /* pipes to scan at once, taken by the thread */
+  volatile bool stop;
+  uint32_t last_handle;
+  struct qrc_rel_pipe_s * ack_list; /* pipes owing an ack, read thread only */
+  bool ack_fired;                   /* an ack timer woke the read thread */
+};
+
+/****************************************************************************
+ * Private Data
+ ****************************************************************************/
+
+static struct qrc_rel_s g_rel;
+
+/****************************************************************************
+ * Private Functions
+ ****************************************************************************/
+
+/* timer callback, a delayed ack is due */
+static void qrc_rel_ack_expired(void * arg)
+{
+  (void)arg;
+  __atomic_store_n(&g_rel.ack_fired, true, __ATOMIC_RELEASE);
+  qrc_read_thread_wakeup();
+}
+
+/****************************************************************************
+ * @intro: get the state of a pipe, create it on first use
+ * @return: state or NULL if malloc failed
+ ****************************************************************************/
+static struct qrc_rel_pipe_s * qrc_rel_get(const qrc_pipe_s * pipe)
+{
+  struct qrc_rel_pipe_s * r = __atomic_load_n(&g_rel.pipes[pipe->pipe_id], __ATOMIC_ACQUIRE);
+  if (NULL != r) {
+    return r;
+  }
+
+  pthread_mutex_lock(&g_rel.mutex);
+  r = g_rel.pipes[pipe->pipe_id];
+  if (NULL == r) {
+    r = (struct qrc_rel_pipe_s *)calloc(1, sizeof(struct qrc_rel_pipe_s));
+    if (NULL == r) {
+      QRC_LOGE("pipe(%s) reliable state malloc failed!", pipe->pipe_name);
+    } else if (0 != pthread_mutex_init(&r->tx.mutex, NULL) ||
+               0 != pthread_cond_init(&r->tx.cond, NULL)) {
+      QRC_LOGE("pipe(%s) reliable mutex initalize failed!", pipe->pipe_name);
+      free(r);
+      r = NULL;
+    } else {
+      r->pipe = (qrc_pipe_s *)pipe;
+      r->tx.window = 1;
+      r->tx.policy.max_tries = QRC_REL_MAX_TRIES;
+      r->tx.policy.init_rto_ms = QRC_REL_INIT_RTO_MS;
+      r->tx.policy.min_rto_ms = QRC_REL_MIN_RTO_MS;
+      r->tx.policy.max_rto_ms = QRC_REL_MAX_RTO_MS;
+      r->tx.rto_us = QRC_REL_INIT_RTO_MS * 1000U;
+      r->tx.event_fd[0] = -1;
+      r->tx.event_fd[1] = -1;
+      /* a restarted peer must not take our new frames for old ones */
+      r->tx.isn = (uint16_t)(qrc_timer_now_us() ^ ((uint64_t)pipe->pipe_id << 10));
+      r->tx.base = r->tx.isn;
+      r->tx.next_seq = r->tx.isn;
+      qrc_timer_setup(&r->ack_timer, qrc_rel_ack_expired, NULL);
+      __atomic_store_n(&g_rel.pipes[pipe->pipe_id], r, __ATOMIC_RELEASE);
+    }
+  }
+  pthread_mutex_unlock(&g_rel.mutex);
+
+  return r;
+}
+
+/* wait on the tx cond, the last sender woken by a stop tells destroy */
+static void qrc_rel_tx_wait(struct qrc_rel_tx_s * tx)
+{
+  tx->waiters++;
+  pthread_cond_wait(&tx->cond, &tx->mutex);
+  tx->waiters--;
+  if (g_rel.stop && 0 == tx->waiters) {
+    pthread_cond_broadcast(&tx->cond);
+  }
+}
+
+/* wake the retransmit thread, r: the pipe to scan, NULL for the due ones */
+static void qrc_rel_kick(const struct qrc_rel_pipe_s * r)
+{
+  pthread_mutex_lock(&g_rel.mutex);
+  if (NULL != r) {
+    g_rel.dirty[r->pipe->pipe_id / 64] |= 1ULL << (r->pipe->pipe_id % 64);
+  }
+  g_rel.kicked = true;
+  pthread_cond_signal(&g_rel.cond);
+  pthread_mutex_unlock(&g_rel.mutex);
+}
+
+static void qrc_rel_tick(void * arg)
+{
+  (void)arg;
+  __atomic_store_n(&g_rel.tick_due_us, 0, __ATOMIC_RELAXED);
+  qrc_rel_kick(NULL);
+}
+
+/* make the retransmit thread scan at due at the latest */
+static void qrc_rel_schedule(uint64_t due, uint64_t now)
+{
+  uint64_t armed = __atomic_load_n(&g_rel.tick_due_us, __ATOMIC_RELAXED);
+
+  if (0 == armed || due < armed) {
+    __atomic_store_n(&g_rel.tick_due_us, due, __ATOMIC_RELAXED);
+    qrc_timer_arm(&g_rel.tick, (due > now) ? due - now : 0);
+  }
+}
+
+/* tx mutex held, retransmission timeout with backoff */
+static uint64_t qrc_rel_rto(const struct qrc_rel_tx_s * tx)
+{
+  uint64_t rto = (uint64_t)tx->rto_us << tx->backoff;
+  uint64_t max = tx->policy.max_rto_ms * 1000ULL;
+
+  return (rto < max) ? rto : max;
+}
+
+/* tx mutex held, fold a round trip time into the estimate, RFC 6298 2.2 ~ 2.4 */
+static void qrc_rel_rtt_sample(struct qrc_rel_tx_s * tx, uint64_t rtt)
+{
+  uint32_t r = (rtt > UINT32_MAX / 2) ? UINT32_MAX / 2 : (uint32_t)rtt;
+  uint64_t rto;
+
+  if (0 == tx->srtt_us) {
+    tx->srtt_us = (0 == r) ? 1 : r;
+    tx->rttvar_us = r / 2;
+  } else {
+    uint32_t err = (tx->srtt_us > r) ? tx->srtt_us - r : r - tx->srtt_us;
+    tx->rttvar_us = tx->rttvar_us - tx->rttvar_us / 4 + err / 4;
+    tx->srtt_us = tx->srtt_us - tx->srtt_us / 8 + r / 8;
+  }
+
+  rto = tx->srtt_us + (uint64_t)((4ULL * tx->rttvar_us > QRC_REL_CLOCK_US) ? 4ULL * tx->rttvar_us
+                                                                           : QRC_REL_CLOCK_US);
+  if (rto < tx->policy.min_rto_ms * 1000ULL) {
+    rto = tx->policy.min_rto_ms * 1000ULL;
+  }
+  if (rto > tx->policy.max_rto_ms * 1000ULL) {
+    rto = tx->policy.max_rto_ms * 1000ULL;
+  }
+  tx->rto_us = (uint32_t)rto;
+  tx->backoff = 0;
+  tx->samples++;
+}
+
+/* tx mutex held, the retransmission timer expired: double the timeout, RFC 6298 5.5 */
+static void qrc_rel_backoff(struct qrc_rel_tx_s * tx)
+{
+  if (qrc_rel_rto(tx) < tx->policy.max_rto_ms * 1000ULL) {
+    tx->backoff++;
+  }
+}
+
+/****************************************************************************
+ * @intro: send a frame to the peer pipe with the ack we owe the peer on it.
+ *An ack the tx ring refused is put back unless a newer one replaced it
+ * @param r: state of the pipe
+ * @return: result of qrc_frame_sendv(), SUCCESS if there was nothing to send
+ ****************************************************************************/
+static enum qrc_write_status_e qrc_rel_sendv(struct qrc_rel_pipe_s * r,
+    qrc_frame * qrcf,
+    struct qrc_ext_s * ext,
+    const struct iovec * iov,
+    const int iovcnt,
+    bool wait,
+    bool resend)
+{
+  enum qrc_write_status_e res;
+  uint8_t flags = ext->flags;
+  uint64_t w = 0;
+
+  if (0 != __atomic_load_n(&r->ack_word, __ATOMIC_RELAXED)) {
+    w = __atomic_exchange_n(&r->ack_word, 0, __ATOMIC_ACQ_REL);
+  }
+  if (0 != w) {
+    ext->flags |= QRC_EXT_ACK;
+    ext->ack = (uint16_t)w;
+    ext->sack = (uint32_t)(w >> 16);
+  } else if (0 == flags) {
+    return SUCCESS;
+  }
+
+  res = qrc_pipe_sendv(r->pipe, qrcf, ext, iov, iovcnt, wait, resend);
+
+  if (0 != w && SUCCESS != res) {
+    uint64_t none = 0;
+    __atomic_compare_exchange_n(
+        &r->ack_word, &none, w, false, __ATOMIC_ACQ_REL, __ATOMIC_RELAXED);
+  } else if (0 != w) {
+    __atomic_add_fetch((0 == flags) ? &r->acks : &r->acks_piggybacked, 1, __ATOMIC_RELAXED);
+  }
+
+  return res;
+}
+
+/****************************************************************************
+ * @intro: queue a frame with an extended header to the peer pipe, never
+ *waits for the tx ring, a refused frame is sent again by the scan
+ ****************************************************************************/
+static enum qrc_write_status_e qrc_rel_xmit(struct qrc_rel_pipe_s * r,
+    const struct qrc_ext_s * ext,
+    const uint8_t * data,
+    size_t len,
+    bool resend)
+{
+  qrc_frame qrcf;
+  struct qrc_ext_s e = *ext;
+  struct iovec iov;
+
+  memset(&qrcf, 0, sizeof(qrcf));
+  qrcf.ack = NO_ACK;
+  iov.iov_base = (void *)data;
+  iov.iov_len = len;
+
+  return qrc_rel_sendv(r, &qrcf, &e, &iov, (0 == len) ? 0 : 1, false, resend);
+}
+
+/* tx mutex held */
+static void qrc_rel_xmit_data(struct qrc_rel_pipe_s * r, uint16_t seq, uint64_t now)
+{
+  struct qrc_rel_txslot_s * slot = &r->tx.slots[seq & QRC_REL_MASK];
+  struct qrc_ext_s ext;
+
+  memset(&ext, 0, sizeof(ext));
+  ext.flags = QRC_EXT_SEQ;
+  ext.seq = seq;
+  if (SUCCESS == qrc_rel_xmit(r, &ext, slot->data, slot->len, slot->tries > 0)) {
+    if (slot->tries > 0) {
+      r->tx.retransmits++;
+      QRC_STAT_ADD(qrc_stats_pipe(r->pipe->pipe_id)->retransmits, 1);
+    }
+    slot->tries++;
+    slot->stamp = ++r->tx.xmit_stamp;
+    slot->sent_us = now;
+    slot->due_us = now + qrc_rel_rto(&r->tx);
+    slot->refused = false;
+  } else {
+    slot->due_us = now + QRC_REL_RESCAN_US; /* tx ring full, try again soon */
+    slot->refused = true;
+  }
+  qrc_rel_schedule(slot->due_us, now);
+}
+
+/* tx mutex held, announce the sequence number the peer goes on from */
+static void qrc_rel_xmit_ctl(struct qrc_rel_pipe_s * r, uint64_t now)
+{
+  struct qrc_ext_s ext;
+
+  memset(&ext, 0, sizeof(ext));
+  ext.flags = QRC_EXT_SYN;
+  ext.seq = r->tx.isn;
+  if (SUCCESS == qrc_rel_xmit(r, &ext, NULL, 0, false)) {
+    r->tx.syn_stamp = ++r->tx.xmit_stamp;
+    r->tx.ctl_due_us = now + qrc_rel_rto(&r->tx);
+  } else {
+    r->tx.ctl_due_us = now + QRC_REL_RESCAN_US;
+  }
+  qrc_rel_schedule(r->tx.ctl_due_us, now);
+}
+
+/* tx mutex held, report the result of an async write */
+static void qrc_rel_tx_complete(struct qrc_rel_pipe_s * r,
+    struct qrc_rel_txslot_s * slot,
+    enum qrc_write_status_e status)
+{
+  struct qrc_rel_tx_s * tx = &r->tx;
+  struct qrc_rel_done_s * d;
+  uint8_t c = 0;
+
+  if (0 == slot->handle) {
+    return;
+  }
+
+  if (NULL != slot->done_cb) {
+    qrc_write_done_dispatch(r->pipe, slot->done_cb, slot->done_arg, slot->handle, status);
+  } else {
+    d = &tx->done[(uint16_t)(tx->done_head + tx->done_len) & QRC_REL_MASK];
+    d->handle = slot->handle;
+    d->status = (uint8_t)status;
+    tx->done_len++;
+    if (write(tx->event_fd[1], &c, 1) != 1) {
+      QRC_LOGW("pipe(%s) write event signal failed", r->pipe->pipe_name);
+    }
+  }
+  slot->handle = 0;
+}
+
+/* tx mutex held, the peer has the frame of slot. Only a frame sent once
+ * gives a round trip time, the ack of a resent one may be for any send
+ * (Karn's algorithm) */
+static void qrc_rel_tx_delivered(struct qrc_rel_pipe_s * r,
+    struct qrc_rel_txslot_s * slot,
+    uint64_t now)
+{
+  struct qrc_rel_tx_s * tx = &r->tx;
+
+  if (QRC_REL_INFLIGHT != slot->state) {
+    return;
+  }
+  if ((int32_t)(slot->stamp - tx->delivered) > 0) {
+    tx->delivered = slot->stamp;
+  }
+  if (1 == slot->tries) {
+    qrc_rel_rtt_sample(tx, now - slot->sent_us);
+    qrc_stats_ack(r->pipe->pipe_id, now - slot->sent_us);
+  }
+  slot->state = QRC_REL_SACKED;
+  qrc_rel_tx_complete(r, slot, SUCCESS);
+}
+
+/****************************************************************************
+ * @intro: tx mutex held, send the frames of the window that are due: new
+ *ones, timed out ones and ones sent before a frame the peer got (the tx
+ *ring and the link keep frames in order, so those are lost). Gives up the
+ *frames that used all their tries. The first timeout of a call backs the
+ *timeout off once, the frames found lost by order do not
+ * @return: time the next frame in the window is due, 0 if none waits for
+ *an ack
+ ****************************************************************************/
+static uint64_t qrc_rel_tx_pump(struct qrc_rel_pipe_s * r, uint64_t now)
+{
+  struct qrc_rel_tx_s * tx = &r->tx;
+  uint64_t next_due = 0;
+  bool backed_off = false;
+
+  for (uint16_t seq = tx->base; seq != tx->next_seq && QRC_SEQ_DIFF(seq, tx->base) < tx->window;
+       seq++) {
+    struct qrc_rel_txslot_s * slot = &tx->slots[seq & QRC_REL_MASK];
+    if (QRC_REL_INFLIGHT != slot->state) {
+      continue;
+    }
+    if (slot->due_us > now && (int32_t)(tx->delivered - slot->stamp) <= 0) {
+      if (0 == next_due || slot->due_us < next_due) {
+        next_due = slot->due_us;
+      }
+      continue;
+    }
+    if (slot->tries >= tx->policy.max_tries) {
+      QRC_LOGE("pipe(%s) frame %u is not acknowledged, give up!",
+          r->pipe->pipe_name,
+          (unsigned)seq);
+      slot->state = QRC_REL_LOST;
+      tx->lost++;
+      tx->given_up++;
+      QRC_STAT_ADD(qrc_stats_pipe(r->pipe->pipe_id)->timeouts, 1);
+      qrc_rel_tx_complete(r, slot, TIMEOUT);
+      continue;
+    }
+    if (slot->tries > 0 && slot->due_us <= now && !backed_off) {
+      qrc_rel_backoff(tx);
+      backed_off = true;
+    }
+    qrc_rel_xmit_data(r, seq, now);
+    if (0 == next_due || slot->due_us < next_due) {
+      next_due = slot->due_us;
+    }
+  }
+
+  return next_due;
+}
+
+/****************************************************************************
+ * @intro: tx mutex held, start the sequence anew at base with a SYN. A peer
+ *that kept its state delivers what it holds before base and skips the rest
+ *before it, a restarted one starts at base
+ * @param r: state of the pipe
+ * @param peer_lost: the peer lost what it held, frames it sacked go again
+ * @param now: time
+ ****************************************************************************/
+static void qrc_rel_tx_resync(struct qrc_rel_pipe_s * r, bool peer_lost, uint64_t now)
+{
+  struct qrc_rel_tx_s * tx = &r->tx;
+
+  tx->synced = false;
+  tx->resync = true;
+  tx->isn = tx->base;
+  if (peer_lost) {
+    for (uint16_t seq = tx->base; seq != tx->next_seq; seq++) {
+      struct qrc_rel_txslot_s * slot = &tx->slots[seq & QRC_REL_MASK];
+      if (QRC_REL_SACKED == slot->state) {
+        slot->state = QRC_REL_INFLIGHT;
+        slot->tries = 1; /* resent, no round trip sample from it */
+        slot->due_us = now;
+      }
+    }
+  }
+  qrc_rel_xmit_ctl(r, now);
+}
+
+/****************************************************************************
+ * @intro: tx mutex held, move base over the frames that need no more acks.
+ *Passing a lost frame makes the peer skip it with a SYN at the new base
+ * @return: true if base moved
+ ****************************************************************************/
+static bool qrc_rel_tx_advance(struct qrc_rel_pipe_s * r)
+{
+  struct qrc_rel_tx_s * tx = &r->tx;
+  uint16_t old = tx->base;
+  bool skipped = false;
+
+  while (tx->base != tx->next_seq) {
+    struct qrc_rel_txslot_s * slot = &tx->slots[tx->base & QRC_REL_MASK];
+    if (QRC_REL_INFLIGHT == slot->state) {
+      break;
+    }
+    if (QRC_REL_FREE != slot->state) {
+      skipped = true;
+    }
+    slot->state = QRC_REL_FREE;
+    tx->base++;
+  }
+
+  if (skipped) {
+    qrc_rel_tx_resync(r, false, qrc_timer_now_us());
+  }
+
+  return old != tx->base;
+}
+
+/****************************************************************************
+ * @intro: retransmit thread, resend what is due and give up frames that used
+ *all their tries
+ * @return: time the pipe needs the next scan, 0 if it waits for nothing
+ ****************************************************************************/
+static uint64_t qrc_rel_tx_scan(struct qrc_rel_pipe_s * r, uint64_t now)
+{
+  struct qrc_rel_tx_s * tx = &r->tx;
+  uint64_t next_due = 0;
+  uint64_t due;
+
+  pthread_mutex_lock(&tx->mutex);
+
+  if (!tx->synced && (tx->resync || tx->base != tx->next_seq)) {
+    if (tx->ctl_due_us <= now) {
+      qrc_rel_xmit_ctl(r, now);
+    }
+    next_due = tx->ctl_due_us;
+  }
+
+  due = qrc_rel_tx_pump(r, now);
+  if (qrc_rel_tx_advance(r)) {
+    due = qrc_rel_tx_pump(r, now);
+    pthread_cond_broadcast(&tx->cond);
+  }
+  if (0 != due && (0 == next_due || due < next_due)) {
+    next_due = due;
+  }
+
+  pthread_mutex_unlock(&tx->mutex);
+
+  return next_due;
+}
+
+/****************************************************************************
+ * @intro: thread of retransmission, scans the pipes kicked by a sender and
+ *the ones whose earliest frame in flight is due, sleeps otherwise. Pipes
+ *that wait for nothing are not visited
+ ****************************************************************************/
+static void * qrc_rel_thread(void * args)
+{
+  uint64_t busy[QRC_REL_SET_WORDS] = { 0 }; /* pipes that wait for an ack or a SYN */
+  uint64_t dirty[QRC_REL_SET_WORDS];
+  uint64_t next_due;
+
+  (void)args;
+
+  pthread_mutex_lock(&g_rel.mutex);
+  memcpy(dirty, g_rel.dirty, sizeof(dirty));
+  memset(g_rel.dirty, 0, sizeof(g_rel.dirty));
+  pthread_mutex_unlock(&g_rel.mutex);
+
+  while (!g_rel.stop) {
+    uint64_t now = qrc_timer_now_us();
+    next_due = 0;
+    for (int w = 0; w < QRC_REL_SET_WORDS; w++) {
+      uint64_t bits = dirty[w] | busy[w];
+      while (0 != bits) {
+        uint64_t bit = bits & -bits;
+        struct qrc_rel_pipe_s * r =
+            __atomic_load_n(&g_rel.pipes[w * 64 + __builtin_ctzll(bits)], __ATOMIC_ACQUIRE);
+        bits &= bits - 1;
+        if (NULL == r) {
+          busy[w] &= ~bit;
+          continue;
+        }
+        if (0 == (dirty[w] & bit) && r->scan_due_us > now) {
+          if (0 == next_due || r->scan_due_us < next_due) {
+            next_due = r->scan_due_us;
+          }
+          continue;
+        }
+        r->scan_due_us = qrc_rel_tx_scan(r, now);
+        if (0 == r->scan_due_us) {
+          busy[w] &= ~bit;
+          continue;
+        }
+        busy[w] |= bit;
+        if (0 == next_due || r->scan_due_us < next_due) {
+          next_due = r->scan_due_us;
+        }
+      }
+    }
+
+    if (0 != next_due) {
+      qrc_rel_schedule(next_due, now);
+    }
+
+    pthread_mutex_lock(&g_rel.mutex);
+    if (!g_rel.stop && !g_rel.kicked) {
+      pthread_cond_wait(&g_rel.cond, &g_rel.mutex);
+    }
+    g_rel.kicked = false;
+    memcpy(dirty, g_rel.dirty, sizeof(dirty));
+    memset(g_rel.dirty, 0, sizeof(g_rel.dirty));
+    pthread_mutex_unlock(&g_rel.mutex);
+  }
+
+  return NULL;
+}
+
+/* read thread, owe the peer an ack of what we hold now. It replaces an
+ * older one not sent yet, acks are cumulative */
+static void qrc_rel_ack_update(struct qrc_rel_pipe_s * r)
+{
+  struct qrc_rel_rx_s * rx = &r->rx;
+  uint64_t sack = 0;
+
+  for (uint16_t i = 0; i + 1 < QRC_REL_WINDOW_MAX; i++) {
+    if (NULL != rx->held[(uint16_t)(rx->next + 1 + i) & QRC_REL_MASK].buf) {
+      sack |= 1ULL << i;
+    }
+  }
+  if (0 == __atomic_exchange_n(
+               &r->ack_word, QRC_REL_ACK_PENDING | (sack << 16) | rx->next, __ATOMIC_ACQ_REL)) {
+    rx->unacked = 0; /* the last one went out on a frame of ours */
+  }
+}
+
+/* read thread, send the ack we owe now unless a frame of ours took it */
+static void qrc_rel_send_ack(struct qrc_rel_pipe_s * r)
+{
+  struct qrc_ext_s ext;
+
+  memset(&ext, 0, sizeof(ext));
+  r->rx.unacked = 0;
+
+  /* a lost ack is covered by the next one or by a retransmission */
+  qrc_rel_xmit(r, &ext, NULL, 0, false);
+}
+
+/* read thread, not synced: ask the sender for a SYN, at most once per
+ * QRC_REL_RST_US */
+static void qrc_rel_send_rst(struct qrc_rel_pipe_s * r)
+{
+  struct qrc_ext_s ext;
+  uint64_t now = qrc_timer_now_us();
+
+  if (now - r->rx.rst_us < QRC_REL_RST_US) {
+    return;
+  }
+  r->rx.rst_us = now;
+  memset(&ext, 0, sizeof(ext));
+  ext.flags = QRC_EXT_RST;
+  qrc_rel_xmit(r, &ext, NULL, 0, false);
+}
+
+/* read thread, leave the ack for the end of the receive burst or the ack
+ * delay, a frame of ours may take it before */
+static void qrc_rel_ack_queue(struct qrc_rel_pipe_s * r)
+{
+  struct qrc_rel_rx_s * rx = &r->rx;
+  uint32_t delay = __atomic_load_n(&r->ack_delay_us, __ATOMIC_RELAXED);
+
+  if (rx->ack_queued) {
+    return;
+  }
+  rx->ack_queued = true;
+  rx->ack_next = g_rel.ack_list;
+  g_rel.ack_list = r;
+  rx->ack_due_us = 0;
+  if (0 != delay) {
+    rx->ack_due_us = qrc_timer_now_us() + delay;
+    qrc_timer_arm(&r->ack_timer, delay);
+  }
+}
+
+/* read thread, deliver the frames held for rx->next and after it in order */
+static void qrc_rel_rx_drain(struct qrc_rel_pipe_s * r, qrc_pipe_s * p)
+{
+  struct qrc_rel_rx_s * rx = &r->rx;
+  struct qrc_rel_held_s * h = &rx->held[rx->next & QRC_REL_MASK];
+
+  while (NULL != h->buf) {
+    qrc_msg_dispatch(p, h->buf, h->data, h->len, NO_ACK, 0);
+    h->buf = NULL;
+    rx->next++;
+    h = &rx->held[rx->next & QRC_REL_MASK];
+  }
+}
+
+/****************************************************************************
+ * Public Functions
+ ****************************************************************************/
+
+bool qrc_rel_init(void)
+{
+  memset(&g_rel, 0, sizeof(g_rel));
+  if (0 != pthread_mutex_init(&g_rel.mutex, NULL) || 0 != pthread_cond_init(&g_rel.cond, NULL)) {
+    QRC_LOGE("qrc reliable mutex initalize failed!");
+    return false;
+  }
+  qrc_timer_setup(&g_rel.tick, qrc_rel_tick, NULL);
+  if (0 != pthread_create(&g_rel.thread, NULL, qrc_rel_thread, NULL)) {
+    QRC_LOGE("qrc retransmit thread create failed!");
+    return false;
+  }
+
+  return true;
+}
+
+/****************************************************************************
+ * @intro: stop retransmission, after it no async write completes on the
+ *callback pool. Call it after the read thread is stopped, before the pool
+ ****************************************************************************/
+void qrc_rel_stop(void)
+{
+  pthread_mutex_lock(&g_rel.mutex);
+  g_rel.stop = true;
+  pthread_cond_signal(&g_rel.cond);
+  pthread_mutex_unlock(&g_rel.mutex);
+  pthread_join(g_rel.thread, NULL);
+  qrc_timer_cancel(&g_rel.tick);
+}
+
+/****************************************************************************
+ * @intro: fail the waiting senders and pending async writes, free all held
+ *receive slabs and the state of every pipe, call after qrc_rel_stop() and
+ *the callback pool is stopped
+ ****************************************************************************/
+void qrc_rel_destroy(void)
+{
+  for (int i = 0; i < MAX_PIPE_ID; i++) {
+    struct qrc_rel_pipe_s * r = g_rel.pipes[i];
+    if (NULL == r) {
+      continue;
+    }
+
+    /* the callback pool is gone, fail pending async writes from here */
+    struct qrc_rel_txslot_s pending[QRC_REL_WINDOW_MAX];
+    int npending = 0;
+
+    qrc_timer_cancel(&r->ack_timer);
+
+    pthread_mutex_lock(&r->tx.mutex);
+    for (int j = 0; j < QRC_REL_WINDOW_MAX; j++) {
+      struct qrc_rel_txslot_s * slot = &r->tx.slots[j];
+      if (QRC_REL_INFLIGHT != slot->state || 0 == slot->handle) {
+        continue;
+      }
+      if (NULL != slot->done_cb) {
+        pending[npending++] = *slot;
+        slot->handle = 0;
+      } else {
+        qrc_rel_tx_complete(r, slot, FAILED);
+      }
+    }
+    pthread_cond_broadcast(&r->tx.cond);
+    while (0 != r->tx.waiters) {
+      pthread_cond_wait(&r->tx.cond, &r->tx.mutex);
+    }
+    pthread_mutex_unlock(&r->tx.mutex);
+
+    for (int j = 0; j < npending; j++) {
+      pending[j].done_cb(r->pipe, pending[j].handle, FAILED, pending[j].done_arg);
+    }
+
+    for (int j = 0; j < QRC_REL_WINDOW_MAX; j++) {
+      if (NULL != r->rx.held[j].buf) {
+        qrc_rxbuf_release(r->rx.held[j].buf);
+      }
+    }
+
+    g_rel.pipes[i] = NULL;
+    if (r->tx.event_fd[0] >= 0) {
+      close(r->tx.event_fd[0]);
+      close(r->tx.event_fd[1]);
+    }
+    pthread_cond_destroy(&r->tx.cond);
+    pthread_mutex_destroy(&r->tx.mutex);
+    free(r->tx.mem);
+    free(r);
+  }
+
+  pthread_cond_destroy(&g_rel.cond);
+  pthread_mutex_destroy(&g_rel.mutex);
+}
+
+/****************************************************************************
+ * @intro: set how many reliable frames of a pipe may wait for acks
+ * @param pipe: sender
+ * @param window: 1 to QRC_MAX_SEND_WINDOW
+ * @return: result of setting
+ ****************************************************************************/
+bool qrc_rel_set_window(const qrc_pipe_s * pipe, uint16_t window)
+{
+  struct qrc_rel_pipe_s * r;
+
+  if (0 == window || window > QRC_REL_WINDOW_MAX) {
+    QRC_LOGE("send window %u is out of 1 ~ %d!", (unsigned)window, QRC_REL_WINDOW_MAX);
+    return false;
+  }
+  r = qrc_rel_get(pipe);
+  if (NULL == r) {
+    return false;
+  }
+
+  pthread_mutex_lock(&r->tx.mutex);
+  r->tx.window = window;
+  qrc_rel_tx_pump(r, qrc_timer_now_us());
+  pthread_cond_broadcast(&r->tx.cond);
+  pthread_mutex_unlock(&r->tx.mutex);
+
+  return true;
+}
+
+/****************************************************************************
+ * @intro: tx mutex held, take the next sequence number for user data and
+ *send it if the window has room, otherwise it waits in its slot
+ * @return: the slot
+ ****************************************************************************/
+static struct qrc_rel_txslot_s * qrc_rel_tx_enqueue(struct qrc_rel_pipe_s * r,
+    const struct iovec * iov,
+    const int iovcnt,
+    uint16_t * seq)
+{
+  struct qrc_rel_tx_s * tx = &r->tx;
+  struct qrc_rel_txslot_s * slot;
+  uint64_t now = qrc_timer_now_us();
+
+  if (!tx->synced && tx->base == tx->next_seq && tx->ctl_due_us <= now) {
+    qrc_rel_xmit_ctl(r, now);
+  }
+
+  *seq = tx->next_seq++;
+  slot = &tx->slots[*seq & QRC_REL_MASK];
+  slot->len = 0;
+  for (int i = 0; i < iovcnt; i++) {
+    memcpy(slot->data + slot->len, iov[i].iov_base, iov[i].iov_len);
+    slot->len += iov[i].iov_len;
+  }
+  slot->state = QRC_REL_INFLIGHT;
+  slot->tries = 0;
+  slot->refused = false;
+  slot->stamp = tx->xmit_stamp;
+  slot->due_us = 0;
+  slot->handle = 0;
+  slot->done_cb = NULL;
+
+  qrc_rel_tx_pump(r, now);
+  qrc_rel_kick(r);
+
+  return slot;
+}
+
+/****************************************************************************
+ * @intro: get the state of a pipe ready for sending, with tx mutex held
+ * @return: state or NULL
+ ****************************************************************************/
+static struct qrc_rel_pipe_s * qrc_rel_tx_lock(const qrc_pipe_s * pipe, size_t len)
+{
+  struct qrc_rel_pipe_s * r;
+  struct qrc_rel_tx_s * tx;
+
+  if (len > QRC_MAX_PAYLOAD) {
+    QRC_LOGE("pipe(%s) data of %u bytes is too long!", pipe->pipe_name, (unsigned)len);
+    return NULL;
+  }
+  r = qrc_rel_get(pipe);
+  if (NULL == r) {
+    return NULL;
+  }
+  tx = &r->tx;
+
+  pthread_mutex_lock(&tx->mutex);
+  if (g_rel.stop) {
+    pthread_mutex_unlock(&tx->mutex);
+    return NULL;
+  }
+  if (NULL == tx->mem) {
+    tx->mem = (uint8_t *)malloc(QRC_REL_WINDOW_MAX * QRC_MAX_PAYLOAD);
+    if (NULL == tx->mem) {
+      QRC_LOGE("pipe(%s) send window malloc failed!", pipe->pipe_name);
+      pthread_mutex_unlock(&tx->mutex);
+      return NULL;
+    }
+    for (int i = 0; i < QRC_REL_WINDOW_MAX; i++) {
+      tx->slots[i].data = tx->mem + i * QRC_MAX_PAYLOAD;
+    }
+  }
+
+  return r;
+}
+
+static size_t qrc_rel_iov_len(const struct iovec * iov, const int iovcnt)
+{
+  size_t len = 0;
+  for (int i = 0; i < iovcnt; i++) {
+    len += iov[i].iov_len;
+  }
+  return len;
+}
+
+/* tx mutex held */
+static bool qrc_rel_event_fd_open(struct qrc_rel_pipe_s * r)
+{
+  struct qrc_rel_tx_s * tx = &r->tx;
+
+  if (tx->event_fd[0] >= 0) {
+    return true;
+  }
+  if (0 != pipe(tx->event_fd)) {
+    QRC_LOGE("pipe(%s) write event fd create failed!", r->pipe->pipe_name);
+    tx->event_fd[0] = -1;
+    tx->event_fd[1] = -1;
+    return false;
+  }
+  fcntl(tx->event_fd[0], F_SETFL, fcntl(tx->event_fd[0], F_GETFL) | O_NONBLOCK);
+  fcntl(tx->event_fd[1], F_SETFL, fcntl(tx->event_fd[1], F_GETFL) | O_NONBLOCK);
+
+  return true;
+}
+
+/****************************************************************************
+ * @intro: send user data with a sequence number and keep a copy until the
+ *peer acknowledges it. Waits while the send window is full; with a window
+ *of 1 also waits for the ack
+ * @param pipe: sender
+ * @param iov: user data segments
+ * @param iovcnt: number of segments
+ * @return: SUCCESS once queued (window 1: once acknowledged), TIMEOUT if
+ *the peer never acknowledged it (window 1), FAILED
+ ****************************************************************************/
+enum qrc_write_status_e qrc_rel_send(const qrc_pipe_s * pipe,
+    const struct iovec * iov,
+    const int iovcnt)
+{
+  struct qrc_rel_pipe_s * r;
+  struct qrc_rel_tx_s * tx;
+  enum qrc_write_status_e res = SUCCESS;
+  uint32_t lost;
+  uint16_t seq;
+
+  /* wait for the bus gate before taking the pipe, the read thread needs it */
+  qrc_bus_gate_wait();
+
+  r = qrc_rel_tx_lock(pipe, qrc_rel_iov_len(iov, iovcnt));
+  if (NULL == r) {
+    return FAILED;
+  }
+  tx = &r->tx;
+
+  while (!g_rel.stop && QRC_SEQ_DIFF(tx->next_seq, tx->base) >= tx->window) {
+    qrc_rel_tx_wait(tx);
+  }
+  if (g_rel.stop) {
+    pthread_mutex_unlock(&tx->mutex);
+    return FAILED;
+  }
+
+  qrc_rel_tx_enqueue(r, iov, iovcnt, &seq);
+
+  if (1 == tx->window) {
+    lost = tx->lost;
+    while (!g_rel.stop && QRC_SEQ_DIFF(tx->base, seq) <= 0) {
+      qrc_rel_tx_wait(tx);
+    }
+    if (g_rel.stop) {
+      res = FAILED;
+    } else if (tx->lost != lost) {
+      res = TIMEOUT;
+    }
+  }
+  pthread_mutex_unlock(&tx->mutex);
+
+  return res;
+}
+
+/****************************************************************************
+ * @intro: queue user data like qrc_rel_send() without waiting. Frames past
+ *the send window wait in their slot until acks make room
+ * @param pipe: sender
+ * @param iov: user data segments
+ * @param iovcnt: number of segments
+ * @param done_cb: completion callback, NULL to use qrc_rel_poll()
+ * @param arg: argument of done_cb
+ * @param handle: handle of the write, reported with its completion
+ * @return: SUCCESS once queued, BUSY if QRC_MAX_SEND_WINDOW writes are
+ *pending, the bus is locked or the strand of the pipe has no room for the
+ *completion, FAILED
+ ****************************************************************************/
+enum qrc_write_status_e qrc_rel_send_async(const qrc_pipe_s * pipe,
+    const struct iovec * iov,
+    const int iovcnt,
+    qrc_write_done_cb done_cb,
+    void * arg,
+    uint32_t * handle)
+{
+  struct qrc_rel_pipe_s * r;
+  struct qrc_rel_tx_s * tx;
+  struct qrc_rel_txslot_s * slot;
+  uint16_t seq;
+  uint32_t h;
+
+  if (qrc_bus_gate_closed()) {
+    return BUSY;
+  }
+
+  r = qrc_rel_tx_lock(pipe, qrc_rel_iov_len(iov, iovcnt));
+  if (NULL == r) {
+    return FAILED;
+  }
+  tx = &r->tx;
+
+  if (QRC_SEQ_DIFF(tx->next_seq, tx->base) + tx->done_len >= QRC_REL_WINDOW_MAX) {
+    pthread_mutex_unlock(&tx->mutex);
+    return BUSY;
+  }
+  if (NULL == done_cb && !qrc_rel_event_fd_open(r)) {
+    pthread_mutex_unlock(&tx->mutex);
+    return FAILED;
+  }
+  /* the completion takes a slot of the strand now, it is never dropped */
+  if (NULL != done_cb && !qrc_strand_reserve(pipe)) {
+    pthread_mutex_unlock(&tx->mutex);
+    return BUSY;
+  }
+
+  do {
+    h = __atomic_add_fetch(&g_rel.last_handle, 1, __ATOMIC_RELAXED);
+  } while (0 == h);
+
+  slot = qrc_rel_tx_enqueue(r, iov, iovcnt, &seq);
+  slot->handle = h;
+  slot->done_cb = done_cb;
+  slot->done_arg = arg;
+  pthread_mutex_unlock(&tx->mutex);
+
+  *handle = h;
+  return SUCCESS;
+}
+
+/****************************************************************************
+ * @intro: fd that is readable while completions of async writes without
+ *callback wait for qrc_rel_poll()
+ * @return: fd or -1
+ ****************************************************************************/
+int qrc_rel_event_fd(const qrc_pipe_s * pipe)
+{
+  struct qrc_rel_pipe_s * r = qrc_rel_get(pipe);
+  int fd = -1;
+
+  if (NULL == r) {
+    return -1;
+  }
+
+  pthread_mutex_lock(&r->tx.mutex);
+  if (qrc_rel_event_fd_open(r)) {
+    fd = r->tx.event_fd[0];
+  }
+  pthread_mutex_unlock(&r->tx.mutex);
+
+  return fd;
+}
+
+/****************************************************************************
+ * @intro: take the oldest completion of the async writes without callback
+ * @param pipe: sender
+ * @param handle: handle of the write
+ * @param status: SUCCESS or TIMEOUT
+ * @return: false if there is none
+ ****************************************************************************/
+bool qrc_rel_poll(const qrc_pipe_s * pipe, uint32_t * handle, enum qrc_write_status_e * status)
+{
+  struct qrc_rel_pipe_s * r = __atomic_load_n(&g_rel.pipes[pipe->pipe_id], __ATOMIC_ACQUIRE);
+  struct qrc_rel_tx_s * tx;
+  uint8_t c;
+
+  if (NULL == r) {
+    return false;
+  }
+  tx = &r->tx;
+
+  pthread_mutex_lock(&tx->mutex);
+  if (0 == tx->done_len) {
+    pthread_mutex_unlock(&tx->mutex);
+    return false;
+  }
+  *handle = tx->done[tx->done_head & QRC_REL_MASK].handle;
+  *status = (enum qrc_write_status_e)tx->done[tx->done_head & QRC_REL_MASK].status;
+  tx->done_head++;
+  tx->done_len--;
+  if (read(tx->event_fd[0], &c, 1) != 1) {
+    QRC_LOGW("pipe(%s) write event drain failed", pipe->pipe_name);
+  }
+  pthread_mutex_unlock(&tx->mutex);
+
+  return true;
+}
+
+/****************************************************************************
+ * @intro: wait until every reliable frame of the pipe is acknowledged or
+ *given up
+ * @param pipe: sender
+ * @return: SUCCESS, TIMEOUT if frames were given up since the last flush,
+ *FAILED
+ ****************************************************************************/
+enum qrc_write_status_e qrc_rel_flush(const qrc_pipe_s * pipe)
+{
+  struct qrc_rel_pipe_s * r = qrc_rel_get(pipe);
+  enum qrc_write_status_e res = SUCCESS;
+
+  if (NULL == r) {
+    return FAILED;
+  }
+
+  pthread_mutex_lock(&r->tx.mutex);
+  while (!g_rel.stop && r->tx.base != r->tx.next_seq) {
+    qrc_rel_tx_wait(&r->tx);
+  }
+  if (g_rel.stop) {
+    res = FAILED;
+  } else if (0 != r->tx.lost) {
+    res = TIMEOUT;
+  }
+  r->tx.lost = 0;
+  pthread_mutex_unlock(&r->tx.mutex);
+
+  return res;
+}
+
+/****************************************************************************
+ * @intro: set the retransmission of a pipe, the timeout in use is kept
+ *within the new bounds
+ * @param pipe: sender
+ * @param policy: retry policy, NULL for the default
+ * @return: result of setting
+ ****************************************************************************/
+bool qrc_rel_set_policy(const qrc_pipe_s * pipe, const struct qrc_retry_policy_s * policy)
+{
+  struct qrc_retry_policy_s def = {QRC_REL_MAX_TRIES, QRC_REL_INIT_RTO_MS, QRC_REL_MIN_RTO_MS,
+      QRC_REL_MAX_RTO_MS};
+  struct qrc_rel_pipe_s * r;
+  struct qrc_rel_tx_s * tx;
+
+  if (NULL == policy) {
+    policy = &def;
+  }
+  if (0 == policy->max_tries || 0 == policy->min_rto_ms ||
+      policy->min_rto_ms > policy->max_rto_ms || policy->init_rto_ms < policy->min_rto_ms ||
+      policy->init_rto_ms > policy->max_rto_ms || policy->max_rto_ms > UINT32_MAX / 1000U) {
+    QRC_LOGE("pipe(%s) retry policy is invalid!", pipe->pipe_name);
+    return false;
+  }
+  r = qrc_rel_get(pipe);
+  if (NULL == r) {
+    return false;
+  }
+  tx = &r->tx;
+
+  pthread_mutex_lock(&tx->mutex);
+  tx->policy = *policy;
+  if (0 == tx->srtt_us) {
+    tx->rto_us = policy->init_rto_ms * 1000U;
+  } else if (tx->rto_us < policy->min_rto_ms * 1000U) {
+    tx->rto_us = policy->min_rto_ms * 1000U;
+  } else if (tx->rto_us > policy->max_rto_ms * 1000U) {
+    tx->rto_us = policy->max_rto_ms * 1000U;
+  }
+  pthread_mutex_unlock(&tx->mutex);
+
+  return true;
+}
+
+/****************************************************************************
+ * @intro: get the round trip estimate and retransmission counters of a pipe
+ * @param pipe: sender
+ * @param info: filled with the estimate
+ * @return: result of getting
+ ****************************************************************************/
+bool qrc_rel_get_rtt(const qrc_pipe_s * pipe, struct qrc_rtt_info_s * info)
+{
+  struct qrc_rel_pipe_s * r = qrc_rel_get(pipe);
+  struct qrc_rel_tx_s * tx;
+
+  if (NULL == r) {
+    return false;
+  }
+  tx = &r->tx;
+
+  pthread_mutex_lock(&tx->mutex);
+  info->srtt_us = tx->srtt_us;
+  info->rttvar_us = tx->rttvar_us;
+  info->rto_us = (uint32_t)qrc_rel_rto(tx);
+  info->samples = tx->samples;
+  info->retransmits = tx->retransmits;
+  info->given_up = tx->given_up;
+  info->acks = __atomic_load_n(&r->acks, __ATOMIC_RELAXED);
+  info->acks_piggybacked = __atomic_load_n(&r->acks_piggybacked, __ATOMIC_RELAXED);
+  pthread_mutex_unlock(&tx->mutex);
+
+  return true;
+}
+
+/****************************************************************************
+ * @intro: read thread, handle a reliable data frame: deliver it in order,
+ *hold it until the frames before it arrive, or drop a duplicate; then
+ *acknowledge
+ * @param p: receiver pipe
+ * @param seq: sequence number of the frame
+ * @param buf: slab holding data, the reference is passed on
+ * @param data: user data
+ * @param len: length of data
+ ****************************************************************************/
+void qrc_rel_on_data(qrc_pipe_s * p,
+    uint16_t seq,
+    struct qrc_rxbuf_s * buf,
+    uint8_t * data,
+    size_t len)
+{
+  struct qrc_rel_pipe_s * r = qrc_rel_get(p);
+  struct qrc_rel_rx_s * rx;
+  struct qrc_rel_held_s * h;
+  bool in_order = false;
+  uint16_t next;
+  int16_t dif;
+
+  if (NULL == r) {
+    qrc_rxbuf_release(buf);
+    qrc_stats_dropped(p);
+    qrc_credit_done(p);
+    return;
+  }
+  rx = &r->rx;
+
+  /* frames before the SYN are from a sequence we do not know, e.g. we
+   * restarted; the RST makes the sender announce it again */
+  if (!rx->synced) {
+    qrc_rxbuf_release(buf);
+    qrc_stats_dropped(p);
+    qrc_credit_done(p);
+    qrc_rel_send_rst(r);
+    return;
+  }
+
+  dif = QRC_SEQ_DIFF(seq, rx->next);
+  h = &rx->held[seq & QRC_REL_MASK];
+  if (dif < 0 || dif >= QRC_REL_WINDOW_MAX || NULL != h->buf) {
+    qrc_rxbuf_release(buf); /* duplicate, or beyond what we can hold */
+    qrc_stats_dropped(p);
+    qrc_credit_on_copy(p);
+  } else {
+    h->buf = buf;
+    h->data = data;
+    h->len = len;
+    next = rx->next;
+    qrc_rel_rx_drain(r, p);
+    in_order = (1 == (uint16_t)(rx->next - next));
+  }
+
+  qrc_rel_ack_update(r);
+  if (!in_order || ++rx->unacked >= QRC_REL_ACK_EVERY) {
+    /* a gap, its filling or a duplicate is told at once, the sender resends
+     * by it */
+    qrc_rel_send_ack(r);
+  } else {
+    qrc_rel_ack_queue(r);
+  }
+}
+
+/****************************************************************************
+ * @intro: read thread, handle an ack of our reliable frames
+ * @param p: sender pipe
+ * @param ack: next sequence number the peer expects
+ * @param sack: frames after ack the peer holds already
+ ****************************************************************************/
+void qrc_rel_on_ack(qrc_pipe_s * p, uint16_t ack, uint32_t sack)
+{
+  struct qrc_rel_pipe_s * r = __atomic_load_n(&g_rel.pipes[p->pipe_id], __ATOMIC_ACQUIRE);
+  struct qrc_rel_tx_s * tx;
+  uint64_t now;
+
+  if (NULL == r) {
+    return;
+  }
+  tx = &r->tx;
+
+  pthread_mutex_lock(&tx->mutex);
+  if (QRC_SEQ_DIFF(ack, tx->base) < 0 || QRC_SEQ_DIFF(tx->next_seq, ack) < 0) {
+    pthread_mutex_unlock(&tx->mutex); /* stale */
+    return;
+  }
+
+  now = qrc_timer_now_us();
+  if (!tx->synced) {
+    /* the peer dropped the frames sent before it got the SYN, resend them */
+    tx->synced = true;
+    tx->resync = false;
+    if ((int32_t)(tx->syn_stamp - tx->delivered) > 0) {
+      tx->delivered = tx->syn_stamp;
+    }
+  }
+  while (tx->base != ack) {
+    struct qrc_rel_txslot_s * slot = &tx->slots[tx->base & QRC_REL_MASK];
+    qrc_rel_tx_delivered(r, slot, now);
+    slot->state = QRC_REL_FREE;
+    tx->base++;
+  }
+  for (uint16_t i = 0; i + 1 < QRC_REL_WINDOW_MAX && (sack >> i); i++) {
+    uint16_t seq = ack + 1 + i;
+    if (QRC_SEQ_DIFF(tx->next_seq, seq) <= 0) {
+      break;
+    }
+    if (sack & (1UL << i)) {
+      qrc_rel_tx_delivered(r, &tx->slots[seq & QRC_REL_MASK], now);
+    }
+  }
+
+  /* resend the lost frames now instead of waiting for their timeout, and
+   * send the queued ones the window has room for */
+  qrc_rel_tx_advance(r);
+  qrc_rel_tx_pump(r, now);
+
+  pthread_cond_broadcast(&tx->cond);
+  pthread_mutex_unlock(&tx->mutex);
+}
+
+/****************************************************************************
+ * @intro: read thread, handle a SYN: the peer starts its sequence at seq. A
+ *seq near the one expected comes from a peer that gave frames up or resyncs,
+ *what is held before seq is delivered and the missing frames are skipped.
+ *Any other seq starts a new sequence
+ * @param p: receiver pipe
+ * @param seq: sequence number carried by the frame
+ ****************************************************************************/
+void qrc_rel_on_syn(qrc_pipe_s * p, uint16_t seq)
+{
+  struct qrc_rel_pipe_s * r = qrc_rel_get(p);
+  struct qrc_rel_rx_s * rx;
+  int16_t dif;
+
+  if (NULL == r) {
+    return;
+  }
+  rx = &r->rx;
+
+  dif = QRC_SEQ_DIFF(seq, rx->next);
+  if (rx->synced && seq == rx->syn_seq) {
+    /* retransmitted, only acked again */
+  } else if (rx->synced && dif >= -QRC_REL_WINDOW_MAX && dif <= QRC_REL_WINDOW_MAX) {
+    while (QRC_SEQ_DIFF(seq, rx->next) > 0) {
+      struct qrc_rel_held_s * h = &rx->held[rx->next & QRC_REL_MASK];
+      if (NULL != h->buf) {
+        qrc_msg_dispatch(p, h->buf, h->data, h->len, NO_ACK, 0);
+        h->buf = NULL;
+      }
+      rx->next++;
+    }
+    qrc_rel_rx_drain(r, p);
+    rx->syn_seq = seq;
+  } else {
+    for (int i = 0; i < QRC_REL_WINDOW_MAX; i++) {
+      if (NULL != rx->held[i].buf) {
+        qrc_rxbuf_release(rx->held[i].buf);
+        rx->held[i].buf = NULL;
+        qrc_credit_done(p);
+      }
+    }
+    rx->synced = true;
+    rx->syn_seq = seq;
+    rx->next = seq;
+  }
+
+  qrc_rel_ack_update(r);
+  qrc_rel_send_ack(r);
+}
+
+/****************************************************************************
+ * @intro: read thread, handle a RST: the peer has no sequence of ours, e.g.
+ *it restarted. It lost what it held, so start anew with a SYN
+ * @param p: sender pipe
+ ****************************************************************************/
+void qrc_rel_on_rst(qrc_pipe_s * p)
+{
+  struct qrc_rel_pipe_s * r = __atomic_load_n(&g_rel.pipes[p->pipe_id], __ATOMIC_ACQUIRE);
+
+  if (NULL == r) {
+    return;
+  }
+
+  pthread_mutex_lock(&r->tx.mutex);
+  /* RSTs sent before the peer got our SYN come before its ack of it */
+  if (r->tx.synced) {
+    QRC_LOGW("pipe(%s) peer lost the sequence, resync", p->pipe_name);
+    qrc_rel_tx_resync(r, true, qrc_timer_now_us());
+  }
+  pthread_mutex_unlock(&r->tx.mutex);
+  qrc_rel_kick(r);
+}
+
+/****************************************************************************
+ * @intro: control thread, the peer requested the pipe anew, it restarted and
+ *knows no sequence of ours
+ * @param pipe: sender
+ ****************************************************************************/
+void qrc_rel_on_peer_connect(const qrc_pipe_s * pipe)
+{
+  struct qrc_rel_pipe_s * r = __atomic_load_n(&g_rel.pipes[pipe->pipe_id], __ATOMIC_ACQUIRE);
+
+  if (NULL == r) {
+    return;
+  }
+
+  pthread_mutex_lock(&r->tx.mutex);
+  if (r->tx.synced || r->tx.base != r->tx.next_seq) {
+    qrc_rel_tx_resync(r, true, qrc_timer_now_us());
+  }
+  pthread_mutex_unlock(&r->tx.mutex);
+  qrc_rel_kick(r);
+}
+
+/****************************************************************************
+ * @intro: control thread, the peer started, resync every pipe that sent to
+ *it before
+ ****************************************************************************/
+void qrc_rel_on_peer_restart(void)
+{
+  for (int i = 0; i < MAX_PIPE_ID; i++) {
+    struct qrc_rel_pipe_s * r = __atomic_load_n(&g_rel.pipes[i], __ATOMIC_ACQUIRE);
+    if (NULL != r) {
+      qrc_rel_on_peer_connect(r->pipe);
+    }
+  }
+}
+
+/****************************************************************************
+ * @intro: read thread, an ack timer fired since the last call, so a
+ *delayed ack may be due
+ ****************************************************************************/
+bool qrc_rel_ack_timer_fired(void)
+{
+  return __atomic_exchange_n(&g_rel.ack_fired, false, __ATOMIC_ACQUIRE);
+}
+
+/****************************************************************************
+ * @intro: read thread, the link has no more data for now: send the acks
+ *left for the end of the burst and the delayed ones that are due
+ ****************************************************************************/
+void qrc_rel_flush_acks(void)
+{
+  struct qrc_rel_pipe_s ** link = &g_rel.ack_list;
+  struct qrc_rel_pipe_s * r;
+  uint64_t now = 0;
+
+  while (NULL != (r = *link)) {
+    if (0 != r->rx.ack_due_us && 0 != __atomic_load_n(&r->ack_word, __ATOMIC_RELAXED)) {
+      if (0 == now) {
+        now = qrc_timer_now_us();
+      }
+      if (now < r->rx.ack_due_us) {
+        link = &r->rx.ack_next;
+        continue;
+      }
+    }
+    *link = r->rx.ack_next;
+    r->rx.ack_queued = false;
+    qrc_rel_send_ack(r);
+  }
+}
+
+/****************************************************************************
+ * @intro: read thread, the peer gave credits: send the frames of the pipe
+ *they refused now instead of at the rescan
+ * @param pipe: sender
+ ****************************************************************************/
+void qrc_rel_on_credit(const qrc_pipe_s * pipe)
+{
+  struct qrc_rel_pipe_s * r = __atomic_load_n(&g_rel.pipes[pipe->pipe_id], __ATOMIC_ACQUIRE);
+  uint64_t now;
+
+  if (NULL == r) {
+    return;
+  }
+
+  pthread_mutex_lock(&r->tx.mutex);
+  now = qrc_timer_now_us();
+  for (int i = 0; i < QRC_REL_WINDOW_MAX; i++) {
+    if (QRC_REL_INFLIGHT == r->tx.slots[i].state && r->tx.slots[i].refused) {
+      r->tx.slots[i].due_us = now;
+    }
+  }
+  qrc_rel_tx_pump(r, now);
+  pthread_mutex_unlock(&r->tx.mutex);
+  qrc_rel_kick(r);
+}
+
+/****************************************************************************
+ * @intro: send a frame that is not reliable data (e.g. a request or a
+ *response) to the peer pipe with the ack we owe the peer on it
+ * @param pipe: sender
+ * @return: result of qrc_frame_sendv()
+ ****************************************************************************/
+enum qrc_write_status_e qrc_rel_frame_sendv(const qrc_pipe_s * pipe,
+    qrc_frame * qrcf,
+    struct qrc_ext_s * ext,
+    const struct iovec * iov,
+    const int iovcnt,
+    bool wait)
+{
+  struct qrc_rel_pipe_s * r = __atomic_load_n(&g_rel.pipes[pipe->pipe_id], __ATOMIC_ACQUIRE);
+
+  if (NULL == r) {
+    return qrc_pipe_sendv(pipe, qrcf, ext, iov, iovcnt, wait, false);
+  }
+  return qrc_rel_sendv(r, qrcf, ext, iov, iovcnt, wait, false);
+}
+
+/****************************************************************************
+ * @intro: set how long the ack of the reliable frames a pipe receives may
+ *wait for a frame of ours to ride on
+ * @param pipe: receiver
+ * @param delay_us: 0 ~ QRC_MAX_ACK_DELAY_US, 0 acks at the end of each
+ *receive burst
+ * @return: result of setting
+ ****************************************************************************/
+bool qrc_rel_set_ack_delay(const qrc_pipe_s * pipe, uint32_t delay_us)
+{
+  struct qrc_rel_pipe_s * r;
+
+  if (delay_us > QRC_MAX_ACK_DELAY_US) {
+    QRC_LOGE("ack delay %u us is out of 0 ~ %d!", (unsigned)delay_us, QRC_MAX_ACK_DELAY_US);
+    return false;
+  }
+  r = qrc_rel_get(pipe);
+  if (NULL == r) {
+    return false;
+  }
+  __atomic_store_n(&r->ack_delay_us, delay_us, __ATOMIC_RELAXED);
+
+  return true;
+}
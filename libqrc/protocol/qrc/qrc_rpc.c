@@ -0,0 +1,313 @@
+/****************************************************************************
+ *
+ * Copyright (c) 2024 Qualcomm Innovation Center, Inc. All rights reserved.
+ * SPDX-License-Identifier: BSD-3-Clause-Clear
+ *
+ ****************************************************************************/
+#include <stdio.h>
+
+#include "qrc.h"
+
+/****************************************************************************
+ * Pre-processor Definitions
+ ****************************************************************************/
+
+#ifdef QRC_MCB
+#define QRC_RPC_BITS (3)
+#else
+#define QRC_RPC_BITS (6)
+#endif
+
+#define QRC_RPC_SLOTS (1 << QRC_RPC_BITS) /* requests waiting for a response */
+#define QRC_RPC_MASK (QRC_RPC_SLOTS - 1)
+
+/****************************************************************************
+ * Private Types
+ ****************************************************************************/
+
+enum qrc_rpc_state_e
+{
+  QRC_RPC_FREE = 0,
+  QRC_RPC_WAITING, /* request sent, caller waits */
+  QRC_RPC_DONE,    /* response copied into the caller's buffer, or given up */
+};
+
+/* outstanding request, the low QRC_RPC_BITS of its id are the slot index */
+struct qrc_rpc_call_s
+{
+  pthread_cond_t cond;
+  struct qrc_timer_s timer;
+  bool expired;
+  uint8_t state;
+  uint16_t pipe_id;
+  uint16_t id;
+  uint16_t gen; /* makes ids of a reused slot differ */
+  uint8_t * buf;
+  size_t cap;
+  size_t len; /* length of the response, may be more than cap */
+};
+
+struct qrc_rpc_s
+{
+  pthread_mutex_t mutex;
+  pthread_key_t request_key; /* request the callback of this thread answers */
+  struct qrc_rpc_call_s calls[QRC_RPC_SLOTS];
+  volatile bool stop;
+};
+
+/****************************************************************************
+ * Private Data
+ ****************************************************************************/
+
+static struct qrc_rpc_s g_rpc;
+
+/****************************************************************************
+ * Private Functions
+ ****************************************************************************/
+
+/* mutex held, take a free slot and give it a new id */
+static struct qrc_rpc_call_s * qrc_rpc_alloc(void)
+{
+  for (uint16_t i = 0; i < QRC_RPC_SLOTS; i++) {
+    struct qrc_rpc_call_s * call = &g_rpc.calls[i];
+    if (QRC_RPC_FREE != call->state) {
+      continue;
+    }
+    do {
+      call->gen++;
+      call->id = (uint16_t)((call->gen << QRC_RPC_BITS) | i);
+    } while (0 == call->id);
+    return call;
+  }
+
+  return NULL;
+}
+
+static enum qrc_write_status_e qrc_rpc_send(const qrc_pipe_s * pipe,
+    uint8_t flags,
+    uint16_t id,
+    const void * data,
+    const size_t len)
+{
+  qrc_frame qrcf;
+  struct qrc_ext_s ext;
+  struct iovec iov;
+
+  memset(&qrcf, 0, sizeof(qrcf));
+  qrcf.sync_mode = 1;
+  qrcf.ack = NO_ACK;
+  memset(&ext, 0, sizeof(ext));
+  ext.flags = flags;
+  ext.rpc = id;
+  iov.iov_base = (void *)data;
+  iov.iov_len = len;
+
+  /* carries the ack of the peer's writes with ack, if we owe one. A request
+   * needs a credit of the peer */
+  return qrc_rel_frame_sendv(pipe, &qrcf, &ext, &iov, (0 == len) ? 0 : 1, true);
+}
+
+/* timer callback, the response did not come in time */
+static void qrc_rpc_expired(void * arg)
+{
+  struct qrc_rpc_call_s * call = (struct qrc_rpc_call_s *)arg;
+
+  pthread_mutex_lock(&g_rpc.mutex);
+  if (QRC_RPC_WAITING == call->state) {
+    call->expired = true;
+    pthread_cond_signal(&call->cond);
+  }
+  pthread_mutex_unlock(&g_rpc.mutex);
+}
+
+/****************************************************************************
+ * Public Functions
+ ****************************************************************************/
+
+bool qrc_rpc_init(void)
+{
+  memset(&g_rpc, 0, sizeof(g_rpc));
+  if (0 != pthread_mutex_init(&g_rpc.mutex, NULL) ||
+      0 != pthread_key_create(&g_rpc.request_key, NULL)) {
+    QRC_LOGE("qrc rpc mutex initalize failed!");
+    return false;
+  }
+  for (int i = 0; i < QRC_RPC_SLOTS; i++) {
+    if (0 != pthread_cond_init(&g_rpc.calls[i].cond, NULL)) {
+      QRC_LOGE("qrc rpc cond initalize failed!");
+      return false;
+    }
+    qrc_timer_setup(&g_rpc.calls[i].timer, qrc_rpc_expired, &g_rpc.calls[i]);
+  }
+
+  return true;
+}
+
+/****************************************************************************
+ * @intro: fail the callers still waiting for a response, free the key of
+ *the answering thread
+ ****************************************************************************/
+void qrc_rpc_destroy(void)
+{
+  pthread_mutex_lock(&g_rpc.mutex);
+  g_rpc.stop = true;
+  for (int i = 0; i < QRC_RPC_SLOTS; i++) {
+    pthread_cond_broadcast(&g_rpc.calls[i].cond);
+  }
+  pthread_mutex_unlock(&g_rpc.mutex);
+  pthread_key_delete(g_rpc.request_key);
+}
+
+/****************************************************************************
+ * @intro: send a request and wait for its response, any number of threads
+ *may call it at once on any pipes
+ * @param pipe: requester
+ * @param data: request
+ * @param len: length of data
+ * @param rsp: buffer for the response, filled by the read thread
+ * @param rsp_len: in: size of rsp, out: length of the response
+ * @param timeout_ms: time to wait for the response
+ * @return: SUCCESS, TIMEOUT, BUSY if too many requests are outstanding or
+ *the tx ring is full, FAILED if the response does not fit in rsp
+ ****************************************************************************/
+enum qrc_write_status_e qrc_rpc_call(const qrc_pipe_s * pipe,
+    const void * data,
+    const size_t len,
+    void * rsp,
+    size_t * rsp_len,
+    uint32_t timeout_ms)
+{
+  struct qrc_rpc_call_s * call;
+  enum qrc_write_status_e res;
+  uint16_t id;
+
+  if (len > QRC_MAX_PAYLOAD) {
+    QRC_LOGE("pipe(%s) request of %u bytes is too long!", pipe->pipe_name, (unsigned)len);
+    return FAILED;
+  }
+
+  pthread_mutex_lock(&g_rpc.mutex);
+  if (g_rpc.stop) {
+    pthread_mutex_unlock(&g_rpc.mutex);
+    return FAILED;
+  }
+  call = qrc_rpc_alloc();
+  if (NULL == call) {
+    pthread_mutex_unlock(&g_rpc.mutex);
+    QRC_LOGE("pipe(%s) too many requests wait for responses!", pipe->pipe_name);
+    return BUSY;
+  }
+  call->state = QRC_RPC_WAITING;
+  call->pipe_id = pipe->pipe_id;
+  call->buf = (uint8_t *)rsp;
+  call->cap = *rsp_len;
+  call->len = 0;
+  call->expired = false;
+  id = call->id;
+  pthread_mutex_unlock(&g_rpc.mutex);
+
+  /* the slot is waiting before the request leaves, so a fast response finds it */
+  res = qrc_rpc_send(pipe, QRC_EXT_REQ, id, data, len);
+
+  QRC_TRACE2(rpc_wait, pipe->pipe_id, id);
+  pthread_mutex_lock(&g_rpc.mutex);
+  if (SUCCESS == res) {
+    qrc_timer_arm(&call->timer, timeout_ms * 1000ULL);
+  }
+  while (SUCCESS == res && QRC_RPC_WAITING == call->state && !g_rpc.stop && !call->expired) {
+    pthread_cond_wait(&call->cond, &g_rpc.mutex);
+  }
+  if (SUCCESS == res && QRC_RPC_DONE == call->state) {
+    *rsp_len = call->len;
+    if (call->len > call->cap) {
+      QRC_LOGE("pipe(%s) response of %u bytes is cut to %u!",
+          pipe->pipe_name,
+          (unsigned)call->len,
+          (unsigned)call->cap);
+      res = FAILED;
+    }
+  } else if (SUCCESS == res) {
+    res = g_rpc.stop ? FAILED : TIMEOUT;
+    if (TIMEOUT == res) {
+      QRC_STAT_ADD(qrc_stats_pipe(pipe->pipe_id)->timeouts, 1);
+    }
+  }
+  /* a late response finds the call done, the slot is freed once the timer
+   * callback can not run any more */
+  call->state = QRC_RPC_DONE;
+  call->buf = NULL;
+  pthread_mutex_unlock(&g_rpc.mutex);
+  QRC_TRACE3(rpc_wait_done, pipe->pipe_id, id, TIMEOUT == res);
+
+  qrc_timer_cancel(&call->timer);
+
+  pthread_mutex_lock(&g_rpc.mutex);
+  call->state = QRC_RPC_FREE;
+  pthread_mutex_unlock(&g_rpc.mutex);
+
+  return res;
+}
+
+/****************************************************************************
+ * @intro: answer the request being handled by the pipe callback of the
+ *calling thread, once per request
+ * @param pipe: the pipe the request came in on
+ * @param data: response
+ * @param len: length of data
+ * @return: SUCCESS, FAILED if not called from such a callback, BUSY
+ ****************************************************************************/
+enum qrc_write_status_e qrc_rpc_respond(const qrc_pipe_s * pipe,
+    const void * data,
+    const size_t len)
+{
+  uintptr_t request = (uintptr_t)pthread_getspecific(g_rpc.request_key);
+
+  if (0 == request || (request >> 16) != pipe->pipe_id) {
+    QRC_LOGE("pipe(%s) qrc_response() is not in the callback of a request!", pipe->pipe_name);
+    return FAILED;
+  }
+  if (len > QRC_MAX_PAYLOAD) {
+    QRC_LOGE("pipe(%s) response of %u bytes is too long!", pipe->pipe_name, (unsigned)len);
+    return FAILED;
+  }
+  pthread_setspecific(g_rpc.request_key, NULL);
+
+  return qrc_rpc_send(pipe, QRC_EXT_RSP, (uint16_t)request, data, len);
+}
+
+/****************************************************************************
+ * @intro: read thread, copy a response into the buffer of its caller and
+ *wake it up. Responses after the timeout are dropped
+ * @param p: pipe that received the response
+ * @param id: request id
+ * @param data: response
+ * @param len: length of data
+ ****************************************************************************/
+void qrc_rpc_on_response(const qrc_pipe_s * p, uint16_t id, const uint8_t * data, size_t len)
+{
+  struct qrc_rpc_call_s * call = &g_rpc.calls[id & QRC_RPC_MASK];
+
+  pthread_mutex_lock(&g_rpc.mutex);
+  if (QRC_RPC_WAITING == call->state && id == call->id && p->pipe_id == call->pipe_id) {
+    memcpy(call->buf, data, (len < call->cap) ? len : call->cap);
+    call->len = len;
+    call->state = QRC_RPC_DONE;
+    pthread_cond_signal(&call->cond);
+  } else {
+    QRC_LOGW("pipe(%s) late response %u dropped", p->pipe_name, (unsigned)id);
+  }
+  pthread_mutex_unlock(&g_rpc.mutex);
+}
+
+/****************************************************************************
+ * @intro: the pipe callback of this thread is handling request id
+ ****************************************************************************/
+void qrc_rpc_enter(const qrc_pipe_s * p, uint16_t id)
+{
+  pthread_setspecific(g_rpc.request_key, (void *)(((uintptr_t)p->pipe_id << 16) | id));
+}
+
+void qrc_rpc_leave(void)
+{
+  pthread_setspecific(g_rpc.request_key, NULL);
+}
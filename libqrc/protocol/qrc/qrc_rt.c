@@ -0,0 +1,412 @@
+/****************************************************************************
+ *
+ * Copyright (c) 2024 Qualcomm Innovation Center, Inc. All rights reserved.
+ * SPDX-License-Identifier: BSD-3-Clause-Clear
+ *
+ ****************************************************************************/
+#ifndef QRC_MCB
+#define _GNU_SOURCE /* CPU affinity and thread names */
+#endif
+#include <pthread.h>
+#include <sched.h>
+#include <stdio.h>
+#ifndef QRC_MCB
+#include <limits.h>
+#include <sys/mman.h>
+#endif
+
+#include "qrc.h"
+
+/****************************************************************************
+ * Pre-processor Definitions
+ ****************************************************************************/
+
+#define QRC_RT_HEADER "qrc-threads 1"
+#define QRC_RT_PAGE (4096)
+#define QRC_RT_STACK_MARGIN (16 * 1024) /* of the stack left untouched by the prefault */
+#define QRC_RT_CPUS (64)                /* CPUs a thread config can name */
+
+/****************************************************************************
+ * Private Types
+ ****************************************************************************/
+
+/* scheduling of the library threads, applied when they are created */
+struct qrc_rt_s
+{
+  struct qrc_thread_config_s config[QRC_THREAD_ROLES];
+  bool mlock;  /* mlockall() in init */
+  bool locked; /* memory is locked by us */
+};
+
+#ifndef QRC_MCB
+/* what a new thread does before its own function */
+struct qrc_rt_start_s
+{
+  void * (*fun)(void *);
+  void * arg;
+  enum qrc_thread_role_e role;
+  size_t prefault_size;
+};
+#endif
+
+/****************************************************************************
+ * Private Data
+ ****************************************************************************/
+
+static struct qrc_rt_s g_rt;
+
+#ifndef QRC_MCB
+static const char * const g_rt_roles[QRC_THREAD_ROLES] = {"read", "write", "control", "message"};
+#endif
+
+/****************************************************************************
+ * Private Functions
+ ****************************************************************************/
+
+#ifndef QRC_MCB
+/* stack of a thread created without a stack size */
+static size_t qrc_rt_default_stack(void)
+{
+  pthread_attr_t attr;
+  size_t size = 0;
+
+  if (0 == pthread_attr_init(&attr)) {
+    pthread_attr_getstacksize(&attr, &size);
+    pthread_attr_destroy(&attr);
+  }
+  return size;
+}
+
+/****************************************************************************
+ * @intro: check a thread config
+ * @return: false with an error logged if it can not be applied
+ ****************************************************************************/
+static bool qrc_rt_check(enum qrc_thread_role_e role, const struct qrc_thread_config_s * c)
+{
+  const char * name = g_rt_roles[role];
+  size_t stack;
+
+  if (SCHED_OTHER != c->policy && SCHED_FIFO != c->policy && SCHED_RR != c->policy) {
+    QRC_LOGE("%s thread policy(%d) is invalid!", name, c->policy);
+    return false;
+  }
+  if ((SCHED_OTHER == c->policy && 0 != c->priority) ||
+      (SCHED_OTHER != c->policy && (c->priority < sched_get_priority_min(c->policy) ||
+                                       c->priority > sched_get_priority_max(c->policy)))) {
+    QRC_LOGE("%s thread priority(%d) is invalid for its policy!", name, c->priority);
+    return false;
+  }
+  if (0 != c->stack_size && c->stack_size < (size_t)PTHREAD_STACK_MIN) {
+    QRC_LOGE("%s thread stack of %zu bytes is too small!", name, c->stack_size);
+    return false;
+  }
+  stack = (0 != c->stack_size) ? c->stack_size : qrc_rt_default_stack();
+  if (0 != c->prefault_size && c->prefault_size + QRC_RT_STACK_MARGIN > stack) {
+    QRC_LOGE("%s thread prefault of %zu bytes does not fit its stack of %zu!",
+        name,
+        c->prefault_size,
+        stack);
+    return false;
+  }
+  return true;
+}
+
+/****************************************************************************
+ * @intro: parse a CPU list like "2-3,6", or "any"
+ * @param cpus: bit n for CPU n, 0 for any
+ * @return: false if the list is invalid
+ ****************************************************************************/
+static bool qrc_rt_parse_cpus(const char * list, uint64_t * cpus)
+{
+  const char * s = list;
+  char * end;
+
+  *cpus = 0;
+  if (0 == strcmp(list, "any")) {
+    return true;
+  }
+  for (;;) {
+    unsigned long first = strtoul(s, &end, 10);
+    unsigned long last = first;
+    if (end == s) {
+      return false;
+    }
+    if ('-' == *end) {
+      s = end + 1;
+      last = strtoul(s, &end, 10);
+      if (end == s) {
+        return false;
+      }
+    }
+    if (first > last || last >= QRC_RT_CPUS) {
+      return false;
+    }
+    for (unsigned long cpu = first; cpu <= last; cpu++) {
+      *cpus |= 1ULL << cpu;
+    }
+    if ('\0' == *end) {
+      return true;
+    }
+    if (',' != *end) {
+      return false;
+    }
+    s = end + 1;
+  }
+}
+
+static bool qrc_rt_parse_policy(const char * name, int * policy)
+{
+  if (0 == strcmp(name, "other")) {
+    *policy = SCHED_OTHER;
+  } else if (0 == strcmp(name, "fifo")) {
+    *policy = SCHED_FIFO;
+  } else if (0 == strcmp(name, "rr")) {
+    *policy = SCHED_RR;
+  } else {
+    return false;
+  }
+  return true;
+}
+
+/* touch the pages of the stack a thread will use, so they fault in now */
+static __attribute__((noinline)) void qrc_rt_prefault(size_t size)
+{
+  uint8_t stack[size];
+
+  for (size_t i = 0; i < size; i += QRC_RT_PAGE) {
+    stack[i] = 0;
+  }
+  __asm__ __volatile__("" : : "r"(stack) : "memory"); /* keep the stores */
+}
+
+static void * qrc_rt_start(void * args)
+{
+  struct qrc_rt_start_s start = *(struct qrc_rt_start_s *)args;
+  char name[16];
+
+  free(args);
+  snprintf(name, sizeof(name), "qrc-%s", g_rt_roles[start.role]);
+  pthread_setname_np(pthread_self(), name);
+  if (0 != start.prefault_size) {
+    qrc_rt_prefault(start.prefault_size);
+  }
+  return start.fun(start.arg);
+}
+#endif
+
+/****************************************************************************
+ * Public Functions
+ ****************************************************************************/
+
+/****************************************************************************
+ * @intro: set the scheduling of the threads of a role, set before init
+ * @param config: NULL for the default
+ * @return: false if it is invalid
+ ****************************************************************************/
+bool qrc_rt_set_config(enum qrc_thread_role_e role, const struct qrc_thread_config_s * config)
+{
+  if (role < QRC_THREAD_READ || role >= QRC_THREAD_ROLES) {
+    QRC_LOGE("thread role(%d) is invalid!", role);
+    return false;
+  }
+  if (NULL == config) {
+    memset(&g_rt.config[role], 0, sizeof(g_rt.config[role]));
+    return true;
+  }
+#ifdef QRC_MCB
+  QRC_LOGE("thread config is not supported on MCB!");
+  return false;
+#else
+  if (!qrc_rt_check(role, config)) {
+    return false;
+  }
+  g_rt.config[role] = *config;
+  return true;
+#endif
+}
+
+/****************************************************************************
+ * @intro: set the thread configs from a file, set before init. After the
+ *"qrc-threads 1" header each line is "mlockall" or
+ *"<role> <policy> <priority> <cpus> [stack_size [prefault_size]]", role is
+ *read, write, control or message, policy is other, fifo or rr, cpus is a
+ *list like 2-3,6 or any. '#' starts a comment line
+ * @return: false if the file can not be read or a line is invalid, nothing
+ *is set then
+ ****************************************************************************/
+bool qrc_rt_load_file(const char * path)
+{
+#ifdef QRC_MCB
+  QRC_LOGE("thread config file %s is not supported on MCB!", path);
+  return false;
+#else
+  struct qrc_thread_config_s config[QRC_THREAD_ROLES];
+  bool mlock = g_rt.mlock;
+  char line[160];
+  int n = 1;
+  FILE * f;
+
+  f = fopen(path, "r");
+  if (NULL == f) {
+    QRC_LOGE("thread config %s can not be opened, errno=%d!", path, errno);
+    return false;
+  }
+  if (NULL == fgets(line, sizeof(line), f) ||
+      0 != strncmp(line, QRC_RT_HEADER, strlen(QRC_RT_HEADER))) {
+    QRC_LOGE("thread config %s is not valid!", path);
+    fclose(f);
+    return false;
+  }
+
+  memcpy(config, g_rt.config, sizeof(config));
+  while (NULL != fgets(line, sizeof(line), f)) {
+    char role_name[16];
+    char policy_name[16];
+    char cpus[64];
+    struct qrc_thread_config_s c;
+    int role;
+    int fields;
+
+    n++;
+    memset(&c, 0, sizeof(c));
+    fields = sscanf(line, "%15s %15s %d %63s %zu %zu", role_name, policy_name, &c.priority, cpus,
+        &c.stack_size, &c.prefault_size);
+    if (fields <= 0 || '#' == role_name[0]) {
+      continue;
+    }
+    if (1 == fields && 0 == strcmp(role_name, "mlockall")) {
+      mlock = true;
+      continue;
+    }
+    for (role = 0; role < QRC_THREAD_ROLES; role++) {
+      if (0 == strcmp(role_name, g_rt_roles[role])) {
+        break;
+      }
+    }
+    if (fields < 4 || QRC_THREAD_ROLES == role || !qrc_rt_parse_policy(policy_name, &c.policy) ||
+        !qrc_rt_parse_cpus(cpus, &c.cpus) || !qrc_rt_check((enum qrc_thread_role_e)role, &c)) {
+      QRC_LOGE("thread config %s line %d is not valid!", path, n);
+      fclose(f);
+      return false;
+    }
+    config[role] = c;
+  }
+  fclose(f);
+
+  memcpy(g_rt.config, config, sizeof(config));
+  g_rt.mlock = mlock;
+  return true;
+#endif
+}
+
+/****************************************************************************
+ * @intro: lock the memory of the process in init, set before init
+ ****************************************************************************/
+bool qrc_rt_set_mlock(bool enable)
+{
+#ifdef QRC_MCB
+  if (enable) {
+    QRC_LOGE("memory lock is not supported on MCB!");
+    return false;
+  }
+#endif
+  g_rt.mlock = enable;
+  return true;
+}
+
+/****************************************************************************
+ * @intro: init, lock the pages of the process now and later, before the
+ *threads and pools allocate theirs. Failing is not fatal
+ ****************************************************************************/
+void qrc_rt_lock_memory(void)
+{
+#ifndef QRC_MCB
+  if (!g_rt.mlock || g_rt.locked) {
+    return;
+  }
+  if (0 != mlockall(MCL_CURRENT | MCL_FUTURE)) {
+    QRC_LOGW("mlockall failed, errno=%d, memory is not locked", errno);
+    return;
+  }
+  g_rt.locked = true;
+#endif
+}
+
+/* destroy, unlock what qrc_rt_lock_memory() locked */
+void qrc_rt_unlock_memory(void)
+{
+#ifndef QRC_MCB
+  if (g_rt.locked) {
+    munlockall();
+    g_rt.locked = false;
+  }
+#endif
+}
+
+/****************************************************************************
+ * @intro: create a thread of a role with its config. A policy the process
+ *may not set is warned about and the thread inherits the one of its creator
+ * @return: 0 or the error of pthread_create()
+ ****************************************************************************/
+int qrc_rt_thread_create(enum qrc_thread_role_e role,
+    pthread_t * thread,
+    void * (*fun)(void *),
+    void * arg)
+{
+#ifdef QRC_MCB
+  (void)role;
+  return pthread_create(thread, NULL, fun, arg);
+#else
+  const struct qrc_thread_config_s * c = &g_rt.config[role];
+  struct qrc_rt_start_s * start;
+  struct sched_param sparam;
+  pthread_attr_t attr;
+  cpu_set_t cpus;
+  int status;
+
+  start = (struct qrc_rt_start_s *)malloc(sizeof(struct qrc_rt_start_s));
+  if (NULL == start) {
+    QRC_LOGE("%s thread malloc failed!", g_rt_roles[role]);
+    return ENOMEM;
+  }
+  start->fun = fun;
+  start->arg = arg;
+  start->role = role;
+  start->prefault_size = c->prefault_size;
+
+  pthread_attr_init(&attr);
+  if (0 != c->stack_size) {
+    pthread_attr_setstacksize(&attr, c->stack_size);
+  }
+  if (0 != c->cpus) {
+    CPU_ZERO(&cpus);
+    for (int cpu = 0; cpu < QRC_RT_CPUS; cpu++) {
+      if (c->cpus & (1ULL << cpu)) {
+        CPU_SET(cpu, &cpus);
+      }
+    }
+    pthread_attr_setaffinity_np(&attr, sizeof(cpus), &cpus);
+  }
+  if (SCHED_OTHER != c->policy) {
+    sparam.sched_priority = c->priority;
+    pthread_attr_setinheritsched(&attr, PTHREAD_EXPLICIT_SCHED);
+    pthread_attr_setschedpolicy(&attr, c->policy);
+    pthread_attr_setschedparam(&attr, &sparam);
+  }
+
+  status = pthread_create(thread, &attr, qrc_rt_start, start);
+  if (EPERM == status && SCHED_OTHER != c->policy) {
+    QRC_LOGW("%s thread may not run at priority %d, it inherits the policy of its creator",
+        g_rt_roles[role],
+        c->priority);
+    pthread_attr_setinheritsched(&attr, PTHREAD_INHERIT_SCHED);
+    status = pthread_create(thread, &attr, qrc_rt_start, start);
+  }
+  if (0 != status) {
+    QRC_LOGE("%s thread create failed, status=%d", g_rt_roles[role], status);
+    free(start);
+  }
+  pthread_attr_destroy(&attr);
+  return status;
+#endif
+}
@@ -0,0 +1,246 @@
+/****************************************************************************
+ *
+ * Copyright (c) 2024 Qualcomm Innovation Center, Inc. All rights reserved.
+ * SPDX-License-Identifier: BSD-3-Clause-Clear
+ *
+ ****************************************************************************/
+#include <stdio.h>
+
+#include "qrc.h"
+
+/****************************************************************************
+ * Pre-processor Definitions
+ ****************************************************************************/
+
+#ifdef QRC_MCB
+#define QRC_RXBUF_FIRST_CHUNK (4)
+#define QRC_RXBUF_MAX_SLABS (16)
+#else
+#define QRC_RXBUF_FIRST_CHUNK (16)
+#define QRC_RXBUF_MAX_SLABS (512)
+#endif
+
+/****************************************************************************
+ * Private Types
+ ****************************************************************************/
+
+/* one receive slab, the parser collects a whole frame payload into data */
+struct qrc_rxbuf_s
+{
+  struct qrc_rxbuf_s * next; /* free list link */
+  uint32_t refcnt;           /* 0 while the slab is free */
+  uint64_t stamp_us;         /* time the frame in it was decoded */
+  uint8_t data[TF_MAX_PAYLOAD_RX];
+};
+
+/* slabs are allocated in chunks that are never freed before destroy */
+struct qrc_rxbuf_chunk_s
+{
+  struct qrc_rxbuf_chunk_s * next;
+  uint32_t count;
+  struct qrc_rxbuf_s slabs[];
+};
+
+struct qrc_rxbuf_pool_s
+{
+  struct qrc_rxbuf_chunk_s * chunks; /* published with release order */
+  struct qrc_rxbuf_s * free_list;    /* owned by the read thread */
+  struct qrc_rxbuf_s * return_list;  /* slabs released by other threads */
+  uint32_t total;
+};
+
+/****************************************************************************
+ * Private Data
+ ****************************************************************************/
+
+static struct qrc_rxbuf_pool_s g_rxbuf_pool;
+
+/****************************************************************************
+ * Private Functions
+ ****************************************************************************/
+
+/****************************************************************************
+ * @intro: add a chunk of count slabs to the read thread's free list
+ * @return: false if the pool is at its limit or malloc failed
+ ****************************************************************************/
+static bool qrc_rxbuf_grow(uint32_t count)
+{
+  struct qrc_rxbuf_pool_s * pool = &g_rxbuf_pool;
+  struct qrc_rxbuf_chunk_s * chunk;
+
+  if (pool->total + count > QRC_RXBUF_MAX_SLABS) {
+    count = QRC_RXBUF_MAX_SLABS - pool->total;
+  }
+  if (0 == count) {
+    return false;
+  }
+
+  chunk = (struct qrc_rxbuf_chunk_s *)malloc(
+      sizeof(struct qrc_rxbuf_chunk_s) + count * sizeof(struct qrc_rxbuf_s));
+  if (NULL == chunk) {
+    QRC_LOGE("qrc rx buffer pool malloc failed!");
+    return false;
+  }
+
+  chunk->count = count;
+  for (uint32_t i = 0; i < count; i++) {
+    chunk->slabs[i].refcnt = 0;
+    chunk->slabs[i].next = pool->free_list;
+    pool->free_list = &chunk->slabs[i];
+  }
+  pool->total += count;
+
+  chunk->next = pool->chunks;
+  __atomic_store_n(&pool->chunks, chunk, __ATOMIC_RELEASE);
+
+  return true;
+}
+
+/****************************************************************************
+ * Public Functions
+ ****************************************************************************/
+
+/****************************************************************************
+ * @intro: create the receive slab pool, call before the read thread starts
+ ****************************************************************************/
+bool qrc_rxbuf_pool_init(void)
+{
+  memset(&g_rxbuf_pool, 0, sizeof(g_rxbuf_pool));
+  return qrc_rxbuf_grow(QRC_RXBUF_FIRST_CHUNK);
+}
+
+/****************************************************************************
+ * @intro: free all slabs, call after the read thread and the thread pools
+ *are stopped. Slabs the user still retains would be freed under it, so then
+ *the pool is left allocated and debug builds assert
+ ****************************************************************************/
+void qrc_rxbuf_pool_destroy(void)
+{
+  struct qrc_rxbuf_chunk_s * chunk = g_rxbuf_pool.chunks;
+  uint32_t in_use = 0;
+
+  for (; NULL != chunk; chunk = chunk->next) {
+    for (uint32_t i = 0; i < chunk->count; i++) {
+      if (0 != __atomic_load_n(&chunk->slabs[i].refcnt, __ATOMIC_ACQUIRE)) {
+        in_use++;
+      }
+    }
+  }
+  if (0 != in_use) {
+    QRC_LOGE("%u rx buffers are retained at deinit, the pool is not freed!", (unsigned)in_use);
+    assert(0 == in_use);
+    memset(&g_rxbuf_pool, 0, sizeof(g_rxbuf_pool));
+    return;
+  }
+
+  chunk = g_rxbuf_pool.chunks;
+  while (NULL != chunk) {
+    struct qrc_rxbuf_chunk_s * next = chunk->next;
+    free(chunk);
+    chunk = next;
+  }
+  memset(&g_rxbuf_pool, 0, sizeof(g_rxbuf_pool));
+}
+
+/****************************************************************************
+ * @intro: take a free slab with one reference, can be only used by the read
+ *thread. Takes back the slabs released by other threads first, and grows
+ *the pool by doubling when all slabs are in use
+ * @return: slab or NULL when QRC_RXBUF_MAX_SLABS are in use
+ ****************************************************************************/
+struct qrc_rxbuf_s * qrc_rxbuf_alloc(void)
+{
+  struct qrc_rxbuf_pool_s * pool = &g_rxbuf_pool;
+  struct qrc_rxbuf_s * buf;
+
+  if (NULL == pool->free_list) {
+    pool->free_list = __atomic_exchange_n(&pool->return_list, NULL, __ATOMIC_ACQUIRE);
+  }
+  if (NULL == pool->free_list && qrc_rxbuf_grow(pool->total)) {
+    QRC_LOGI("qrc rx buffer pool grows to %u slabs", (unsigned)pool->total);
+  }
+
+  buf = pool->free_list;
+  if (NULL == buf) {
+    return NULL;
+  }
+  pool->free_list = buf->next;
+  buf->next = NULL;
+  buf->refcnt = 1;
+
+  return buf;
+}
+
+/****************************************************************************
+ * @intro: payload area of a slab, TF_MAX_PAYLOAD_RX bytes
+ ****************************************************************************/
+uint8_t * qrc_rxbuf_data(struct qrc_rxbuf_s * buf)
+{
+  return buf->data;
+}
+
+/****************************************************************************
+ * @intro: note the time the frame in a slab was decoded, read thread only
+ ****************************************************************************/
+void qrc_rxbuf_stamp(struct qrc_rxbuf_s * buf, uint64_t us)
+{
+  buf->stamp_us = us;
+}
+
+uint64_t qrc_rxbuf_stamp_us(const struct qrc_rxbuf_s * buf)
+{
+  return buf->stamp_us;
+}
+
+/****************************************************************************
+ * @intro: find the slab a pointer points into
+ * @param data: any pointer into the payload of a slab in use
+ * @return: slab or NULL
+ ****************************************************************************/
+struct qrc_rxbuf_s * qrc_rxbuf_find(const void * data)
+{
+  struct qrc_rxbuf_chunk_s * chunk = __atomic_load_n(&g_rxbuf_pool.chunks, __ATOMIC_ACQUIRE);
+  const uint8_t * p = (const uint8_t *)data;
+
+  for (; NULL != chunk; chunk = chunk->next) {
+    const uint8_t * first = (const uint8_t *)chunk->slabs;
+    if (p < first || p >= (const uint8_t *)&chunk->slabs[chunk->count]) {
+      continue;
+    }
+
+    struct qrc_rxbuf_s * buf = &chunk->slabs[(size_t)(p - first) / sizeof(struct qrc_rxbuf_s)];
+    if (p < buf->data || 0 == __atomic_load_n(&buf->refcnt, __ATOMIC_RELAXED)) {
+      return NULL;
+    }
+    return buf;
+  }
+
+  return NULL;
+}
+
+/****************************************************************************
+ * @intro: take one more reference on a slab
+ ****************************************************************************/
+void qrc_rxbuf_retain(struct qrc_rxbuf_s * buf)
+{
+  __atomic_fetch_add(&buf->refcnt, 1, __ATOMIC_RELAXED);
+}
+
+/****************************************************************************
+ * @intro: drop one reference, the last one gives the slab back to the read
+ *thread. Lock free, can be used by any thread
+ ****************************************************************************/
+void qrc_rxbuf_release(struct qrc_rxbuf_s * buf)
+{
+  struct qrc_rxbuf_pool_s * pool = &g_rxbuf_pool;
+
+  if (1 != __atomic_fetch_sub(&buf->refcnt, 1, __ATOMIC_ACQ_REL)) {
+    return;
+  }
+
+  /* the read thread only takes the whole list, so a plain CAS push is safe */
+  buf->next = __atomic_load_n(&pool->return_list, __ATOMIC_RELAXED);
+  while (!__atomic_compare_exchange_n(
+      &pool->return_list, &buf->next, buf, true, __ATOMIC_RELEASE, __ATOMIC_RELAXED)) {
+  }
+}
@@ -0,0 +1,320 @@
+/****************************************************************************
+ *
+ * Copyright (c) 2024 Qualcomm Innovation Center, Inc. All rights reserved.
+ * SPDX-License-Identifier: BSD-3-Clause-Clear
+ *
+ ****************************************************************************/
+#include <stdio.h>
+#ifndef QRC_MCB
+#include <signal.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#endif
+
+#include "qrc.h"
+
+/****************************************************************************
+ * Pre-processor Definitions
+ ****************************************************************************/
+
+#define QRC_STATS_NAME_LEN (64)
+#define QRC_STATS_REFRESH_MS (250) /* gauges of the shared segment */
+
+#define QRC_STATS_SIZE                                                                             \
+  (sizeof(struct qrc_stats_shm_s) + MAX_PIPE_ID * sizeof(struct qrc_stats_entry_s))
+
+/****************************************************************************
+ * Private Types
+ ****************************************************************************/
+
+/* the counters are a struct qrc_stats_shm_s and its pipe entries, in a shared
+ * memory segment or in private memory. The memory is kept once set up, like
+ * the pipes, so writers never find it gone */
+struct qrc_stats_s
+{
+  char shm_name[QRC_STATS_NAME_LEN]; /* empty: counters are private */
+  struct qrc_stats_shm_s * local;    /* private memory, reused by the next init */
+  struct qrc_stats_shm_s * shm;      /* counters in use, NULL before init */
+  struct qrc_link_stats_s * link;
+  struct qrc_stats_entry_s * pipes;
+  uint32_t pipe_max;
+  struct qrc_timer_s timer;
+  volatile bool refresh; /* the timer keeps the gauges of a shared segment fresh */
+};
+
+/****************************************************************************
+ * Private Data
+ ****************************************************************************/
+
+/* counted into before init */
+static struct qrc_link_stats_s g_link_sink;
+static struct qrc_pipe_stats_s g_pipe_sink;
+
+static struct qrc_stats_s g_stats = {.link = &g_link_sink};
+
+/****************************************************************************
+ * Private Functions
+ ****************************************************************************/
+
+#ifndef QRC_MCB
+/****************************************************************************
+ * @intro: an existing segment of the name, is the process that recorded
+ *itself in it gone
+ * @return: true if it is gone, false if it runs or the segment is not a
+ *filled in stats segment
+ ****************************************************************************/
+static bool qrc_stats_stale(void)
+{
+  struct qrc_stats_shm_s * old;
+  struct stat st;
+  bool stale = false;
+  uint32_t pid;
+  int fd;
+
+  fd = shm_open(g_stats.shm_name, O_RDONLY, 0);
+  if (fd < 0) {
+    return ENOENT == errno; /* removed meanwhile */
+  }
+  if (0 != fstat(fd, &st) || st.st_size < (off_t)sizeof(*old)) {
+    close(fd);
+    return false;
+  }
+  old = (struct qrc_stats_shm_s *)mmap(NULL, sizeof(*old), PROT_READ, MAP_SHARED, fd, 0);
+  close(fd);
+  if (MAP_FAILED == old) {
+    return false;
+  }
+  if (QRC_STATS_SHM_MAGIC == __atomic_load_n(&old->magic, __ATOMIC_ACQUIRE)) {
+    pid = old->pid;
+    /* a segment of our own last init is ours to replace */
+    stale = ((pid_t)pid == getpid() || (0 != kill((pid_t)pid, 0) && ESRCH == errno));
+    if (!stale) {
+      QRC_LOGW("stats segment %s is in use by process %u", g_stats.shm_name, (unsigned)pid);
+    }
+  }
+  munmap(old, sizeof(*old));
+
+  return stale;
+}
+
+/****************************************************************************
+ * @intro: create the shared segment of the counters. A segment left by a
+ *process that died is replaced, one of a running process is not
+ * @return: segment, NULL if it could not be created
+ ****************************************************************************/
+static struct qrc_stats_shm_s * qrc_stats_map(void)
+{
+  void * addr;
+  int fd;
+
+  fd = shm_open(g_stats.shm_name, O_RDWR | O_CREAT | O_EXCL, 0644);
+  if (fd < 0 && EEXIST == errno && qrc_stats_stale()) {
+    shm_unlink(g_stats.shm_name);
+    fd = shm_open(g_stats.shm_name, O_RDWR | O_CREAT | O_EXCL, 0644);
+  }
+  if (fd < 0) {
+    QRC_LOGW("stats segment %s create failed, errno=%d", g_stats.shm_name, errno);
+    return NULL;
+  }
+  if (0 != ftruncate(fd, QRC_STATS_SIZE)) {
+    QRC_LOGW("stats segment %s resize failed, errno=%d", g_stats.shm_name, errno);
+    close(fd);
+    shm_unlink(g_stats.shm_name);
+    return NULL;
+  }
+  addr = mmap(NULL, QRC_STATS_SIZE, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+  close(fd);
+  if (MAP_FAILED == addr) {
+    QRC_LOGW("stats segment %s map failed, errno=%d", g_stats.shm_name, errno);
+    shm_unlink(g_stats.shm_name);
+    return NULL;
+  }
+
+  return (struct qrc_stats_shm_s *)addr;
+}
+#endif
+
+/* timer callback, gauges that are not counted on the way */
+static void qrc_stats_refresh(void * arg)
+{
+  (void)arg;
+
+  qrc_link_gauges(g_stats.link);
+  __atomic_store_n(&g_stats.shm->update_us, qrc_timer_now_us(), __ATOMIC_RELEASE);
+  if (g_stats.refresh) {
+    qrc_timer_arm(&g_stats.timer, QRC_STATS_REFRESH_MS * 1000ULL);
+  }
+}
+
+/****************************************************************************
+ * Public Functions
+ ****************************************************************************/
+
+/****************************************************************************
+ * @intro: export the counters in a shared memory segment, set before init
+ * @param name: segment name starting with '/', NULL to keep them private
+ * @return: result of setting
+ ****************************************************************************/
+bool qrc_stats_set_shm(const char * name)
+{
+  if (NULL == name) {
+    g_stats.shm_name[0] = '\0';
+    return true;
+  }
+#ifdef QRC_MCB
+  QRC_LOGE("stats segment %s is not supported on MCB!", name);
+  return false;
+#else
+  if ('/' != name[0] || strlen(name) >= QRC_STATS_NAME_LEN) {
+    QRC_LOGE("stats segment name %s is not valid!", name);
+    return false;
+  }
+  strcpy(g_stats.shm_name, name);
+  return true;
+#endif
+}
+
+/****************************************************************************
+ * @intro: set up the counters before the pipes and threads, all zero
+ * @return: false if there is no memory for them
+ ****************************************************************************/
+bool qrc_stats_init(void)
+{
+  struct qrc_stats_shm_s * shm = NULL;
+
+#ifndef QRC_MCB
+  if ('\0' != g_stats.shm_name[0]) {
+    /* the segment of the last init is gone, its mapping stays for late writers */
+    shm = qrc_stats_map();
+  }
+#endif
+  g_stats.refresh = (NULL != shm);
+  if (NULL == shm) {
+    if (NULL == g_stats.local) {
+      g_stats.local = (struct qrc_stats_shm_s *)malloc(QRC_STATS_SIZE);
+      if (NULL == g_stats.local) {
+        QRC_LOGE("qrc stats malloc failed!");
+        return false;
+      }
+    }
+    shm = g_stats.local;
+  }
+
+  memset(shm, 0, QRC_STATS_SIZE);
+  shm->version = QRC_STATS_SHM_VERSION;
+  shm->pid = (uint32_t)getpid();
+  shm->pipe_max = MAX_PIPE_ID;
+  __atomic_store_n(&shm->magic, QRC_STATS_SHM_MAGIC, __ATOMIC_RELEASE);
+
+  g_stats.shm = shm;
+  g_stats.pipes = (struct qrc_stats_entry_s *)(shm + 1);
+  __atomic_store_n(&g_stats.link, &shm->link, __ATOMIC_RELEASE);
+  __atomic_store_n(&g_stats.pipe_max, MAX_PIPE_ID, __ATOMIC_RELEASE);
+
+  qrc_timer_setup(&g_stats.timer, qrc_stats_refresh, NULL);
+  if (g_stats.refresh) {
+    qrc_timer_arm(&g_stats.timer, QRC_STATS_REFRESH_MS * 1000ULL);
+  }
+
+  return true;
+}
+
+/****************************************************************************
+ * @intro: stop refreshing the shared segment and remove its name, readers
+ *that have it mapped see the last values
+ ****************************************************************************/
+void qrc_stats_destroy(void)
+{
+  g_stats.refresh = false;
+  qrc_timer_cancel(&g_stats.timer);
+#ifndef QRC_MCB
+  if (NULL != g_stats.shm && g_stats.shm != g_stats.local) {
+    shm_unlink(g_stats.shm_name);
+  }
+#endif
+}
+
+/* counters of the link, never NULL */
+struct qrc_link_stats_s * qrc_stats_link(void)
+{
+  return __atomic_load_n(&g_stats.link, __ATOMIC_ACQUIRE);
+}
+
+/* counters of a pipe, never NULL */
+struct qrc_pipe_stats_s * qrc_stats_pipe(uint16_t pipe_id)
+{
+  if (pipe_id >= __atomic_load_n(&g_stats.pipe_max, __ATOMIC_ACQUIRE)) {
+    return &g_pipe_sink;
+  }
+  return &g_stats.pipes[pipe_id].stats;
+}
+
+/****************************************************************************
+ * @intro: pipe_list_mutex held, name the entry of a new pipe. Ids are given
+ *in order, the entry is counted once its name is complete
+ ****************************************************************************/
+void qrc_stats_pipe_added(const qrc_pipe_s * p)
+{
+  if (p->pipe_id >= g_stats.pipe_max) {
+    return;
+  }
+  memset(&g_stats.pipes[p->pipe_id], 0, sizeof(struct qrc_stats_entry_s));
+  strcpy(g_stats.pipes[p->pipe_id].name, p->pipe_name);
+  __atomic_store_n(&g_stats.shm->pipe_count, (uint32_t)p->pipe_id + 1, __ATOMIC_RELEASE);
+}
+
+/* a received frame of the pipe was dropped */
+void qrc_stats_dropped(const qrc_pipe_s * p)
+{
+  QRC_STAT_ADD(qrc_stats_pipe(p->pipe_id)->rx_dropped, 1);
+  QRC_STAT_ADD(qrc_stats_link()->rx_dropped, 1);
+}
+
+/* the ack of a reliable frame came rtt_us after it was sent */
+void qrc_stats_ack(uint16_t pipe_id, uint64_t rtt_us)
+{
+  struct qrc_pipe_stats_s * s = qrc_stats_pipe(pipe_id);
+  uint32_t us = (rtt_us > UINT32_MAX) ? UINT32_MAX : (uint32_t)rtt_us;
+
+  qrc_latency_record(pipe_id, QRC_LAT_ACK, rtt_us);
+  QRC_STAT_ADD(s->acks, 1);
+  QRC_STAT_ADD(s->ack_total_us, us);
+  if (us > __atomic_load_n(&s->ack_max_us, __ATOMIC_RELAXED)) {
+    __atomic_store_n(&s->ack_max_us, us, __ATOMIC_RELAXED);
+  }
+}
+
+/****************************************************************************
+ * @intro: snapshot of the link counters, the gauges read now
+ ****************************************************************************/
+void qrc_stats_get_link(struct qrc_link_stats_s * stats)
+{
+  const struct qrc_link_stats_s * s = qrc_stats_link();
+
+  memset(stats, 0, sizeof(*stats));
+  stats->tx_frames = __atomic_load_n(&s->tx_frames, __ATOMIC_RELAXED);
+  stats->tx_bytes = __atomic_load_n(&s->tx_bytes, __ATOMIC_RELAXED);
+  stats->tx_busy = __atomic_load_n(&s->tx_busy, __ATOMIC_RELAXED);
+  stats->rx_frames = __atomic_load_n(&s->rx_frames, __ATOMIC_RELAXED);
+  stats->rx_bytes = __atomic_load_n(&s->rx_bytes, __ATOMIC_RELAXED);
+  stats->rx_dropped = __atomic_load_n(&s->rx_dropped, __ATOMIC_RELAXED);
+  qrc_link_gauges(stats);
+}
+
+void qrc_stats_get_pipe(const qrc_pipe_s * pipe, struct qrc_pipe_stats_s * stats)
+{
+  const struct qrc_pipe_stats_s * s = qrc_stats_pipe(pipe->pipe_id);
+
+  memset(stats, 0, sizeof(*stats));
+  stats->tx_frames = __atomic_load_n(&s->tx_frames, __ATOMIC_RELAXED);
+  stats->tx_bytes = __atomic_load_n(&s->tx_bytes, __ATOMIC_RELAXED);
+  stats->rx_frames = __atomic_load_n(&s->rx_frames, __ATOMIC_RELAXED);
+  stats->rx_bytes = __atomic_load_n(&s->rx_bytes, __ATOMIC_RELAXED);
+  stats->rx_dropped = __atomic_load_n(&s->rx_dropped, __ATOMIC_RELAXED);
+  stats->retransmits = __atomic_load_n(&s->retransmits, __ATOMIC_RELAXED);
+  stats->timeouts = __atomic_load_n(&s->timeouts, __ATOMIC_RELAXED);
+  stats->acks = __atomic_load_n(&s->acks, __ATOMIC_RELAXED);
+  stats->ack_total_us = __atomic_load_n(&s->ack_total_us, __ATOMIC_RELAXED);
+  stats->ack_max_us = __atomic_load_n(&s->ack_max_us, __ATOMIC_RELAXED);
+  stats->cb_overruns = __atomic_load_n(&s->cb_overruns, __ATOMIC_RELAXED);
+}
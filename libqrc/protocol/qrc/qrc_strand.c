@@ -0,0 +1,366 @@
+/****************************************************************************
+ *
+ * Copyright (c) 2024 Qualcomm Innovation Center, Inc. All rights reserved.
+ * SPDX-License-Identifier: BSD-3-Clause-Clear
+ *
+ ****************************************************************************/
+#include <stdio.h>
+
+#include "qrc.h"
+
+/****************************************************************************
+ * Pre-processor Definitions
+ ****************************************************************************/
+
+/* works of one pipe waiting for its strand */
+#ifdef QRC_MCB
+#define QRC_STRAND_SLOTS (16)
+#else
+#define QRC_STRAND_SLOTS (256)
+#endif
+
+#define QRC_STRAND_BATCH (16) /* works run before other pipes get the thread */
+
+/****************************************************************************
+ * Private Types
+ ****************************************************************************/
+
+/* serial executor of a pipe: its works run one after the other in the order
+ * they were queued, on whichever thread of the pool. The strand is in the
+ * pool queue at most once, queued when pending goes from 0 to 1 */
+struct qrc_strand_pipe_s
+{
+  struct qrc_workring_s * ring;
+  uint32_t used;        /* slots of the ring taken by queued works and reservations */
+  uint32_t pending;     /* works queued and not run yet, or 1 while inline */
+  bool inline_dispatch; /* messages run on the read thread when the strand is idle */
+  uint32_t strikes;     /* inline callbacks over budget */
+};
+
+struct qrc_strand_s
+{
+  struct qrc_strand_pipe_s * pipes[QRC_STRAND_MAX]; /* created on first use */
+  struct qrc_thread_pool_s * pool;
+  uint32_t queued; /* works in all strands */
+  uint32_t high;   /* most of them at once */
+  pthread_mutex_t mutex;
+};
+
+/****************************************************************************
+ * Private Function Prototypes
+ ****************************************************************************/
+
+static void qrc_strand_run(const struct qrc_msg_cb_args_s * args);
+
+/****************************************************************************
+ * Private Data
+ ****************************************************************************/
+
+static struct qrc_strand_s g_strand = {.mutex = PTHREAD_MUTEX_INITIALIZER};
+
+/****************************************************************************
+ * Private Functions
+ ****************************************************************************/
+
+/****************************************************************************
+ * @intro: get the strand of a pipe, create it on first use
+ * @return: strand, NULL if malloc failed or the strands are destroyed
+ ****************************************************************************/
+static struct qrc_strand_pipe_s * qrc_strand_get(uint16_t pipe_id)
+{
+  struct qrc_strand_pipe_s * s;
+
+  if (pipe_id >= QRC_STRAND_MAX) {
+    return NULL;
+  }
+  s = __atomic_load_n(&g_strand.pipes[pipe_id], __ATOMIC_ACQUIRE);
+  if (NULL != s) {
+    return s;
+  }
+
+  pthread_mutex_lock(&g_strand.mutex);
+  s = g_strand.pipes[pipe_id];
+  if (NULL == s && NULL == g_strand.pool) {
+    /* destroyed, no new strand for a late work */
+  } else if (NULL == s) {
+    s = (struct qrc_strand_pipe_s *)malloc(sizeof(struct qrc_strand_pipe_s));
+    if (NULL != s) {
+      s->ring = qrc_workring_create(QRC_STRAND_SLOTS);
+      s->used = 0;
+      s->pending = 0;
+      s->inline_dispatch = false;
+      s->strikes = 0;
+      if (NULL == s->ring) {
+        free(s);
+        s = NULL;
+      }
+    }
+    if (NULL == s) {
+      QRC_LOGE("pipe %u strand malloc failed!", (unsigned)pipe_id);
+    } else {
+      __atomic_store_n(&g_strand.pipes[pipe_id], s, __ATOMIC_RELEASE);
+    }
+  }
+  pthread_mutex_unlock(&g_strand.mutex);
+
+  return s;
+}
+
+/* a strand needs a thread, the pool holds one work per strand so it takes it */
+static void qrc_strand_schedule(qrc_pipe_s * pipe)
+{
+  struct qrc_msg_cb_args_s args;
+
+  memset(&args, 0, sizeof(args));
+  args.pipe = pipe;
+  if (0 != qrc_threadpool_add_work(g_strand.pool, qrc_strand_run, &args)) {
+    QRC_LOGE("pipe(%s) strand can not be queued!", pipe->pipe_name);
+  }
+}
+
+/****************************************************************************
+ * @intro: worker, run the works of the strand of args.pipe in order. After
+ *QRC_STRAND_BATCH of them the strand is queued again behind other pipes
+ ****************************************************************************/
+static void qrc_strand_run(const struct qrc_msg_cb_args_s * args)
+{
+  struct qrc_strand_pipe_s * s = __atomic_load_n(&g_strand.pipes[args->pipe->pipe_id],
+      __ATOMIC_ACQUIRE);
+  struct qrc_msg_cb_args_s work_args;
+  qrc_work work_fun;
+
+  for (int n = 1;; n++) {
+    /* pending counts only works already in the ring */
+    while (!qrc_workring_pop(s->ring, &work_fun, &work_args)) {
+    }
+    __atomic_sub_fetch(&s->used, 1, __ATOMIC_RELEASE);
+    __atomic_sub_fetch(&g_strand.queued, 1, __ATOMIC_RELAXED);
+    work_fun(&work_args);
+
+    if (0 == __atomic_sub_fetch(&s->pending, 1, __ATOMIC_ACQ_REL)) {
+      return;
+    }
+    if (n >= QRC_STRAND_BATCH) {
+      /* the last thing this thread does with the strand */
+      qrc_strand_schedule(args->pipe);
+      return;
+    }
+  }
+}
+
+/* take a slot of the ring, false if queued works and reservations fill it */
+static bool qrc_strand_take_slot(struct qrc_strand_pipe_s * s)
+{
+  uint32_t used = __atomic_load_n(&s->used, __ATOMIC_ACQUIRE);
+
+  do {
+    if (used >= QRC_STRAND_SLOTS) {
+      return false;
+    }
+  } while (!__atomic_compare_exchange_n(
+      &s->used, &used, used + 1, true, __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE));
+
+  return true;
+}
+
+/* push a work into a slot taken before, it always finds room */
+static void qrc_strand_push(
+    struct qrc_strand_pipe_s * s, qrc_work work_fun, const struct qrc_msg_cb_args_s * args)
+{
+  uint32_t queued;
+  uint32_t high;
+
+  /* a worker may still be copying the last work out of the slot */
+  while (!qrc_workring_push(s->ring, work_fun, args)) {
+  }
+
+  queued = __atomic_add_fetch(&g_strand.queued, 1, __ATOMIC_RELAXED);
+  high = __atomic_load_n(&g_strand.high, __ATOMIC_RELAXED);
+  while (queued > high && !__atomic_compare_exchange_n(
+                              &g_strand.high, &high, queued, true, __ATOMIC_RELAXED,
+                              __ATOMIC_RELAXED)) {
+  }
+
+  if (1 == __atomic_add_fetch(&s->pending, 1, __ATOMIC_ACQ_REL)) {
+    qrc_strand_schedule(args->pipe);
+  }
+}
+
+/****************************************************************************
+ * Public Functions
+ ****************************************************************************/
+
+/****************************************************************************
+ * @intro: run the strands on pool, forget the strands of the last run
+ * @param pool: thread pool of QRC_STRAND_MAX slots at least
+ ****************************************************************************/
+bool qrc_strand_init(struct qrc_thread_pool_s * pool)
+{
+  qrc_strand_destroy();
+  g_strand.pool = pool;
+  return NULL != pool;
+}
+
+/****************************************************************************
+ * @intro: after the pool is destroyed, drop the works left in the strands
+ ****************************************************************************/
+void qrc_strand_destroy(void)
+{
+  struct qrc_msg_cb_args_s args;
+  qrc_work work_fun;
+
+  pthread_mutex_lock(&g_strand.mutex);
+  for (int i = 0; i < QRC_STRAND_MAX; i++) {
+    struct qrc_strand_pipe_s * s = g_strand.pipes[i];
+    if (NULL == s) {
+      continue;
+    }
+    while (qrc_workring_pop(s->ring, &work_fun, &args)) {
+      if (NULL != args.buf) {
+        qrc_rxbuf_release(args.buf);
+      }
+    }
+    qrc_workring_destroy(s->ring);
+    free(s);
+    g_strand.pipes[i] = NULL;
+  }
+  g_strand.pool = NULL;
+  g_strand.queued = 0;
+  g_strand.high = 0;
+  pthread_mutex_unlock(&g_strand.mutex);
+}
+
+/****************************************************************************
+ * @intro: queue a work behind the other works of args.pipe, it runs after
+ *them and never at the same time as one of them
+ * @param args: copied
+ * @return: 0, -1 if the strand of the pipe is full or has none
+ ****************************************************************************/
+int qrc_strand_add_work(qrc_work work_fun, const struct qrc_msg_cb_args_s * args)
+{
+  struct qrc_strand_pipe_s * s = qrc_strand_get(args->pipe->pipe_id);
+
+  if (NULL == s) {
+    return -1;
+  }
+  if (!qrc_strand_take_slot(s)) {
+    QRC_LOGW("pipe(%s) strand is full", args->pipe->pipe_name);
+    return -1;
+  }
+
+  qrc_strand_push(s, work_fun, args);
+  return 0;
+}
+
+/****************************************************************************
+ * @intro: keep a slot of the strand of a pipe for a work that has to run
+ *later and must not be refused then, e.g. a write completion
+ * @param pipe: pipe
+ * @return: false if the strand is full or has none
+ ****************************************************************************/
+bool qrc_strand_reserve(const qrc_pipe_s * pipe)
+{
+  struct qrc_strand_pipe_s * s = qrc_strand_get(pipe->pipe_id);
+
+  return NULL != s && qrc_strand_take_slot(s);
+}
+
+/****************************************************************************
+ * @intro: queue a work in the slot of qrc_strand_reserve(), like
+ *qrc_strand_add_work() but it is never refused
+ * @param args: copied
+ * @return: 0, -1 if the strands are destroyed and the reservation with them
+ ****************************************************************************/
+int qrc_strand_add_reserved(qrc_work work_fun, const struct qrc_msg_cb_args_s * args)
+{
+  struct qrc_strand_pipe_s * s = (args->pipe->pipe_id < QRC_STRAND_MAX)
+                                     ? __atomic_load_n(&g_strand.pipes[args->pipe->pipe_id],
+                                           __ATOMIC_ACQUIRE)
+                                     : NULL;
+
+  if (NULL == s) {
+    return -1;
+  }
+  qrc_strand_push(s, work_fun, args);
+  return 0;
+}
+
+/****************************************************************************
+ * @intro: run the messages of a pipe on the read thread instead of the pool
+ * @param enable: false to queue them for the pool again
+ * @return: false if the strand could not be created
+ ****************************************************************************/
+bool qrc_strand_set_inline(const qrc_pipe_s * pipe, bool enable)
+{
+  struct qrc_strand_pipe_s * s = qrc_strand_get(pipe->pipe_id);
+
+  if (NULL == s) {
+    return false;
+  }
+  __atomic_store_n(&s->strikes, 0, __ATOMIC_RELAXED);
+  __atomic_store_n(&s->inline_dispatch, enable, __ATOMIC_RELAXED);
+  return true;
+}
+
+/****************************************************************************
+ * @intro: read thread, run a work of an inline pipe right away. The strand
+ *is taken for the time, so the work never overtakes or runs beside a
+ *queued one. After QRC_INLINE_STRIKES callbacks over the budget of the
+ *pipe, its messages go to the pool again
+ * @param args: pipe and arguments of work_fun
+ * @return: false if the pipe is not inline or its strand is busy, queue the
+ *work then
+ ****************************************************************************/
+bool qrc_strand_try_inline(qrc_work work_fun, const struct qrc_msg_cb_args_s * args)
+{
+  struct qrc_strand_pipe_s * s = (args->pipe->pipe_id < QRC_STRAND_MAX)
+                                     ? __atomic_load_n(&g_strand.pipes[args->pipe->pipe_id],
+                                           __ATOMIC_ACQUIRE)
+                                     : NULL;
+  uint32_t idle = 0;
+  uint32_t budget;
+  uint64_t start;
+  uint64_t us;
+
+  if (NULL == s || !__atomic_load_n(&s->inline_dispatch, __ATOMIC_RELAXED) ||
+      !__atomic_compare_exchange_n(
+          &s->pending, &idle, 1, false, __ATOMIC_ACQ_REL, __ATOMIC_RELAXED)) {
+    return false;
+  }
+
+  start = qrc_timer_now_us();
+  work_fun(args);
+  us = qrc_timer_now_us() - start;
+
+  /* works queued meanwhile found the strand taken, they run on the pool */
+  if (0 != __atomic_sub_fetch(&s->pending, 1, __ATOMIC_ACQ_REL)) {
+    qrc_strand_schedule(args->pipe);
+  }
+
+  budget = qrc_latency_get_budget(args->pipe);
+  if (0 != budget && us > budget &&
+      QRC_INLINE_STRIKES == __atomic_add_fetch(&s->strikes, 1, __ATOMIC_RELAXED)) {
+    __atomic_store_n(&s->inline_dispatch, false, __ATOMIC_RELAXED);
+    QRC_LOGE("pipe(%s) inline callback ran over its budget of %u us %d times, its "
+             "messages go to the worker threads again",
+        args->pipe->pipe_name,
+        (unsigned)budget,
+        QRC_INLINE_STRIKES);
+  }
+  return true;
+}
+
+/* works waiting in the strands, read without a lock */
+uint32_t qrc_strand_queue_len(void)
+{
+  uint32_t queued = __atomic_load_n(&g_strand.queued, __ATOMIC_RELAXED);
+
+  /* a worker may count a work out before its producer counted it in */
+  return (queued > UINT32_MAX / 2) ? 0 : queued;
+}
+
+/* most works that waited in the strands at once */
+uint32_t qrc_strand_queue_high(void)
+{
+  return __atomic_load_n(&g_strand.high, __ATOMIC_RELAXED);
+}
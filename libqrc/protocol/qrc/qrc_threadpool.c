@@ -13,6 +13,11 @@
 #include <string.h>
 #include <time.h>
 #include <unistd.h>
+#ifndef QRC_MCB
+#include <limits.h>
+#include <linux/futex.h>
+#include <sys/syscall.h>
+#endif
 
 #include "qrc.h"
 
@@ -25,34 +30,44 @@
  * Pre-processor Definitions
  ****************************************************************************/
 
+/* times an idle worker looks for work before it sleeps, on SMP hosts only */
+#ifdef QRC_MCB
+#define QRC_WORK_SPIN (0)
+#else
+#define QRC_WORK_SPIN (200)
+#endif
+
+#if defined(__x86_64__) || defined(__i386__)
+#define QRC_CPU_RELAX() __builtin_ia32_pause()
+#elif defined(__aarch64__) || defined(__arm__)
+#define QRC_CPU_RELAX() __asm__ __volatile__("yield" ::: "memory")
+#else
+#define QRC_CPU_RELAX() __asm__ __volatile__("" ::: "memory")
+#endif
+
 /****************************************************************************
  * Private Types
  ****************************************************************************/
 
-/* semaphore   */
-struct work_sem_s
+/* eventcount, seq changes on every notify. A worker takes the key, looks
+ * for work once more, then sleeps only while seq still equals the key, so a
+ * work queued in between is never missed. Every queued work wakes one
+ * sleeping worker. Host workers sleep on a futex on seq */
+struct work_ec_s
 {
+  uint32_t seq;
+  uint32_t waiters; /* workers between prepare and wake up */
+#ifdef QRC_MCB
   pthread_mutex_t mutex;
   pthread_cond_t cond;
-  int value;
-};
-
-/* qrc work */
-struct qrc_work_s
-{
-  struct qrc_work_s * previous;
-  qrc_work work_fun;
-  struct qrc_msg_cb_args_s args;
+#endif
 };
 
-/* qrc work queue */
+/* qrc work queue, works are copied in and out of preallocated slots */
 struct qrc_workqueue_s
 {
-  pthread_mutex_t queue_mutex;
-  struct qrc_work_s * work_front;
-  struct qrc_work_s * work_rear;
-  struct work_sem_s * work_sem;
-  int len;
+  struct qrc_workring_s * ring;
+  struct work_ec_s work_ec; /* idle workers sleep on it */
 };
 
 /* qrc thread */
@@ -69,9 +84,12 @@ struct qrc_thread_pool_s
   struct qrc_thread_s ** threads; /* thread list */
   volatile int num_threads_alive;
   volatile int num_threads_working;
+  int idle_waiters; /* threads in qrc_threadpool_wait() */
   pthread_mutex_t thread_count_lock;
   pthread_cond_t threads_all_idle;
+  pthread_cond_t threads_alive; /* a thread started */
   struct qrc_workqueue_s workqueue;
+  enum qrc_thread_role_e role; /* scheduling of the threads */
 };
 
 /****************************************************************************
@@ -83,17 +101,22 @@ static void * thread_run(struct qrc_thread_s * qrc_thread);
 static void thread_hold(int sig_id);
 static void thread_destroy(struct qrc_thread_s * qrc_thread);
 
-static int workqueue_init(struct qrc_workqueue_s * workqueue);
+static int workqueue_init(struct qrc_workqueue_s * workqueue, uint32_t slots);
 static void workqueue_clear(struct qrc_workqueue_s * workqueue);
-static void workqueue_push(struct qrc_workqueue_s * workqueue, struct qrc_work_s * work);
-static struct qrc_work_s * workqueue_pull(struct qrc_workqueue_s * workqueue);
+static bool workqueue_push(struct qrc_workqueue_s * workqueue,
+    qrc_work work_fun,
+    const struct qrc_msg_cb_args_s * args);
+static bool workqueue_pull(struct qrc_workqueue_s * workqueue,
+    qrc_work * work_fun,
+    struct qrc_msg_cb_args_s * args);
 static void workqueue_destroy(struct qrc_workqueue_s * workqueue_p);
 
-static void work_sem_init(struct work_sem_s * sem, int value);
-static void work_sem_reset(struct work_sem_s * sem);
-static void work_sem_post(struct work_sem_s * sem);
-static void work_sem_post_all(struct work_sem_s * sem);
-static void work_sem_wait(struct work_sem_s * sem);
+static void work_ec_init(struct work_ec_s * ec);
+static void work_ec_destroy(struct work_ec_s * ec);
+static uint32_t work_ec_prepare(struct work_ec_s * ec);
+static void work_ec_cancel(struct work_ec_s * ec);
+static void work_ec_wait(struct work_ec_s * ec, uint32_t key);
+static void work_ec_notify(struct work_ec_s * ec, bool all);
 
 /****************************************************************************
  * Private Data
@@ -101,6 +124,7 @@ static void work_sem_wait(struct work_sem_s * sem);
 
 static volatile int g_threads_keepalive;
 static volatile int g_threads_on_hold;
+static int g_work_spin; /* QRC_WORK_SPIN with more than one CPU, 0 otherwise */
 
 /****************************************************************************
  * Public Data
@@ -114,7 +138,7 @@ static int thread_init(struct qrc_thread_pool_s * qrc_tp, struct qrc_thread_s **
 {
   *threads = (struct qrc_thread_s *)malloc(sizeof(struct qrc_thread_s));
   if (*threads == NULL) {
-    printf("thread_init(): Could not allocate memory for thread\n");
+    QRC_LOGE("thread_init(): Could not allocate memory for thread");
     return -1;
   }
 
@@ -128,39 +152,35 @@ static int thread_init(struct qrc_thread_pool_s * qrc_tp, struct qrc_thread_s **
 
   status = pthread_attr_init(&attr);
   if (status != 0) {
-    printf("thread_init: ERROR pthread_attr_init failed, status=%d\n", status);
+    QRC_LOGE("thread_init: pthread_attr_init failed, status=%d", status);
     ASSERT(false);
   }
 
   status = pthread_attr_setstacksize(&attr, QRC_THREAD_STACKSIZE);
   if (status != 0) {
-    printf(
-        "thread_init: "
-        "ERROR pthread_attr_setstacksize failed, status=%d\n",
-        status);
+    QRC_LOGE("thread_init: pthread_attr_setstacksize failed, status=%d", status);
     ASSERT(false);
   }
 
   sparam.sched_priority = QRC_THREAD_PRIORITY;
   status = pthread_attr_setschedparam(&attr, &sparam);
   if (status != 0) {
-    printf(
-        "thread_init: "
-        "ERROR pthread_attr_setschedparam failed, status=%d\n",
-        status);
+    QRC_LOGE("thread_init: pthread_attr_setschedparam failed, status=%d", status);
     ASSERT(false);
   }
 
   status = pthread_create(&(*threads)->pthread, &attr, (void * (*)(void *))thread_run, (*threads));
   if (status != 0) {
-    printf(
-        "thread_init: "
-        "ERROR pthread_create failed, status=%d\n",
-        status);
+    QRC_LOGE("thread_init: pthread_create failed, status=%d", status);
     ASSERT(false);
   }
 #else
-  pthread_create(&(*threads)->pthread, NULL, (void * (*)(void *))thread_run, (*threads));
+  if (0 != qrc_rt_thread_create(
+               qrc_tp->role, &(*threads)->pthread, (void * (*)(void *))thread_run, (*threads))) {
+    free(*threads);
+    *threads = NULL;
+    return -1;
+  }
 #endif
 
   // pthread_detach((*threads)->pthread);
@@ -177,6 +197,32 @@ static void thread_hold(int sig_id)
   }
 }
 
+/****************************************************************************
+ * @intro: run the oldest work if there is one
+ * @return: true if a work was run
+ ****************************************************************************/
+static bool thread_run_work(struct qrc_thread_pool_s * qrc_tp)
+{
+  qrc_work work_fun;
+  struct qrc_msg_cb_args_s args;
+  bool ran;
+
+  /* counted before the pull, so qrc_threadpool_wait() finds a work either
+   * in the queue or in a working thread */
+  __atomic_add_fetch(&qrc_tp->num_threads_working, 1, __ATOMIC_SEQ_CST);
+  ran = workqueue_pull(&qrc_tp->workqueue, &work_fun, &args);
+  if (ran) {
+    work_fun(&args);
+  }
+  if (0 == __atomic_sub_fetch(&qrc_tp->num_threads_working, 1, __ATOMIC_SEQ_CST) &&
+      0 != __atomic_load_n(&qrc_tp->idle_waiters, __ATOMIC_SEQ_CST)) {
+    pthread_mutex_lock(&qrc_tp->thread_count_lock);
+    pthread_cond_broadcast(&qrc_tp->threads_all_idle);
+    pthread_mutex_unlock(&qrc_tp->thread_count_lock);
+  }
+  return ran;
+}
+
 static void * thread_run(struct qrc_thread_s * qrc_thread)
 {
   struct qrc_thread_pool_s * qrc_tp = qrc_thread->qrc_tp;
@@ -186,38 +232,35 @@ static void * thread_run(struct qrc_thread_s * qrc_thread)
   act.sa_flags = SA_ONSTACK;
   act.sa_handler = thread_hold;
   if (sigaction(SIGUSR1, &act, NULL) == -1) {
-    printf("thread_run(): cannot handle SIGUSR1");
+    QRC_LOGE("thread_run(): cannot handle SIGUSR1");
   }
 
   pthread_mutex_lock(&qrc_tp->thread_count_lock);
   qrc_tp->num_threads_alive += 1;
+  pthread_cond_signal(&qrc_tp->threads_alive);
   pthread_mutex_unlock(&qrc_tp->thread_count_lock);
   while (g_threads_keepalive) {
-    work_sem_wait(qrc_tp->workqueue.work_sem);
-    if (g_threads_keepalive) {
-      pthread_mutex_lock(&qrc_tp->thread_count_lock);
-      qrc_tp->num_threads_working++;
-      pthread_mutex_unlock(&qrc_tp->thread_count_lock);
-
-      /* execute qrc function */
-      qrc_work work_fun;
-      struct qrc_msg_cb_args_s * args;
-
-      struct qrc_work_s * work_p = workqueue_pull(&qrc_tp->workqueue);
-      if (work_p) {
-        work_fun = work_p->work_fun;
-        args = &work_p->args;
-        work_fun(*args);
-        free(work_p);
-      }
+    if (thread_run_work(qrc_tp)) {
+      continue;
+    }
 
-      pthread_mutex_lock(&qrc_tp->thread_count_lock);
-      qrc_tp->num_threads_working--;
-      if (!qrc_tp->num_threads_working) {
-        pthread_cond_signal(&qrc_tp->threads_all_idle);
+    /* a burst often has the next work right behind, look before sleeping */
+    for (int spin = 0; spin < g_work_spin; spin++) {
+      QRC_CPU_RELAX();
+      if (0 != qrc_workring_len(qrc_tp->workqueue.ring)) {
+        break;
       }
-      pthread_mutex_unlock(&qrc_tp->thread_count_lock);
     }
+    if (0 != qrc_workring_len(qrc_tp->workqueue.ring)) {
+      continue;
+    }
+
+    uint32_t key = work_ec_prepare(&qrc_tp->workqueue.work_ec);
+    if (!g_threads_keepalive || 0 != qrc_workring_len(qrc_tp->workqueue.ring)) {
+      work_ec_cancel(&qrc_tp->workqueue.work_ec);
+      continue;
+    }
+    work_ec_wait(&qrc_tp->workqueue.work_ec, key);
   }
   pthread_mutex_lock(&qrc_tp->thread_count_lock);
   qrc_tp->num_threads_alive--;
@@ -233,132 +276,130 @@ static void thread_destroy(struct qrc_thread_s * qrc_thread)
   free(qrc_thread);
 }
 
-static int workqueue_init(struct qrc_workqueue_s * workqueue)
+static int workqueue_init(struct qrc_workqueue_s * workqueue, uint32_t slots)
 {
-  workqueue->len = 0;
-  workqueue->work_front = NULL;
-  workqueue->work_rear = NULL;
-
-  workqueue->work_sem = (struct work_sem_s *)malloc(sizeof(struct work_sem_s));
-  if (workqueue->work_sem == NULL) {
+  workqueue->ring = qrc_workring_create(slots);
+  if (workqueue->ring == NULL) {
     return -1;
   }
 
-  pthread_mutex_init(&(workqueue->queue_mutex), NULL);
-  work_sem_init(workqueue->work_sem, 0);
+  work_ec_init(&workqueue->work_ec);
 
   return 0;
 }
 
 static void workqueue_clear(struct qrc_workqueue_s * workqueue)
 {
-  while (workqueue->len) {
-    free(workqueue_pull(workqueue));
-  }
+  qrc_work work_fun;
+  struct qrc_msg_cb_args_s args;
 
-  workqueue->work_front = NULL;
-  workqueue->work_rear = NULL;
-  work_sem_reset(workqueue->work_sem);
-  workqueue->len = 0;
+  while (qrc_workring_pop(workqueue->ring, &work_fun, &args)) {
+    if (NULL != args.buf) {
+      qrc_rxbuf_release(args.buf);
+    }
+  }
 }
 
-static void workqueue_push(struct qrc_workqueue_s * workqueue, struct qrc_work_s * work)
+static bool workqueue_push(struct qrc_workqueue_s * workqueue,
+    qrc_work work_fun,
+    const struct qrc_msg_cb_args_s * args)
 {
-  pthread_mutex_lock(&workqueue->queue_mutex);
-  work->previous = NULL;
-
-  switch (workqueue->len) {
-    case 0: {
-      workqueue->work_front = work;
-      workqueue->work_rear = work;
-      break;
-    }
-
-    default: {
-      workqueue->work_rear->previous = work;
-      workqueue->work_rear = work;
-    }
+  if (!qrc_workring_push(workqueue->ring, work_fun, args)) {
+    return false;
   }
-  workqueue->len++;
+  QRC_TRACE4(work_push, workqueue, args->pipe->pipe_id, args->buf,
+      qrc_workring_len(workqueue->ring));
 
-  work_sem_post(workqueue->work_sem);
-  pthread_mutex_unlock(&workqueue->queue_mutex);
+  work_ec_notify(&workqueue->work_ec, false);
+  return true;
 }
 
-static struct qrc_work_s * workqueue_pull(struct qrc_workqueue_s * workqueue)
+static bool workqueue_pull(struct qrc_workqueue_s * workqueue,
+    qrc_work * work_fun,
+    struct qrc_msg_cb_args_s * args)
 {
-  pthread_mutex_lock(&workqueue->queue_mutex);
-  struct qrc_work_s * work_p = workqueue->work_front;
-
-  switch (workqueue->len) {
-    case 0: {
-      break;
-    }
-    case 1: {
-      workqueue->work_front = NULL;
-      workqueue->work_rear = NULL;
-      workqueue->len = 0;
-      break;
-    }
-    default: {
-      workqueue->work_front = work_p->previous;
-      workqueue->len--;
-      work_sem_post(workqueue->work_sem);
-    }
+  if (!qrc_workring_pop(workqueue->ring, work_fun, args)) {
+    return false;
   }
-
-  pthread_mutex_unlock(&workqueue->queue_mutex);
-  return work_p;
+  QRC_TRACE4(work_pull, workqueue, args->pipe->pipe_id, args->buf,
+      qrc_workring_len(workqueue->ring));
+  return true;
 }
 
 static void workqueue_destroy(struct qrc_workqueue_s * workqueue)
 {
   workqueue_clear(workqueue);
-  free(workqueue->work_sem);
+  qrc_workring_destroy(workqueue->ring);
+  work_ec_destroy(&workqueue->work_ec);
 }
 
-static void work_sem_init(struct work_sem_s * sem, int value)
+static void work_ec_init(struct work_ec_s * ec)
 {
-  if (value < 0 || value > 1) {
-    printf("work_sem_init(): value invalid\n");
-    exit(1);
-  }
-  pthread_mutex_init(&(sem->mutex), NULL);
-  pthread_cond_init(&(sem->cond), NULL);
-  sem->value = value;
+  ec->seq = 0;
+  ec->waiters = 0;
+#ifdef QRC_MCB
+  pthread_mutex_init(&ec->mutex, NULL);
+  pthread_cond_init(&ec->cond, NULL);
+#endif
+}
+
+static void work_ec_destroy(struct work_ec_s * ec)
+{
+#ifdef QRC_MCB
+  pthread_mutex_destroy(&ec->mutex);
+  pthread_cond_destroy(&ec->cond);
+#else
+  (void)ec;
+#endif
 }
 
-static void work_sem_reset(struct work_sem_s * sem)
+/* announce the worker may sleep, it has to look for work once more */
+static uint32_t work_ec_prepare(struct work_ec_s * ec)
 {
-  pthread_mutex_destroy(&(sem->mutex));
-  pthread_cond_destroy(&(sem->cond));
-  work_sem_init(sem, 0);
+  __atomic_add_fetch(&ec->waiters, 1, __ATOMIC_SEQ_CST);
+  return __atomic_load_n(&ec->seq, __ATOMIC_SEQ_CST);
 }
 
-static void work_sem_post(struct work_sem_s * sem)
+/* found work after prepare */
+static void work_ec_cancel(struct work_ec_s * ec)
 {
-  pthread_mutex_lock(&sem->mutex);
-  sem->value = 1;
-  pthread_cond_signal(&sem->cond);
-  pthread_mutex_unlock(&sem->mutex);
+  __atomic_sub_fetch(&ec->waiters, 1, __ATOMIC_SEQ_CST);
 }
 
-static void work_sem_post_all(struct work_sem_s * sem)
+/* sleep unless a notify came since prepare returned key */
+static void work_ec_wait(struct work_ec_s * ec, uint32_t key)
 {
-  pthread_mutex_lock(&sem->mutex);
-  sem->value = 1;
-  pthread_cond_broadcast(&sem->cond);
-  pthread_mutex_unlock(&sem->mutex);
+#ifdef QRC_MCB
+  pthread_mutex_lock(&ec->mutex);
+  while (__atomic_load_n(&ec->seq, __ATOMIC_SEQ_CST) == key) {
+    pthread_cond_wait(&ec->cond, &ec->mutex);
+  }
+  pthread_mutex_unlock(&ec->mutex);
+#else
+  /* EAGAIN if seq moved already, spurious wake ups just look for work again */
+  syscall(SYS_futex, &ec->seq, FUTEX_WAIT_PRIVATE, key, NULL, NULL, 0);
+#endif
+  __atomic_sub_fetch(&ec->waiters, 1, __ATOMIC_SEQ_CST);
 }
 
-static void work_sem_wait(struct work_sem_s * sem)
+/* a work was queued, wake one sleeping worker or all of them */
+static void work_ec_notify(struct work_ec_s * ec, bool all)
 {
-  pthread_mutex_lock(&sem->mutex);
-  while (sem->value != 1) {
-    pthread_cond_wait(&sem->cond, &sem->mutex);
+  __atomic_add_fetch(&ec->seq, 1, __ATOMIC_SEQ_CST);
+  if (0 == __atomic_load_n(&ec->waiters, __ATOMIC_SEQ_CST)) {
+    return;
+  }
+#ifdef QRC_MCB
+  pthread_mutex_lock(&ec->mutex);
+  if (all) {
+    pthread_cond_broadcast(&ec->cond);
+  } else {
+    pthread_cond_signal(&ec->cond);
   }
-  sem->value = 0;
-  pthread_mutex_unlock(&sem->mutex);
+  pthread_mutex_unlock(&ec->mutex);
+#else
+  syscall(SYS_futex, &ec->seq, FUTEX_WAKE_PRIVATE, all ? INT_MAX : 1, NULL, NULL, 0);
+#endif
 }
 
 /****************************************************************************
@@ -366,7 +407,8 @@ static void work_sem_wait(struct work_sem_s * sem)
  ****************************************************************************/
 
 /* Initialise thread pool */
-struct qrc_thread_pool_s * qrc_thread_pool_init(int num)
+struct qrc_thread_pool_s *
+qrc_thread_pool_init(int num, uint32_t slots, enum qrc_thread_role_e role)
 {
   int n;
 
@@ -380,15 +422,22 @@ struct qrc_thread_pool_s * qrc_thread_pool_init(int num)
   struct qrc_thread_pool_s * thpool;
   thpool = (struct qrc_thread_pool_s *)malloc(sizeof(struct qrc_thread_pool_s));
   if (thpool == NULL) {
-    printf("qrc_thread_pool_init(): Could not allocate memory for thread pool\n");
+    QRC_LOGE("qrc_thread_pool_init(): Could not allocate memory for thread pool");
     return NULL;
   }
+  thpool->role = role;
   thpool->num_threads_alive = 0;
   thpool->num_threads_working = 0;
+  thpool->idle_waiters = 0;
+#ifdef QRC_MCB
+  g_work_spin = QRC_WORK_SPIN;
+#else
+  g_work_spin = (sysconf(_SC_NPROCESSORS_ONLN) > 1) ? QRC_WORK_SPIN : 0;
+#endif
 
   /* Initialise the work queue */
-  if (workqueue_init(&thpool->workqueue) == -1) {
-    printf("qrc_thread_pool_init(): Could not allocate memory for work queue\n");
+  if (workqueue_init(&thpool->workqueue, slots) == -1) {
+    QRC_LOGE("qrc_thread_pool_init(): Could not allocate memory for work queue");
     free(thpool);
     return NULL;
   }
@@ -396,7 +445,7 @@ struct qrc_thread_pool_s * qrc_thread_pool_init(int num)
   /* Make threads in pool */
   thpool->threads = (struct qrc_thread_s **)malloc(num * sizeof(struct qrc_thread_s *));
   if (thpool->threads == NULL) {
-    printf("qrc_thread_pool_init(): Could not allocate memory for threads\n");
+    QRC_LOGE("qrc_thread_pool_init(): Could not allocate memory for threads");
     workqueue_destroy(&thpool->workqueue);
     free(thpool);
     return NULL;
@@ -404,52 +453,69 @@ struct qrc_thread_pool_s * qrc_thread_pool_init(int num)
 
   pthread_mutex_init(&(thpool->thread_count_lock), NULL);
   pthread_cond_init(&thpool->threads_all_idle, NULL);
+  pthread_cond_init(&thpool->threads_alive, NULL);
 
   /* Thread init */
   for (n = 0; n < num; n++) {
-    thread_init(thpool, &thpool->threads[n], n);
+    if (0 != thread_init(thpool, &thpool->threads[n], n)) {
+      break;
+    }
   }
+  num = n; /* the pool runs with the threads that could be created */
 
   /* Wait for threads to initialize */
+  pthread_mutex_lock(&thpool->thread_count_lock);
   while (thpool->num_threads_alive != num) {
-    sleep(1);
-    printf("wait thread_alive \n");
+    pthread_cond_wait(&thpool->threads_alive, &thpool->thread_count_lock);
   }
+  pthread_mutex_unlock(&thpool->thread_count_lock);
 
   return thpool;
 }
 
-/* Add work to the thread pool */
+/* Add work to the thread pool, args is copied */
 int qrc_threadpool_add_work(struct qrc_thread_pool_s * thpool,
     qrc_work work_fun,
-    struct qrc_msg_cb_args_s args)
+    const struct qrc_msg_cb_args_s * args)
 {
-  struct qrc_work_s * newwork;
-
-  newwork = (struct qrc_work_s *)malloc(sizeof(struct qrc_work_s));
-  if (newwork == NULL) {
-    printf("qrc_threadpool_add_work(): Could not allocate memory for new work\n");
+  if (!workqueue_push(&thpool->workqueue, work_fun, args)) {
+    QRC_LOGW("qrc_threadpool_add_work(): work queue is full");
     return -1;
   }
 
-  /* add function and argument */
-  newwork->work_fun = work_fun;
-  memcpy(&newwork->args, &args, sizeof(struct qrc_msg_cb_args_s));
-  /* add work to queue */
-  workqueue_push(&thpool->workqueue, newwork);
-
   return 0;
 }
 
 void qrc_threadpool_wait(struct qrc_thread_pool_s * thpool)
 {
   pthread_mutex_lock(&thpool->thread_count_lock);
-  while (thpool->workqueue.len || thpool->num_threads_working) {
+  __atomic_add_fetch(&thpool->idle_waiters, 1, __ATOMIC_SEQ_CST);
+  while (qrc_workring_len(thpool->workqueue.ring) ||
+         __atomic_load_n(&thpool->num_threads_working, __ATOMIC_SEQ_CST)) {
     pthread_cond_wait(&thpool->threads_all_idle, &thpool->thread_count_lock);
   }
+  __atomic_sub_fetch(&thpool->idle_waiters, 1, __ATOMIC_SEQ_CST);
   pthread_mutex_unlock(&thpool->thread_count_lock);
 }
 
+/* Works waiting for a thread, read without the queue lock */
+int qrc_threadpool_queue_len(struct qrc_thread_pool_s * thpool)
+{
+  if (thpool == NULL)
+    return 0;
+
+  return (int)qrc_workring_len(thpool->workqueue.ring);
+}
+
+/* Most works that waited for a thread at once */
+int qrc_threadpool_queue_high(struct qrc_thread_pool_s * thpool)
+{
+  if (thpool == NULL)
+    return 0;
+
+  return (int)qrc_workring_high(thpool->workqueue.ring);
+}
+
 /* Destroy the threadpool */
 void qrc_threadpool_destroy(struct qrc_thread_pool_s * thpool)
 {
@@ -468,14 +534,14 @@ void qrc_threadpool_destroy(struct qrc_thread_pool_s * thpool)
   double tpassed = 0.0;
   time(&start);
   while (tpassed < TIMEOUT && thpool->num_threads_alive) {
-    work_sem_post_all(thpool->workqueue.work_sem);
+    work_ec_notify(&thpool->workqueue.work_ec, true);
     time(&end);
     tpassed = difftime(end, start);
   }
 
   /* Poll remaining threads */
   while (thpool->num_threads_alive) {
-    work_sem_post_all(thpool->workqueue.work_sem);
+    work_ec_notify(&thpool->workqueue.work_ec, true);
     sleep(2);
   }
 
@@ -504,7 +570,7 @@ void qrc_threads_join(struct qrc_thread_pool_s * thpool)
 
   for (i = 0; i < thread_num; i++) {
     pthread_join(threads[i], NULL);
-    printf(" qrc_threads_join =%d \n", i);
+    QRC_LOGD("qrc_threads_join %d", i);
     sleep(1);
   }
   free(threads);
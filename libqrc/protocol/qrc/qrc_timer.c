@@ -0,0 +1,327 @@
+/****************************************************************************
+ *
+ * Copyright (c) 2024 Qualcomm Innovation Center, Inc. All rights reserved.
+ * SPDX-License-Identifier: BSD-3-Clause-Clear
+ *
+ ****************************************************************************/
+#include <stdio.h>
+
+#include "qrc.h"
+
+/****************************************************************************
+ * Pre-processor Definitions
+ ****************************************************************************/
+
+#define QRC_TIMER_TICK_US (100) /* resolution */
+#define QRC_TIMER_BITS (6)
+#define QRC_TIMER_SLOTS (1 << QRC_TIMER_BITS) /* one bit of a uint64_t bitmap each */
+#define QRC_TIMER_MASK (QRC_TIMER_SLOTS - 1)
+#define QRC_TIMER_LEVELS (4) /* 2^24 ticks, about 28 minutes */
+#define QRC_TIMER_MAX_TICKS ((1ULL << (QRC_TIMER_BITS * QRC_TIMER_LEVELS)) - 1)
+
+/****************************************************************************
+ * Private Types
+ ****************************************************************************/
+
+/* hierarchical timing wheel: level 0 holds the timers of the next 64 ticks,
+ * level l the timers 64^l ~ 64^(l+1) ticks away. A level l slot is moved
+ * down when level l - 1 wraps around, so arming and cancelling are O(1) */
+struct qrc_timer_wheel_s
+{
+  pthread_mutex_t mutex;
+  pthread_cond_t cond;      /* timer thread sleeps on CLOCK_MONOTONIC */
+  pthread_cond_t done_cond; /* qrc_timer_cancel() waits for a running callback */
+  pthread_t thread;
+  uint64_t start_us; /* time of tick 0 */
+  uint64_t now;      /* next tick to process */
+  uint32_t count;    /* armed timers */
+  uint64_t bitmap[QRC_TIMER_LEVELS];
+  struct qrc_timer_s * slots[QRC_TIMER_LEVELS][QRC_TIMER_SLOTS];
+  struct qrc_timer_s * running;
+  volatile bool stop;
+};
+
+/****************************************************************************
+ * Private Data
+ ****************************************************************************/
+
+static struct qrc_timer_wheel_s g_timer;
+
+/****************************************************************************
+ * Private Functions
+ ****************************************************************************/
+
+static uint64_t qrc_timer_tick_of(uint64_t us)
+{
+  return (us - g_timer.start_us) / QRC_TIMER_TICK_US;
+}
+
+/* mutex held */
+static void qrc_timer_link(struct qrc_timer_wheel_s * w, struct qrc_timer_s * t)
+{
+  uint64_t delta = t->expires - w->now;
+  uint8_t level = 0;
+  uint8_t slot;
+
+  if ((int64_t)delta < 0) {
+    t->expires = w->now; /* already due, fire on the next tick */
+    delta = 0;
+  }
+  while (level < QRC_TIMER_LEVELS - 1 && delta >= (1ULL << (QRC_TIMER_BITS * (level + 1)))) {
+    level++;
+  }
+  slot = (uint8_t)((t->expires >> (QRC_TIMER_BITS * level)) & QRC_TIMER_MASK);
+
+  t->level = level;
+  t->slot = slot;
+  t->next = w->slots[level][slot];
+  if (NULL != t->next) {
+    t->next->pprev = &t->next;
+  }
+  t->pprev = &w->slots[level][slot];
+  w->slots[level][slot] = t;
+  w->bitmap[level] |= 1ULL << slot;
+}
+
+/* mutex held */
+static void qrc_timer_unlink(struct qrc_timer_wheel_s * w, struct qrc_timer_s * t)
+{
+  *t->pprev = t->next;
+  if (NULL != t->next) {
+    t->next->pprev = t->pprev;
+  }
+  if (NULL == w->slots[t->level][t->slot]) {
+    w->bitmap[t->level] &= ~(1ULL << t->slot);
+  }
+  t->pprev = NULL;
+  t->next = NULL;
+}
+
+/* mutex held, move the timers of a higher level slot to lower levels */
+static void qrc_timer_cascade(struct qrc_timer_wheel_s * w, uint8_t level, uint8_t slot)
+{
+  struct qrc_timer_s * t = w->slots[level][slot];
+
+  w->slots[level][slot] = NULL;
+  w->bitmap[level] &= ~(1ULL << slot);
+  while (NULL != t) {
+    struct qrc_timer_s * next = t->next;
+    qrc_timer_link(w, t);
+    t = next;
+  }
+}
+
+/* mutex held, tick of the next slot to look at: a level 0 slot with timers
+ *or the next wrap of level 0, where the higher levels cascade */
+static uint64_t qrc_timer_next(struct qrc_timer_wheel_s * w)
+{
+  uint64_t pending = w->bitmap[0] & (~0ULL << (w->now & QRC_TIMER_MASK));
+
+  if (0 == (w->now & QRC_TIMER_MASK)) {
+    return w->now;
+  }
+  if (0 != pending) {
+    return (w->now & ~(uint64_t)QRC_TIMER_MASK) + (uint64_t)__builtin_ctzll(pending);
+  }
+  return (w->now | QRC_TIMER_MASK) + 1;
+}
+
+/* mutex held, fire the timers of tick w->now, callbacks run unlocked */
+static void qrc_timer_run_tick(struct qrc_timer_wheel_s * w)
+{
+  uint8_t idx = (uint8_t)(w->now & QRC_TIMER_MASK);
+  struct qrc_timer_s * t;
+
+  if (0 == idx) {
+    for (uint8_t level = 1; level < QRC_TIMER_LEVELS; level++) {
+      uint8_t slot = (uint8_t)((w->now >> (QRC_TIMER_BITS * level)) & QRC_TIMER_MASK);
+      qrc_timer_cascade(w, level, slot);
+      if (0 != slot) {
+        break;
+      }
+    }
+  }
+
+  while (NULL != (t = w->slots[0][idx])) {
+    qrc_timer_unlink(w, t);
+    w->count--;
+    w->running = t;
+    pthread_mutex_unlock(&w->mutex);
+    t->cb(t->arg);
+    pthread_mutex_lock(&w->mutex);
+    w->running = NULL;
+    pthread_cond_broadcast(&w->done_cond);
+  }
+  w->now++;
+}
+
+/****************************************************************************
+ * @intro: thread of the timers, sleeps until the next slot with timers
+ ****************************************************************************/
+static void * qrc_timer_thread(void * args)
+{
+  struct qrc_timer_wheel_s * w = &g_timer;
+  struct timespec outtime;
+  uint64_t cur;
+  uint64_t next;
+  uint64_t us;
+
+  (void)args;
+
+  pthread_mutex_lock(&w->mutex);
+  while (!w->stop) {
+    cur = qrc_timer_tick_of(qrc_timer_now_us());
+    while (w->now <= cur && !w->stop) {
+      next = qrc_timer_next(w);
+      if (next > w->now) {
+        w->now = (next <= cur) ? next : cur + 1;
+        continue;
+      }
+      qrc_timer_run_tick(w);
+    }
+    if (w->stop) {
+      break;
+    }
+
+    if (0 == w->count) {
+      pthread_cond_wait(&w->cond, &w->mutex);
+    } else {
+      us = w->start_us + qrc_timer_next(w) * QRC_TIMER_TICK_US;
+      outtime.tv_sec = (time_t)(us / 1000000ULL);
+      outtime.tv_nsec = (long)(us % 1000000ULL) * 1000L;
+      pthread_cond_timedwait(&w->cond, &w->mutex, &outtime);
+    }
+  }
+  pthread_mutex_unlock(&w->mutex);
+
+  return NULL;
+}
+
+/****************************************************************************
+ * Public Functions
+ ****************************************************************************/
+
+/****************************************************************************
+ * @intro: monotonic time, not affected by setting the system clock
+ * @return: us
+ ****************************************************************************/
+uint64_t qrc_timer_now_us(void)
+{
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (uint64_t)ts.tv_sec * 1000000ULL + (uint64_t)ts.tv_nsec / 1000ULL;
+}
+
+bool qrc_timer_init(void)
+{
+  struct qrc_timer_wheel_s * w = &g_timer;
+  pthread_condattr_t attr;
+
+  memset(w, 0, sizeof(*w));
+  w->start_us = qrc_timer_now_us();
+
+  if (0 != pthread_mutex_init(&w->mutex, NULL) || 0 != pthread_condattr_init(&attr)) {
+    QRC_LOGE("qrc timer mutex initalize failed!");
+    return false;
+  }
+  if (0 != pthread_condattr_setclock(&attr, CLOCK_MONOTONIC) ||
+      0 != pthread_cond_init(&w->cond, &attr) || 0 != pthread_cond_init(&w->done_cond, NULL)) {
+    QRC_LOGE("qrc timer cond initalize failed!");
+    pthread_condattr_destroy(&attr);
+    return false;
+  }
+  pthread_condattr_destroy(&attr);
+
+  if (0 != pthread_create(&w->thread, NULL, qrc_timer_thread, NULL)) {
+    QRC_LOGE("qrc timer thread create failed!");
+    return false;
+  }
+
+  return true;
+}
+
+/****************************************************************************
+ * @intro: stop the timer thread, armed timers do not fire any more
+ ****************************************************************************/
+void qrc_timer_destroy(void)
+{
+  struct qrc_timer_wheel_s * w = &g_timer;
+
+  pthread_mutex_lock(&w->mutex);
+  w->stop = true;
+  pthread_cond_signal(&w->cond);
+  pthread_mutex_unlock(&w->mutex);
+  pthread_join(w->thread, NULL);
+}
+
+/****************************************************************************
+ * @intro: prepare a timer, before it is armed the first time
+ * @param t: timer
+ * @param cb: runs on the timer thread when the timer expires
+ * @param arg: argument of cb
+ ****************************************************************************/
+void qrc_timer_setup(struct qrc_timer_s * t, qrc_timer_cb cb, void * arg)
+{
+  memset(t, 0, sizeof(*t));
+  t->cb = cb;
+  t->arg = arg;
+}
+
+/****************************************************************************
+ * @intro: (re)arm a timer, an armed timer is moved to the new time
+ * @param t: timer
+ * @param timeout_us: from now, rounded up to the timer resolution
+ ****************************************************************************/
+void qrc_timer_arm(struct qrc_timer_s * t, uint64_t timeout_us)
+{
+  struct qrc_timer_wheel_s * w = &g_timer;
+  uint64_t ticks = (timeout_us + QRC_TIMER_TICK_US - 1) / QRC_TIMER_TICK_US;
+  uint64_t now_us = qrc_timer_now_us();
+
+  if (ticks > QRC_TIMER_MAX_TICKS) {
+    ticks = QRC_TIMER_MAX_TICKS;
+  }
+
+  pthread_mutex_lock(&w->mutex);
+  if (NULL != t->pprev) {
+    qrc_timer_unlink(w, t);
+    w->count--;
+  }
+  if (0 == w->count && w->now < qrc_timer_tick_of(now_us)) {
+    w->now = qrc_timer_tick_of(now_us); /* the wheel is empty, skip the idle ticks */
+  }
+  /* +1: the current tick has partly passed already */
+  t->expires = qrc_timer_tick_of(now_us) + ticks + 1;
+  qrc_timer_link(w, t);
+  w->count++;
+  if (1 == w->count || (0 == t->level && qrc_timer_next(w) == t->expires)) {
+    pthread_cond_signal(&w->cond); /* the timer thread sleeps longer */
+  }
+  pthread_mutex_unlock(&w->mutex);
+}
+
+/****************************************************************************
+ * @intro: disarm a timer and wait for its callback if it is running, so the
+ *callback does not run after this returns. Must not be called with a lock
+ *the callback takes
+ * @param t: timer
+ * @return: true if the timer was armed
+ ****************************************************************************/
+bool qrc_timer_cancel(struct qrc_timer_s * t)
+{
+  struct qrc_timer_wheel_s * w = &g_timer;
+  bool armed = false;
+
+  pthread_mutex_lock(&w->mutex);
+  if (NULL != t->pprev) {
+    qrc_timer_unlink(w, t);
+    w->count--;
+    armed = true;
+  }
+  while (w->running == t && !pthread_equal(pthread_self(), w->thread)) {
+    pthread_cond_wait(&w->done_cond, &w->mutex);
+  }
+  pthread_mutex_unlock(&w->mutex);
+
+  return armed;
+}
@@ -0,0 +1,48 @@
+/****************************************************************************
+ *
+ * Copyright (c) 2024 Qualcomm Innovation Center, Inc. All rights reserved.
+ * SPDX-License-Identifier: BSD-3-Clause-Clear
+ *
+ ****************************************************************************/
+#ifndef __QRC_TRACE_H
+#define __QRC_TRACE_H
+
+/* static tracepoints (USDT) of provider "qrc". Each one is a nop until perf,
+ * bpftrace or LTTng attaches to it, so they stay in release builds. They are
+ * built when <sys/sdt.h> is found (cmake option QRC_USDT), list them with
+ * "perf list sdt_qrc:*" after "perf buildid-cache --add libqrc.so".
+ *
+ * A received frame is followed by its rx slab address (buf):
+ *   link_read(len)                          read() returned len bytes
+ *   tf_accept(len)                          the parser takes them
+ *   tf_frame(frame_id, type, len)           the parser decoded a frame
+ *   rx_frame(pipe_id, flags, len, buf)      the frame is for a pipe
+ *   work_push(pool, pipe_id, buf, queued)   queued for a worker
+ *   work_pull(pool, pipe_id, buf, queued)   taken by a worker
+ *   cb_start(pipe_id, buf, len)             callback of the pipe called
+ *   cb_end(pipe_id, buf, us)                callback returned after us
+ * A sent frame:
+ *   tf_write(len)                           frame composed into the tx ring
+ *   link_write(frames, len)                 frames written to the device
+ * Waits of a thread for the peer, done has timeout 1 if it gave up:
+ *   pipe_wait(pipe_id) / pipe_wait_done(pipe_id, timeout)
+ *   lock_wait() / lock_wait_done(timeout)
+ *   rpc_wait(pipe_id, rpc_id) / rpc_wait_done(pipe_id, rpc_id, timeout) */
+
+#if defined(QRC_USDT) && !defined(QRC_MCB)
+#include <sys/sdt.h>
+
+#define QRC_TRACE0(name) DTRACE_PROBE(qrc, name)
+#define QRC_TRACE1(name, a) DTRACE_PROBE1(qrc, name, a)
+#define QRC_TRACE2(name, a, b) DTRACE_PROBE2(qrc, name, a, b)
+#define QRC_TRACE3(name, a, b, c) DTRACE_PROBE3(qrc, name, a, b, c)
+#define QRC_TRACE4(name, a, b, c, d) DTRACE_PROBE4(qrc, name, a, b, c, d)
+#else
+#define QRC_TRACE0(name) ((void)0)
+#define QRC_TRACE1(name, a) ((void)0)
+#define QRC_TRACE2(name, a, b) ((void)0)
+#define QRC_TRACE3(name, a, b, c) ((void)0)
+#define QRC_TRACE4(name, a, b, c, d) ((void)0)
+#endif
+
+#endif
@@ -0,0 +1,290 @@
+/****************************************************************************
+ *
+ * Copyright (c) 2024 Qualcomm Innovation Center, Inc. All rights reserved.
+ * SPDX-License-Identifier: BSD-3-Clause-Clear
+ *
+ ****************************************************************************/
+#include <stdio.h>
+
+#include "qrc.h"
+
+/****************************************************************************
+ * Pre-processor Definitions
+ ****************************************************************************/
+
+#ifdef QRC_MCB
+#define QRC_TXRING_SLOTS (8) /* must be a power of 2 */
+#else
+#define QRC_TXRING_SLOTS (64) /* must be a power of 2 */
+#endif
+
+#define QRC_TXRING_MASK (QRC_TXRING_SLOTS - 1)
+
+/****************************************************************************
+ * Private Types
+ ****************************************************************************/
+
+/* one composed frame, seq tells who owns the slot:
+ * seq == pos: free for the producer of pos
+ * seq == pos + 1: frame of pos is ready for the writer thread */
+struct qrc_txslot_s
+{
+  uint32_t seq;
+  uint32_t len;
+  uint8_t frame[QRC_TX_FRAME_MAX];
+};
+
+struct qrc_txring_s
+{
+  struct qrc_txslot_s * slots;
+  uint32_t enqueue_pos; /* shared by producers */
+  uint32_t dequeue_pos; /* owned by the writer thread */
+
+  pthread_mutex_t mutex;
+  pthread_cond_t data_cond;  /* writer thread waits for frames */
+  pthread_cond_t space_cond; /* blocking producers wait for free slots */
+  volatile bool writer_sleeping;
+  volatile uint32_t space_waiters;
+  volatile bool stop;
+};
+
+/****************************************************************************
+ * Private Data
+ ****************************************************************************/
+
+static struct qrc_txring_s g_txring;
+
+/****************************************************************************
+ * Private Functions
+ ****************************************************************************/
+
+static bool qrc_txring_ready(struct qrc_txring_s * ring)
+{
+  struct qrc_txslot_s * slot = &ring->slots[ring->dequeue_pos & QRC_TXRING_MASK];
+  return __atomic_load_n(&slot->seq, __ATOMIC_ACQUIRE) == ring->dequeue_pos + 1;
+}
+
+/****************************************************************************
+ * @intro: claim the next free slot
+ * @return: slot or NULL if the ring is full
+ ****************************************************************************/
+static struct qrc_txslot_s * qrc_txring_claim(struct qrc_txring_s * ring)
+{
+  uint32_t pos = __atomic_load_n(&ring->enqueue_pos, __ATOMIC_RELAXED);
+  struct qrc_txslot_s * slot;
+  int32_t dif;
+
+  for (;;) {
+    slot = &ring->slots[pos & QRC_TXRING_MASK];
+    dif = (int32_t)(__atomic_load_n(&slot->seq, __ATOMIC_ACQUIRE) - pos);
+    if (0 == dif) {
+      if (__atomic_compare_exchange_n(
+              &ring->enqueue_pos, &pos, pos + 1, true, __ATOMIC_RELAXED, __ATOMIC_RELAXED)) {
+        return slot;
+      }
+    } else if (dif < 0) {
+      return NULL; /* the writer thread has not sent this slot yet */
+    } else {
+      pos = __atomic_load_n(&ring->enqueue_pos, __ATOMIC_RELAXED);
+    }
+  }
+}
+
+/****************************************************************************
+ * Public Functions
+ ****************************************************************************/
+
+bool qrc_txring_init(void)
+{
+  struct qrc_txring_s * ring = &g_txring;
+
+  memset(ring, 0, sizeof(*ring));
+  ring->slots = (struct qrc_txslot_s *)malloc(QRC_TXRING_SLOTS * sizeof(struct qrc_txslot_s));
+  if (NULL == ring->slots) {
+    QRC_LOGE("qrc tx ring malloc failed!");
+    return false;
+  }
+  for (uint32_t i = 0; i < QRC_TXRING_SLOTS; i++) {
+    ring->slots[i].seq = i;
+  }
+
+  if (0 != pthread_mutex_init(&ring->mutex, NULL) ||
+      0 != pthread_cond_init(&ring->data_cond, NULL) ||
+      0 != pthread_cond_init(&ring->space_cond, NULL)) {
+    QRC_LOGE("qrc tx ring mutex initalize failed!");
+    free(ring->slots);
+    ring->slots = NULL;
+    return false;
+  }
+
+  return true;
+}
+
+void qrc_txring_destroy(void)
+{
+  struct qrc_txring_s * ring = &g_txring;
+
+  pthread_mutex_destroy(&ring->mutex);
+  pthread_cond_destroy(&ring->data_cond);
+  pthread_cond_destroy(&ring->space_cond);
+  free(ring->slots);
+  ring->slots = NULL;
+}
+
+/****************************************************************************
+ * @intro: compose a frame into the ring, safe to call from any thread
+ * @param compose: writes the frame into the slot, returns its length or 0
+ * @param arg: argument of compose
+ * @param wait: wait for a free slot when the ring is full
+ * @return: SUCCESS, BUSY if the ring is full and wait is false, FAILED if
+ *compose failed or the ring is stopping
+ ****************************************************************************/
+enum qrc_write_status_e qrc_txring_push(qrc_tx_compose compose, void * arg, bool wait)
+{
+  struct qrc_txring_s * ring = &g_txring;
+  struct qrc_txslot_s * slot;
+  uint32_t pos;
+  uint32_t len;
+
+  slot = qrc_txring_claim(ring);
+  while (NULL == slot) {
+    if (!wait) {
+      return BUSY;
+    }
+    if (ring->stop) {
+      return FAILED;
+    }
+
+    /* pairs with the fence in qrc_txring_consume() */
+    pthread_mutex_lock(&ring->mutex);
+    ring->space_waiters++;
+    __atomic_thread_fence(__ATOMIC_SEQ_CST);
+    slot = qrc_txring_claim(ring);
+    if (NULL == slot && !ring->stop) {
+      pthread_cond_wait(&ring->space_cond, &ring->mutex);
+    }
+    ring->space_waiters--;
+    pthread_mutex_unlock(&ring->mutex);
+
+    if (NULL == slot) {
+      slot = qrc_txring_claim(ring);
+    }
+  }
+
+  /* seq is the position this producer owns until the slot is published */
+  pos = slot->seq;
+  len = compose(slot->frame, sizeof(slot->frame), arg);
+  slot->len = len;
+  __atomic_store_n(&slot->seq, pos + 1, __ATOMIC_RELEASE);
+
+  /* pairs with the fence in qrc_txring_wait() */
+  __atomic_thread_fence(__ATOMIC_SEQ_CST);
+  if (ring->writer_sleeping) {
+    pthread_mutex_lock(&ring->mutex);
+    pthread_cond_signal(&ring->data_cond);
+    pthread_mutex_unlock(&ring->mutex);
+  }
+
+  return (0 == len) ? FAILED : SUCCESS;
+}
+
+/****************************************************************************
+ * @intro: writer thread, sleep until a frame is ready or the ring stops
+ * @return: false when the ring is stopped and empty
+ ****************************************************************************/
+bool qrc_txring_wait(void)
+{
+  struct qrc_txring_s * ring = &g_txring;
+
+  while (!qrc_txring_ready(ring)) {
+    pthread_mutex_lock(&ring->mutex);
+    ring->writer_sleeping = true;
+    __atomic_thread_fence(__ATOMIC_SEQ_CST);
+    if (!qrc_txring_ready(ring) && !ring->stop) {
+      pthread_cond_wait(&ring->data_cond, &ring->mutex);
+    }
+    ring->writer_sleeping = false;
+    pthread_mutex_unlock(&ring->mutex);
+
+    if (ring->stop && !qrc_txring_ready(ring)) {
+      return false;
+    }
+  }
+
+  return true;
+}
+
+/****************************************************************************
+ * @intro: writer thread, collect ready frames in ring order without taking
+ *them out of the ring
+ * @param iov: filled with one segment per frame, a frame whose compose
+ *failed has length 0
+ * @param max: size of iov
+ * @return: number of frames
+ ****************************************************************************/
+int qrc_txring_peek(struct iovec * iov, int max)
+{
+  struct qrc_txring_s * ring = &g_txring;
+  int frames = 0;
+
+  while (frames < max) {
+    uint32_t pos = ring->dequeue_pos + frames;
+    struct qrc_txslot_s * slot = &ring->slots[pos & QRC_TXRING_MASK];
+    if (__atomic_load_n(&slot->seq, __ATOMIC_ACQUIRE) != pos + 1) {
+      break;
+    }
+    iov[frames].iov_base = slot->frame;
+    iov[frames].iov_len = slot->len;
+    frames++;
+  }
+
+  return frames;
+}
+
+/****************************************************************************
+ * @intro: writer thread, give the oldest frames' slots back to producers
+ * @param frames: number of frames returned by qrc_txring_peek()
+ ****************************************************************************/
+void qrc_txring_consume(int frames)
+{
+  struct qrc_txring_s * ring = &g_txring;
+
+  for (int i = 0; i < frames; i++) {
+    uint32_t pos = ring->dequeue_pos++;
+    struct qrc_txslot_s * slot = &ring->slots[pos & QRC_TXRING_MASK];
+    __atomic_store_n(&slot->seq, pos + QRC_TXRING_SLOTS, __ATOMIC_RELEASE);
+  }
+
+  __atomic_thread_fence(__ATOMIC_SEQ_CST);
+  if (ring->space_waiters > 0) {
+    pthread_mutex_lock(&ring->mutex);
+    pthread_cond_broadcast(&ring->space_cond);
+    pthread_mutex_unlock(&ring->mutex);
+  }
+}
+
+/****************************************************************************
+ * @intro: frames claimed by producers and not yet consumed by the writer
+ *thread, read without a lock
+ ****************************************************************************/
+uint32_t qrc_txring_depth(void)
+{
+  uint32_t dequeue = __atomic_load_n(&g_txring.dequeue_pos, __ATOMIC_RELAXED);
+
+  return __atomic_load_n(&g_txring.enqueue_pos, __ATOMIC_RELAXED) - dequeue;
+}
+
+/****************************************************************************
+ * @intro: let the writer thread exit after the ring is drained, and wake up
+ *the producers waiting for space
+ ****************************************************************************/
+void qrc_txring_stop(void)
+{
+  struct qrc_txring_s * ring = &g_txring;
+
+  pthread_mutex_lock(&ring->mutex);
+  ring->stop = true;
+  pthread_cond_broadcast(&ring->data_cond);
+  pthread_cond_broadcast(&ring->space_cond);
+  pthread_mutex_unlock(&ring->mutex);
+}
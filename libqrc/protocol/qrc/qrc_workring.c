@@ -0,0 +1,200 @@
+/****************************************************************************
+ *
+ * Copyright (c) 2024 Qualcomm Innovation Center, Inc. All rights reserved.
+ * SPDX-License-Identifier: BSD-3-Clause-Clear
+ *
+ ****************************************************************************/
+#include <stdio.h>
+
+#include "qrc.h"
+
+/****************************************************************************
+ * Pre-processor Definitions
+ ****************************************************************************/
+
+/* producers and workers touch different lines, and each slot has its own */
+#ifdef QRC_MCB
+#define QRC_WORKRING_LINE (8) /* no data cache, just keep the slots aligned */
+#else
+#define QRC_WORKRING_LINE (64)
+#endif
+
+#define QRC_WORKRING_ALIGNED __attribute__((aligned(QRC_WORKRING_LINE)))
+
+/****************************************************************************
+ * Private Types
+ ****************************************************************************/
+
+/* one work, seq tells who owns the slot:
+ * seq == pos: free for the producer of pos
+ * seq == pos + 1: work of pos is ready for a worker */
+struct qrc_workslot_s
+{
+  uint32_t seq;
+  qrc_work work_fun;
+  struct qrc_msg_cb_args_s args;
+} QRC_WORKRING_ALIGNED;
+
+/* bounded MPMC ring, the slots are allocated once */
+struct qrc_workring_s
+{
+  struct qrc_workslot_s * slots;
+  uint32_t mask; /* slots - 1 */
+
+  uint32_t enqueue_pos QRC_WORKRING_ALIGNED; /* shared by producers */
+  uint32_t high;                             /* most works queued at once */
+  uint32_t dequeue_pos QRC_WORKRING_ALIGNED; /* shared by workers */
+};
+
+/****************************************************************************
+ * Private Functions
+ ****************************************************************************/
+
+static void * qrc_workring_alloc(size_t size)
+{
+  void * p = NULL;
+
+  if (0 != posix_memalign(&p, QRC_WORKRING_LINE, size)) {
+    return NULL;
+  }
+  return p;
+}
+
+/****************************************************************************
+ * Public Functions
+ ****************************************************************************/
+
+/****************************************************************************
+ * @intro: create a ring of preallocated works
+ * @param slots: works it holds, rounded up to a power of 2
+ * @return: ring or NULL if malloc failed
+ ****************************************************************************/
+struct qrc_workring_s * qrc_workring_create(uint32_t slots)
+{
+  struct qrc_workring_s * ring;
+  uint32_t n = 2;
+
+  while (n < slots) {
+    n <<= 1;
+  }
+
+  ring = (struct qrc_workring_s *)qrc_workring_alloc(sizeof(struct qrc_workring_s));
+  if (NULL == ring) {
+    QRC_LOGE("qrc work ring malloc failed!");
+    return NULL;
+  }
+  memset(ring, 0, sizeof(*ring));
+  ring->slots = (struct qrc_workslot_s *)qrc_workring_alloc(n * sizeof(struct qrc_workslot_s));
+  if (NULL == ring->slots) {
+    QRC_LOGE("qrc work ring of %u slots malloc failed!", (unsigned)n);
+    free(ring);
+    return NULL;
+  }
+  for (uint32_t i = 0; i < n; i++) {
+    ring->slots[i].seq = i;
+  }
+  ring->mask = n - 1;
+
+  return ring;
+}
+
+void qrc_workring_destroy(struct qrc_workring_s * ring)
+{
+  if (NULL != ring) {
+    free(ring->slots);
+    free(ring);
+  }
+}
+
+/****************************************************************************
+ * @intro: copy a work into the next free slot
+ * @return: false if the ring is full
+ ****************************************************************************/
+bool qrc_workring_push(struct qrc_workring_s * ring,
+    qrc_work work_fun,
+    const struct qrc_msg_cb_args_s * args)
+{
+  uint32_t pos = __atomic_load_n(&ring->enqueue_pos, __ATOMIC_RELAXED);
+  struct qrc_workslot_s * slot;
+  uint32_t depth;
+  uint32_t high;
+  int32_t dif;
+
+  for (;;) {
+    slot = &ring->slots[pos & ring->mask];
+    dif = (int32_t)(__atomic_load_n(&slot->seq, __ATOMIC_ACQUIRE) - pos);
+    if (0 == dif) {
+      if (__atomic_compare_exchange_n(
+              &ring->enqueue_pos, &pos, pos + 1, true, __ATOMIC_RELAXED, __ATOMIC_RELAXED)) {
+        break;
+      }
+    } else if (dif < 0) {
+      return false; /* no worker has taken this slot yet */
+    } else {
+      pos = __atomic_load_n(&ring->enqueue_pos, __ATOMIC_RELAXED);
+    }
+  }
+
+  slot->work_fun = work_fun;
+  memcpy(&slot->args, args, sizeof(slot->args));
+  __atomic_store_n(&slot->seq, pos + 1, __ATOMIC_RELEASE);
+
+  /* the high water mark is written only when it grows */
+  depth = pos + 1 - __atomic_load_n(&ring->dequeue_pos, __ATOMIC_RELAXED);
+  high = __atomic_load_n(&ring->high, __ATOMIC_RELAXED);
+  while (depth > high && depth <= ring->mask + 1 &&
+         !__atomic_compare_exchange_n(
+             &ring->high, &high, depth, true, __ATOMIC_RELAXED, __ATOMIC_RELAXED)) {
+  }
+  return true;
+}
+
+/****************************************************************************
+ * @intro: take the oldest work out of the ring
+ * @param work_fun: its function
+ * @param args: its arguments are copied here
+ * @return: false if the ring is empty
+ ****************************************************************************/
+bool qrc_workring_pop(struct qrc_workring_s * ring,
+    qrc_work * work_fun,
+    struct qrc_msg_cb_args_s * args)
+{
+  uint32_t pos = __atomic_load_n(&ring->dequeue_pos, __ATOMIC_RELAXED);
+  struct qrc_workslot_s * slot;
+  int32_t dif;
+
+  for (;;) {
+    slot = &ring->slots[pos & ring->mask];
+    dif = (int32_t)(__atomic_load_n(&slot->seq, __ATOMIC_ACQUIRE) - (pos + 1));
+    if (0 == dif) {
+      if (__atomic_compare_exchange_n(
+              &ring->dequeue_pos, &pos, pos + 1, true, __ATOMIC_RELAXED, __ATOMIC_RELAXED)) {
+        break;
+      }
+    } else if (dif < 0) {
+      return false; /* the producer of this slot has not finished it */
+    } else {
+      pos = __atomic_load_n(&ring->dequeue_pos, __ATOMIC_RELAXED);
+    }
+  }
+
+  *work_fun = slot->work_fun;
+  memcpy(args, &slot->args, sizeof(*args));
+  __atomic_store_n(&slot->seq, pos + ring->mask + 1, __ATOMIC_RELEASE);
+  return true;
+}
+
+/* works queued or being queued, read without a lock */
+uint32_t qrc_workring_len(const struct qrc_workring_s * ring)
+{
+  uint32_t dequeue = __atomic_load_n(&ring->dequeue_pos, __ATOMIC_RELAXED);
+  uint32_t enqueue = __atomic_load_n(&ring->enqueue_pos, __ATOMIC_RELAXED);
+
+  return (enqueue - dequeue <= ring->mask + 1) ? enqueue - dequeue : 0;
+}
+
+/* most works queued at once since the ring was created */
+uint32_t qrc_workring_high(const struct qrc_workring_s * ring)
+{
+  return __atomic_load_n(&ring->high, __ATOMIC_RELAXED);
+}
@@ -11,11 +11,19 @@
 #include <stdint.h>
 #include <stdio.h>
 
+#include "qrc_log.h"
+#include "qrc_trace.h"
+
 #define TF_USE_MUTEX 0
+#define TF_USE_WRITEV 1
+#define TF_MAX_IOV 8
+#define TF_USE_STATS 1
 #define TF_ID_BYTES 1
 #define TF_LEN_BYTES 2
 #define TF_TYPE_BYTES 1
+#ifndef TF_CKSUM_TYPE
 #define TF_CKSUM_TYPE TF_CKSUM_CRC16
+#endif
 #define TF_USE_SOF_BYTE 1
 #define TF_SOF_BYTE 0x01
 typedef uint16_t TF_TICKS;
@@ -27,6 +35,10 @@ typedef uint8_t TF_COUNT;
 #define TF_MAX_GEN_LST 5
 #define TF_PARSER_TIMEOUT_TICKS 10
 
-#define TF_Error(format, ...) printf("[TF] " format "\n", ##__VA_ARGS__)
+// static tracepoints of qrc, see qrc_trace.h
+#define TF_TRACE_ACCEPT(tf, count) QRC_TRACE1(tf_accept, count)
+#define TF_TRACE_FRAME(tf, msg) QRC_TRACE3(tf_frame, (msg)->frame_id, (msg)->type, (msg)->len)
+
+#define TF_Error(format, ...) QRC_LOGE("[TF] " format, ##__VA_ARGS__)
 
 #endif
\ No newline at end of file
@@ -9,41 +9,146 @@
 
 #include "qrc.h"
 
-#define TRY_TIMES (1)
-static uint8_t g_pipe_write_lock_owner = 255;
+/****************************************************************************
+ * @intro: set the scheduling policy, priority, CPUs and stack of the library
+ *threads of a role, e.g. SCHED_FIFO on the big cores for the read and
+ *message threads. Call it before init_qrc_management(), Linux only. A
+ *policy the process may not set is warned about and not applied
+ * @param role: QRC_THREAD_READ, QRC_THREAD_WRITE, QRC_THREAD_CONTROL or
+ *QRC_THREAD_MESSAGE
+ * @param config: NULL for the default
+ * @return: result of setting
+ ****************************************************************************/
+bool qrc_set_thread_config(enum qrc_thread_role_e role, const struct qrc_thread_config_s * config)
+{
+  return qrc_rt_set_config(role, config);
+}
+
+/****************************************************************************
+ * @intro: set the thread configs and the memory lock from a file, call it
+ *before init_qrc_management(). After a "qrc-threads 1" line each line is
+ *"<role> <policy> <priority> <cpus> [stack_size [prefault_size]]" or
+ *"mlockall", for example:
+ *  read fifo 80 4-7 262144 65536
+ *  message fifo 70 4-7
+ *role is read, write, control or message, policy is other, fifo or rr,
+ *cpus is a list like 4-7,2 or any
+ * @param path: file
+ * @return: false if it can not be read or has an invalid line, nothing is
+ *set then
+ ****************************************************************************/
+bool qrc_load_thread_config(const char * path)
+{
+  if (NULL == path) {
+    QRC_LOGE("No thread config file!");
+    return false;
+  }
+  return qrc_rt_load_file(path);
+}
 
 /****************************************************************************
- * @intro: require both MCB and RB5's lock
+ * @intro: lock all pages of the process in init_qrc_management() with
+ *mlockall(), so the threads do not fault on memory that was paged out.
+ *Call it before init_qrc_management(), Linux only. Failing to lock, e.g.
+ *for RLIMIT_MEMLOCK, is warned about and not fatal. Thread stacks are locked
+ *whole, set a stack_size with qrc_set_thread_config() to keep them small
+ * @param enable: true to lock
+ * @return: result of setting
+ ****************************************************************************/
+bool qrc_set_memory_lock(bool enable)
+{
+  return qrc_rt_set_mlock(enable);
+}
+
+/****************************************************************************
+ * @intro: require both MCB and RB5's lock. The peer grants a lease of the
+ *bus, taking it again soon after qrc_release_pipe() needs no round trip
  * @param p: the initiator of the request
  ****************************************************************************/
 bool qrc_require_pipe(qrc_pipe_s * p)
 {
-  g_pipe_write_lock_owner = p->pipe_id;
-  if (false == qrc_control_write(p, p->pipe_id, QRC_WRITE_LOCK)) {
-    printf("ERROR: %s require pipe failed!\n", p->pipe_name);
+  if (NULL == p || p->pipe_id >= get_pipe_number()) {
+    QRC_LOGE("No such pipe! Require pipe failed!");
     return false;
   }
-  qrc_bus_lock();
-  return true;
+  if (qrc_in_read_thread()) {
+    QRC_LOGE("Require pipe (%s) failed! It waits for the peer, not in an inline callback!",
+        p->pipe_name);
+    return false;
+  }
+  return qrc_lease_acquire(p);
 }
 
 /****************************************************************************
  * @intro: release both MCB and RB5's lock
  * @param p: the initiator of the request
+ * @return: false if p does not hold the lock, or held it past the lease
+ *and the peer unlocked by itself
  ****************************************************************************/
 bool qrc_release_pipe(qrc_pipe_s * p)
 {
-  if (g_pipe_write_lock_owner != p->pipe_id) {
-    printf("ERROR: %s releases pipe failed! owner of lock is not you!\n", p->pipe_name);
+  if (NULL == p) {
+    QRC_LOGE("No such pipe! Release pipe failed!");
     return false;
   }
+  return qrc_lease_release(p);
+}
 
-  qrc_bus_unlock();
-  if (false == qrc_control_write(p, p->pipe_id, QRC_WRITE_UNLOCK)) {
-    printf("ERROR: %s releases pipe failed!\n", p->pipe_name);
+/****************************************************************************
+ * @intro: set the bus lease of qrc_require_pipe()
+ * @param lease_ms: longest time a pipe may hold the bus, the peer unlocks
+ *it by itself after that
+ * @param linger_ms: time the bus stays reserved after qrc_release_pipe()
+ *for the next qrc_require_pipe(), the peer's writes wait meanwhile; 0
+ *gives it back at once
+ * @return: result of setting
+ ****************************************************************************/
+bool qrc_set_bus_lease(uint32_t lease_ms, uint32_t linger_ms)
+{
+  return qrc_lease_config(lease_ms, linger_ms);
+}
+
+/****************************************************************************
+ * @intro: get how often and how long qrc_require_pipe() waited for and held
+ *the bus
+ * @param stats: filled with the counters
+ * @return: result of getting
+ ****************************************************************************/
+bool qrc_get_bus_stats(struct qrc_bus_stats_s * stats)
+{
+  if (NULL == stats) {
     return false;
   }
+  qrc_lease_get_stats(stats);
+  return true;
+}
+
+/****************************************************************************
+ * @intro: send the messages of the library to sink instead of stdout. The
+ *sink runs on the log thread, so it may block without holding up qrc
+ * @param sink: qrc_log_sink, NULL for stdout
+ * @param arg: passed to sink
+ * @return: result of setting
+ ****************************************************************************/
+bool qrc_set_log_sink(qrc_log_sink sink, void * arg)
+{
+  qrc_log_set_sink(sink, arg);
+  return true;
+}
 
+/****************************************************************************
+ * @intro: set the lowest severity of the messages logged, QRC_LOG_INFO by
+ *default
+ * @param level: enum qrc_log_level_e, QRC_LOG_NONE for none
+ * @return: result of setting
+ ****************************************************************************/
+bool qrc_set_log_level(enum qrc_log_level_e level)
+{
+  if (level < QRC_LOG_DEBUG || level > QRC_LOG_NONE) {
+    QRC_LOGE("Log level %d is not valid!", (int)level);
+    return false;
+  }
+  qrc_log_set_level(level);
   return true;
 }
 
@@ -55,6 +160,29 @@ bool init_qrc_management(void)
   return qrc_init();
 }
 
+/****************************************************************************
+ * @intro: select how the receive thread waits for data, can be called
+ *before or after init_qrc_management()
+ * @param mode: QRC_RX_BLOCKING or QRC_RX_BUSY_POLL
+ * @param spin_us: busy poll budget in us after the last received data,
+ *ignored in QRC_RX_BLOCKING mode
+ * @return: result of setting
+ ****************************************************************************/
+bool qrc_set_rx_mode(enum qrc_rx_mode_e mode, uint32_t spin_us)
+{
+  if (QRC_RX_BLOCKING != mode && QRC_RX_BUSY_POLL != mode) {
+    QRC_LOGE("rx mode(%d) is invalid!", mode);
+    return false;
+  }
+  if (QRC_RX_BUSY_POLL == mode && 0 == spin_us) {
+    QRC_LOGE("busy poll rx mode needs a spin budget!");
+    return false;
+  }
+
+  qrc_read_mode_config(mode, spin_us);
+  return true;
+}
+
 /****************************************************************************
  * @intro: get a new or exited pipe
  * @param pipe_name: name of pipe
@@ -63,13 +191,13 @@ bool init_qrc_management(void)
 qrc_pipe_s * qrc_get_pipe(const char * pipe_name)
 {
   int pipe_name_len = (int)strlen(pipe_name);
-  if (pipe_name_len > 10) {
-    printf("\nERROR: Pipe name(%s) is too long!\n", pipe_name);
+  if (pipe_name_len >= QRC_PIPE_NAME_LEN) {
+    QRC_LOGE("Pipe name(%s) is too long!", pipe_name);
     return NULL;
   }
   qrc_pipe_s * p = qrc_pipe_insert(pipe_name);
   if (NULL == p) {
-    printf("ERROR: Pipe(%s) create failed!\n", pipe_name);
+    QRC_LOGE("Pipe(%s) create failed!", pipe_name);
     return NULL;
   }
 
@@ -79,14 +207,78 @@ qrc_pipe_s * qrc_get_pipe(const char * pipe_name)
   }
 
   if (false == qrc_control_write(p, p->pipe_id, QRC_REQUEST)) {
-    printf("ERROR: Pipe(%s) send peer request failed!\n", pipe_name);
+    QRC_LOGE("Pipe(%s) send peer request failed!", pipe_name);
     return NULL;
   }
 
-  printf("INFO: Pipe(%s) create done id=%d\n", pipe_name, p->pipe_id);
+  QRC_LOGI("Pipe(%s) create done id=%d", pipe_name, p->pipe_id);
   return p;
 }
 
+/****************************************************************************
+ * @intro: get several new or exited pipes with one handshake, instead of a
+ *round trip for each pipe
+ * @param pipe_names: names of pipes
+ * @param pipes: filled with the pointers of pipes, NULL for a failed one
+ * @param count: number of pipes
+ * @return: true if all pipes are connected to the peer
+ ****************************************************************************/
+bool qrc_get_pipes(const char * const pipe_names[], qrc_pipe_s * pipes[], int count)
+{
+  qrc_pipe_s * requests[QRC_BATCH_MAX];
+  int n = 0;
+  bool res = true;
+
+  if (NULL == pipe_names || NULL == pipes || count <= 0 || count >= MAX_PIPE_ID) {
+    QRC_LOGE("qrc_get_pipes of %d pipes is invalid!", count);
+    return false;
+  }
+
+  for (int i = 0; i < count; i++) {
+    pipes[i] = NULL;
+    if (strlen(pipe_names[i]) >= QRC_PIPE_NAME_LEN) {
+      QRC_LOGE("Pipe name(%s) is too long!", pipe_names[i]);
+      res = false;
+      continue;
+    }
+    pipes[i] = qrc_pipe_insert(pipe_names[i]);
+    if (NULL == pipes[i]) {
+      QRC_LOGE("Pipe(%s) create failed!", pipe_names[i]);
+      res = false;
+      continue;
+    }
+    if (!pipes[i]->pipe_ready) {
+      requests[n++] = pipes[i];
+    }
+    if (QRC_BATCH_MAX == n) {
+      res = qrc_control_write_batch(requests, n, QRC_REQUEST_BATCH) && res;
+      n = 0;
+    }
+  }
+  if (n > 0) {
+    res = qrc_control_write_batch(requests, n, QRC_REQUEST_BATCH) && res;
+  }
+  for (int i = 0; i < count; i++) {
+    if (NULL != pipes[i] && !pipes[i]->pipe_ready) {
+      res = false;
+    }
+  }
+
+  return res;
+}
+
+/****************************************************************************
+ * @intro: keep the pipes and their peer ids in a file, so the next run
+ *connects them in the QRC_CONNECT handshake when the peer has the same ones.
+ *Call it before init_qrc_management()
+ * @param path: file, NULL to keep no map
+ * @return: result of setting
+ ****************************************************************************/
+bool qrc_set_pipe_map_file(const char * path)
+{
+  return qrc_pipe_map_set_file(path);
+}
+
 /****************************************************************************
  * @intro: register callback function of pipe
  * @param pipe_name: name of pipe
@@ -96,7 +288,7 @@ qrc_pipe_s * qrc_get_pipe(const char * pipe_name)
 bool qrc_register_message_cb(qrc_pipe_s * pipe, qrc_msg_cb fun_cb)
 {
   if (pipe == NULL) {
-    printf("ERROR: Register callback function failed! Pipe is NULL!\n");
+    QRC_LOGE("Register callback function failed! Pipe is NULL!");
     return false;
   }
   pipe->cb = fun_cb;
@@ -108,109 +300,527 @@ bool qrc_register_message_cb(qrc_pipe_s * pipe, qrc_msg_cb fun_cb)
  * @param pipe: writer
  * @param data: data of writer
  * @param len: length of data
- * @param ack: whether writer need response, true means yes, false means no
- * @return: SUCCESS or TIMEOUT or FAILED
+ * @param ack: true sends reliably with a sequence number, the frame is
+ *retransmitted until the peer acknowledges it, see qrc_set_send_window()
+ * @return: SUCCESS or TIMEOUT or FAILED, BUSY if the tx ring is full (only
+ *without ack)
  ****************************************************************************/
 enum qrc_write_status_e
 qrc_write(const qrc_pipe_s * pipe, const uint8_t * data, const size_t len, const bool data_ack)
+{
+  struct iovec iov;
+  iov.iov_base = (void *)data;
+  iov.iov_len = len;
+
+  return qrc_writev(pipe, &iov, 1, data_ack);
+}
+
+/****************************************************************************
+ * @intro: qrc write with lock, data is gathered from several buffers (e.g. a
+ *header and a body) and sent as one message without being copied
+ * @param pipe: writer
+ * @param iov: data segments of writer
+ * @param iovcnt: number of segments, at most QRC_MAX_IOV
+ * @param ack: true sends reliably, see qrc_write()
+ * @return: SUCCESS or TIMEOUT or FAILED, BUSY if the tx ring is full (only
+ *without ack)
+ ****************************************************************************/
+enum qrc_write_status_e qrc_writev(const qrc_pipe_s * pipe,
+    const struct iovec * iov,
+    const int iovcnt,
+    const bool data_ack)
 {
   enum qrc_write_status_e res = FAILED;
-  bool timeout;
-  int try = TRY_TIMES;
-  bool send_result;
 
   if (NULL == pipe || pipe->pipe_id >= get_pipe_number()) {
-    printf("ERROR: No such pipe! Write failed!\n");
+    QRC_LOGE("No such pipe! Write failed!");
     return res;
   }
-  if (255 == pipe->peer_pipe_id) {
-    printf("ERROR: Pipe write failed! (%s) doesn't have peer pipe!\n", pipe->pipe_name);
+  if (QRC_PIPE_ID_NONE == pipe->peer_pipe_id) {
+    QRC_LOGE("Pipe write failed! (%s) doesn't have peer pipe!", pipe->pipe_name);
   } else {
     qrc_frame qrcf;
-    qrcf.receiver_id = pipe->peer_pipe_id;
+    struct qrc_ext_s ext;
+    memset(&qrcf, 0, sizeof(qrcf));
+    memset(&ext, 0, sizeof(ext));
     qrcf.ack = NO_ACK;
 
-    if (data_ack == true) /* need ack transport */
+    if (iovcnt < 0 || iovcnt > QRC_MAX_IOV) {
+      QRC_LOGE("Pipe (%s) write with %d segments!", pipe->pipe_name, iovcnt);
+    } else if (data_ack == true && qrc_in_read_thread()) {
+      QRC_LOGE("Pipe (%s) write with ack in an inline callback, use qrc_write_async()!",
+          pipe->pipe_name);
+    } else if (data_ack == true) /* need ack transport */
     {
-      while (try >= 0) {
-        try = try - 1;
-
-        if (true == is_pipe_timeout_busy(pipe->pipe_id)) {
-          printf("Warning: Pipe (%s) send with nack by timer is using\n", pipe->pipe_name);
-          send_result = qrc_frame_send(&qrcf, (uint8_t *)data, len, true);
-          res = (send_result) ? SUCCESS : FAILED;
-          break;
-        } else /* add ack in frame and start timer */
-        {
-          qrcf.ack = ACK;
-          send_result = qrc_frame_send(&qrcf, (uint8_t *)data, len, true);
-          if (true == send_result) {
-            if (QRC_OK != start_pipe_timeout(pipe->pipe_id, &timeout)) {
-              res = ACK_ERR;
-              break;
-            }
-            if (true == timeout) {
-              res = TIMEOUT;
-              printf("Warning: Pipe (%s) timeout, try to send again \n", pipe->pipe_name);
-              continue;
-            }
-            res = SUCCESS;
-            break;
-          }
-          break;
-        }
-      }
+      res = qrc_rel_send(pipe, iov, iovcnt);
     } else /* no ack transport */
     {
-      send_result = qrc_frame_send(&qrcf, (uint8_t *)data, len, true);
-      res = (send_result) ? SUCCESS : FAILED;
+      res = qrc_pipe_sendv(pipe, &qrcf, &ext, iov, iovcnt, true, false);
     }
   }
   return res;
 }
 
+/****************************************************************************
+ * @intro: qrc write with ack that returns once the data is queued. Up to
+ *QRC_MAX_SEND_WINDOW writes of a pipe may be pending; the ones past the
+ *send window go out as acks come in
+ * @param pipe: writer
+ * @param data: data of writer
+ * @param len: length of data
+ * @param done_cb: called with the result on the callback pool, or NULL to
+ *get it from qrc_write_poll()
+ * @param arg: argument of done_cb
+ * @param handle: handle of the write, never 0
+ * @return: SUCCESS once queued, BUSY if too many writes are pending or the
+ *bus is locked, FAILED
+ ****************************************************************************/
+enum qrc_write_status_e qrc_write_async(qrc_pipe_s * pipe,
+    const void * data,
+    const size_t len,
+    qrc_write_done_cb done_cb,
+    void * arg,
+    qrc_write_handle * handle)
+{
+  struct iovec iov;
+
+  iov.iov_base = (void *)data;
+  iov.iov_len = len;
+  return qrc_writev_async(pipe, &iov, 1, done_cb, arg, handle);
+}
+
+/****************************************************************************
+ * @intro: qrc_write_async() of data given as segments
+ * @param pipe: writer
+ * @param iov: data segments
+ * @param iovcnt: number of segments, 1 ~ QRC_MAX_IOV
+ * @param done_cb: completion callback or NULL
+ * @param arg: argument of done_cb
+ * @param handle: handle of the write, never 0
+ * @return: SUCCESS once queued, BUSY, FAILED
+ ****************************************************************************/
+enum qrc_write_status_e qrc_writev_async(qrc_pipe_s * pipe,
+    const struct iovec * iov,
+    const int iovcnt,
+    qrc_write_done_cb done_cb,
+    void * arg,
+    qrc_write_handle * handle)
+{
+  if (NULL == pipe || pipe->pipe_id >= get_pipe_number() || NULL == handle) {
+    QRC_LOGE("No such pipe! Write failed!");
+    return FAILED;
+  }
+  if (QRC_PIPE_ID_NONE == pipe->peer_pipe_id) {
+    QRC_LOGE("Pipe write failed! (%s) doesn't have peer pipe!", pipe->pipe_name);
+    return FAILED;
+  }
+  if (iovcnt < 0 || iovcnt > QRC_MAX_IOV) {
+    QRC_LOGE("Pipe (%s) write with %d segments!", pipe->pipe_name, iovcnt);
+    return FAILED;
+  }
+
+  return qrc_rel_send_async(pipe, iov, iovcnt, done_cb, arg, handle);
+}
+
+/****************************************************************************
+ * @intro: fd that is readable while results of qrc_write_async() without
+ *callback wait for qrc_write_poll(), to use with poll()/epoll
+ * @param pipe: writer
+ * @return: fd or -1, owned by qrc
+ ****************************************************************************/
+int qrc_write_event_fd(qrc_pipe_s * pipe)
+{
+  if (NULL == pipe || pipe->pipe_id >= get_pipe_number()) {
+    QRC_LOGE("No such pipe! Get write event fd failed!");
+    return -1;
+  }
+  return qrc_rel_event_fd(pipe);
+}
+
+/****************************************************************************
+ * @intro: take the oldest result of the qrc_write_async() without callback
+ * @param pipe: writer
+ * @param handle: handle of the write
+ * @param status: SUCCESS, TIMEOUT or FAILED
+ * @return: false if no result is ready
+ ****************************************************************************/
+bool qrc_write_poll(qrc_pipe_s * pipe, qrc_write_handle * handle, enum qrc_write_status_e * status)
+{
+  if (NULL == pipe || pipe->pipe_id >= get_pipe_number()) {
+    QRC_LOGE("No such pipe! Write poll failed!");
+    return false;
+  }
+  return qrc_rel_poll(pipe, handle, status);
+}
+
 /****************************************************************************
  * @intro: qrc write without lock
  * @param pipe: writer
  * @param data: data of writer
  * @param len: length of data
- * @return: SUCCESS or TIMEOUT or FAILED
+ * @return: SUCCESS or FAILED, BUSY if the tx ring is full
  ****************************************************************************/
 enum qrc_write_status_e qrc_write_fast(const qrc_pipe_s * pipe, const void * data, const size_t len)
 {
   enum qrc_write_status_e res = FAILED;
-  if (255 == pipe->peer_pipe_id) {
-    printf("ERROR: Pipe write failed! (%s) doesn't have peer pipe!\n", pipe->pipe_name);
+  if (QRC_PIPE_ID_NONE == pipe->peer_pipe_id) {
+    QRC_LOGE("Pipe write failed! (%s) doesn't have peer pipe!", pipe->pipe_name);
     return FAILED;
   } else {
     qrc_frame qrcf;
-    qrcf.receiver_id = pipe->peer_pipe_id;
+    struct qrc_ext_s ext;
+    struct iovec iov;
+    memset(&qrcf, 0, sizeof(qrcf));
+    memset(&ext, 0, sizeof(ext));
     qrcf.ack = NO_ACK;
-    bool send_result = qrc_frame_send(&qrcf, data, len, false);
-    res = (true == send_result) ? SUCCESS : FAILED;
+    iov.iov_base = (void *)data;
+    iov.iov_len = len;
+    res = qrc_pipe_sendv(pipe, &qrcf, &ext, &iov, 1, false, false);
   }
 
   return res;
 }
 
-/*
- * wait for implement
- */
+/****************************************************************************
+ * @intro: set how many frames qrc_write() with ack may have in flight. With
+ *1 (default) each write waits for its ack; with more, writes return once
+ *queued and keep the link busy while earlier frames wait for acks
+ * @param pipe: writer
+ * @param window: 1 ~ QRC_MAX_SEND_WINDOW
+ * @return: result of setting
+ ****************************************************************************/
+bool qrc_set_send_window(qrc_pipe_s * pipe, uint16_t window)
+{
+  if (NULL == pipe || pipe->pipe_id >= get_pipe_number()) {
+    QRC_LOGE("No such pipe! Set send window failed!");
+    return false;
+  }
+  return qrc_rel_set_window(pipe, window);
+}
+
+/****************************************************************************
+ * @intro: wait until every qrc_write() with ack of the pipe is acknowledged
+ * @param pipe: writer
+ * @return: SUCCESS, TIMEOUT if some frames were never acknowledged since
+ *the last qrc_flush(), FAILED
+ ****************************************************************************/
+enum qrc_write_status_e qrc_flush(const qrc_pipe_s * pipe)
+{
+  if (NULL == pipe || pipe->pipe_id >= get_pipe_number()) {
+    QRC_LOGE("No such pipe! Flush failed!");
+    return FAILED;
+  }
+  if (qrc_in_read_thread()) {
+    QRC_LOGE("Pipe (%s) flush in an inline callback failed!", pipe->pipe_name);
+    return FAILED;
+  }
+  return qrc_rel_flush(pipe);
+}
+
+/****************************************************************************
+ * @intro: set when qrc_write() with ack sends a frame again. The timeout
+ *follows the measured round trip time within min_rto_ms ~ max_rto_ms and
+ *doubles each time it expires without an ack
+ * @param pipe: writer
+ * @param policy: retransmission policy, NULL for the default
+ * @return: result of setting
+ ****************************************************************************/
+bool qrc_set_retry_policy(qrc_pipe_s * pipe, const struct qrc_retry_policy_s * policy)
+{
+  if (NULL == pipe || pipe->pipe_id >= get_pipe_number()) {
+    QRC_LOGE("No such pipe! Set retry policy failed!");
+    return false;
+  }
+  return qrc_rel_set_policy(pipe, policy);
+}
+
+/****************************************************************************
+ * @intro: get the round trip estimate of the writes with ack of a pipe, to
+ *watch the quality of the link
+ * @param pipe: writer
+ * @param info: filled with the estimate
+ * @return: result of getting
+ ****************************************************************************/
+bool qrc_get_rtt_info(const qrc_pipe_s * pipe, struct qrc_rtt_info_s * info)
+{
+  if (NULL == pipe || pipe->pipe_id >= get_pipe_number() || NULL == info) {
+    QRC_LOGE("No such pipe! Get rtt info failed!");
+    return false;
+  }
+  return qrc_rel_get_rtt(pipe, info);
+}
+
+/****************************************************************************
+ * @intro: let the ack of the writes with ack the pipe receives wait up to
+ *delay_us for a write with ack or a request of ours to ride on. 0 (default)
+ *acks at the end of each burst read from the link. Keep it well below the
+ *min_rto_ms of the peer, the peer's round trip times include it
+ * @param pipe: reader
+ * @param delay_us: 0 ~ QRC_MAX_ACK_DELAY_US
+ * @return: result of setting
+ ****************************************************************************/
+bool qrc_set_ack_delay(qrc_pipe_s * pipe, uint32_t delay_us)
+{
+  if (NULL == pipe || pipe->pipe_id >= get_pipe_number()) {
+    QRC_LOGE("No such pipe! Set ack delay failed!");
+    return false;
+  }
+  return qrc_rel_set_ack_delay(pipe, delay_us);
+}
+
+/****************************************************************************
+ * @intro: set how many frames of the pipe the peer may send before their
+ *callbacks are done. The peer's writes get BUSY (writes with ack wait)
+ *instead of overrunning this side
+ * @param pipe: reader
+ * @param credits: 1 ~ QRC_MAX_CREDITS
+ * @return: result of setting
+ ****************************************************************************/
+bool qrc_set_rx_credits(qrc_pipe_s * pipe, uint16_t credits)
+{
+  if (NULL == pipe || pipe->pipe_id >= get_pipe_number()) {
+    QRC_LOGE("No such pipe! Set rx credits failed!");
+    return false;
+  }
+  return qrc_credit_set_capacity(pipe, credits);
+}
+
+/****************************************************************************
+ * @intro: get the credits of a pipe in both directions and how often its
+ *writes stalled for lack of credits
+ * @param pipe: pipe
+ * @param info: filled with the credits
+ * @return: result of getting
+ ****************************************************************************/
+bool qrc_get_credit_info(const qrc_pipe_s * pipe, struct qrc_credit_info_s * info)
+{
+  if (NULL == pipe || pipe->pipe_id >= get_pipe_number() || NULL == info) {
+    QRC_LOGE("No such pipe! Get credit info failed!");
+    return false;
+  }
+  qrc_credit_get_info(pipe, info);
+  return true;
+}
+
+/****************************************************************************
+ * @intro: export the link and pipe counters in a POSIX shared memory segment
+ *for qrc-top, laid out as struct qrc_stats_shm_s. Call it before
+ *init_qrc_management(), the segment is removed by deinit_qrc_management().
+ *A segment of the name left by a process that died is replaced, while its
+ *process runs the counters stay private
+ * @param name: segment name starting with '/', QRC_STATS_SHM_DEFAULT for
+ *qrc-top without options, NULL to keep the counters private
+ * @return: result of setting
+ ****************************************************************************/
+bool qrc_set_stats_shm(const char * name)
+{
+  return qrc_stats_set_shm(name);
+}
+
+/****************************************************************************
+ * @intro: get the frames, bytes and errors of the link since init, and its
+ *queue depths now
+ * @param stats: filled with the counters
+ * @return: result of getting
+ ****************************************************************************/
+bool qrc_get_link_stats(struct qrc_link_stats_s * stats)
+{
+  if (NULL == stats) {
+    QRC_LOGE("Get link stats failed! Stats is NULL!");
+    return false;
+  }
+  qrc_stats_get_link(stats);
+  return true;
+}
+
+/****************************************************************************
+ * @intro: get the frames, bytes, retransmissions, timeouts and ack round
+ *trips of a pipe since init
+ * @param pipe: pipe
+ * @param stats: filled with the counters
+ * @return: result of getting
+ ****************************************************************************/
+bool qrc_get_pipe_stats(const qrc_pipe_s * pipe, struct qrc_pipe_stats_s * stats)
+{
+  if (NULL == pipe || pipe->pipe_id >= get_pipe_number() || NULL == stats) {
+    QRC_LOGE("No such pipe! Get pipe stats failed!");
+    return false;
+  }
+  qrc_stats_get_pipe(pipe, stats);
+  return true;
+}
+
+/****************************************************************************
+ * @intro: get the latency histogram of a stage of the pipe's messages, from
+ *read() to callback for received ones and from send to ack for writes
+ * @param pipe: pipe
+ * @param stage: enum qrc_latency_stage_e
+ * @param latency: filled with count, min, max and percentiles in us
+ * @return: result of getting
+ ****************************************************************************/
+bool qrc_get_latency(const qrc_pipe_s * pipe,
+    enum qrc_latency_stage_e stage,
+    struct qrc_latency_s * latency)
+{
+  if (NULL == pipe || pipe->pipe_id >= get_pipe_number() || NULL == latency) {
+    QRC_LOGE("No such pipe! Get latency failed!");
+    return false;
+  }
+  if (stage < QRC_LAT_PARSE || stage >= QRC_LAT_STAGES) {
+    QRC_LOGE("Latency stage %d is not valid!", (int)stage);
+    return false;
+  }
+  qrc_latency_get(pipe, stage, latency);
+  return true;
+}
+
+/****************************************************************************
+ * @intro: empty the latency histograms of a pipe, to measure from now on
+ * @param pipe: pipe
+ * @return: result of resetting
+ ****************************************************************************/
+bool qrc_reset_latency(const qrc_pipe_s * pipe)
+{
+  if (NULL == pipe || pipe->pipe_id >= get_pipe_number()) {
+    QRC_LOGE("No such pipe! Reset latency failed!");
+    return false;
+  }
+  qrc_latency_reset(pipe);
+  return true;
+}
+
+/****************************************************************************
+ * @intro: set the time a callback of the pipe may take. Callbacks that take
+ *longer hold up the worker threads, they are counted in cb_overruns of the
+ *pipe stats and warned about
+ * @param pipe: reader
+ * @param budget_us: 0 for no budget, QRC_CALLBACK_BUDGET_DEFAULT_US by default
+ * @return: result of setting
+ ****************************************************************************/
+bool qrc_set_callback_budget(qrc_pipe_s * pipe, uint32_t budget_us)
+{
+  if (NULL == pipe || pipe->pipe_id >= get_pipe_number()) {
+    QRC_LOGE("No such pipe! Set callback budget failed!");
+    return false;
+  }
+  return qrc_latency_set_budget(pipe, budget_us);
+}
+
+/****************************************************************************
+ * @intro: run the callback of the pipe on the read thread as each message
+ *arrives, without waking a worker. Messages that find an earlier one still
+ *queued or running go to the workers, so the order is kept. An inline
+ *callback holds up every pipe: it must not wait for the peer, qrc_write()
+ *with ack, qrc_flush(), qrc_sync_write() and qrc_require_pipe() fail in it.
+ *Enabling sets the callback budget to QRC_INLINE_BUDGET_DEFAULT_US, after
+ *QRC_INLINE_STRIKES callbacks over it the pipe goes back to the workers
+ * @param pipe: reader
+ * @param enable: false for the workers, the default
+ * @return: result of setting
+ ****************************************************************************/
+bool qrc_set_inline_dispatch(qrc_pipe_s * pipe, bool enable)
+{
+  if (NULL == pipe || pipe->pipe_id >= get_pipe_number()) {
+    QRC_LOGE("No such pipe! Set inline dispatch failed!");
+    return false;
+  }
+  if (QRC_CONTROL_PIPE_ID == pipe->pipe_id) {
+    QRC_LOGE("Control pipe callbacks can not run inline!");
+    return false;
+  }
+  if (!qrc_latency_set_budget(
+          pipe, enable ? QRC_INLINE_BUDGET_DEFAULT_US : QRC_CALLBACK_BUDGET_DEFAULT_US)) {
+    return false;
+  }
+  return qrc_strand_set_inline(pipe, enable);
+}
+
+/****************************************************************************
+ * @intro: send a request to the peer pipe and wait for its qrc_response().
+ *Many requests may be outstanding at once, from any threads and pipes
+ * @param pipe: requester
+ * @param data: request
+ * @param len: length of data
+ * @param respond_data: buffer the response is copied into
+ * @param res_len: in: size of respond_data, out: length of the response
+ * @param timeout_ms: time to wait for the response
+ * @return: SUCCESS, TIMEOUT, BUSY if too many requests are outstanding or
+ *the tx ring is full, FAILED
+ ****************************************************************************/
 enum qrc_write_status_e qrc_sync_write(const qrc_pipe_s * pipe,
     const void * data,
     const size_t len,
-    const void * respond_data,
-    const size_t res_len)
+    void * respond_data,
+    size_t * res_len,
+    const uint32_t timeout_ms)
 {
-  return FAILED;
+  if (NULL == pipe || pipe->pipe_id >= get_pipe_number() || NULL == res_len) {
+    QRC_LOGE("No such pipe! Sync write failed!");
+    return FAILED;
+  }
+  if (QRC_PIPE_ID_NONE == pipe->peer_pipe_id) {
+    QRC_LOGE("Pipe write failed! (%s) doesn't have peer pipe!", pipe->pipe_name);
+    return FAILED;
+  }
+  if (qrc_in_read_thread()) {
+    QRC_LOGE("Pipe (%s) sync write in an inline callback failed!", pipe->pipe_name);
+    return FAILED;
+  }
+  return qrc_rpc_call(pipe, data, len, respond_data, res_len, timeout_ms);
 }
 
-/*
- * wait for implement
- */
+/****************************************************************************
+ * @intro: answer a request of qrc_sync_write(), call it from the pipe
+ *callback that got the request with response set to true
+ * @param pipe: the pipe given to the callback
+ * @param data: response
+ * @param len: length of data
+ * @return: SUCCESS, BUSY if the tx ring is full, FAILED
+ ****************************************************************************/
 enum qrc_write_status_e qrc_response(const qrc_pipe_s * pipe, const void * data, const size_t len)
 {
-  return FAILED;
+  if (NULL == pipe || pipe->pipe_id >= get_pipe_number()) {
+    QRC_LOGE("No such pipe! Response failed!");
+    return FAILED;
+  }
+  if (QRC_PIPE_ID_NONE == pipe->peer_pipe_id) {
+    QRC_LOGE("Pipe write failed! (%s) doesn't have peer pipe!", pipe->pipe_name);
+    return FAILED;
+  }
+  return qrc_rpc_respond(pipe, data, len);
+}
+
+/****************************************************************************
+ * @intro: keep the receive buffer of a message after its callback returns,
+ *the data stays valid without a copy until qrc_buffer_release()
+ * @param data: data pointer given to the pipe callback
+ * @return: false if data is not in a receive buffer in use
+ ****************************************************************************/
+bool qrc_buffer_retain(const void * data)
+{
+  struct qrc_rxbuf_s * buf = qrc_rxbuf_find(data);
+  if (NULL == buf) {
+    QRC_LOGE("qrc buffer retain failed, %p is not a receive buffer!", data);
+    return false;
+  }
+  qrc_rxbuf_retain(buf);
+  return true;
+}
+
+/****************************************************************************
+ * @intro: give back a receive buffer kept by qrc_buffer_retain()
+ * @param data: data pointer given to the pipe callback
+ * @return: false if data is not in a receive buffer in use
+ ****************************************************************************/
+bool qrc_buffer_release(const void * data)
+{
+  struct qrc_rxbuf_s * buf = qrc_rxbuf_find(data);
+  if (NULL == buf) {
+    QRC_LOGE("qrc buffer release failed, %p is not a receive buffer!", data);
+    return false;
+  }
+  qrc_rxbuf_release(buf);
+  return true;
 }
 
 bool deinit_qrc_management(void)
@@ -45,6 +45,13 @@
 #define TF_ID_MASK (TF_ID)(((TF_ID)1 << (sizeof(TF_ID) * 8 - 1)) - 1)
 #define TF_ID_PEERBIT (TF_ID)((TF_ID)1 << ((sizeof(TF_ID) * 8) - 1))
 
+// Count a parser event, read racily by other threads
+#if TF_USE_STATS
+#define TF_STAT(tf, field) ((tf)->stats.field++)
+#else
+#define TF_STAT(tf, field) ((void)0)
+#endif
+
 #if !TF_USE_MUTEX
 // Not thread safe lock implementation, used if user did not provide a better
 // one. This is less reliable than a real mutex, but will catch most bugs caused
@@ -146,7 +153,6 @@ static TF_CKSUM TF_CksumEnd(TF_CKSUM cksum)
 
 #elif TF_CKSUM_TYPE == TF_CKSUM_CRC16
 
-// TODO try to replace with an algorithm
 /** CRC table for the CRC-16. The poly is 0x8005 (x^16 + x^15 + x^2 + 1) */
 static const uint16_t crc16_table[256] = { 0x0000, 0xC0C1, 0xC181, 0x0140, 0xC301, 0x03C0, 0x0280,
   0xC241, 0xC601, 0x06C0, 0x0780, 0xC741, 0x0500, 0xC5C1, 0xC481, 0x0440, 0xCC01, 0x0CC0, 0x0D80,
@@ -188,7 +194,6 @@ static TF_CKSUM TF_CksumEnd(TF_CKSUM cksum)
 
 #elif TF_CKSUM_TYPE == TF_CKSUM_CRC32
 
-// TODO try to replace with an algorithm
 static const uint32_t crc32_table[] = { /* CRC polynomial 0xedb88320 */
   0x00000000, 0x77073096, 0xee0e612c, 0x990951ba, 0x076dc419, 0x706af48f, 0xe963a535, 0x9e6495a3,
   0x0edb8832, 0x79dcb8a4, 0xe0d5e91e, 0x97d2d988, 0x09b64c2b, 0x7eb17cbd, 0xe7b82d07, 0x90bf1d91,
@@ -239,6 +244,218 @@ static TF_CKSUM TF_CksumEnd(TF_CKSUM cksum)
   return (TF_CKSUM)~cksum;
 }
 
+#elif TF_CKSUM_TYPE == TF_CKSUM_CRC32C
+
+static const uint32_t crc32c_table[] = { /* CRC polynomial 0x82f63b78 */
+  0x00000000, 0xf26b8303, 0xe13b70f7, 0x1350f3f4, 0xc79a971f, 0x35f1141c, 0x26a1e7e8, 0xd4ca64eb,
+  0x8ad958cf, 0x78b2dbcc, 0x6be22838, 0x9989ab3b, 0x4d43cfd0, 0xbf284cd3, 0xac78bf27, 0x5e133c24,
+  0x105ec76f, 0xe235446c, 0xf165b798, 0x030e349b, 0xd7c45070, 0x25afd373, 0x36ff2087, 0xc494a384,
+  0x9a879fa0, 0x68ec1ca3, 0x7bbcef57, 0x89d76c54, 0x5d1d08bf, 0xaf768bbc, 0xbc267848, 0x4e4dfb4b,
+  0x20bd8ede, 0xd2d60ddd, 0xc186fe29, 0x33ed7d2a, 0xe72719c1, 0x154c9ac2, 0x061c6936, 0xf477ea35,
+  0xaa64d611, 0x580f5512, 0x4b5fa6e6, 0xb93425e5, 0x6dfe410e, 0x9f95c20d, 0x8cc531f9, 0x7eaeb2fa,
+  0x30e349b1, 0xc288cab2, 0xd1d83946, 0x23b3ba45, 0xf779deae, 0x05125dad, 0x1642ae59, 0xe4292d5a,
+  0xba3a117e, 0x4851927d, 0x5b016189, 0xa96ae28a, 0x7da08661, 0x8fcb0562, 0x9c9bf696, 0x6ef07595,
+  0x417b1dbc, 0xb3109ebf, 0xa0406d4b, 0x522bee48, 0x86e18aa3, 0x748a09a0, 0x67dafa54, 0x95b17957,
+  0xcba24573, 0x39c9c670, 0x2a993584, 0xd8f2b687, 0x0c38d26c, 0xfe53516f, 0xed03a29b, 0x1f682198,
+  0x5125dad3, 0xa34e59d0, 0xb01eaa24, 0x42752927, 0x96bf4dcc, 0x64d4cecf, 0x77843d3b, 0x85efbe38,
+  0xdbfc821c, 0x2997011f, 0x3ac7f2eb, 0xc8ac71e8, 0x1c661503, 0xee0d9600, 0xfd5d65f4, 0x0f36e6f7,
+  0x61c69362, 0x93ad1061, 0x80fde395, 0x72966096, 0xa65c047d, 0x5437877e, 0x4767748a, 0xb50cf789,
+  0xeb1fcbad, 0x197448ae, 0x0a24bb5a, 0xf84f3859, 0x2c855cb2, 0xdeeedfb1, 0xcdbe2c45, 0x3fd5af46,
+  0x7198540d, 0x83f3d70e, 0x90a324fa, 0x62c8a7f9, 0xb602c312, 0x44694011, 0x5739b3e5, 0xa55230e6,
+  0xfb410cc2, 0x092a8fc1, 0x1a7a7c35, 0xe811ff36, 0x3cdb9bdd, 0xceb018de, 0xdde0eb2a, 0x2f8b6829,
+  0x82f63b78, 0x709db87b, 0x63cd4b8f, 0x91a6c88c, 0x456cac67, 0xb7072f64, 0xa457dc90, 0x563c5f93,
+  0x082f63b7, 0xfa44e0b4, 0xe9141340, 0x1b7f9043, 0xcfb5f4a8, 0x3dde77ab, 0x2e8e845f, 0xdce5075c,
+  0x92a8fc17, 0x60c37f14, 0x73938ce0, 0x81f80fe3, 0x55326b08, 0xa759e80b, 0xb4091bff, 0x466298fc,
+  0x1871a4d8, 0xea1a27db, 0xf94ad42f, 0x0b21572c, 0xdfeb33c7, 0x2d80b0c4, 0x3ed04330, 0xccbbc033,
+  0xa24bb5a6, 0x502036a5, 0x4370c551, 0xb11b4652, 0x65d122b9, 0x97baa1ba, 0x84ea524e, 0x7681d14d,
+  0x2892ed69, 0xdaf96e6a, 0xc9a99d9e, 0x3bc21e9d, 0xef087a76, 0x1d63f975, 0x0e330a81, 0xfc588982,
+  0xb21572c9, 0x407ef1ca, 0x532e023e, 0xa145813d, 0x758fe5d6, 0x87e466d5, 0x94b49521, 0x66df1622,
+  0x38cc2a06, 0xcaa7a905, 0xd9f75af1, 0x2b9cd9f2, 0xff56bd19, 0x0d3d3e1a, 0x1e6dcdee, 0xec064eed,
+  0xc38d26c4, 0x31e6a5c7, 0x22b65633, 0xd0ddd530, 0x0417b1db, 0xf67c32d8, 0xe52cc12c, 0x1747422f,
+  0x49547e0b, 0xbb3ffd08, 0xa86f0efc, 0x5a048dff, 0x8ecee914, 0x7ca56a17, 0x6ff599e3, 0x9d9e1ae0,
+  0xd3d3e1ab, 0x21b862a8, 0x32e8915c, 0xc083125f, 0x144976b4, 0xe622f5b7, 0xf5720643, 0x07198540,
+  0x590ab964, 0xab613a67, 0xb831c993, 0x4a5a4a90, 0x9e902e7b, 0x6cfbad78, 0x7fab5e8c, 0x8dc0dd8f,
+  0xe330a81a, 0x115b2b19, 0x020bd8ed, 0xf0605bee, 0x24aa3f05, 0xd6c1bc06, 0xc5914ff2, 0x37faccf1,
+  0x69e9f0d5, 0x9b8273d6, 0x88d28022, 0x7ab90321, 0xae7367ca, 0x5c18e4c9, 0x4f48173d, 0xbd23943e,
+  0xf36e6f75, 0x0105ec76, 0x12551f82, 0xe03e9c81, 0x34f4f86a, 0xc69f7b69, 0xd5cf889d, 0x27a40b9e,
+  0x79b737ba, 0x8bdcb4b9, 0x988c474d, 0x6ae7c44e, 0xbe2da0a5, 0x4c4623a6, 0x5f16d052, 0xad7d5351
+};
+
+static TF_CKSUM TF_CksumStart(void)
+{
+  return (TF_CKSUM)0xFFFFFFFF;
+}
+
+static TF_CKSUM TF_CksumAdd(TF_CKSUM cksum, uint8_t byte)
+{
+  return crc32c_table[((cksum) ^ ((uint8_t)byte)) & 0xff] ^ ((cksum) >> 8);
+}
+
+static TF_CKSUM TF_CksumEnd(TF_CKSUM cksum)
+{
+  return (TF_CKSUM)~cksum;
+}
+
+#endif
+
+#if (TF_CKSUM_TYPE == TF_CKSUM_CRC16) || (TF_CKSUM_TYPE == TF_CKSUM_CRC32) ||                     \
+    (TF_CKSUM_TYPE == TF_CKSUM_CRC32C)
+#define TF_CKSUM_SLICED 1
+
+#if TF_CKSUM_TYPE == TF_CKSUM_CRC16
+#define crc_byte_table crc16_table
+#elif TF_CKSUM_TYPE == TF_CKSUM_CRC32
+#define crc_byte_table crc32_table
+#else
+#define crc_byte_table crc32c_table
+#endif
+
+// CRC instructions only exist for the Castagnoli polynomial. Define
+// TF_CKSUM_NO_HW to build the table engine only.
+#if (TF_CKSUM_TYPE == TF_CKSUM_CRC32C) && !defined(TF_CKSUM_NO_HW) && defined(__GNUC__)
+#if defined(__x86_64__)
+#define TF_CKSUM_HW_SSE42 1
+#include <nmmintrin.h>
+#elif defined(__aarch64__) && defined(__linux__)
+#define TF_CKSUM_HW_ARMV8 1
+#include <sys/auxv.h>
+#ifndef HWCAP_CRC32
+#define HWCAP_CRC32 (1 << 7)
+#endif
+#endif
+#endif
+
+/**
+ * Slice-by-8 tables. crc_slice[k][n] is the CRC of byte n followed by k zero
+ * bytes, so 8 input bytes are folded in with 8 independent lookups.
+ * Row 0 is the byte table, filled in by TF_CksumInit().
+ */
+static TF_CKSUM crc_slice[8][256];
+
+/** Span engine picked at runtime by TF_CksumInit() */
+static TF_CKSUM (*crc_span)(TF_CKSUM cksum, const uint8_t * buf, uint32_t len);
+static const char * crc_span_name = "table";
+
+static inline uint32_t _TF_FN crc_load32(const uint8_t * buf)
+{
+  return (uint32_t)buf[0] | ((uint32_t)buf[1] << 8) | ((uint32_t)buf[2] << 16) |
+         ((uint32_t)buf[3] << 24);
+}
+
+static TF_CKSUM _TF_FN crc_span_slice8(TF_CKSUM cksum, const uint8_t * buf, uint32_t len)
+{
+  uint32_t one;
+  uint32_t two;
+
+  while (len >= 8) {
+    // the CRC register lines up with the first bytes (reflected CRCs)
+    one = crc_load32(buf) ^ cksum;
+    two = crc_load32(buf + 4);
+    cksum = (TF_CKSUM)(crc_slice[7][one & 0xff] ^ crc_slice[6][(one >> 8) & 0xff] ^
+                       crc_slice[5][(one >> 16) & 0xff] ^ crc_slice[4][one >> 24] ^
+                       crc_slice[3][two & 0xff] ^ crc_slice[2][(two >> 8) & 0xff] ^
+                       crc_slice[1][(two >> 16) & 0xff] ^ crc_slice[0][two >> 24]);
+    buf += 8;
+    len -= 8;
+  }
+
+  while (len--) {
+    cksum = (TF_CKSUM)((cksum >> 8) ^ crc_slice[0][(cksum ^ *buf++) & 0xff]);
+  }
+  return cksum;
+}
+
+#if TF_CKSUM_HW_SSE42
+__attribute__((target("sse4.2"))) static TF_CKSUM _TF_FN crc_span_sse42(TF_CKSUM cksum,
+    const uint8_t * buf,
+    uint32_t len)
+{
+  uint64_t crc = cksum;
+  uint64_t word;
+
+  while (len >= 8) {
+    memcpy(&word, buf, sizeof(word));
+    crc = _mm_crc32_u64(crc, word);
+    buf += 8;
+    len -= 8;
+  }
+
+  while (len--) {
+    crc = _mm_crc32_u8((uint32_t)crc, *buf++);
+  }
+  return (TF_CKSUM)crc;
+}
+#endif
+
+#if TF_CKSUM_HW_ARMV8
+#ifdef __clang__
+__attribute__((target("crc")))
+#else
+__attribute__((target("+crc")))
+#endif
+static TF_CKSUM _TF_FN crc_span_armv8(TF_CKSUM cksum, const uint8_t * buf, uint32_t len)
+{
+  uint32_t crc = cksum;
+  uint64_t word;
+
+  while (len >= 8) {
+    memcpy(&word, buf, sizeof(word));
+    __asm__("crc32cx %w0, %w0, %x1" : "+r"(crc) : "r"(word));
+    buf += 8;
+    len -= 8;
+  }
+
+  while (len--) {
+    __asm__("crc32cb %w0, %w0, %w1" : "+r"(crc) : "r"((uint32_t)*buf++));
+  }
+  return (TF_CKSUM)crc;
+}
+#endif
+
+/** Build the slice tables and pick the span engine, done once */
+static void _TF_FN TF_CksumInit(void)
+{
+  uint32_t k;
+  uint32_t n;
+
+  if (crc_span != NULL) {
+    return;
+  }
+
+  for (n = 0; n < 256; n++) {
+    crc_slice[0][n] = (TF_CKSUM)crc_byte_table[n];
+  }
+  for (k = 1; k < 8; k++) {
+    for (n = 0; n < 256; n++) {
+      TF_CKSUM prev = crc_slice[k - 1][n];
+      crc_slice[k][n] = (TF_CKSUM)((prev >> 8) ^ crc_slice[0][prev & 0xff]);
+    }
+  }
+
+#if TF_CKSUM_HW_SSE42
+  if (__builtin_cpu_supports("sse4.2")) {
+    crc_span_name = "sse4.2";
+    crc_span = crc_span_sse42;
+    return;
+  }
+#elif TF_CKSUM_HW_ARMV8
+  if (getauxval(AT_HWCAP) & HWCAP_CRC32) {
+    crc_span_name = "armv8-crc";
+    crc_span = crc_span_armv8;
+    return;
+  }
+#endif
+
+  crc_span_name = "slice-by-8";
+  crc_span = crc_span_slice8;
+}
+
+#else
+
+static void _TF_FN TF_CksumInit(void)
+{
+}
+
 #endif
 
 #define CKSUM_RESET(cksum)                                                                         \
@@ -254,6 +471,45 @@ static TF_CKSUM TF_CksumEnd(TF_CKSUM cksum)
     (cksum) = TF_CksumEnd((cksum));                                                                \
   } while (0)
 
+/** Add a contiguous span of bytes to a running checksum */
+static inline TF_CKSUM _TF_FN TF_CksumAddBuf(TF_CKSUM cksum, const uint8_t * buf, uint32_t len)
+{
+#if TF_CKSUM_SLICED
+  return crc_span(cksum, buf, len);
+#else
+  (void)buf;  // suppress "unused" warning if checksums are disabled
+  while (len--) {
+    CKSUM_ADD(cksum, *buf++);
+  }
+  return cksum;
+#endif
+}
+
+/** Checksum a whole buffer */
+TF_CKSUM _TF_FN TF_Checksum(const uint8_t * buffer, uint32_t len)
+{
+  TF_CKSUM cksum = 0;
+
+  (void)cksum;  // suppress "unused" warning if checksums are disabled
+
+  TF_CksumInit();
+  CKSUM_RESET(cksum);
+  cksum = TF_CksumAddBuf(cksum, buffer, len);
+  CKSUM_FINALIZE(cksum);
+  return cksum;
+}
+
+/** Name of the checksum engine used for buffers */
+const char * _TF_FN TF_ChecksumEngine(void)
+{
+#if TF_CKSUM_SLICED
+  TF_CksumInit();
+  return crc_span_name;
+#else
+  return "byte";
+#endif
+}
+
 // endregion
 
 // region Init
@@ -276,6 +532,8 @@ bool _TF_FN TF_InitStatic(TinyFrame * tf, TF_Peer peer_bit)
   tf->userdata = userdata;
 
   tf->peer_bit = peer_bit;
+  tf->data = tf->data_buf;
+  TF_CksumInit();
   return true;
 }
 
@@ -492,6 +750,8 @@ static void _TF_FN TF_HandleReceivedMessage(TinyFrame * tf)
   struct TF_GenericListener_ * glst;
   TF_Result res;
 
+  TF_STAT(tf, frames);
+
   // Prepare message object
   TF_Msg msg;
   TF_ClearMsg(&msg);
@@ -500,6 +760,7 @@ static void _TF_FN TF_HandleReceivedMessage(TinyFrame * tf)
   msg.type = tf->type;
   msg.data = tf->data;
   msg.len = tf->len;
+  TF_TRACE_FRAME(tf, &msg);
 
   // Any listener can consume the message, or let someone else handle it.
 
@@ -583,6 +844,7 @@ static void _TF_FN TF_HandleReceivedMessage(TinyFrame * tf)
     }
   }
 
+  TF_STAT(tf, unhandled);
   TF_Error("Unhandled message, type %d", (int)msg.type);
 }
 
@@ -608,15 +870,6 @@ bool _TF_FN TF_RenewIdListener(TinyFrame * tf, TF_ID id)
 
 // region Parser
 
-/** Handle a received byte buffer */
-void _TF_FN TF_Accept(TinyFrame * tf, const uint8_t * buffer, uint32_t count)
-{
-  uint32_t i;
-  for (i = 0; i < count; i++) {
-    TF_AcceptChar(tf, buffer[i]);
-  }
-}
-
 /** Reset the parser's internal state. */
 void _TF_FN TF_ResetParser(TinyFrame * tf)
 {
@@ -624,6 +877,224 @@ void _TF_FN TF_ResetParser(TinyFrame * tf)
   // more init will be done by the parser when the first byte is received
 }
 
+/** Swap the payload buffer, a frame in progress is moved along with it */
+uint8_t * _TF_FN TF_SwapRxBuffer(TinyFrame * tf, uint8_t * buf)
+{
+  uint8_t * old = tf->data;
+
+  if (buf == NULL) {
+    buf = tf->data_buf;
+  }
+  if (buf != old && tf->state == TFState_DATA && tf->rxi > 0 && tf->rxi < tf->len) {
+    memcpy(buf, old, tf->rxi);
+  }
+  tf->data = buf;
+  return old;
+}
+
+/** Reset a partial frame if TF_Tick() timed it out */
+static inline void _TF_FN pars_check_timeout(TinyFrame * tf)
+{
+  if (tf->parser_timeout_ticks >= TF_PARSER_TIMEOUT_TICKS) {
+    if (tf->state != TFState_SOF) {
+      TF_ResetParser(tf);
+      TF_STAT(tf, timeouts);
+      TF_Error("Parser timeout");
+    }
+  }
+  tf->parser_timeout_ticks = 0;
+}
+
+/** Read a big endian number of 'size' bytes from the input stream */
+static inline uint32_t _TF_FN pars_read_number(const uint8_t * buffer, uint32_t size)
+{
+  uint32_t num = 0;
+  while (size--) {
+    num = (num << 8) | *buffer++;
+  }
+  return num;
+}
+
+// Bytes of a frame head after the SOF byte, and of one checksum field
+#if TF_CKSUM_TYPE == TF_CKSUM_NONE
+#define TF_CKSUM_LEN 0
+#else
+#define TF_CKSUM_LEN sizeof(TF_CKSUM)
+#endif
+#define TF_HEAD_LEN (sizeof(TF_ID) + sizeof(TF_LEN) + sizeof(TF_TYPE) + TF_CKSUM_LEN)
+
+/** Handle the frame when its body is complete, body checksum at 'buffer' */
+static inline void _TF_FN pars_end_frame(TinyFrame * tf, const uint8_t * buffer)
+{
+  (void)buffer;  // suppress "unused" warning if checksums are disabled
+
+#if TF_CKSUM_TYPE != TF_CKSUM_NONE
+  CKSUM_FINALIZE(tf->cksum);
+  tf->ref_cksum = (TF_CKSUM)pars_read_number(buffer, sizeof(TF_CKSUM));
+  if (tf->cksum != tf->ref_cksum) {
+    TF_STAT(tf, body_errors);
+    TF_Error("Body cksum mismatch");
+    TF_ResetParser(tf);
+    return;
+  }
+#endif
+  TF_HandleReceivedMessage(tf);
+  TF_ResetParser(tf);
+}
+
+/**
+ * Parse a whole frame head in one step. 'buffer' starts at the SOF byte.
+ *
+ * @return nr of bytes consumed, 0 if the head is not complete in this chunk
+ */
+static uint32_t _TF_FN pars_accept_head(TinyFrame * tf, const uint8_t * buffer, uint32_t count)
+{
+  const uint8_t * p = buffer + 1;
+
+  if (count < 1 + TF_HEAD_LEN) {
+    return 0;
+  }
+
+  // SOF, ID, LEN and TYPE are covered by the head checksum
+  CKSUM_RESET(tf->cksum);
+  tf->cksum = TF_CksumAddBuf(tf->cksum, buffer, 1 + TF_HEAD_LEN - TF_CKSUM_LEN);
+
+  tf->id = (TF_ID)pars_read_number(p, sizeof(TF_ID));
+  p += sizeof(TF_ID);
+  tf->len = (TF_LEN)pars_read_number(p, sizeof(TF_LEN));
+  p += sizeof(TF_LEN);
+  tf->type = (TF_TYPE)pars_read_number(p, sizeof(TF_TYPE));
+  p += sizeof(TF_TYPE);
+
+#if TF_CKSUM_TYPE != TF_CKSUM_NONE
+  CKSUM_FINALIZE(tf->cksum);
+  tf->ref_cksum = (TF_CKSUM)pars_read_number(p, sizeof(TF_CKSUM));
+  if (tf->cksum != tf->ref_cksum) {
+    TF_STAT(tf, head_errors);
+    TF_Error("Rx head cksum mismatch");
+    TF_ResetParser(tf);
+    return 1 + TF_HEAD_LEN;
+  }
+#endif
+
+  if (tf->len == 0) {
+    // if the message has no body, we're done.
+    TF_HandleReceivedMessage(tf);
+    TF_ResetParser(tf);
+    return 1 + TF_HEAD_LEN;
+  }
+
+  // Enter DATA state
+  tf->state = TFState_DATA;
+  tf->rxi = 0;
+  tf->discard_data = false;
+  CKSUM_RESET(tf->cksum);  // Start collecting the payload
+
+  if (tf->len > TF_MAX_PAYLOAD_RX) {
+    TF_STAT(tf, oversized);
+    TF_Error("Rx payload too long: %d", (int)tf->len);
+    // ERROR - frame too long. Consume, but do not store.
+    tf->discard_data = true;
+  }
+
+  return 1 + TF_HEAD_LEN;
+}
+
+/**
+ * Copy the span of payload available in this chunk and checksum it in one
+ * pass, then check the body checksum if it is in the chunk too.
+ *
+ * @return nr of bytes consumed
+ */
+static uint32_t _TF_FN pars_accept_data(TinyFrame * tf, const uint8_t * buffer, uint32_t count)
+{
+  uint32_t chunk = TF_MIN((uint32_t)(tf->len - tf->rxi), count);
+
+  memcpy(tf->data + tf->rxi, buffer, chunk);
+  tf->cksum = TF_CksumAddBuf(tf->cksum, buffer, chunk);
+  tf->rxi = (TF_LEN)(tf->rxi + chunk);
+
+  if (tf->rxi != tf->len) {
+    return chunk;
+  }
+
+#if TF_CKSUM_TYPE == TF_CKSUM_NONE
+  pars_end_frame(tf, buffer + chunk);
+  return chunk;
+#else
+  if (count - chunk >= TF_CKSUM_LEN) {
+    pars_end_frame(tf, buffer + chunk);
+    return chunk + TF_CKSUM_LEN;
+  }
+
+  // Checksum straddles the chunk, let the state machine collect it
+  tf->state = TFState_DATA_CKSUM;
+  tf->rxi = 0;
+  tf->ref_cksum = 0;
+  return chunk;
+#endif
+}
+
+/**
+ * Handle a received byte buffer.
+ *
+ * Whole heads and payload spans are parsed directly from the buffer, the
+ * byte state machine in TF_AcceptChar() only collects fields which straddle
+ * two buffers.
+ */
+void _TF_FN TF_Accept(TinyFrame * tf, const uint8_t * buffer, uint32_t count)
+{
+  uint32_t i = 0;
+  uint32_t used;
+
+  TF_TRACE_ACCEPT(tf, count);
+  if (count <= 1 + TF_HEAD_LEN) {
+    // Too short to hold a head, spans don't pay off
+    for (; i < count; i++) {
+      TF_AcceptChar(tf, buffer[i]);
+    }
+    return;
+  }
+
+  pars_check_timeout(tf);
+
+  while (i < count) {
+    switch (tf->state) {
+#if TF_USE_SOF_BYTE
+      case TFState_SOF: {
+        const uint8_t * sof = memchr(buffer + i, TF_SOF_BYTE, count - i);
+        if (sof == NULL) {
+          return;
+        }
+        i = (uint32_t)(sof - buffer);
+        used = pars_accept_head(tf, buffer + i, count - i);
+        if (used == 0) {
+          // Head straddles the chunk, all that is left belongs to it
+          for (; i < count; i++) {
+            TF_AcceptChar(tf, buffer[i]);
+          }
+          return;
+        }
+        i += used;
+        break;
+      }
+#endif
+
+      case TFState_DATA:
+        if (!tf->discard_data) {
+          i += pars_accept_data(tf, buffer + i, count - i);
+          break;
+        }
+        TF_AcceptChar(tf, buffer[i++]);
+        break;
+
+      default:
+        TF_AcceptChar(tf, buffer[i++]);
+        break;
+    }
+  }
+}
+
 /** SOF was received - prepare for the frame */
 static void _TF_FN pars_begin_frame(TinyFrame * tf)
 {
@@ -644,13 +1115,7 @@ static void _TF_FN pars_begin_frame(TinyFrame * tf)
 void _TF_FN TF_AcceptChar(TinyFrame * tf, unsigned char c)
 {
   // Parser timeout - clear
-  if (tf->parser_timeout_ticks >= TF_PARSER_TIMEOUT_TICKS) {
-    if (tf->state != TFState_SOF) {
-      TF_ResetParser(tf);
-      TF_Error("Parser timeout");
-    }
-  }
-  tf->parser_timeout_ticks = 0;
+  pars_check_timeout(tf);
 
 // DRY snippet - collect multi-byte number from the input stream, byte by byte
 // This is a little dirty, but makes the code easier to read. It's used like
@@ -717,6 +1182,7 @@ void _TF_FN TF_AcceptChar(TinyFrame * tf, unsigned char c)
         CKSUM_FINALIZE(tf->cksum);
 
         if (tf->cksum != tf->ref_cksum) {
+          TF_STAT(tf, head_errors);
           TF_Error("Rx head cksum mismatch");
           TF_ResetParser(tf);
           break;
@@ -736,6 +1202,7 @@ void _TF_FN TF_AcceptChar(TinyFrame * tf, unsigned char c)
         CKSUM_RESET(tf->cksum);  // Start collecting the payload
 
         if (tf->len > TF_MAX_PAYLOAD_RX) {
+          TF_STAT(tf, oversized);
           TF_Error("Rx payload too long: %d", (int)tf->len);
           // ERROR - frame too long. Consume, but do not store.
           tf->discard_data = true;
@@ -774,6 +1241,7 @@ void _TF_FN TF_AcceptChar(TinyFrame * tf, unsigned char c)
           if (tf->cksum == tf->ref_cksum) {
             TF_HandleReceivedMessage(tf);
           } else {
+            TF_STAT(tf, body_errors);
             TF_Error("Body cksum mismatch");
           }
         }
@@ -852,7 +1320,12 @@ static inline uint32_t _TF_FN TF_ComposeHead(TinyFrame * tf, uint8_t * outbuff,
   if (msg->is_response) {
     id = msg->frame_id;
   } else {
+#ifdef __GNUC__
+    // frames may be composed by several threads, see TF_ComposeVector()
+    id = (TF_ID)(__atomic_fetch_add(&tf->next_id, 1, __ATOMIC_RELAXED) & TF_ID_MASK);
+#else
     id = (TF_ID)(tf->next_id++ & TF_ID_MASK);
+#endif
     if (tf->peer_bit) {
       id |= TF_ID_PEERBIT;
     }
@@ -896,17 +1369,10 @@ static inline uint32_t _TF_FN TF_ComposeBody(uint8_t * outbuff,
     TF_LEN data_len,
     TF_CKSUM * cksum)
 {
-  TF_LEN i = 0;
-  uint8_t b = 0;
-  uint32_t pos = 0;
-
-  for (i = 0; i < data_len; i++) {
-    b = data[i];
-    outbuff[pos++] = b;
-    CKSUM_ADD(*cksum, b);
-  }
+  memcpy(outbuff, data, data_len);
+  *cksum = TF_CksumAddBuf(*cksum, data, data_len);
 
-  return pos;
+  return data_len;
 }
 
 /**
@@ -1044,6 +1510,114 @@ static bool _TF_FN TF_SendFrame(TinyFrame * tf,
   return true;
 }
 
+#if TF_USE_WRITEV
+/**
+ * Compose a whole frame into a caller owned buffer. Does not touch the tx
+ * state of the instance, so several threads may compose at the same time.
+ */
+uint32_t _TF_FN TF_ComposeVector(TinyFrame * tf,
+    uint8_t * outbuff,
+    uint32_t size,
+    TF_Msg * msg,
+    const struct iovec * iov,
+    int iovcnt)
+{
+  TF_CKSUM cksum = 0;
+  uint32_t total = 0;
+  uint32_t pos;
+  int i;
+
+  (void)cksum;  // suppress "unused" warning if checksums are disabled
+
+  if (iovcnt < 0) {
+    return 0;
+  }
+  for (i = 0; i < iovcnt; i++) {
+    total += (uint32_t)iov[i].iov_len;
+  }
+  if (total > (TF_LEN)~0 || total + TF_FRAME_OVERHEAD > size) {
+    TF_Error("TF_ComposeVector() failed, frame too long");
+    return 0;
+  }
+
+  msg->data = NULL;
+  msg->len = (TF_LEN)total;
+
+  pos = TF_ComposeHead(tf, outbuff, msg);
+  CKSUM_RESET(cksum);
+  for (i = 0; i < iovcnt; i++) {
+    pos += TF_ComposeBody(outbuff + pos, (const uint8_t *)iov[i].iov_base,
+        (TF_LEN)iov[i].iov_len, &cksum);
+  }
+
+  // Checksum only if message had a body
+  if (total > 0) {
+    pos += TF_ComposeTail(outbuff + pos, &cksum);
+  }
+  return pos;
+}
+
+/**
+ * Compose head and tail around caller owned body segments and write them
+ * with a single TF_WriteVImpl() call.
+ */
+bool _TF_FN TF_SendVector(TinyFrame * tf, TF_Msg * msg, const struct iovec * iov, int iovcnt)
+{
+  struct iovec out[TF_MAX_IOV + 2];
+  uint8_t head[1 + TF_HEAD_LEN];
+  uint8_t tail[sizeof(TF_CKSUM)];
+  TF_CKSUM cksum = 0;
+  uint32_t total = 0;
+  int cnt = 0;
+  int i;
+
+  (void)cksum;  // suppress "unused" warning if checksums are disabled
+
+  if (iovcnt < 0 || iovcnt > TF_MAX_IOV) {
+    TF_Error("TF_SendVector() failed, too many segments");
+    return false;
+  }
+  for (i = 0; i < iovcnt; i++) {
+    total += (uint32_t)iov[i].iov_len;
+  }
+  if (total > (TF_LEN)~0) {
+    TF_Error("TF_SendVector() failed, frame too long");
+    return false;
+  }
+
+  msg->data = NULL;
+  msg->len = (TF_LEN)total;
+
+  TF_TRY(TF_ClaimTx(tf));
+
+  out[cnt].iov_base = head;
+  out[cnt].iov_len = TF_ComposeHead(tf, head, msg);
+  cnt++;
+
+  CKSUM_RESET(cksum);
+  for (i = 0; i < iovcnt; i++) {
+    if (iov[i].iov_len == 0) {
+      continue;
+    }
+    cksum = TF_CksumAddBuf(cksum, (const uint8_t *)iov[i].iov_base, (uint32_t)iov[i].iov_len);
+    out[cnt++] = iov[i];
+  }
+
+  // Checksum only if message had a body
+  if (total > 0) {
+    out[cnt].iov_base = tail;
+    out[cnt].iov_len = TF_ComposeTail(tail, &cksum);
+    if (out[cnt].iov_len > 0) {
+      cnt++;
+    }
+  }
+
+  TF_WriteVImpl(tf, out, cnt);
+  TF_ReleaseTx(tf);
+  return true;
+}
+#endif
+
 // endregion Compose and send
 
 // region Sending API funcs
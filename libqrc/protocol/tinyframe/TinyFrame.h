@@ -47,12 +47,37 @@
 #define TF_CKSUM_CRC8 9      // Dallas/Maxim CRC8 (1-wire)
 #define TF_CKSUM_CRC16 16    // CRC16 with the polynomial 0x8005 (x^16 + x^15 + x^2 + 1)
 #define TF_CKSUM_CRC32 32    // CRC32 with the polynomial 0xedb88320
+#define TF_CKSUM_CRC32C 33   // CRC32C (Castagnoli) with the polynomial 0x82f63b78
 #define TF_CKSUM_CUSTOM8 1   // Custom 8-bit checksum
 #define TF_CKSUM_CUSTOM16 2  // Custom 16-bit checksum
 #define TF_CKSUM_CUSTOM32 3  // Custom 32-bit checksum
 
 #include "TF_Config.h"
 
+#ifndef TF_USE_WRITEV
+#define TF_USE_WRITEV 0  // gather send with TF_SendVector() and TF_WriteVImpl()
+#endif
+
+#ifndef TF_USE_STATS
+#define TF_USE_STATS 0  // count received frames and parser errors in TinyFrame.stats
+#endif
+
+// Tracing hooks, a port may define them in TF_Config.h
+#ifndef TF_TRACE_ACCEPT
+#define TF_TRACE_ACCEPT(tf, count) ((void)0)  // bytes handed to TF_Accept()
+#endif
+#ifndef TF_TRACE_FRAME
+#define TF_TRACE_FRAME(tf, msg) ((void)0)  // a frame is decoded, before its listeners
+#endif
+
+#if TF_USE_WRITEV
+#include <sys/uio.h>  // for struct iovec
+
+#ifndef TF_MAX_IOV
+#define TF_MAX_IOV 8  // max body segments of TF_SendVector()
+#endif
+#endif
+
 // region Resolve data types
 
 #if TF_LEN_BYTES == 1
@@ -92,7 +117,8 @@ typedef uint8_t TF_CKSUM;
 #elif (TF_CKSUM_TYPE == TF_CKSUM_CRC16) || (TF_CKSUM_TYPE == TF_CKSUM_CUSTOM16)
 // CRC16
 typedef uint16_t TF_CKSUM;
-#elif (TF_CKSUM_TYPE == TF_CKSUM_CRC32) || (TF_CKSUM_TYPE == TF_CKSUM_CUSTOM32)
+#elif (TF_CKSUM_TYPE == TF_CKSUM_CRC32) || (TF_CKSUM_TYPE == TF_CKSUM_CRC32C) ||               \
+    (TF_CKSUM_TYPE == TF_CKSUM_CUSTOM32)
 // CRC32
 typedef uint32_t TF_CKSUM;
 #else
@@ -258,6 +284,35 @@ void TF_Tick(TinyFrame * tf);
  */
 void TF_ResetParser(TinyFrame * tf);
 
+/**
+ * Replace the buffer the parser collects payloads into.
+ * Safe to call from a listener: the current message data stays in the
+ * returned buffer, and the next frame is collected into the new one.
+ *
+ * @param tf - instance
+ * @param buf - buffer of at least TF_MAX_PAYLOAD_RX bytes, NULL to go back
+ *              to the built-in buffer
+ * @return the buffer used until now
+ */
+uint8_t * TF_SwapRxBuffer(TinyFrame * tf, uint8_t * buf);
+
+/**
+ * Compute the frame checksum of a whole buffer.
+ * Uses the same engine as the parser and the composer, CRCs are computed
+ * with slice-by-8 tables or with CPU CRC instructions when available.
+ *
+ * @param buffer - bytes to checksum
+ * @param len - nr of bytes in the buffer
+ * @return finalized checksum
+ */
+TF_CKSUM TF_Checksum(const uint8_t * buffer, uint32_t len);
+
+/**
+ * Name of the checksum engine used for buffers, e.g. "slice-by-8" or
+ * "sse4.2".
+ */
+const char * TF_ChecksumEngine(void);
+
 // ---------------------------- MESSAGE LISTENERS
 // -------------------------------
 
@@ -343,6 +398,48 @@ bool TF_RenewIdListener(TinyFrame * tf, TF_ID id);
  */
 bool TF_Send(TinyFrame * tf, TF_Msg * msg);
 
+/** Largest nr of bytes a frame adds around its payload */
+#define TF_FRAME_OVERHEAD                                                                          \
+  (TF_USE_SOF_BYTE + TF_ID_BYTES + TF_LEN_BYTES + TF_TYPE_BYTES + 2 * sizeof(TF_CKSUM))
+
+#if TF_USE_WRITEV
+/**
+ * Compose a frame whose body is gathered from several buffers into outbuff,
+ * without sending it. Unlike the send functions this does not use the tx
+ * buffer or the tx lock of the instance, frame IDs are taken atomically,
+ * so it can be called from several threads at once.
+ *
+ * @param tf - instance
+ * @param outbuff - buffer to store the frame in
+ * @param size - size of outbuff, payload + TF_FRAME_OVERHEAD is enough
+ * @param msg - message struct, len is set to the total of the segments, data
+ *              is ignored. ID is stored in the frame_id field
+ * @param iov - body segments
+ * @param iovcnt - nr of segments
+ * @return nr of bytes in outbuff used by the frame, 0 on failure
+ */
+uint32_t TF_ComposeVector(TinyFrame * tf,
+    uint8_t * outbuff,
+    uint32_t size,
+    TF_Msg * msg,
+    const struct iovec * iov,
+    int iovcnt);
+
+/**
+ * Send a frame whose body is gathered from several buffers.
+ * Head, body segments and checksum tail are handed to TF_WriteVImpl() in one
+ * call without copying the body into the tx buffer.
+ *
+ * @param tf - instance
+ * @param msg - message struct, len is set to the total of the segments, data
+ *              is ignored. ID is stored in the frame_id field
+ * @param iov - body segments
+ * @param iovcnt - nr of segments, at most TF_MAX_IOV
+ * @return success
+ */
+bool TF_SendVector(TinyFrame * tf, TF_Msg * msg, const struct iovec * iov, int iovcnt);
+#endif
+
 /**
  * Like TF_Send, but without the struct
  */
@@ -481,6 +578,21 @@ struct TF_GenericListener_
   TF_Listener fn;
 };
 
+#if TF_USE_STATS
+/**
+ * Parser counters, only written by the thread feeding the parser
+ */
+typedef struct TF_Stats_
+{
+  uint32_t frames;       //!< Frames handed to the listeners
+  uint32_t head_errors;  //!< Head checksum mismatches
+  uint32_t body_errors;  //!< Body checksum mismatches
+  uint32_t timeouts;     //!< Partial frames dropped by the parser timeout
+  uint32_t oversized;    //!< Frames longer than TF_MAX_PAYLOAD_RX, skipped
+  uint32_t unhandled;    //!< Frames no listener took
+} TF_Stats;
+#endif
+
 /**
  * Frame parser internal state.
  */
@@ -501,13 +613,17 @@ struct TinyFrame_
   TF_TICKS parser_timeout_ticks;
   TF_ID id;                         //!< Incoming packet ID
   TF_LEN len;                       //!< Payload length
-  uint8_t data[TF_MAX_PAYLOAD_RX];  //!< Data byte buffer
+  uint8_t * data;                       //!< Data byte buffer, data_buf or TF_SwapRxBuffer()
+  uint8_t data_buf[TF_MAX_PAYLOAD_RX];  //!< Built-in data byte buffer
   TF_LEN rxi;                       //!< Field size byte counter
   TF_CKSUM cksum;                   //!< Checksum calculated of the data stream
   TF_CKSUM ref_cksum;               //!< Reference checksum read from the message
   TF_TYPE type;                     //!< Collected message type number
   bool discard_data;                //!< Set if (len > TF_MAX_PAYLOAD) to read the frame, but
                                     //!< ignore the data.
+#if TF_USE_STATS
+  TF_Stats stats;  //!< Parser counters, may be read from other threads
+#endif
 
   /* Tx state */
   // Buffer for building frames
@@ -545,6 +661,16 @@ struct TinyFrame_
  */
 extern void TF_WriteImpl(TinyFrame * tf, const uint8_t * buff, uint32_t len);
 
+#if TF_USE_WRITEV
+/**
+ * 'Write' a frame given as segments, used by TF_SendVector(). All segments
+ * must go out back to back, like one TF_WriteImpl() call.
+ *
+ * ! Implement this in your application code !
+ */
+extern void TF_WriteVImpl(TinyFrame * tf, const struct iovec * iov, int iovcnt);
+#endif
+
 // Mutex functions
 #if TF_USE_MUTEX
 
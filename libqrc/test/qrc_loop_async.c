@@ -0,0 +1,124 @@
+/****************************************************************************
+ *
+ * Copyright (c) 2024 Qualcomm Innovation Center, Inc. All rights reserved.
+ * SPDX-License-Identifier: BSD-3-Clause-Clear
+ *
+ ****************************************************************************/
+
+/* loopback cases of qrc_write_async(), see qrc_write_done_dispatch() */
+
+#include <poll.h>
+#include <stdint.h>
+#include <unistd.h>
+
+#include "qrc.h"
+#include "qrc_loop_test.h"
+#include "qrc_loop_udriver.h"
+
+/****************************************************************************
+ * async: every qrc_write_async() completes once with its handle, by
+ * callback or by qrc_write_poll()
+ ****************************************************************************/
+
+#define ASYNC_CB_N (1000)
+#define ASYNC_POLL_N (300)
+
+static qrc_write_handle g_async_handles[ASYNC_CB_N];
+static qrc_write_handle g_async_done_handles[ASYNC_CB_N];
+static volatile int g_async_done;
+static int g_async_twice;
+static int g_async_failed;
+
+/* arg is the slot of the write in g_async_handles */
+static void async_done(qrc_pipe_s * pipe,
+    qrc_write_handle handle,
+    enum qrc_write_status_e status,
+    void * arg)
+{
+  int i = (int)((qrc_write_handle *)arg - g_async_handles);
+
+  (void)pipe;
+  if (0 != g_async_done_handles[i]) {
+    g_async_twice++;
+  }
+  g_async_done_handles[i] = handle;
+  if (SUCCESS != status) {
+    g_async_failed++;
+  }
+  __atomic_add_fetch(&g_async_done, 1, __ATOMIC_RELEASE);
+}
+
+int async_receiver(void)
+{
+  loop_accept("async", 0);
+  loop_barrier();
+  LOOP_EXPECT(loop_wait(&g_rx[0].got, ASYNC_CB_N + ASYNC_POLL_N, LOOP_WAIT_MS));
+  loop_barrier();
+  loop_expect_in_order(&g_rx[0], ASYNC_CB_N + ASYNC_POLL_N);
+  return 0;
+}
+
+/* take the completions waiting for qrc_write_poll() */
+static void async_poll(qrc_pipe_s * p, int * polled, int * failed)
+{
+  qrc_write_handle handle;
+  enum qrc_write_status_e status;
+
+  while (qrc_write_poll(p, &handle, &status)) {
+    (*polled)++;
+    *failed += (SUCCESS != status);
+  }
+}
+
+int async_sender(void)
+{
+  qrc_pipe_s * p = loop_connect("async");
+  uint8_t buf[LOOP_MSG_LEN];
+  qrc_write_handle handle;
+  enum qrc_write_status_e res;
+  struct pollfd pfd;
+  int polled = 0;
+  int failed = 0;
+  uint64_t end;
+
+  LOOP_EXPECT(qrc_set_send_window(p, 16));
+  qrc_loop_udriver_set_loss(5);
+  for (int i = 0; i < ASYNC_CB_N; i++) {
+    loop_fill(buf, (uint32_t)i);
+    while (BUSY == (res = qrc_write_async(p, buf, sizeof(buf), async_done, &g_async_handles[i],
+                              &g_async_handles[i]))) {
+      usleep(100); /* QRC_MAX_SEND_WINDOW writes are pending */
+    }
+    LOOP_EXPECT(SUCCESS == res);
+  }
+  LOOP_EXPECT(loop_wait(&g_async_done, ASYNC_CB_N, LOOP_WAIT_MS));
+  for (int i = 0; i < ASYNC_CB_N; i++) {
+    LOOP_EXPECT(0 != g_async_handles[i] && g_async_done_handles[i] == g_async_handles[i]);
+  }
+  LOOP_EXPECT(0 == g_async_twice);
+  LOOP_EXPECT(0 == g_async_failed);
+
+  /* completions without callback wake the event fd, a write is refused
+   * until they are taken */
+  pfd.fd = qrc_write_event_fd(p);
+  pfd.events = POLLIN;
+  LOOP_EXPECT(pfd.fd >= 0);
+  for (int i = 0; i < ASYNC_POLL_N; i++) {
+    loop_fill(buf, (uint32_t)(ASYNC_CB_N + i));
+    while (BUSY == (res = qrc_write_async(p, buf, sizeof(buf), NULL, NULL, &handle))) {
+      poll(&pfd, 1, 100);
+      async_poll(p, &polled, &failed);
+    }
+    LOOP_EXPECT(SUCCESS == res);
+  }
+  end = loop_now_ms() + LOOP_WAIT_MS;
+  while (polled < ASYNC_POLL_N && loop_now_ms() < end) {
+    poll(&pfd, 1, 100);
+    async_poll(p, &polled, &failed);
+  }
+  LOOP_EXPECT(ASYNC_POLL_N == polled);
+  LOOP_EXPECT(0 == failed);
+  qrc_loop_udriver_set_loss(0);
+  loop_barrier();
+  return 0;
+}
@@ -0,0 +1,72 @@
+/****************************************************************************
+ *
+ * Copyright (c) 2024 Qualcomm Innovation Center, Inc. All rights reserved.
+ * SPDX-License-Identifier: BSD-3-Clause-Clear
+ *
+ ****************************************************************************/
+
+/* loopback cases of the credit based flow control, see qrc_credit.c */
+
+#include <stdint.h>
+#include <unistd.h>
+
+#include "qrc.h"
+#include "qrc_loop_test.h"
+
+/****************************************************************************
+ * credit: a slow receiver with few credits holds the sender back instead of
+ * dropping its messages
+ ****************************************************************************/
+
+#define CREDIT_N (300)
+#define CREDIT_CAPACITY (8)
+
+static void credit_cb(qrc_pipe_s * pipe, void * data, size_t len, bool response)
+{
+  usleep(1000);
+  loop_rx_cb(pipe, data, len, response);
+}
+
+int credit_receiver(void)
+{
+  qrc_pipe_s * p = loop_accept("credit", 0);
+  struct qrc_pipe_stats_s stats;
+
+  qrc_register_message_cb(p, credit_cb);
+  LOOP_EXPECT(qrc_set_rx_credits(p, CREDIT_CAPACITY));
+  loop_barrier();
+  LOOP_EXPECT(loop_wait(&g_rx[0].got, CREDIT_N, LOOP_WAIT_MS));
+  loop_barrier();
+  loop_expect_in_order(&g_rx[0], CREDIT_N);
+  LOOP_EXPECT(qrc_get_pipe_stats(p, &stats));
+  return 0;
+}
+
+int credit_sender(void)
+{
+  qrc_pipe_s * p = loop_connect("credit");
+  struct qrc_credit_info_s info;
+  uint8_t buf[LOOP_MSG_LEN];
+  enum qrc_write_status_e res;
+  uint64_t end;
+
+  for (uint32_t seq = 0; seq < CREDIT_N; seq++) {
+    loop_fill(buf, seq);
+    while (BUSY == (res = qrc_write_fast(p, buf, sizeof(buf)))) {
+      usleep(100);
+    }
+    LOOP_EXPECT(SUCCESS == res);
+    /* the first frame probes, until the grant is back frames go without
+     * limit and would overrun the receiver */
+    end = loop_now_ms() + LOOP_WAIT_MS;
+    while (0 == seq && qrc_get_credit_info(p, &info) && !info.enabled && loop_now_ms() < end) {
+      usleep(1000);
+    }
+  }
+  LOOP_EXPECT(qrc_get_credit_info(p, &info));
+  LOOP_EXPECT(info.enabled);
+  LOOP_EXPECT(info.stalls > 0);
+  LOOP_EXPECT(info.probes > 0);
+  loop_barrier();
+  return 0;
+}
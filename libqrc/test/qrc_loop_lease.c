@@ -0,0 +1,97 @@
+/****************************************************************************
+ *
+ * Copyright (c) 2024 Qualcomm Innovation Center, Inc. All rights reserved.
+ * SPDX-License-Identifier: BSD-3-Clause-Clear
+ *
+ ****************************************************************************/
+
+/* loopback cases of the bus leases, see qrc_lease.c */
+
+#include <stdint.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "qrc.h"
+#include "qrc_loop_test.h"
+
+/****************************************************************************
+ * lease: qrc_require_pipe() and qrc_release_pipe() pairs, an expired lease
+ * does not keep the bus of the peer locked
+ ****************************************************************************/
+
+#define LEASE_N (100)
+#define LEASE_MARKER (0xffffffffU)
+
+static volatile int g_lease_marker;
+
+static void lease_cb(qrc_pipe_s * pipe, void * data, size_t len, bool response)
+{
+  uint32_t v;
+
+  (void)pipe;
+  (void)response;
+  memcpy(&v, data, sizeof(v) < len ? sizeof(v) : len);
+  if (LEASE_MARKER == v) {
+    __atomic_store_n(&g_lease_marker, 1, __ATOMIC_RELEASE);
+  }
+  __atomic_add_fetch(&g_rx[0].got, 1, __ATOMIC_RELEASE);
+}
+
+int lease_receiver(void)
+{
+  qrc_pipe_s * p = loop_accept("lease", 0);
+  uint32_t v = 1;
+  uint64_t start;
+
+  qrc_register_message_cb(p, lease_cb);
+  loop_barrier();
+  LOOP_EXPECT(loop_wait(&g_lease_marker, 1, LOOP_WAIT_MS));
+  LOOP_EXPECT(g_rx[0].got >= LEASE_N);
+
+  /* the lease of the sender ran out, our bus is free again */
+  start = loop_now_ms();
+  LOOP_EXPECT(SUCCESS == qrc_write(p, (const uint8_t *)&v, sizeof(v), false));
+  LOOP_EXPECT(loop_now_ms() - start < 1000);
+  loop_barrier();
+  return 0;
+}
+
+int lease_sender(void)
+{
+  qrc_pipe_s * p = loop_connect("lease");
+  struct qrc_bus_stats_s stats;
+  enum qrc_write_status_e res;
+  uint32_t v = 7;
+  int fails = 0;
+
+  for (int i = 0; i < LEASE_N; i++) {
+    fails += !qrc_require_pipe(p);
+    while (BUSY == (res = qrc_write_fast(p, &v, sizeof(v)))) {
+      usleep(100); /* out of credits, the receiver is behind */
+    }
+    fails += (SUCCESS != res);
+    fails += !qrc_release_pipe(p);
+  }
+  LOOP_EXPECT(0 == fails);
+  LOOP_EXPECT(qrc_get_bus_stats(&stats));
+  LOOP_EXPECT(stats.acquires >= LEASE_N);
+  LOOP_EXPECT(0 == stats.expired);
+
+  /* without linger the lease kept from the loop is given up, the next one
+   * is asked for anew and held past its end */
+  LOOP_EXPECT(qrc_set_bus_lease(50, 0));
+  LOOP_EXPECT(qrc_require_pipe(p));
+  LOOP_EXPECT(qrc_release_pipe(p));
+  LOOP_EXPECT(qrc_require_pipe(p));
+  v = LEASE_MARKER;
+  while (BUSY == (res = qrc_write_fast(p, &v, sizeof(v)))) {
+    usleep(100);
+  }
+  LOOP_EXPECT(SUCCESS == res);
+  usleep(200000);
+  LOOP_EXPECT(!qrc_release_pipe(p));
+  LOOP_EXPECT(qrc_get_bus_stats(&stats));
+  LOOP_EXPECT(1 == stats.expired);
+  loop_barrier();
+  return 0;
+}
@@ -0,0 +1,105 @@
+/****************************************************************************
+ *
+ * Copyright (c) 2024 Qualcomm Innovation Center, Inc. All rights reserved.
+ * SPDX-License-Identifier: BSD-3-Clause-Clear
+ *
+ ****************************************************************************/
+
+/* loopback cases of the pipe map, see qrc_pipemap.c */
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <unistd.h>
+
+#include "qrc.h"
+#include "qrc_loop_test.h"
+
+/****************************************************************************
+ * pipemap: pipes of a map both sides agree on are ready without a request
+ ****************************************************************************/
+
+static char g_map_path[64];
+
+/* same ids on both sides, each side keeps its own copy */
+static bool pipemap_write(const char * path)
+{
+  FILE * f = fopen(path, "w");
+
+  if (NULL == f) {
+    return false;
+  }
+  fprintf(f, "qrc-pipe-map 1\n");
+  for (int i = 0; i < LOOP_PIPES; i++) {
+    fprintf(f, "%d %d %s\n", i + 1, i + 1, g_names[i]);
+  }
+  fclose(f);
+  return true;
+}
+
+/* the side that came up first takes the map when the other one connects */
+static bool pipemap_wait_ready(void)
+{
+  uint64_t end = loop_now_ms() + LOOP_WAIT_MS;
+  int ready;
+
+  do {
+    ready = 0;
+    for (int i = 0; i < LOOP_PIPES; i++) {
+      qrc_pipe_s * p = qrc_pipe_find_by_name(g_names[i]);
+      ready += (NULL != p && p->pipe_ready);
+    }
+    if (LOOP_PIPES == ready) {
+      return true;
+    }
+    usleep(1000);
+  } while (loop_now_ms() < end);
+
+  return false;
+}
+
+int pipemap_receiver(void)
+{
+  loop_barrier();
+  LOOP_EXPECT(pipemap_wait_ready());
+  for (int i = 0; i < LOOP_PIPES; i++) {
+    g_rx[i].pipe = qrc_pipe_find_by_name(g_names[i]);
+    LOOP_EXPECT(NULL != g_rx[i].pipe);
+    if (NULL != g_rx[i].pipe) {
+      qrc_register_message_cb(g_rx[i].pipe, loop_rx_cb);
+    }
+  }
+  loop_barrier();
+  for (int i = 0; i < LOOP_PIPES; i++) {
+    LOOP_EXPECT(loop_wait(&g_rx[i].got, 1, LOOP_WAIT_MS));
+  }
+  loop_barrier();
+  unlink(g_map_path);
+  return 0;
+}
+
+int pipemap_sender(void)
+{
+  qrc_pipe_s * pipes[LOOP_PIPES];
+  uint8_t buf[LOOP_MSG_LEN];
+
+  loop_barrier();
+  LOOP_EXPECT(pipemap_wait_ready());
+  LOOP_EXPECT(qrc_get_pipes(g_names, pipes, LOOP_PIPES));
+  loop_barrier();
+  loop_fill(buf, 0);
+  for (int i = 0; i < LOOP_PIPES; i++) {
+    LOOP_EXPECT(pipes[i]->pipe_id == i + 1 && pipes[i]->peer_pipe_id == i + 1);
+    LOOP_EXPECT(SUCCESS == qrc_write(pipes[i], buf, sizeof(buf), true));
+  }
+  loop_barrier();
+  unlink(g_map_path);
+  return 0;
+}
+
+/* before init, each side reads its own copy of the map */
+bool pipemap_setup(void)
+{
+  snprintf(g_map_path, sizeof(g_map_path), "/tmp/qrc_loop_map.%d.%s", (int)g_pid, g_side);
+  return pipemap_write(g_map_path) && qrc_set_pipe_map_file(g_map_path);
+}
@@ -0,0 +1,346 @@
+/****************************************************************************
+ *
+ * Copyright (c) 2024 Qualcomm Innovation Center, Inc. All rights reserved.
+ * SPDX-License-Identifier: BSD-3-Clause-Clear
+ *
+ ****************************************************************************/
+
+/* loopback cases of the reliable delivery, see qrc_reliable.c */
+
+#include <stdint.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "qrc.h"
+#include "qrc_loop_test.h"
+#include "qrc_loop_udriver.h"
+
+/****************************************************************************
+ * reliable: writes with ack arrive once and in order over a lossy link
+ ****************************************************************************/
+
+#define RELIABLE_N (2000)
+
+int reliable_receiver(void)
+{
+  loop_accept("reliable", 0);
+  loop_barrier();
+  LOOP_EXPECT(loop_wait(&g_rx[0].got, RELIABLE_N, LOOP_WAIT_MS));
+  loop_barrier();
+  loop_expect_in_order(&g_rx[0], RELIABLE_N);
+  return 0;
+}
+
+int reliable_sender(void)
+{
+  qrc_pipe_s * p = loop_connect("reliable");
+  struct qrc_rtt_info_s info;
+
+  LOOP_EXPECT(qrc_set_send_window(p, 16));
+  qrc_loop_udriver_set_loss(10);
+  loop_send(p, 0, RELIABLE_N);
+  LOOP_EXPECT(SUCCESS == qrc_flush(p));
+  qrc_loop_udriver_set_loss(0);
+  loop_barrier();
+
+  LOOP_EXPECT(qrc_get_rtt_info(p, &info));
+  LOOP_EXPECT(info.retransmits > 0);
+  LOOP_EXPECT(0 == info.given_up);
+  LOOP_EXPECT(info.samples > 0);
+  return 0;
+}
+
+/****************************************************************************
+ * sack: with a full window the frames after a lost one are held by the
+ * receiver and delivered in order once it is resent. The selective acks
+ * tell the sender which ones it lost, it resends those only
+ ****************************************************************************/
+
+#define SACK_N (2000)
+#define SACK_LOSS (10)
+
+int sack_receiver(void)
+{
+  loop_accept("sack", 0);
+  loop_barrier();
+  LOOP_EXPECT(loop_wait(&g_rx[0].got, SACK_N, LOOP_WAIT_MS));
+  loop_barrier();
+  loop_expect_in_order(&g_rx[0], SACK_N);
+  return 0;
+}
+
+int sack_sender(void)
+{
+  qrc_pipe_s * p = loop_connect("sack");
+  struct qrc_rtt_info_s info;
+  unsigned frames;
+  unsigned dropped;
+
+  LOOP_EXPECT(qrc_set_send_window(p, QRC_MAX_SEND_WINDOW));
+  qrc_loop_udriver_set_loss(SACK_LOSS);
+  loop_send(p, 0, SACK_N);
+  LOOP_EXPECT(SUCCESS == qrc_flush(p));
+  qrc_loop_udriver_set_loss(0);
+  loop_barrier();
+
+  /* go back n would resend half the window behind each lost frame. Resends
+   * of timeouts come on top on a busy host, so the margin is wide */
+  qrc_loop_udriver_get_counts(&frames, &dropped);
+  LOOP_EXPECT(qrc_get_rtt_info(p, &info));
+  LOOP_EXPECT(dropped > 0);
+  LOOP_EXPECT(info.retransmits >= dropped / 2);
+  LOOP_EXPECT(info.retransmits <= dropped * QRC_MAX_SEND_WINDOW / 4);
+  LOOP_EXPECT(0 == info.given_up);
+  return 0;
+}
+
+/****************************************************************************
+ * forward: frames given up are skipped by the receiver, the ones after
+ * them are delivered
+ ****************************************************************************/
+
+#define FORWARD_BEFORE (10)
+#define FORWARD_LOST (4)
+#define FORWARD_AFTER (100)
+
+static volatile int g_forward_done;
+static volatile int g_forward_timeouts;
+
+static void forward_done(qrc_pipe_s * pipe,
+    qrc_write_handle handle,
+    enum qrc_write_status_e status,
+    void * arg)
+{
+  (void)pipe;
+  (void)handle;
+  (void)arg;
+  if (TIMEOUT == status) {
+    __atomic_add_fetch(&g_forward_timeouts, 1, __ATOMIC_RELEASE);
+  }
+  __atomic_add_fetch(&g_forward_done, 1, __ATOMIC_RELEASE);
+}
+
+int forward_receiver(void)
+{
+  loop_accept("forward", 0);
+  loop_barrier();
+  LOOP_EXPECT(loop_wait(&g_rx[0].got, FORWARD_BEFORE + FORWARD_AFTER, LOOP_WAIT_MS));
+  loop_barrier();
+
+  LOOP_EXPECT(g_rx[0].got == FORWARD_BEFORE + FORWARD_AFTER);
+  LOOP_EXPECT(0 == g_rx[0].bad);
+  LOOP_EXPECT(0 == g_rx[0].misorder);
+  LOOP_EXPECT(1 == g_rx[0].gaps);
+  LOOP_EXPECT(0 == g_rx[0].first_seq);
+  LOOP_EXPECT(FORWARD_BEFORE + FORWARD_LOST + FORWARD_AFTER - 1 == g_rx[0].last_seq);
+  return 0;
+}
+
+int forward_sender(void)
+{
+  qrc_pipe_s * p = loop_connect("forward");
+  /* the lost frames are given up soon, the others get time on a busy host */
+  struct qrc_retry_policy_s give_up = {2, 5, 5, 20};
+  struct qrc_retry_policy_s patient = {20, 50, 5, 1000};
+  struct qrc_rtt_info_s info;
+  uint8_t buf[LOOP_MSG_LEN];
+  qrc_write_handle handle;
+
+  LOOP_EXPECT(qrc_set_send_window(p, 8));
+  LOOP_EXPECT(qrc_set_retry_policy(p, &patient));
+  loop_send(p, 0, FORWARD_BEFORE);
+  LOOP_EXPECT(SUCCESS == qrc_flush(p));
+
+  LOOP_EXPECT(qrc_set_retry_policy(p, &give_up));
+  qrc_loop_udriver_set_loss(100);
+  for (uint32_t seq = FORWARD_BEFORE; seq < FORWARD_BEFORE + FORWARD_LOST; seq++) {
+    loop_fill(buf, seq);
+    LOOP_EXPECT(SUCCESS == qrc_write_async(p, buf, sizeof(buf), forward_done, NULL, &handle));
+  }
+  LOOP_EXPECT(loop_wait(&g_forward_done, FORWARD_LOST, LOOP_WAIT_MS));
+  LOOP_EXPECT(FORWARD_LOST == g_forward_timeouts);
+  LOOP_EXPECT(TIMEOUT == qrc_flush(p));
+  qrc_loop_udriver_set_loss(0);
+  LOOP_EXPECT(qrc_set_retry_policy(p, &patient));
+
+  loop_send(p, FORWARD_BEFORE + FORWARD_LOST, FORWARD_AFTER);
+  LOOP_EXPECT(SUCCESS == qrc_flush(p));
+  loop_barrier();
+
+  LOOP_EXPECT(qrc_get_rtt_info(p, &info));
+  LOOP_EXPECT(FORWARD_LOST == info.given_up);
+  return 0;
+}
+
+/****************************************************************************
+ * loss: a full window over links that lose 1, 5 and 20% of the frames, all
+ * of them arrive once, in order and intact. At 20% one of the 20000 frames
+ * is lost 8 times in a row now and then, so the frames have more tries than
+ * the default policy gives
+ ****************************************************************************/
+
+#define LOSS_N (20000)
+#define LOSS_RATES (3)
+
+static const int g_loss_rates[LOSS_RATES] = {1, 5, 20};
+
+int loss_receiver(void)
+{
+  loop_barrier();
+  for (int i = 0; i < LOSS_RATES; i++) {
+    g_rx[i].pipe = qrc_pipe_find_by_name(g_names[i]);
+    LOOP_EXPECT(NULL != g_rx[i].pipe && g_rx[i].pipe->pipe_ready);
+    if (NULL != g_rx[i].pipe) {
+      qrc_register_message_cb(g_rx[i].pipe, loop_rx_cb);
+    }
+  }
+  loop_barrier();
+  for (int i = 0; i < LOSS_RATES; i++) {
+    LOOP_EXPECT(loop_wait(&g_rx[i].got, LOSS_N, LOOP_WAIT_MS));
+    loop_barrier();
+    loop_expect_in_order(&g_rx[i], LOSS_N);
+  }
+  return 0;
+}
+
+int loss_sender(void)
+{
+  qrc_pipe_s * pipes[LOOP_PIPES];
+  struct qrc_rtt_info_s info;
+  struct qrc_retry_policy_s patient = {20, 500, 10, 500}; /* the default timeouts */
+
+  LOOP_EXPECT(qrc_get_pipes(g_names, pipes, LOOP_PIPES));
+  loop_barrier();
+  loop_barrier();
+  for (int i = 0; i < LOSS_RATES; i++) {
+    LOOP_EXPECT(qrc_set_send_window(pipes[i], QRC_MAX_SEND_WINDOW));
+    LOOP_EXPECT(qrc_set_retry_policy(pipes[i], &patient));
+    qrc_loop_udriver_set_loss(g_loss_rates[i]);
+    loop_send(pipes[i], 0, LOSS_N);
+    LOOP_EXPECT(SUCCESS == qrc_flush(pipes[i]));
+    qrc_loop_udriver_set_loss(0);
+    loop_barrier();
+    LOOP_EXPECT(qrc_get_rtt_info(pipes[i], &info));
+    LOOP_EXPECT(0 == info.given_up);
+  }
+  return 0;
+}
+
+/****************************************************************************
+ * rate: messages per second of writes with ack without loss, at window 1
+ * and at the largest window. Prints the rates, fails only if messages are
+ * lost
+ ****************************************************************************/
+
+#define RATE_N (20000)
+
+int rate_receiver(void)
+{
+  loop_barrier();
+  for (int i = 0; i < 2; i++) {
+    g_rx[i].pipe = qrc_pipe_find_by_name(g_names[i]);
+    LOOP_EXPECT(NULL != g_rx[i].pipe && g_rx[i].pipe->pipe_ready);
+    if (NULL != g_rx[i].pipe) {
+      qrc_register_message_cb(g_rx[i].pipe, loop_rx_cb);
+    }
+  }
+  loop_barrier();
+  for (int i = 0; i < 2; i++) {
+    LOOP_EXPECT(loop_wait(&g_rx[i].got, RATE_N, LOOP_WAIT_MS));
+    loop_barrier();
+    loop_expect_in_order(&g_rx[i], RATE_N);
+  }
+  return 0;
+}
+
+int rate_sender(void)
+{
+  const uint16_t windows[2] = {1, QRC_MAX_SEND_WINDOW};
+  qrc_pipe_s * pipes[LOOP_PIPES];
+  uint64_t start;
+  uint64_t ms;
+
+  LOOP_EXPECT(qrc_get_pipes(g_names, pipes, LOOP_PIPES));
+  loop_barrier();
+  loop_barrier();
+  for (int i = 0; i < 2; i++) {
+    LOOP_EXPECT(qrc_set_send_window(pipes[i], windows[i]));
+    start = loop_now_ms();
+    loop_send(pipes[i], 0, RATE_N);
+    LOOP_EXPECT(SUCCESS == qrc_flush(pipes[i]));
+    ms = loop_now_ms() - start;
+    printf("rate: window %2u: %d messages of %d bytes in %llu ms, %llu msg/s\n",
+        (unsigned)windows[i], RATE_N, LOOP_MSG_LEN, (unsigned long long)ms,
+        (unsigned long long)(RATE_N * 1000ULL / (0 == ms ? 1 : ms)));
+    loop_barrier();
+  }
+  return 0;
+}
+
+/****************************************************************************
+ * restart: the receiver starts anew while frames are in flight, the sender
+ * syncs again and the pipe goes on without losing them
+ ****************************************************************************/
+
+#define RESTART_BEFORE (200)
+#define RESTART_DURING (8)
+#define RESTART_AFTER (200)
+
+int restart_receiver(void)
+{
+  qrc_pipe_s * p;
+  uint64_t end;
+
+  loop_accept("restart", 0);
+  loop_barrier();
+  LOOP_EXPECT(loop_wait(&g_rx[0].got, RESTART_BEFORE, LOOP_WAIT_MS));
+  loop_barrier();
+
+  /* the frames sent now find no pipe, then one that knows no sequence */
+  deinit_qrc_management();
+  memset(&g_rx[0], 0, sizeof(g_rx[0]));
+  loop_barrier();
+  LOOP_EXPECT(init_qrc_management());
+  p = qrc_get_pipe("restart");
+  end = loop_now_ms() + LOOP_WAIT_MS;
+  while (NULL != p && !p->pipe_ready && loop_now_ms() < end) {
+    usleep(1000);
+  }
+  LOOP_EXPECT(NULL != p && p->pipe_ready);
+  g_rx[0].pipe = p;
+  if (NULL != p) {
+    qrc_register_message_cb(p, loop_rx_cb);
+  }
+
+  LOOP_EXPECT(loop_wait(&g_rx[0].got, RESTART_DURING + RESTART_AFTER, LOOP_WAIT_MS));
+  loop_barrier();
+  LOOP_EXPECT(0 == g_rx[0].bad);
+  LOOP_EXPECT(0 == g_rx[0].misorder);
+  LOOP_EXPECT(RESTART_BEFORE == g_rx[0].first_seq);
+  LOOP_EXPECT(RESTART_BEFORE + RESTART_DURING + RESTART_AFTER - 1 == g_rx[0].last_seq);
+  return 0;
+}
+
+int restart_sender(void)
+{
+  qrc_pipe_s * p = loop_connect("restart");
+  /* the frames in flight outlast the restart of the receiver */
+  struct qrc_retry_policy_s patient = {30, 50, 10, 1000};
+  struct qrc_rtt_info_s info;
+
+  LOOP_EXPECT(qrc_set_send_window(p, RESTART_DURING));
+  LOOP_EXPECT(qrc_set_retry_policy(p, &patient));
+  loop_send(p, 0, RESTART_BEFORE);
+  LOOP_EXPECT(SUCCESS == qrc_flush(p));
+  loop_barrier();
+
+  loop_barrier();
+  loop_send(p, RESTART_BEFORE, RESTART_DURING);
+  loop_send(p, RESTART_BEFORE + RESTART_DURING, RESTART_AFTER);
+  LOOP_EXPECT(SUCCESS == qrc_flush(p));
+  loop_barrier();
+
+  LOOP_EXPECT(qrc_get_rtt_info(p, &info));
+  LOOP_EXPECT(0 == info.given_up);
+  return 0;
+}
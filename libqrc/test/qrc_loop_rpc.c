@@ -0,0 +1,110 @@
+/****************************************************************************
+ *
+ * Copyright (c) 2024 Qualcomm Innovation Center, Inc. All rights reserved.
+ * SPDX-License-Identifier: BSD-3-Clause-Clear
+ *
+ ****************************************************************************/
+
+/* loopback cases of qrc_sync_write() and qrc_response(), see qrc_rpc.c */
+
+#include <pthread.h>
+#include <stdint.h>
+#include <string.h>
+
+#include "qrc.h"
+#include "qrc_loop_test.h"
+#include "qrc_loop_udriver.h"
+
+/****************************************************************************
+ * rpc: every request gets its own response, from several threads at once
+ ****************************************************************************/
+
+#define RPC_THREADS (4)
+#define RPC_CALLS (200)
+#define RPC_NO_ANSWER (0xbeef)
+
+static volatile int g_rpc_requests;
+static int g_rpc_outside;
+
+static void rpc_cb(qrc_pipe_s * pipe, void * data, size_t len, bool response)
+{
+  uint32_t v[8];
+
+  if (!response || len > sizeof(v)) {
+    return;
+  }
+  memcpy(v, data, len);
+  __atomic_add_fetch(&g_rpc_requests, 1, __ATOMIC_RELEASE);
+  if (RPC_NO_ANSWER == v[0]) {
+    return;
+  }
+  for (size_t i = 0; i < len / sizeof(v[0]); i++) {
+    v[i] = v[i] * 3 + 1;
+  }
+  LOOP_EXPECT(SUCCESS == qrc_response(pipe, v, len));
+  LOOP_EXPECT(SUCCESS != qrc_response(pipe, v, len));
+}
+
+int rpc_receiver(void)
+{
+  qrc_pipe_s * p = loop_accept("rpc", 0);
+  uint32_t v = 1;
+
+  qrc_register_message_cb(p, rpc_cb);
+  g_rpc_outside = (SUCCESS == qrc_response(p, &v, sizeof(v)));
+  loop_barrier();
+  LOOP_EXPECT(loop_wait(&g_rpc_requests, RPC_THREADS * RPC_CALLS + 1, LOOP_WAIT_MS));
+  loop_barrier();
+  LOOP_EXPECT(0 == g_rpc_outside);
+  return 0;
+}
+
+static qrc_pipe_s * g_rpc_pipe;
+static volatile int g_rpc_ok;
+
+static void * rpc_caller(void * arg)
+{
+  uint32_t id = (uint32_t)(uintptr_t)arg;
+
+  for (uint32_t i = 0; i < RPC_CALLS; i++) {
+    uint32_t q[8];
+    uint32_t r[8];
+    size_t len = sizeof(r);
+    bool good;
+
+    for (uint32_t k = 0; k < 8; k++) {
+      q[k] = id * 1000000 + i * 8 + k;
+    }
+    if (SUCCESS != qrc_sync_write(g_rpc_pipe, q, sizeof(q), r, &len, 1000)) {
+      continue;
+    }
+    good = (sizeof(r) == len);
+    for (int k = 0; good && k < 8; k++) {
+      good = (r[k] == q[k] * 3 + 1);
+    }
+    if (good) {
+      __atomic_add_fetch(&g_rpc_ok, 1, __ATOMIC_RELAXED);
+    }
+  }
+  return NULL;
+}
+
+int rpc_sender(void)
+{
+  pthread_t threads[RPC_THREADS];
+  uint32_t q = RPC_NO_ANSWER;
+  uint32_t r;
+  size_t len = sizeof(r);
+
+  g_rpc_pipe = loop_connect("rpc");
+  for (int i = 0; i < RPC_THREADS; i++) {
+    pthread_create(&threads[i], NULL, rpc_caller, (void *)(uintptr_t)i);
+  }
+  for (int i = 0; i < RPC_THREADS; i++) {
+    pthread_join(threads[i], NULL);
+  }
+  LOOP_EXPECT(RPC_THREADS * RPC_CALLS == g_rpc_ok);
+  LOOP_EXPECT(TIMEOUT == qrc_sync_write(g_rpc_pipe, &q, sizeof(q), &r, &len, 100));
+  loop_barrier();
+  return 0;
+}
@@ -0,0 +1,72 @@
+/****************************************************************************
+ *
+ * Copyright (c) 2024 Qualcomm Innovation Center, Inc. All rights reserved.
+ * SPDX-License-Identifier: BSD-3-Clause-Clear
+ *
+ ****************************************************************************/
+
+/* loopback cases of the per pipe strands, see qrc_strand.c */
+
+#include <pthread.h>
+#include <stddef.h>
+
+#include "qrc.h"
+#include "qrc_loop_test.h"
+
+/****************************************************************************
+ * strand: callbacks of a pipe run one at a time in order while the pipes
+ * are sent to at once
+ ****************************************************************************/
+
+#define STRAND_N (2000)
+
+int strand_receiver(void)
+{
+  loop_barrier();
+  for (int i = 0; i < LOOP_PIPES; i++) {
+    g_rx[i].pipe = qrc_pipe_find_by_name(g_names[i]);
+    LOOP_EXPECT(NULL != g_rx[i].pipe && g_rx[i].pipe->pipe_ready);
+    if (NULL != g_rx[i].pipe) {
+      qrc_register_message_cb(g_rx[i].pipe, loop_rx_cb);
+    }
+  }
+  loop_barrier();
+  for (int i = 0; i < LOOP_PIPES; i++) {
+    LOOP_EXPECT(loop_wait(&g_rx[i].got, STRAND_N, LOOP_WAIT_MS));
+  }
+  loop_barrier();
+  for (int i = 0; i < LOOP_PIPES; i++) {
+    loop_expect_in_order(&g_rx[i], STRAND_N);
+  }
+  return 0;
+}
+
+static void * strand_send(void * arg)
+{
+  qrc_pipe_s * p = (qrc_pipe_s *)arg;
+
+  loop_send(p, 0, STRAND_N);
+  LOOP_EXPECT(SUCCESS == qrc_flush(p));
+  return NULL;
+}
+
+int strand_sender(void)
+{
+  qrc_pipe_s * pipes[LOOP_PIPES];
+  pthread_t threads[LOOP_PIPES];
+
+  LOOP_EXPECT(qrc_get_pipes(g_names, pipes, LOOP_PIPES));
+  for (int i = 0; i < LOOP_PIPES; i++) {
+    LOOP_EXPECT(qrc_set_send_window(pipes[i], QRC_MAX_SEND_WINDOW));
+  }
+  loop_barrier();
+  loop_barrier();
+  for (int i = 0; i < LOOP_PIPES; i++) {
+    pthread_create(&threads[i], NULL, strand_send, pipes[i]);
+  }
+  for (int i = 0; i < LOOP_PIPES; i++) {
+    pthread_join(threads[i], NULL);
+  }
+  loop_barrier();
+  return 0;
+}
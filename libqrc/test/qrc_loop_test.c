@@ -0,0 +1,309 @@
+/****************************************************************************
+ *
+ * Copyright (c) 2024 Qualcomm Innovation Center, Inc. All rights reserved.
+ * SPDX-License-Identifier: BSD-3-Clause-Clear
+ *
+ ****************************************************************************/
+
+/* behavior tests of libqrc over a loopback link: the test forks, parent and
+ * child each run the whole library on one end of a socketpair, see
+ * qrc_loop_udriver.c. The parent receives, the child sends. A second
+ * socketpair lets both sides wait for each other between the steps.
+ *
+ * usage: qrc_loop_test <case>, exit status 0 when both sides passed */
+
+#include <signal.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <sys/wait.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "qrc.h"
+#include "qrc_loop_test.h"
+#include "qrc_loop_udriver.h"
+
+/****************************************************************************
+ * Public Data
+ ****************************************************************************/
+
+const char * g_side = "receiver";
+int g_failures;
+struct loop_rx_s g_rx[LOOP_PIPES];
+const char * g_names[LOOP_PIPES] = {"loop0", "loop1", "loop2", "loop3"};
+pid_t g_pid;
+
+/****************************************************************************
+ * Private Data
+ ****************************************************************************/
+
+static int g_sync_fd = -1;
+
+/****************************************************************************
+ * Private Functions
+ ****************************************************************************/
+
+static struct loop_rx_s * loop_rx_of(const qrc_pipe_s * pipe)
+{
+  for (int i = 0; i < LOOP_PIPES; i++) {
+    if (g_rx[i].pipe == pipe) {
+      return &g_rx[i];
+    }
+  }
+  return &g_rx[0];
+}
+
+/****************************************************************************
+ * Public Functions
+ ****************************************************************************/
+
+uint64_t loop_now_ms(void)
+{
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (uint64_t)ts.tv_sec * 1000 + (uint64_t)ts.tv_nsec / 1000000;
+}
+
+/* both sides are here, false if the peer is gone */
+bool loop_barrier(void)
+{
+  char c = 0;
+
+  if (write(g_sync_fd, &c, 1) != 1 || read(g_sync_fd, &c, 1) != 1) {
+    fprintf(stderr, "%s: peer is gone\n", g_side);
+    g_failures++;
+    return false;
+  }
+  return true;
+}
+
+bool loop_wait(volatile int * value, int target, int timeout_ms)
+{
+  uint64_t end = loop_now_ms() + (uint64_t)timeout_ms;
+
+  while (__atomic_load_n(value, __ATOMIC_ACQUIRE) < target) {
+    if (loop_now_ms() > end) {
+      return false;
+    }
+    usleep(1000);
+  }
+  return true;
+}
+
+void loop_fill(uint8_t * buf, uint32_t seq)
+{
+  memcpy(buf, &seq, sizeof(seq));
+  for (int i = sizeof(seq); i < LOOP_MSG_LEN; i++) {
+    buf[i] = (uint8_t)(seq + i);
+  }
+}
+
+/* check a message of loop_fill() against the ones before it */
+void loop_rx_cb(qrc_pipe_s * pipe, void * data, size_t len, bool response)
+{
+  struct loop_rx_s * rx = loop_rx_of(pipe);
+  const uint8_t * d = (const uint8_t *)data;
+  uint32_t seq;
+
+  (void)response;
+  if (__atomic_exchange_n(&rx->inside, 1, __ATOMIC_ACQ_REL)) {
+    rx->concurrent++;
+  }
+  memcpy(&seq, d, sizeof(seq));
+  if (LOOP_MSG_LEN != len) {
+    rx->bad++;
+  } else {
+    for (int i = sizeof(seq); i < LOOP_MSG_LEN; i++) {
+      if (d[i] != (uint8_t)(seq + i)) {
+        rx->bad++;
+        break;
+      }
+    }
+  }
+  if (!rx->first) {
+    rx->first = true;
+    rx->first_seq = seq;
+  } else if (seq <= rx->last_seq) {
+    rx->misorder++;
+  } else if (seq != rx->last_seq + 1) {
+    rx->gaps++;
+  }
+  rx->last_seq = seq;
+  if (0 == seq % 97) {
+    usleep(200); /* let the messages behind it pile up */
+  }
+  __atomic_store_n(&rx->inside, 0, __ATOMIC_RELEASE);
+  __atomic_add_fetch(&rx->got, 1, __ATOMIC_RELEASE);
+}
+
+/* sender: create the pipe and wait until the receiver has set it up */
+qrc_pipe_s * loop_connect(const char * name)
+{
+  qrc_pipe_s * p = qrc_get_pipe(name);
+  uint64_t end = loop_now_ms() + LOOP_WAIT_MS;
+
+  while (NULL != p && !p->pipe_ready && loop_now_ms() < end) {
+    usleep(1000);
+  }
+  LOOP_EXPECT(NULL != p && p->pipe_ready);
+  loop_barrier();
+  loop_barrier();
+  return p;
+}
+
+/* receiver: find the pipe of loop_connect(), set it up, then call
+ * loop_barrier() to let the sender go */
+qrc_pipe_s * loop_accept(const char * name, int idx)
+{
+  qrc_pipe_s * p;
+
+  loop_barrier();
+  p = qrc_pipe_find_by_name(name);
+  LOOP_EXPECT(NULL != p && p->pipe_ready);
+  g_rx[idx].pipe = p;
+  if (NULL != p) {
+    qrc_register_message_cb(p, loop_rx_cb);
+  }
+  return p;
+}
+
+/* writes with ack of seq first ~ first + n - 1 */
+void loop_send(const qrc_pipe_s * p, uint32_t first, int n)
+{
+  uint8_t buf[LOOP_MSG_LEN];
+  int fails = 0;
+
+  for (uint32_t seq = first; seq < first + (uint32_t)n; seq++) {
+    loop_fill(buf, seq);
+    if (SUCCESS != qrc_write(p, buf, sizeof(buf), true)) {
+      fails++;
+    }
+  }
+  LOOP_EXPECT(0 == fails);
+}
+
+void loop_expect_in_order(const struct loop_rx_s * rx, int n)
+{
+  LOOP_EXPECT(rx->got == n);
+  LOOP_EXPECT(0 == rx->bad);
+  LOOP_EXPECT(0 == rx->misorder);
+  LOOP_EXPECT(0 == rx->gaps);
+  LOOP_EXPECT(0 == rx->concurrent);
+}
+
+/****************************************************************************
+ * Harness
+ ****************************************************************************/
+
+static const struct loop_case_s g_cases[] = {
+  {"reliable", reliable_receiver, reliable_sender, NULL},
+  {"sack", sack_receiver, sack_sender, NULL},
+  {"forward", forward_receiver, forward_sender, NULL},
+  {"loss", loss_receiver, loss_sender, NULL},
+  {"rate", rate_receiver, rate_sender, NULL},
+  {"restart", restart_receiver, restart_sender, NULL},
+  {"async", async_receiver, async_sender, NULL},
+  {"rpc", rpc_receiver, rpc_sender, NULL},
+  {"timer", timer_run, NULL, NULL},
+  {"lease", lease_receiver, lease_sender, NULL},
+  {"pipemap", pipemap_receiver, pipemap_sender, pipemap_setup},
+  {"credit", credit_receiver, credit_sender, NULL},
+  {"strand", strand_receiver, strand_sender, NULL},
+};
+
+/* one side of a case on its end of the link */
+static int loop_side(const struct loop_case_s * c, int (*run)(void), int link_fd)
+{
+  qrc_loop_udriver_set_fd(link_fd);
+  if (NULL != c->setup && !c->setup()) {
+    fprintf(stderr, "%s: setup failed\n", g_side);
+    return 1;
+  }
+  if (!init_qrc_management()) {
+    fprintf(stderr, "%s: init failed\n", g_side);
+    return 1;
+  }
+  run();
+  loop_barrier();
+  deinit_qrc_management();
+
+  return (0 == g_failures) ? 0 : 1;
+}
+
+static int loop_run(const struct loop_case_s * c)
+{
+  int link[2];
+  int sync[2];
+  int status = 1;
+  int res;
+  pid_t pid;
+
+  if (NULL == c->sender) {
+    g_side = c->name;
+    c->receiver();
+    return (0 == g_failures) ? 0 : 1;
+  }
+
+  g_pid = getpid();
+  if (0 != socketpair(AF_UNIX, SOCK_STREAM, 0, link) ||
+      0 != socketpair(AF_UNIX, SOCK_STREAM, 0, sync)) {
+    perror("socketpair");
+    return 1;
+  }
+  pid = fork();
+  if (pid < 0) {
+    perror("fork");
+    return 1;
+  }
+  if (0 == pid) {
+    g_side = "sender";
+    g_sync_fd = sync[1];
+    close(link[0]);
+    close(sync[0]);
+    res = loop_side(c, c->sender, link[1]);
+    fflush(stdout);
+    _exit(res);
+  }
+
+  g_sync_fd = sync[0];
+  close(link[1]);
+  close(sync[1]);
+  res = loop_side(c, c->receiver, link[0]);
+  if (waitpid(pid, &status, 0) != pid || !WIFEXITED(status) || 0 != WEXITSTATUS(status)) {
+    fprintf(stderr, "sender failed\n");
+    res = 1;
+  }
+  return res;
+}
+
+int main(int argc, char ** argv)
+{
+  const struct loop_case_s * c = NULL;
+  int res;
+
+  for (size_t i = 0; argc > 1 && i < sizeof(g_cases) / sizeof(g_cases[0]); i++) {
+    if (0 == strcmp(argv[1], g_cases[i].name)) {
+      c = &g_cases[i];
+    }
+  }
+  if (NULL == c) {
+    fprintf(stderr, "usage: %s <case>, cases:", argv[0]);
+    for (size_t i = 0; i < sizeof(g_cases) / sizeof(g_cases[0]); i++) {
+      fprintf(stderr, " %s", g_cases[i].name);
+    }
+    fprintf(stderr, "\n");
+    return 2;
+  }
+
+  /* a side that hangs fails the case, the peer sees its end of the link close */
+  alarm(LOOP_TIMEOUT_S);
+  qrc_set_log_level(QRC_LOG_ERROR);
+  res = loop_run(c);
+  printf("%s: %s\n", c->name, (0 == res) ? "passed" : "FAILED");
+
+  return res;
+}
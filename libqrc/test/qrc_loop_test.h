@@ -0,0 +1,150 @@
+/****************************************************************************
+ *
+ * Copyright (c) 2024 Qualcomm Innovation Center, Inc. All rights reserved.
+ * SPDX-License-Identifier: BSD-3-Clause-Clear
+ *
+ ****************************************************************************/
+#ifndef __QRC_LOOP_TEST_H
+#define __QRC_LOOP_TEST_H
+
+/* harness of the loopback tests, see qrc_loop_test.c. The cases of each
+ * part of the library live in their own qrc_loop_<part>.c */
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <sys/types.h>
+
+#include "qrc_msg_management.h"
+
+/****************************************************************************
+ * Pre-processor Definitions
+ ****************************************************************************/
+
+#define LOOP_TIMEOUT_S (90)    /* a side still running after it failed */
+#define LOOP_WAIT_MS (20000)   /* for the messages of a step */
+#define LOOP_MSG_LEN (64)
+#define LOOP_PIPES (4)
+
+/* count a failed check and go on, so the peer is not left waiting */
+#define LOOP_EXPECT(cond)                                                             \
+  do {                                                                                \
+    if (!(cond)) {                                                                    \
+      fprintf(stderr, "%s: %s:%d: %s failed\n", g_side, __FILE__, __LINE__, #cond); \
+      g_failures++;                                                                   \
+    }                                                                                 \
+  } while (0)
+
+/****************************************************************************
+ * Public Types
+ ****************************************************************************/
+
+struct loop_case_s
+{
+  const char * name;
+  int (*receiver)(void); /* parent */
+  int (*sender)(void);   /* child, NULL: the case needs no link */
+  bool (*setup)(void);   /* both sides before init, NULL: none */
+};
+
+/* what the callbacks of a pipe saw */
+struct loop_rx_s
+{
+  qrc_pipe_s * pipe;
+  volatile int got;
+  int bad;        /* payload does not match its sequence number */
+  int misorder;   /* sequence number is not above the last one */
+  int gaps;       /* sequence numbers skipped */
+  int concurrent; /* callbacks of the pipe that overlapped */
+  int inside;
+  bool first;
+  uint32_t first_seq;
+  uint32_t last_seq;
+};
+
+/****************************************************************************
+ * Public Data
+ ****************************************************************************/
+
+extern const char * g_side;
+extern int g_failures;
+extern struct loop_rx_s g_rx[LOOP_PIPES];
+extern const char * g_names[LOOP_PIPES];
+extern pid_t g_pid; /* of the parent, names the files of a run */
+
+/****************************************************************************
+ * Public Functions
+ ****************************************************************************/
+
+uint64_t loop_now_ms(void);
+
+/* both sides are here, false if the peer is gone */
+bool loop_barrier(void);
+
+bool loop_wait(volatile int * value, int target, int timeout_ms);
+
+/* payload of LOOP_MSG_LEN bytes carrying seq */
+void loop_fill(uint8_t * buf, uint32_t seq);
+
+/* check a message of loop_fill() against the ones before it */
+void loop_rx_cb(qrc_pipe_s * pipe, void * data, size_t len, bool response);
+
+/* sender: create the pipe and wait until the receiver has set it up */
+qrc_pipe_s * loop_connect(const char * name);
+
+/* receiver: find the pipe of loop_connect(), set it up, then call
+ * loop_barrier() to let the sender go */
+qrc_pipe_s * loop_accept(const char * name, int idx);
+
+/* writes with ack of seq first ~ first + n - 1 */
+void loop_send(const qrc_pipe_s * p, uint32_t first, int n);
+
+void loop_expect_in_order(const struct loop_rx_s * rx, int n);
+
+/****************************************************************************
+ * Cases
+ ****************************************************************************/
+
+/* qrc_loop_reliable.c */
+int reliable_receiver(void);
+int reliable_sender(void);
+int sack_receiver(void);
+int sack_sender(void);
+int forward_receiver(void);
+int forward_sender(void);
+int loss_receiver(void);
+int loss_sender(void);
+int rate_receiver(void);
+int rate_sender(void);
+int restart_receiver(void);
+int restart_sender(void);
+
+/* qrc_loop_async.c */
+int async_receiver(void);
+int async_sender(void);
+
+/* qrc_loop_rpc.c */
+int rpc_receiver(void);
+int rpc_sender(void);
+
+/* qrc_loop_timer.c */
+int timer_run(void);
+
+/* qrc_loop_lease.c */
+int lease_receiver(void);
+int lease_sender(void);
+
+/* qrc_loop_pipemap.c */
+int pipemap_receiver(void);
+int pipemap_sender(void);
+bool pipemap_setup(void);
+
+/* qrc_loop_credit.c */
+int credit_receiver(void);
+int credit_sender(void);
+
+/* qrc_loop_strand.c */
+int strand_receiver(void);
+int strand_sender(void);
+
+#endif
@@ -0,0 +1,90 @@
+/****************************************************************************
+ *
+ * Copyright (c) 2024 Qualcomm Innovation Center, Inc. All rights reserved.
+ * SPDX-License-Identifier: BSD-3-Clause-Clear
+ *
+ ****************************************************************************/
+
+/* cases of the timer wheel, they need no link, see qrc_timer.c */
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <unistd.h>
+
+#include "qrc.h"
+#include "qrc_loop_test.h"
+
+/****************************************************************************
+ * timer: the wheel fires every armed timer once, never early, and never a
+ * cancelled one
+ ****************************************************************************/
+
+#define TIMER_N (2000)
+
+static struct qrc_timer_s g_timers[TIMER_N];
+static uint64_t g_timer_due[TIMER_N];
+static uint64_t g_timer_fired_at[TIMER_N];
+static volatile int g_timer_fired[TIMER_N];
+
+static void timer_cb(void * arg)
+{
+  int i = (int)(uintptr_t)arg;
+
+  g_timer_fired_at[i] = qrc_timer_now_us();
+  __atomic_add_fetch(&g_timer_fired[i], 1, __ATOMIC_RELEASE);
+}
+
+int timer_run(void)
+{
+  unsigned seed = 1;
+  int early = 0;
+  int missed = 0;
+  int twice = 0;
+  uint64_t start;
+
+  LOOP_EXPECT(qrc_timer_init());
+  for (int i = 0; i < TIMER_N; i++) {
+    /* most timers within the first wheel, some on the outer ones */
+    uint64_t delay = (0 == i % 10) ? rand_r(&seed) % 1500000 : rand_r(&seed) % 50000;
+
+    qrc_timer_setup(&g_timers[i], timer_cb, (void *)(uintptr_t)i);
+    g_timer_due[i] = qrc_timer_now_us() + delay;
+    qrc_timer_arm(&g_timers[i], delay);
+  }
+  for (int i = 1; i < TIMER_N; i += 7) {
+    if (!qrc_timer_cancel(&g_timers[i])) {
+      g_timer_fired[i] = -TIMER_N; /* fired before it could be cancelled */
+    }
+  }
+  usleep(2000000);
+
+  for (int i = 0; i < TIMER_N; i++) {
+    if (1 == i % 7) {
+      LOOP_EXPECT(g_timer_fired[i] <= 0);
+      continue;
+    }
+    if (0 == g_timer_fired[i]) {
+      missed++;
+    } else if (g_timer_fired[i] > 1) {
+      twice++;
+    } else if (g_timer_fired_at[i] < g_timer_due[i]) {
+      early++;
+    }
+  }
+  LOOP_EXPECT(0 == missed);
+  LOOP_EXPECT(0 == twice);
+  LOOP_EXPECT(0 == early);
+
+  /* arming an armed timer moves it */
+  g_timer_fired[0] = 0;
+  qrc_timer_arm(&g_timers[0], 1000000);
+  start = qrc_timer_now_us();
+  qrc_timer_arm(&g_timers[0], 1000);
+  LOOP_EXPECT(loop_wait(&g_timer_fired[0], 1, 500));
+  LOOP_EXPECT(g_timer_fired_at[0] - start < 500000);
+  usleep(100000);
+  LOOP_EXPECT(1 == g_timer_fired[0]);
+
+  qrc_timer_destroy();
+  return 0;
+}
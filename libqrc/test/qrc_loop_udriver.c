@@ -0,0 +1,196 @@
+/****************************************************************************
+ *
+ * Copyright (c) 2024 Qualcomm Innovation Center, Inc. All rights reserved.
+ * SPDX-License-Identifier: BSD-3-Clause-Clear
+ *
+ ****************************************************************************/
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/ioctl.h>
+#include <sys/uio.h>
+#include <unistd.h>
+
+#include "qrc_loop_udriver.h"
+#include "qti_qrc_udriver.h"
+
+/****************************************************************************
+ * Pre-processor Definitions
+ ****************************************************************************/
+
+#define LOOP_SYNC_WRITES (2) /* boot byte and sync message of qrc_hardware_sync() */
+
+/****************************************************************************
+ * Private Types
+ ****************************************************************************/
+
+struct loop_udriver_s
+{
+  pthread_mutex_t mutex; /* writes of the hardware sync and the write thread */
+  int fd;
+  bool synced;     /* "OK!" of the MCB was read */
+  int sync_writes; /* writes of the sync still swallowed */
+  int loss;
+  unsigned seed;
+  unsigned frames;
+  unsigned dropped;
+};
+
+/****************************************************************************
+ * Private Data
+ ****************************************************************************/
+
+static struct loop_udriver_s g_loop = {
+  .mutex = PTHREAD_MUTEX_INITIALIZER,
+  .fd = -1,
+  .seed = 1,
+};
+
+/****************************************************************************
+ * Private Functions
+ ****************************************************************************/
+
+static int loop_write_all(const void * data, size_t len)
+{
+  const uint8_t * p = (const uint8_t *)data;
+
+  while (len > 0) {
+    ssize_t n = write(g_loop.fd, p, len);
+    if (n < 0) {
+      if (EAGAIN == errno || EINTR == errno) {
+        usleep(50);
+        continue;
+      }
+      return -1;
+    }
+    p += n;
+    len -= (size_t)n;
+  }
+
+  return 0;
+}
+
+/* one frame of the write thread, on its way it may get lost */
+static int loop_write_frame(const void * data, size_t len)
+{
+  g_loop.frames++;
+  if (g_loop.loss > 0 && (int)(rand_r(&g_loop.seed) % 100) < g_loop.loss) {
+    g_loop.dropped++;
+    return 0;
+  }
+
+  return loop_write_all(data, len);
+}
+
+/****************************************************************************
+ * Public Functions
+ ****************************************************************************/
+
+void qrc_loop_udriver_set_fd(int fd)
+{
+  g_loop.fd = fd;
+}
+
+void qrc_loop_udriver_set_loss(int percent)
+{
+  pthread_mutex_lock(&g_loop.mutex);
+  g_loop.loss = percent;
+  pthread_mutex_unlock(&g_loop.mutex);
+}
+
+void qrc_loop_udriver_get_counts(unsigned * frames, unsigned * dropped)
+{
+  pthread_mutex_lock(&g_loop.mutex);
+  *frames = g_loop.frames;
+  *dropped = g_loop.dropped;
+  pthread_mutex_unlock(&g_loop.mutex);
+}
+
+/* qrc_destroy() closes what it opened, a copy keeps the link for the next
+ * init of a restart */
+int qrc_udriver_open(void)
+{
+  if (g_loop.fd < 0) {
+    return -1;
+  }
+  fcntl(g_loop.fd, F_SETFL, fcntl(g_loop.fd, F_GETFL) | O_NONBLOCK);
+  g_loop.synced = false;
+  g_loop.sync_writes = LOOP_SYNC_WRITES;
+
+  return dup(g_loop.fd);
+}
+
+void qrc_udriver_close(int fd)
+{
+  (void)fd;
+}
+
+ssize_t qrc_udriver_read(int fd, char * buffer, size_t size)
+{
+  ssize_t n;
+
+  if (!g_loop.synced) {
+    g_loop.synced = true;
+    memcpy(buffer, "OK!", 3);
+    return 3;
+  }
+  n = read(fd, buffer, size);
+
+  return (n < 0) ? 0 : n;
+}
+
+ssize_t qrc_udriver_write(int fd, const char * data, size_t length)
+{
+  int res;
+
+  (void)fd;
+  pthread_mutex_lock(&g_loop.mutex);
+  if (g_loop.sync_writes > 0) {
+    g_loop.sync_writes--;
+    pthread_mutex_unlock(&g_loop.mutex);
+    return (ssize_t)length;
+  }
+  res = loop_write_frame(data, length);
+  pthread_mutex_unlock(&g_loop.mutex);
+
+  return (res < 0) ? -1 : (ssize_t)length;
+}
+
+/* every segment is a whole frame of the tx ring */
+ssize_t qrc_udriver_writev(int fd, const struct iovec * iov, int iovcnt)
+{
+  ssize_t total = 0;
+
+  (void)fd;
+  pthread_mutex_lock(&g_loop.mutex);
+  for (int i = 0; i < iovcnt; i++) {
+    if (loop_write_frame(iov[i].iov_base, iov[i].iov_len) < 0) {
+      pthread_mutex_unlock(&g_loop.mutex);
+      return -1;
+    }
+    total += (ssize_t)iov[i].iov_len;
+  }
+  pthread_mutex_unlock(&g_loop.mutex);
+
+  return total;
+}
+
+int qrc_udriver_fionread(int fd, int * arg)
+{
+  return ioctl(fd, FIONREAD, arg);
+}
+
+int qrc_udriver_tcflsh(int fd)
+{
+  (void)fd;
+  return 0;
+}
+
+int qrc_mcb_reset(void)
+{
+  return 0;
+}
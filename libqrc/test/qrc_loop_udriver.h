@@ -0,0 +1,23 @@
+/****************************************************************************
+ *
+ * Copyright (c) 2024 Qualcomm Innovation Center, Inc. All rights reserved.
+ * SPDX-License-Identifier: BSD-3-Clause-Clear
+ *
+ ****************************************************************************/
+#ifndef __QRC_LOOP_UDRIVER_H
+#define __QRC_LOOP_UDRIVER_H
+
+/* udriver of the loopback tests: the link is one end of a socketpair, the
+ * other end belongs to the peer process. Like the uart it keeps the frames
+ * in order, it may only lose some. The bus sync of the MCB is faked */
+
+/* end of the socketpair qrc_udriver_open() returns, set before init */
+void qrc_loop_udriver_set_fd(int fd);
+
+/* drop the frames written from now on with a chance of percent / 100 */
+void qrc_loop_udriver_set_loss(int percent);
+
+/* frames written to the link and frames dropped on the way */
+void qrc_loop_udriver_get_counts(unsigned * frames, unsigned * dropped);
+
+#endif
@@ -0,0 +1,334 @@
+/****************************************************************************
+ *
+ * Copyright (c) 2024 Qualcomm Innovation Center, Inc. All rights reserved.
+ * SPDX-License-Identifier: BSD-3-Clause-Clear
+ *
+ ****************************************************************************/
+
+/* TinyFrame receive parser benchmark, bulk TF_Accept() vs per byte TF_AcceptChar(),
+ * and checksum engine benchmark, TF_Checksum() vs a byte-wise table CRC */
+
+#include <getopt.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "TinyFrame.h"
+#include "imu_msg.h"
+#include "motion_msg.h"
+
+#define DEFAULT_FRAMES (20000)
+#define DEFAULT_TIMES (20)
+#define DEFAULT_CHUNK (64)
+#define BENCH_TF_MSG_TYPE 0x22
+#define CKSUM_BENCH_BYTES (64 * 1024 * 1024)
+
+/* byte-wise reference of the configured CRC, as TinyFrame computed it before */
+#if TF_CKSUM_TYPE == TF_CKSUM_CRC16
+#define REF_POLY 0xA001
+#define REF_INIT 0
+#elif TF_CKSUM_TYPE == TF_CKSUM_CRC32
+#define REF_POLY 0xEDB88320
+#define REF_INIT 0xFFFFFFFF
+#elif TF_CKSUM_TYPE == TF_CKSUM_CRC32C
+#define REF_POLY 0x82F63B78
+#define REF_INIT 0xFFFFFFFF
+#endif
+
+struct bench_result_s
+{
+  uint64_t frames;
+  uint64_t payload_bytes;
+  double seconds;
+};
+
+static struct option long_options[] = { { "file", required_argument, 0, 'f' },
+  { "chunk", required_argument, 0, 'c' }, { "times", required_argument, 0, 't' },
+  { "frames", required_argument, 0, 'n' }, { "help", no_argument, 0, 'h' }, { 0, 0, 0, 0 } };
+
+static uint8_t * g_traffic;
+static size_t g_traffic_len;
+static size_t g_traffic_cap;
+static struct bench_result_s * g_result;
+
+void usage()
+{
+  printf("Usage: ./qrc_tf_bench [options]\n");
+  printf("Options:\n");
+  printf("  -f, --file=FILE           Raw link capture to parse, synthetic traffic if not set\n");
+  printf("  -c, --chunk=SIZE          Bytes handed to the parser per read (default %d)\n",
+      DEFAULT_CHUNK);
+  printf("  -t, --times=NUMBER        Passes over the traffic (default %d)\n", DEFAULT_TIMES);
+  printf("  -n, --frames=NUMBER       Synthetic frames to generate (default %d)\n",
+      DEFAULT_FRAMES);
+}
+
+/* collects the synthetic traffic composed by TF_Send() */
+void TF_WriteImpl(TinyFrame * tf, const uint8_t * buff, uint32_t len)
+{
+  (void)tf;
+  if (g_traffic_len + len > g_traffic_cap) {
+    g_traffic_cap = (g_traffic_cap + len) * 2;
+    g_traffic = (uint8_t *)realloc(g_traffic, g_traffic_cap);
+    if (g_traffic == NULL) {
+      fprintf(stderr, "Failed to allocate traffic buffer\n");
+      exit(EXIT_FAILURE);
+    }
+  }
+  memcpy(g_traffic + g_traffic_len, buff, len);
+  g_traffic_len += len;
+}
+
+void TF_WriteVImpl(TinyFrame * tf, const struct iovec * iov, int iovcnt)
+{
+  for (int i = 0; i < iovcnt; i++) {
+    TF_WriteImpl(tf, (const uint8_t *)iov[i].iov_base, (uint32_t)iov[i].iov_len);
+  }
+}
+
+static TF_Result count_listener(TinyFrame * tf, TF_Msg * msg)
+{
+  (void)tf;
+  g_result->frames++;
+  g_result->payload_bytes += msg->len;
+  return TF_STAY;
+}
+
+/* mix of imu, odometry and control sized messages, each behind a qrc_frame byte,
+ * every other frame is gathered from the qrc_frame byte and the message */
+static void generate_traffic(int frames)
+{
+  static TinyFrame tf;
+  uint8_t payload[1 + sizeof(struct imu_msg_s)];
+  size_t sizes[] = { sizeof(struct imu_msg_s), sizeof(struct imu_msg_s),
+    sizeof(struct motion_odom_s), sizeof(struct motion_odom_s),
+    sizeof(struct motion_control_msg_s) };
+
+  TF_InitStatic(&tf, TF_SLAVE);
+  srand(1);
+  for (int i = 0; i < frames; i++) {
+    size_t len = 1 + sizes[rand() % (sizeof(sizes) / sizeof(sizes[0]))];
+    for (size_t j = 0; j < len; j++) {
+      payload[j] = (uint8_t)rand();
+    }
+#if TF_USE_WRITEV
+    if (i & 1) {
+      struct iovec iov[2] = { { payload, 1 }, { payload + 1, len - 1 } };
+      TF_Msg msg;
+      TF_ClearMsg(&msg);
+      msg.type = BENCH_TF_MSG_TYPE;
+      TF_SendVector(&tf, &msg, iov, 2);
+      continue;
+    }
+#endif
+    TF_SendSimple(&tf, BENCH_TF_MSG_TYPE, payload, (TF_LEN)len);
+  }
+}
+
+static bool load_traffic(const char * path)
+{
+  FILE * file = fopen(path, "rb");
+  if (file == NULL) {
+    fprintf(stderr, "Failed to open %s\n", path);
+    return false;
+  }
+  uint8_t buf[4096];
+  size_t num;
+  while ((num = fread(buf, 1, sizeof(buf), file)) > 0) {
+    TF_WriteImpl(NULL, buf, (uint32_t)num);
+  }
+  fclose(file);
+  return true;
+}
+
+#ifdef REF_POLY
+static TF_CKSUM g_ref_table[256];
+
+static void ref_init(void)
+{
+  for (uint32_t n = 0; n < 256; n++) {
+    uint32_t crc = n;
+    for (int k = 0; k < 8; k++) {
+      crc = (crc & 1) ? (crc >> 1) ^ REF_POLY : crc >> 1;
+    }
+    g_ref_table[n] = (TF_CKSUM)crc;
+  }
+}
+
+static TF_CKSUM ref_checksum(const uint8_t * buf, size_t len)
+{
+  TF_CKSUM crc = (TF_CKSUM)REF_INIT;
+  for (size_t i = 0; i < len; i++) {
+    crc = (TF_CKSUM)((crc >> 8) ^ g_ref_table[(crc ^ buf[i]) & 0xff]);
+  }
+  return (TF_CKSUM)(crc ^ (TF_CKSUM)REF_INIT);
+}
+#endif
+
+static double now_seconds(void)
+{
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static void run(struct bench_result_s * result, bool bulk, size_t chunk, int times)
+{
+  static TinyFrame tf;
+
+  memset(result, 0, sizeof(*result));
+  g_result = result;
+  TF_InitStatic(&tf, TF_MASTER);
+  TF_AddGenericListener(&tf, count_listener);
+
+  double start = now_seconds();
+  for (int t = 0; t < times; t++) {
+    for (size_t pos = 0; pos < g_traffic_len; pos += chunk) {
+      size_t len = g_traffic_len - pos < chunk ? g_traffic_len - pos : chunk;
+      if (bulk) {
+        TF_Accept(&tf, g_traffic + pos, (uint32_t)len);
+      } else {
+        for (size_t i = 0; i < len; i++) {
+          TF_AcceptChar(&tf, g_traffic[pos + i]);
+        }
+      }
+    }
+  }
+  result->seconds = now_seconds() - start;
+}
+
+#ifdef REF_POLY
+/* checksum spans of frame sizes, byte-wise reference vs TF_Checksum() */
+static bool run_cksum(void)
+{
+  size_t spans[] = { 16, 64, 256, 1024 };
+  uint8_t buf[1024];
+  volatile TF_CKSUM sink = 0;
+
+  ref_init();
+  for (size_t i = 0; i < sizeof(buf); i++) {
+    buf[i] = (uint8_t)rand();
+  }
+  if (ref_checksum((const uint8_t *)"123456789", 9) != TF_Checksum((const uint8_t *)"123456789", 9)) {
+    fprintf(stderr, "Failed! Checksum engine mismatch on the check string\n");
+    return false;
+  }
+
+  printf("\nchecksum engine: %s\n", TF_ChecksumEngine());
+  for (size_t s = 0; s < sizeof(spans) / sizeof(spans[0]); s++) {
+    size_t rounds = CKSUM_BENCH_BYTES / spans[s];
+
+    for (size_t off = 0; off + spans[s] <= sizeof(buf); off += 7) {
+      if (ref_checksum(buf + off, spans[s]) != TF_Checksum(buf + off, (uint32_t)spans[s])) {
+        fprintf(stderr, "Failed! Checksum engine mismatch, span %zu offset %zu\n", spans[s], off);
+        return false;
+      }
+    }
+
+    double start = now_seconds();
+    for (size_t r = 0; r < rounds; r++) {
+      sink ^= ref_checksum(buf, spans[s]);
+    }
+    double ref_seconds = now_seconds() - start;
+
+    start = now_seconds();
+    for (size_t r = 0; r < rounds; r++) {
+      sink ^= TF_Checksum(buf, (uint32_t)spans[s]);
+    }
+    double engine_seconds = now_seconds() - start;
+
+    printf("span %4zu  byte-wise %8.1f MB/s  engine %8.1f MB/s  speedup %5.2fx\n", spans[s],
+        CKSUM_BENCH_BYTES / ref_seconds / 1e6, CKSUM_BENCH_BYTES / engine_seconds / 1e6,
+        ref_seconds / engine_seconds);
+  }
+  (void)sink;
+  return true;
+}
+#endif
+
+static void report(const char * name, const struct bench_result_s * result, int times)
+{
+  double mbytes = (double)g_traffic_len * times / 1e6;
+  printf("%-10s %10.1f MB/s %12.0f frames/s %10llu frames\n", name, mbytes / result->seconds,
+      result->frames / result->seconds, (unsigned long long)result->frames);
+}
+
+int main(int argc, char ** argv)
+{
+  const char * file = NULL;
+  int chunk = DEFAULT_CHUNK;
+  int times = DEFAULT_TIMES;
+  int frames = DEFAULT_FRAMES;
+  int ret;
+  int option_index = 0;
+
+  while ((ret = getopt_long(argc, argv, "f:c:t:n:h", long_options, &option_index)) != -1) {
+    switch (ret) {
+      case 'f':
+        file = optarg;
+        break;
+      case 'c':
+        chunk = atoi(optarg);
+        break;
+      case 't':
+        times = atoi(optarg);
+        break;
+      case 'n':
+        frames = atoi(optarg);
+        break;
+      default:
+        usage();
+        exit(EXIT_FAILURE);
+    }
+  }
+
+  if ((chunk <= 0) || (times <= 0) || (frames <= 0)) {
+    fprintf(stderr, "Error: Invalid options.\n");
+    usage();
+    exit(EXIT_FAILURE);
+  }
+
+  if (file != NULL) {
+    if (!load_traffic(file)) {
+      exit(EXIT_FAILURE);
+    }
+  } else {
+    generate_traffic(frames);
+  }
+  if (g_traffic_len == 0) {
+    fprintf(stderr, "Error: No traffic to parse.\n");
+    exit(EXIT_FAILURE);
+  }
+
+  printf("%zu bytes of %s traffic, %d byte reads, %d passes\n", g_traffic_len,
+      file ? "recorded" : "synthetic", chunk, times);
+
+  struct bench_result_s bytewise;
+  struct bench_result_s bulk;
+  run(&bytewise, false, (size_t)chunk, times);
+  run(&bulk, true, (size_t)chunk, times);
+  report("per-byte", &bytewise, times);
+  report("bulk", &bulk, times);
+  printf("speedup    %10.2fx\n", bytewise.seconds / bulk.seconds);
+
+  free(g_traffic);
+  if (bytewise.frames != bulk.frames || bytewise.payload_bytes != bulk.payload_bytes) {
+    fprintf(stderr, "Failed! The parsers disagree on the traffic\n");
+    return EXIT_FAILURE;
+  }
+  if (file == NULL && bulk.frames != (uint64_t)frames * times) {
+    fprintf(stderr, "Failed! %llu of %llu generated frames parsed\n",
+        (unsigned long long)bulk.frames, (unsigned long long)frames * times);
+    return EXIT_FAILURE;
+  }
+
+#ifdef REF_POLY
+  if (!run_cksum()) {
+    return EXIT_FAILURE;
+  }
+#endif
+  return EXIT_SUCCESS;
+}
@@ -0,0 +1,320 @@
+/****************************************************************************
+ *
+ * Copyright (c) 2024 Qualcomm Innovation Center, Inc. All rights reserved.
+ * SPDX-License-Identifier: BSD-3-Clause-Clear
+ *
+ ****************************************************************************/
+
+/* thread pool work queue contention benchmark, the mutex protected list of
+ * malloc'd works the pool used before vs the preallocated MPMC work ring */
+
+#include <getopt.h>
+#include <pthread.h>
+#include <sched.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "qrc.h"
+
+#define DEFAULT_PRODUCERS (1)
+#define DEFAULT_CONSUMERS (2)
+#define DEFAULT_WORKS (1000000)
+#define DEFAULT_SLOTS (1024)
+#define MAX_THREADS (64)
+#define LIST_CACHE_MAX (64) /* finished works the list kept for reuse */
+
+/* the list queue as the thread pool had it */
+struct list_work_s
+{
+  struct list_work_s * previous;
+  qrc_work work_fun;
+  struct qrc_msg_cb_args_s args;
+};
+
+struct list_queue_s
+{
+  pthread_mutex_t mutex;
+  struct list_work_s * front;
+  struct list_work_s * rear;
+  struct list_work_s * cache;
+  int len;
+  int cache_len;
+};
+
+struct bench_s
+{
+  bool ring; /* work ring, list queue otherwise */
+  struct qrc_workring_s * workring;
+  struct list_queue_s list;
+  uint64_t works;    /* per producer */
+  uint64_t expected; /* of all producers */
+  uint64_t done;     /* works run by the consumers */
+  uint64_t sum;      /* of the handles run, to catch lost or doubled works */
+  uint32_t full;     /* pushes retried because the ring was full */
+};
+
+static struct option long_options[] = { { "producers", required_argument, 0, 'p' },
+  { "consumers", required_argument, 0, 'c' }, { "works", required_argument, 0, 'n' },
+  { "slots", required_argument, 0, 's' }, { "help", no_argument, 0, 'h' }, { 0, 0, 0, 0 } };
+
+static __thread uint64_t t_sum;
+
+void usage()
+{
+  printf("Usage: ./qrc_workqueue_bench [options]\n");
+  printf("Options:\n");
+  printf("  -p, --producers=NUMBER    Threads queueing works (default %d)\n", DEFAULT_PRODUCERS);
+  printf("  -c, --consumers=NUMBER    Threads running works (default %d)\n", DEFAULT_CONSUMERS);
+  printf("  -n, --works=NUMBER        Works queued per producer (default %d)\n", DEFAULT_WORKS);
+  printf("  -s, --slots=NUMBER        Slots of the work ring (default %d)\n", DEFAULT_SLOTS);
+}
+
+static void bench_work(const struct qrc_msg_cb_args_s * args)
+{
+  t_sum += args->handle;
+}
+
+static void list_push(struct list_queue_s * q, qrc_work work_fun, struct qrc_msg_cb_args_s args)
+{
+  struct list_work_s * work;
+
+  pthread_mutex_lock(&q->mutex);
+  work = q->cache;
+  if (NULL != work) {
+    q->cache = work->previous;
+    q->cache_len--;
+  }
+  pthread_mutex_unlock(&q->mutex);
+  if (NULL == work) {
+    work = (struct list_work_s *)malloc(sizeof(struct list_work_s));
+    if (NULL == work) {
+      fprintf(stderr, "Failed to allocate a work\n");
+      exit(EXIT_FAILURE);
+    }
+  }
+  work->work_fun = work_fun;
+  memcpy(&work->args, &args, sizeof(args));
+
+  pthread_mutex_lock(&q->mutex);
+  work->previous = NULL;
+  if (0 == q->len) {
+    q->front = work;
+  } else {
+    q->rear->previous = work;
+  }
+  q->rear = work;
+  q->len++;
+  pthread_mutex_unlock(&q->mutex);
+}
+
+static bool list_pull_run(struct list_queue_s * q)
+{
+  struct list_work_s * work;
+
+  pthread_mutex_lock(&q->mutex);
+  work = q->front;
+  if (NULL != work) {
+    q->front = work->previous;
+    q->len--;
+  }
+  pthread_mutex_unlock(&q->mutex);
+  if (NULL == work) {
+    return false;
+  }
+
+  work->work_fun(&work->args);
+
+  pthread_mutex_lock(&q->mutex);
+  if (q->cache_len < LIST_CACHE_MAX) {
+    work->previous = q->cache;
+    q->cache = work;
+    q->cache_len++;
+    work = NULL;
+  }
+  pthread_mutex_unlock(&q->mutex);
+  free(work);
+  return true;
+}
+
+static bool ring_pull_run(struct qrc_workring_s * ring)
+{
+  qrc_work work_fun;
+  struct qrc_msg_cb_args_s args;
+
+  if (!qrc_workring_pop(ring, &work_fun, &args)) {
+    return false;
+  }
+  work_fun(&args);
+  return true;
+}
+
+static void * producer_run(void * arg)
+{
+  struct bench_s * b = (struct bench_s *)arg;
+  struct qrc_msg_cb_args_s args;
+
+  memset(&args, 0, sizeof(args));
+  for (uint64_t i = 0; i < b->works; i++) {
+    args.handle = (uint32_t)i;
+    if (b->ring) {
+      while (!qrc_workring_push(b->workring, bench_work, &args)) {
+        __atomic_add_fetch(&b->full, 1, __ATOMIC_RELAXED);
+        sched_yield();
+      }
+    } else {
+      list_push(&b->list, bench_work, args);
+    }
+  }
+  return NULL;
+}
+
+/* runs works until all of them are done */
+static void * consumer_run(void * arg)
+{
+  struct bench_s * b = (struct bench_s *)arg;
+  uint64_t mine = 0;
+  bool ran;
+
+  t_sum = 0;
+  for (;;) {
+    ran = b->ring ? ring_pull_run(b->workring) : list_pull_run(&b->list);
+    if (ran) {
+      mine++;
+      continue;
+    }
+    /* empty: publish what this thread ran and see whether all are done */
+    __atomic_add_fetch(&b->sum, t_sum, __ATOMIC_RELAXED);
+    t_sum = 0;
+    if (__atomic_add_fetch(&b->done, mine, __ATOMIC_ACQ_REL) >= b->expected) {
+      break;
+    }
+    mine = 0;
+    sched_yield();
+  }
+  return NULL;
+}
+
+static double now_seconds(void)
+{
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+/* queue works from the producers to the consumers, false if one got lost */
+static bool run(struct bench_s * b, int producers, int consumers, double * seconds)
+{
+  pthread_t threads[MAX_THREADS * 2];
+  uint64_t sum = (b->works * (b->works - 1) / 2) * (uint64_t)producers;
+  int n = 0;
+
+  b->expected = b->works * (uint64_t)producers;
+  b->done = 0;
+  b->sum = 0;
+  b->full = 0;
+
+  double start = now_seconds();
+  for (int i = 0; i < consumers; i++) {
+    pthread_create(&threads[n++], NULL, consumer_run, b);
+  }
+  for (int i = 0; i < producers; i++) {
+    pthread_create(&threads[n++], NULL, producer_run, b);
+  }
+  for (int i = 0; i < n; i++) {
+    pthread_join(threads[i], NULL);
+  }
+  *seconds = now_seconds() - start;
+
+  if (b->done != b->expected || b->sum != sum) {
+    fprintf(stderr, "Failed! %s ran %llu of %llu works\n", b->ring ? "ring" : "list",
+        (unsigned long long)b->done, (unsigned long long)b->expected);
+    return false;
+  }
+  return true;
+}
+
+static void report(const char * name, const struct bench_s * b, double seconds)
+{
+  printf("%-6s %12.0f works/s %8.1f ns/work", name, b->expected / seconds,
+      seconds * 1e9 / b->expected);
+  if (b->ring) {
+    printf("  high %u  full %u", qrc_workring_high(b->workring), b->full);
+  }
+  printf("\n");
+}
+
+int main(int argc, char ** argv)
+{
+  struct bench_s b;
+  int producers = DEFAULT_PRODUCERS;
+  int consumers = DEFAULT_CONSUMERS;
+  int works = DEFAULT_WORKS;
+  int slots = DEFAULT_SLOTS;
+  double list_seconds;
+  double ring_seconds;
+  int ret;
+  int option_index = 0;
+
+  while ((ret = getopt_long(argc, argv, "p:c:n:s:h", long_options, &option_index)) != -1) {
+    switch (ret) {
+      case 'p':
+        producers = atoi(optarg);
+        break;
+      case 'c':
+        consumers = atoi(optarg);
+        break;
+      case 'n':
+        works = atoi(optarg);
+        break;
+      case 's':
+        slots = atoi(optarg);
+        break;
+      default:
+        usage();
+        exit(EXIT_FAILURE);
+    }
+  }
+
+  if ((producers <= 0) || (producers > MAX_THREADS) || (consumers <= 0) ||
+      (consumers > MAX_THREADS) || (works <= 0) || (slots <= 0)) {
+    fprintf(stderr, "Error: Invalid options.\n");
+    usage();
+    exit(EXIT_FAILURE);
+  }
+
+  printf("%d producers, %d consumers, %d works each, %d ring slots\n", producers, consumers,
+      works, slots);
+
+  memset(&b, 0, sizeof(b));
+  pthread_mutex_init(&b.list.mutex, NULL);
+  b.works = (uint64_t)works;
+  b.workring = qrc_workring_create((uint32_t)slots);
+  if (NULL == b.workring) {
+    exit(EXIT_FAILURE);
+  }
+
+  b.ring = false;
+  if (!run(&b, producers, consumers, &list_seconds)) {
+    return EXIT_FAILURE;
+  }
+  report("list", &b, list_seconds);
+
+  b.ring = true;
+  if (!run(&b, producers, consumers, &ring_seconds)) {
+    return EXIT_FAILURE;
+  }
+  report("ring", &b, ring_seconds);
+  printf("speedup %5.2fx\n", list_seconds / ring_seconds);
+
+  while (NULL != b.list.cache) {
+    struct list_work_s * work = b.list.cache;
+    b.list.cache = work->previous;
+    free(work);
+  }
+  qrc_workring_destroy(b.workring);
+  return EXIT_SUCCESS;
+}
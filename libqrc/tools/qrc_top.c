@@ -0,0 +1,292 @@
+/****************************************************************************
+ *
+ * Copyright (c) 2024 Qualcomm Innovation Center, Inc. All rights reserved.
+ * SPDX-License-Identifier: BSD-3-Clause-Clear
+ *
+ ****************************************************************************/
+
+/* live rates of a qrc link and its pipes, read from the shared memory segment
+ * of qrc_set_stats_shm() */
+
+#include <errno.h>
+#include <fcntl.h>
+#include <getopt.h>
+#include <signal.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "qrc_msg_management.h"
+
+#define DEFAULT_INTERVAL_MS (1000)
+
+struct top_snapshot_s
+{
+  struct qrc_stats_shm_s head;
+  struct qrc_stats_entry_s * pipes;
+  uint64_t time_us;
+};
+
+static struct option long_options[] = { { "name", required_argument, 0, 'n' },
+  { "interval", required_argument, 0, 'i' }, { "count", required_argument, 0, 'c' },
+  { "all", no_argument, 0, 'a' }, { "batch", no_argument, 0, 'b' },
+  { "help", no_argument, 0, 'h' }, { 0, 0, 0, 0 } };
+
+static volatile sig_atomic_t g_stop;
+
+void usage()
+{
+  printf("Usage: ./qrc-top [options]\n");
+  printf("Options:\n");
+  printf("  -n, --name <shm>       Stats segment of qrc_set_stats_shm() (default: %s)\n",
+      QRC_STATS_SHM_DEFAULT);
+  printf("  -i, --interval <ms>    Time between updates (default: %d)\n", DEFAULT_INTERVAL_MS);
+  printf("  -c, --count <n>        Number of updates, 0 runs until interrupted (default: 0)\n");
+  printf("  -a, --all              Show idle pipes too\n");
+  printf("  -b, --batch            Append updates instead of redrawing the screen\n");
+  printf("  -h, --help             Show this help message\n");
+}
+
+static void on_signal(int sig)
+{
+  (void)sig;
+  g_stop = 1;
+}
+
+static uint64_t now_us(void)
+{
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (uint64_t)ts.tv_sec * 1000000ULL + (uint64_t)ts.tv_nsec / 1000ULL;
+}
+
+static const struct qrc_stats_shm_s * map_segment(const char * name, size_t * size)
+{
+  const struct qrc_stats_shm_s * shm;
+  struct stat st;
+  void * addr;
+  int fd;
+
+  fd = shm_open(name, O_RDONLY, 0);
+  if (fd < 0) {
+    fprintf(stderr, "Error: open %s failed: %s, is qrc_set_stats_shm() called?\n", name,
+        strerror(errno));
+    return NULL;
+  }
+  if (0 != fstat(fd, &st) || (size_t)st.st_size < sizeof(struct qrc_stats_shm_s)) {
+    fprintf(stderr, "Error: %s is not a qrc stats segment\n", name);
+    close(fd);
+    return NULL;
+  }
+  addr = mmap(NULL, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+  close(fd);
+  if (MAP_FAILED == addr) {
+    fprintf(stderr, "Error: map %s failed: %s\n", name, strerror(errno));
+    return NULL;
+  }
+
+  shm = (const struct qrc_stats_shm_s *)addr;
+  if (QRC_STATS_SHM_MAGIC != shm->magic || QRC_STATS_SHM_VERSION != shm->version ||
+      sizeof(*shm) + shm->pipe_max * sizeof(struct qrc_stats_entry_s) > (size_t)st.st_size) {
+    fprintf(stderr, "Error: %s is not a qrc stats segment of this version\n", name);
+    munmap(addr, st.st_size);
+    return NULL;
+  }
+  *size = st.st_size;
+  return shm;
+}
+
+static void take_snapshot(const struct qrc_stats_shm_s * shm, struct top_snapshot_s * snap)
+{
+  const struct qrc_stats_entry_s * pipes = (const struct qrc_stats_entry_s *)(shm + 1);
+  uint32_t count;
+
+  memcpy(&snap->head, shm, sizeof(snap->head));
+  count = snap->head.pipe_count;
+  if (count > shm->pipe_max) {
+    count = shm->pipe_max;
+  }
+  snap->head.pipe_count = count;
+  memcpy(snap->pipes, pipes, count * sizeof(struct qrc_stats_entry_s));
+  snap->time_us = now_us();
+}
+
+/* per second rate of a counter between two snapshots */
+static double rate(uint64_t now, uint64_t last, double seconds)
+{
+  return (now >= last) ? (double)(now - last) / seconds : 0.0;
+}
+
+static void print_link(const struct top_snapshot_s * cur,
+    const struct top_snapshot_s * last,
+    double s)
+{
+  const struct qrc_link_stats_s * n = &cur->head.link;
+  const struct qrc_link_stats_s * l = &last->head.link;
+
+  printf("qrc-top  pid %u  pipes %u  interval %.2f s\n\n", cur->head.pid, cur->head.pipe_count,
+      s);
+  printf("LINK     %10s %10s %10s %10s %8s %8s\n", "tx fr/s", "tx KB/s", "rx fr/s", "rx KB/s",
+      "drop/s", "busy/s");
+  printf("         %10.0f %10.1f %10.0f %10.1f %8.0f %8.0f\n",
+      rate(n->tx_frames, l->tx_frames, s),
+      rate(n->tx_bytes, l->tx_bytes, s) / 1024.0,
+      rate(n->rx_frames, l->rx_frames, s),
+      rate(n->rx_bytes, l->rx_bytes, s) / 1024.0,
+      rate(n->rx_dropped, l->rx_dropped, s),
+      rate(n->tx_busy, l->tx_busy, s));
+  printf("         crc errors %llu (+%llu)  parser errors %llu (+%llu)  tx queue %u  "
+         "rx queue %u (high %u)\n",
+      (unsigned long long)n->crc_errors,
+      (unsigned long long)(n->crc_errors - l->crc_errors),
+      (unsigned long long)n->parser_errors,
+      (unsigned long long)(n->parser_errors - l->parser_errors),
+      n->tx_queue,
+      n->rx_queue,
+      n->rx_queue_high);
+  if (n->tty_valid) {
+    printf("         tty overruns %u  frame errors %u  parity errors %u  breaks %u\n",
+        n->tty_overruns,
+        n->tty_frame_errors,
+        n->tty_parity_errors,
+        n->tty_breaks);
+  } else {
+    printf("         tty counts not reported by the link\n");
+  }
+}
+
+static void print_pipes(const struct top_snapshot_s * cur,
+    const struct top_snapshot_s * last,
+    double s,
+    bool all)
+{
+  printf("\n%-20s %8s %8s %9s %9s %7s %7s %6s %6s %8s %8s\n", "PIPE", "tx fr/s", "rx fr/s",
+      "tx KB/s", "rx KB/s", "rexm/s", "drop/s", "tmo", "slow", "ack us", "ack max");
+  for (uint32_t i = 1; i < cur->head.pipe_count; i++) {
+    const struct qrc_pipe_stats_s * n = &cur->pipes[i].stats;
+    struct qrc_pipe_stats_s l;
+    uint64_t acks;
+
+    /* a pipe added since the last update starts at zero */
+    memset(&l, 0, sizeof(l));
+    if (i < last->head.pipe_count) {
+      l = last->pipes[i].stats;
+    }
+    if (!all && n->tx_frames == l.tx_frames && n->rx_frames == l.rx_frames) {
+      continue;
+    }
+    acks = n->acks - l.acks;
+    printf("%-20.20s %8.0f %8.0f %9.1f %9.1f %7.0f %7.0f %6llu %6llu ",
+        cur->pipes[i].name,
+        rate(n->tx_frames, l.tx_frames, s),
+        rate(n->rx_frames, l.rx_frames, s),
+        rate(n->tx_bytes, l.tx_bytes, s) / 1024.0,
+        rate(n->rx_bytes, l.rx_bytes, s) / 1024.0,
+        rate(n->retransmits, l.retransmits, s),
+        rate(n->rx_dropped, l.rx_dropped, s),
+        (unsigned long long)n->timeouts,
+        (unsigned long long)n->cb_overruns);
+    if (0 != acks) {
+      printf("%8llu %8u\n", (unsigned long long)((n->ack_total_us - l.ack_total_us) / acks),
+          n->ack_max_us);
+    } else {
+      printf("%8s %8u\n", "-", n->ack_max_us);
+    }
+  }
+}
+
+int main(int argc, char ** argv)
+{
+  const char * name = QRC_STATS_SHM_DEFAULT;
+  const struct qrc_stats_shm_s * shm;
+  struct top_snapshot_s snaps[2];
+  int interval = DEFAULT_INTERVAL_MS;
+  int count = 0;
+  bool all = false;
+  bool batch = false;
+  size_t size = 0;
+  int cur = 0;
+  int ret;
+  int option_index = 0;
+
+  while ((ret = getopt_long(argc, argv, "n:i:c:abh", long_options, &option_index)) != -1) {
+    switch (ret) {
+      case 'n':
+        name = optarg;
+        break;
+      case 'i':
+        interval = atoi(optarg);
+        break;
+      case 'c':
+        count = atoi(optarg);
+        break;
+      case 'a':
+        all = true;
+        break;
+      case 'b':
+        batch = true;
+        break;
+      default:
+        usage();
+        exit(EXIT_FAILURE);
+    }
+  }
+  if (interval <= 0 || count < 0) {
+    fprintf(stderr, "Error: Invalid options.\n");
+    usage();
+    exit(EXIT_FAILURE);
+  }
+  if (!batch && !isatty(STDOUT_FILENO)) {
+    batch = true;
+  }
+
+  shm = map_segment(name, &size);
+  if (NULL == shm) {
+    exit(EXIT_FAILURE);
+  }
+  for (int i = 0; i < 2; i++) {
+    snaps[i].pipes =
+        (struct qrc_stats_entry_s *)calloc(shm->pipe_max, sizeof(struct qrc_stats_entry_s));
+    if (NULL == snaps[i].pipes) {
+      fprintf(stderr, "Error: Out of memory.\n");
+      exit(EXIT_FAILURE);
+    }
+  }
+
+  signal(SIGINT, on_signal);
+  signal(SIGTERM, on_signal);
+
+  take_snapshot(shm, &snaps[cur]);
+  for (int n = 0; !g_stop && (0 == count || n < count); n++) {
+    usleep((useconds_t)interval * 1000);
+    if (g_stop) {
+      break;
+    }
+    cur ^= 1;
+    take_snapshot(shm, &snaps[cur]);
+    if (0 != kill((pid_t)snaps[cur].head.pid, 0) && ESRCH == errno) {
+      printf("qrc process %u has exited\n", snaps[cur].head.pid);
+      break;
+    }
+
+    double s = (double)(snaps[cur].time_us - snaps[cur ^ 1].time_us) / 1000000.0;
+    if (!batch) {
+      printf("\033[H\033[2J");
+    }
+    print_link(&snaps[cur], &snaps[cur ^ 1], s);
+    print_pipes(&snaps[cur], &snaps[cur ^ 1], s, all);
+    printf("\n");
+    fflush(stdout);
+  }
+
+  free(snaps[0].pipes);
+  free(snaps[1].pipes);
+  munmap((void *)shm, size);
+  return 0;
+}